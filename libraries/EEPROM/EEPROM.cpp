@@ -21,7 +21,8 @@
  * Includes
  ******************************************************************************/
 
-#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include "Arduino.h"
 #include "EEPROM.h"
 
@@ -29,6 +30,94 @@
  * Definitions
  ******************************************************************************/
 
+// Older parts name the write strobes EEWE/EEMWE
+#ifndef EEPE
+#define EEPE  EEWE
+#define EEMPE EEMWE
+#endif
+
+#define EEPROM_QUEUE_MASK (EEPROM_QUEUE_SIZE - 1)
+
+// Start the write cycle of EEDR to EEAR. EEMPE and EEPE must be set within
+// four cycles of each other. Host tests supply their own
+#ifndef EEPROM_START_WRITE
+#define EEPROM_START_WRITE()                                \
+  asm volatile (                                            \
+    "sbi %0, %1" "\n\t"                                     \
+    "sbi %0, %2" "\n\t"                                     \
+    :                                                       \
+    : "I" (_SFR_IO_ADDR(EECR)), "I" (EEMPE), "I" (EEPE)     \
+  )
+#endif
+
+#if (EEPROM_QUEUE_SIZE & EEPROM_QUEUE_MASK) || (EEPROM_QUEUE_SIZE > 128)
+#error "EEPROM_QUEUE_SIZE must be a power of two no greater than 128"
+#endif
+
+struct eeprom_entry_t
+{
+  uint16_t address;
+  uint8_t value;
+};
+
+static eeprom_entry_t queue[EEPROM_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0;    // Next entry to retire (ISR side)
+static volatile uint8_t queueTail = 0;    // Next free slot (caller side)
+
+/******************************************************************************
+ * Private functions
+ ******************************************************************************/
+
+/*
+  Start programming the entry at the head of the queue. EEPE must be clear.
+  Entries whose cell already holds the value are dropped without a write
+  cycle. Returns false once the queue is empty.
+*/
+static bool retireNext(void)
+{
+  while (queueHead != queueTail)
+  {
+    eeprom_entry_t *entry = &queue[queueHead];
+    queueHead = (queueHead + 1) & EEPROM_QUEUE_MASK;
+
+    EEAR = entry->address;
+    EECR |= _BV(EERE);
+    if (EEDR == entry->value)
+      continue;
+
+    EEDR = entry->value;
+    EEPROM_START_WRITE();
+    return true;
+  }
+  return false;
+}
+
+/*
+  Retire queued entries by polling. Used when the EE_READY interrupt cannot
+  run because global interrupts are disabled.
+*/
+static void drainPolled(void)
+{
+  EECR &= ~_BV(EERIE);
+  do
+    loop_until_bit_is_clear(EECR, EEPE);
+  while (retireNext());
+  loop_until_bit_is_clear(EECR, EEPE);
+}
+
+/******************************************************************************
+ * Interrupt routines
+ ******************************************************************************/
+
+/*
+  EEPROM ready: the previous write cycle is over
+*/
+ISR(EE_READY_vect)
+{
+  if (!retireNext())
+    EECR &= ~_BV(EERIE);
+}
+
 /******************************************************************************
  * Constructors
  ******************************************************************************/
@@ -39,12 +128,116 @@
 
 uint8_t EEPROMClass::read(int address)
 {
-	return eeprom_read_byte((unsigned char *) address);
+  uint8_t value;
+  uint8_t oldSREG;
+
+  while (1)
+  {
+    oldSREG = SREG;
+    cli();
+
+    // A queued write not retired yet is the most recent value of the cell
+    for (uint8_t i = queueTail ; i != queueHead ; )
+    {
+      i = (i - 1) & EEPROM_QUEUE_MASK;
+      if (queue[i].address == (uint16_t) address)
+      {
+        value = queue[i].value;
+        SREG = oldSREG;
+        return value;
+      }
+    }
+
+    // EEAR can't be touched while a write cycle is running
+    if (bit_is_clear(EECR, EEPE))
+      break;
+    SREG = oldSREG;
+  }
+
+  EEAR = address;
+  EECR |= _BV(EERE);
+  value = EEDR;
+  SREG = oldSREG;
+
+  return value;
 }
 
 void EEPROMClass::write(int address, uint8_t value)
 {
-	eeprom_write_byte((unsigned char *) address, value);
+  // Going through the queue keeps program order with pending writes
+  writeAsync(address, value);
+  flush();
+}
+
+void EEPROMClass::writeAsync(int address, uint8_t value)
+{
+  uint8_t next;
+  uint8_t oldSREG;
+
+  while (1)
+  {
+    oldSREG = SREG;
+    cli();
+    next = (queueTail + 1) & EEPROM_QUEUE_MASK;
+    if (next != queueHead)
+      break;
+    // Queue full
+    if (oldSREG & _BV(SREG_I))
+    {
+      SREG = oldSREG;
+      continue;
+    }
+    // Called from an ISR: the ready interrupt can't fire, so make room here
+    loop_until_bit_is_clear(EECR, EEPE);
+    retireNext();
+  }
+
+  queue[queueTail].address = address;
+  queue[queueTail].value = value;
+  queueTail = next;
+  EECR |= _BV(EERIE);
+  SREG = oldSREG;
+}
+
+bool EEPROMClass::writeBlockAsync(int address, const uint8_t *buf,
+                                  uint16_t len, uint16_t *done)
+{
+  // Room only grows until we queue, so none of these calls waits
+  uint8_t room = availableForWrite();
+
+  while (*done < len && room--)
+  {
+    writeAsync(address + *done, buf[*done]);
+    (*done)++;
+  }
+  return *done == len;
+}
+
+void EEPROMClass::flush(void)
+{
+  uint8_t oldSREG = SREG;
+
+  if (oldSREG & _BV(SREG_I))
+  {
+    while (queueHead != queueTail)
+      ;
+    loop_until_bit_is_clear(EECR, EEPE);
+  }
+  else
+    drainPolled();
+
+  SREG = oldSREG;
+}
+
+uint8_t EEPROMClass::pending(void)
+{
+  return (queueTail - queueHead) & EEPROM_QUEUE_MASK;
+}
+
+uint8_t EEPROMClass::availableForWrite(void)
+{
+  // One slot stays empty to tell a full queue from an empty one
+  return EEPROM_QUEUE_SIZE - 1 - pending();
 }
 
 EEPROMClass EEPROM;
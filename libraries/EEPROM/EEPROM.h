@@ -22,11 +22,51 @@
 
 #include <inttypes.h>
 
+/*
+  Depth of the asynchronous write queue. Must be a power of two no greater
+  than 128. Each entry costs 3 bytes of RAM.
+*/
+#ifndef EEPROM_QUEUE_SIZE
+#define EEPROM_QUEUE_SIZE 16
+#endif
+
 class EEPROMClass
 {
   public:
     uint8_t read(int);
     void write(int, uint8_t);
+
+    /*
+      Queue a byte for writing and return immediately. Writes are retired
+      in order from the EE_READY interrupt; bytes that already hold the
+      requested value are skipped. If the queue is full the call waits
+      for a free slot.
+    */
+    void writeAsync(int, uint8_t);
+
+    /*
+      Queue bytes of a block for writing without ever waiting, as many as
+      the queue has room for. 'done' counts the bytes queued by earlier
+      calls and is advanced. Returns true once the whole block is queued,
+      so that a long block can be written in pieces across loop passes.
+    */
+    bool writeBlockAsync(int, const uint8_t *, uint16_t, uint16_t *);
+
+    /*
+      Wait until every queued write has reached the EEPROM. Safe to call
+      with interrupts disabled, e.g. before a watchdog reset.
+    */
+    void flush(void);
+
+    /*
+      Number of writes still waiting in the queue
+    */
+    uint8_t pending(void);
+
+    /*
+      Number of writeAsync calls that can be made without waiting
+    */
+    uint8_t availableForWrite(void);
 };
 
 extern EEPROMClass EEPROM;
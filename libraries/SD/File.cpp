@@ -18,33 +18,89 @@
    uint8_t nfilecount=0;
 */
 
+// the open files, so that repeated open/close don't fragment the heap
+static filehandle_t handles[SD_MAX_OPEN_FILES];
+
+boolean File::handleAvailable(void) {
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++) {
+    if (!handles[i].used)
+      return true;
+  }
+  return false;
+}
+
 File::File(SdFile f, const char *n) {
-  // oh man you are kidding me, new() doesnt exist? Ok we do it by hand!
-  _file = (SdFile *)malloc(sizeof(SdFile)); 
-  if (_file) {
-    memcpy(_file, &f, sizeof(SdFile));
-    
-    strncpy(_name, n, 12);
-    _name[12] = 0;
-    
-    /* for debugging file open/close leaks
-       nfilecount++;
-       Serial.print("Created \"");
-       Serial.print(n);
-       Serial.print("\": ");
-       Serial.println(nfilecount, DEC);
-    */
+  _file = 0;
+  _handle = 0;
+  _name[0] = 0;
+
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++) {
+    if (!handles[i].used) {
+      _handle = &handles[i];
+      break;
+    }
   }
+  if (!_handle) {
+    // no room, don't leave the file open
+    f.close();
+    SD.lastError = SD_ERROR_TOO_MANY_FILES;
+    return;
+  }
+
+  _handle->used = true;
+  _handle->file = f;
+#if SD_FILE_BUFFER_SIZE
+  _handle->buf.mode = FILE_BUF_EMPTY;
+#endif
+  _file = &_handle->file;
+
+  strncpy(_name, n, 12);
+  _name[12] = 0;
+
+  /* for debugging file open/close leaks
+     nfilecount++;
+     Serial.print("Created \"");
+     Serial.print(n);
+     Serial.print("\": ");
+     Serial.println(nfilecount, DEC);
+  */
 }
 
 File::File(void) {
   _file = 0;
+  _handle = 0;
   _name[0] = 0;
   //Serial.print("Created empty file object");
 }
 
+File::File(const File &f) : Stream(f) {
+  _file = 0;
+  _handle = 0;
+  take(f);
+}
+
+File &File::operator=(const File &f) {
+  if (this != &f) {
+    close();
+    take(f);
+  }
+  return *this;
+}
+
 File::~File(void) {
   //  Serial.print("Deleted file object");
+  close();
+}
+
+// move the open file of f to this one, f is left closed
+void File::take(const File &f) {
+  File &from = const_cast<File &>(f);
+
+  _file = from._file;
+  _handle = from._handle;
+  memcpy(_name, from._name, sizeof(_name));
+  from._file = 0;
+  from._handle = 0;
 }
 
 // returns a pointer to the file name
@@ -68,6 +124,34 @@ size_t File::write(const uint8_t *buf, size_t size) {
     setWriteError();
     return 0;
   }
+#if SD_FILE_BUFFER_SIZE
+  if (size < SD_FILE_BUFFER_SIZE) {
+    // collect small writes, the buffer is written when it reaches the
+    // end of its window
+    for (t = 0; t < size; t++) {
+      if (_handle->buf.mode != FILE_BUF_WRITE) {
+        if (!flushBuffer()) {
+          setWriteError();
+          return t;
+        }
+        _handle->buf.start = _file->curPosition();
+        _handle->buf.count = 0;
+        _handle->buf.mode = FILE_BUF_WRITE;
+      }
+      _handle->buf.data[_handle->buf.count++] = buf[t];
+      if (((_handle->buf.start + _handle->buf.count) & (SD_FILE_BUFFER_SIZE - 1)) == 0 &&
+          !flushBuffer()) {
+        setWriteError();
+        return t;
+      }
+    }
+    return size;
+  }
+  if (!flushBuffer()) {
+    setWriteError();
+    return 0;
+  }
+#endif
   _file->clearWriteError();
   t = _file->write(buf, size);
   if (_file->getWriteError()) {
@@ -81,22 +165,57 @@ int File::peek() {
   if (! _file) 
     return 0;
 
+#if SD_FILE_BUFFER_SIZE
+  if (!fillBuffer())
+    return -1;
+  return _handle->buf.data[_handle->buf.index];
+#else
   int c = _file->read();
   if (c != -1) _file->seekCur(-1);
   return c;
+#endif
 }
 
 int File::read() {
+#if SD_FILE_BUFFER_SIZE
+  if (_file && fillBuffer())
+    return _handle->buf.data[_handle->buf.index++];
+#else
   if (_file) 
     return _file->read();
+#endif
   return -1;
 }
 
 // buffered read for more efficient, high speed reading
 int File::read(void *buf, uint16_t nbyte) {
-  if (_file) 
-    return _file->read(buf, nbyte);
-  return 0;
+  if (! _file)
+    return 0;
+
+#if SD_FILE_BUFFER_SIZE
+  uint8_t *dst = (uint8_t *)buf;
+  uint16_t n = 0;
+  if (_handle->buf.mode == FILE_BUF_READ) {
+    // bytes already read ahead
+    n = _handle->buf.count - _handle->buf.index;
+    if (n > nbyte)
+      n = nbyte;
+    memcpy(dst, _handle->buf.data + _handle->buf.index, n);
+    _handle->buf.index += n;
+    if (n == nbyte)
+      return n;
+    // _file is positioned after the buffer
+    _handle->buf.mode = FILE_BUF_EMPTY;
+  } else if (!flushBuffer()) {
+    return -1;
+  }
+  int r = _file->read(dst + n, nbyte - n);
+  if (r < 0)
+    return n ? n : -1;
+  return n + r;
+#else
+  return _file->read(buf, nbyte);
+#endif
 }
 
 int File::available() {
@@ -108,31 +227,52 @@ int File::available() {
 }
 
 void File::flush() {
-  if (_file)
+  if (_file) {
+    if (!flushBuffer())
+      setWriteError();
     _file->sync();
+  }
 }
 
 boolean File::seek(uint32_t pos) {
   if (! _file) return false;
 
+  if (!flushBuffer())
+    return false;
   return _file->seekSet(pos);
 }
 
 uint32_t File::position() {
   if (! _file) return -1;
+#if SD_FILE_BUFFER_SIZE
+  if (_handle->buf.mode == FILE_BUF_WRITE)
+    return _handle->buf.start + _handle->buf.count;
+  if (_handle->buf.mode == FILE_BUF_READ)
+    return _handle->buf.start + _handle->buf.index;
+#endif
   return _file->curPosition();
 }
 
 uint32_t File::size() {
   if (! _file) return 0;
+#if SD_FILE_BUFFER_SIZE
+  // buffered data may extend the file
+  if (_handle->buf.mode == FILE_BUF_WRITE &&
+      _handle->buf.start + _handle->buf.count > _file->fileSize()) {
+    return _handle->buf.start + _handle->buf.count;
+  }
+#endif
   return _file->fileSize();
 }
 
 void File::close() {
   if (_file) {
+    if (!flushBuffer())
+      setWriteError();
     _file->close();
-    free(_file); 
+    _handle->used = false;
     _file = 0;
+    _handle = 0;
 
     /* for debugging file open/close leaks
     nfilecount--;
@@ -148,3 +288,47 @@ File::operator bool() {
   return false;
 }
 
+
+// read ahead up to the end of the buffer window unless there are
+// bytes left in the buffer. Returns false at end of file
+boolean File::fillBuffer(void) {
+#if SD_FILE_BUFFER_SIZE
+  if (_handle->buf.mode == FILE_BUF_READ && _handle->buf.index < _handle->buf.count)
+    return true;
+  if (!flushBuffer())
+    return false;
+
+  uint32_t pos = _file->curPosition();
+  uint8_t n = SD_FILE_BUFFER_SIZE - (pos & (SD_FILE_BUFFER_SIZE - 1));
+  int r = _file->read(_handle->buf.data, n);
+  if (r <= 0)
+    return false;
+
+  _handle->buf.start = pos;
+  _handle->buf.count = r;
+  _handle->buf.index = 0;
+  _handle->buf.mode = FILE_BUF_READ;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// write buffered data to the file or give back the bytes read ahead,
+// so that _file is at position()
+boolean File::flushBuffer(void) {
+#if SD_FILE_BUFFER_SIZE
+  uint8_t mode = _handle->buf.mode;
+
+  _handle->buf.mode = FILE_BUF_EMPTY;
+  if (mode == FILE_BUF_WRITE) {
+    _file->clearWriteError();
+    _file->write(_handle->buf.data, _handle->buf.count);
+    if (_file->getWriteError())
+      return false;
+  } else if (mode == FILE_BUF_READ && _handle->buf.index < _handle->buf.count) {
+    return _file->seekSet(_handle->buf.start + _handle->buf.index);
+  }
+#endif
+  return true;
+}
@@ -0,0 +1,281 @@
+/*
+
+ LogFile - circular log on a pre-allocated contiguous file
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ */
+
+#include <LogFile.h>
+
+LogFile::LogFile(void) {
+  _bgnBlock = 0;
+  _blocks = 0;
+  _head = 0;
+  _used = 0;
+  _readPos = 0;
+  _buf = 0;
+  _writing = false;
+  _seqBlock = 0;
+}
+
+boolean LogFile::open(const char *filepath, uint32_t size) {
+  /*
+
+     Open the log file at the supplied path, creating it if needed.
+
+     A new file gets one header block plus enough data blocks for
+     `size` bytes, allocated as a single contiguous run. An existing
+     file keeps its own size and must be contiguous.
+
+     If the header block is valid the log carries on after the data
+     that was there at the last sync(), otherwise the log starts empty.
+
+   */
+
+  int pathidx;
+  uint32_t blocks, endBlock;
+  logheader_t *header;
+  SdBlockDevice *card = SdVolume::sdCard();
+
+  close();
+
+  SdFile parentdir = SD.getParentDir(filepath, &pathidx);
+  filepath += pathidx;
+
+  if (!parentdir.isOpen() || !filepath[0])
+    return false;
+
+  // the root directory is static, use the real one
+  SdFile *dir = parentdir.isRoot() ? &SD.root : &parentdir;
+
+  blocks = (size + 511) / 512;
+  if (blocks == 0)
+    blocks = 1;
+
+  boolean opened = _file.open(dir, filepath, O_RDWR) ||
+                   _file.createContiguous(dir, filepath, 512UL * (blocks + 1));
+
+  if (!parentdir.isRoot())
+    parentdir.close();
+
+  if (!opened)
+    return false;
+
+  // data has to be reachable without the FAT
+  if (!_file.contiguousRange(&_bgnBlock, &endBlock) ||
+      _file.fileSize() < 1024) {
+    goto fail;
+  }
+  _blocks = _file.fileSize() / 512 - 1;
+
+  _buf = SdVolume::cacheClear();
+  if (!card->readBlock(_bgnBlock, _buf))
+    goto fail;
+
+  header = (logheader_t *)_buf;
+  if (header->magic == LOG_FILE_MAGIC && header->blocks == _blocks &&
+      header->head < capacity() && header->used <= capacity()) {
+    _head = header->head;
+    _used = header->used;
+  } else {
+    _head = 0;
+    _used = 0;
+    if (!writeHeader())
+      goto fail;
+  }
+  _readPos = 0;
+  return true;
+
+ fail:
+  _file.close();
+  return false;
+}
+
+boolean LogFile::startWrite(void) {
+  // start a multiple block write at the block holding the head
+  SdBlockDevice *card = SdVolume::sdCard();
+  uint32_t block = _head / 512;
+
+  _buf = SdVolume::cacheClear();
+
+  // keep the whole block, its tail may hold the oldest data and the
+  // card may erase it when the write starts
+  if (!card->readBlock(_bgnBlock + 1 + block, _buf))
+    return false;
+
+  // pre-erase only the first block. Blocks the sequence is stopped
+  // before would lose their data
+  if (!card->writeStart(_bgnBlock + 1 + block, 1))
+    return false;
+
+  _seqBlock = block;
+  _writing = true;
+  return true;
+}
+
+boolean LogFile::stopWrite(void) {
+  // end the multiple block write and store a partial block
+  SdBlockDevice *card = SdVolume::sdCard();
+
+  if (!_writing)
+    return true;
+
+  _writing = false;
+  if (!card->writeStop())
+    return false;
+
+  uint16_t off = _head & 0X1FF;
+  if (off == 0)
+    return true;
+
+  // the rest of the block may still hold the oldest data. The first
+  // block of the sequence was read whole by startWrite
+  uint32_t block = _head / 512;
+  if (block != _seqBlock &&
+      !card->readData(_bgnBlock + 1 + block, off, 512 - off, _buf + off)) {
+    return false;
+  }
+  return card->writeBlock(_bgnBlock + 1 + block, _buf);
+}
+
+boolean LogFile::writeHeader(void) {
+  SdBlockDevice *card = SdVolume::sdCard();
+  uint8_t *buf = SdVolume::cacheClear();
+  logheader_t *header = (logheader_t *)buf;
+
+  memset(buf, 0, 512);
+  header->magic = LOG_FILE_MAGIC;
+  header->blocks = _blocks;
+  header->head = _head;
+  header->used = _used;
+
+  return card->writeBlock(_bgnBlock, buf);
+}
+
+size_t LogFile::write(uint8_t val) {
+  return write(&val, 1);
+}
+
+size_t LogFile::write(const uint8_t *buf, size_t size) {
+  SdBlockDevice *card = SdVolume::sdCard();
+  size_t n = size;
+
+  if (!_file.isOpen())
+    return 0;
+
+  while (n) {
+    if (!_writing && !startWrite())
+      break;
+
+    uint16_t off = _head & 0X1FF;
+    uint16_t cnt = 512 - off;
+    if (cnt > n)
+      cnt = n;
+
+    memcpy(_buf + off, buf, cnt);
+    buf += cnt;
+    n -= cnt;
+    _head += cnt;
+
+    // the oldest data has been overwritten
+    _used += cnt;
+    if (_used > capacity()) {
+      uint32_t lost = _used - capacity();
+      _used = capacity();
+      _readPos = _readPos > lost ? _readPos - lost : 0;
+    }
+
+    if (_head & 0X1FF)
+      continue;
+
+    if (!card->writeData(_buf)) {
+      _writing = false;
+      break;
+    }
+
+    // wrap, the next write starts a new sequence at the first block
+    if (_head == capacity()) {
+      _head = 0;
+      if (!stopWrite())
+        break;
+    }
+  }
+  return size - n;
+}
+
+int LogFile::read(void *buf, uint16_t nbyte) {
+  SdBlockDevice *card = SdVolume::sdCard();
+  uint8_t *dst = (uint8_t *)buf;
+  uint32_t pos;
+
+  if (!_file.isOpen())
+    return -1;
+
+  // data still in the buffer has to be on the card
+  if (!stopWrite())
+    return -1;
+
+  if (nbyte > available())
+    nbyte = available();
+
+  // oldest byte is `_used` bytes behind the head
+  pos = _head + capacity() - _used + _readPos;
+  if (pos >= capacity())
+    pos -= capacity();
+
+  uint16_t n = nbyte;
+  while (n) {
+    uint16_t off = pos & 0X1FF;
+    uint16_t cnt = 512 - off;
+    if (cnt > n)
+      cnt = n;
+
+    if (!card->readData(_bgnBlock + 1 + pos / 512, off, cnt, dst))
+      return -1;
+
+    dst += cnt;
+    n -= cnt;
+    _readPos += cnt;
+    pos += cnt;
+    if (pos == capacity())
+      pos = 0;
+  }
+  return nbyte;
+}
+
+uint32_t LogFile::available(void) {
+  return _used - _readPos;
+}
+
+void LogFile::rewind(void) {
+  _readPos = 0;
+}
+
+boolean LogFile::sync(void) {
+  if (!_file.isOpen())
+    return false;
+
+  return stopWrite() && writeHeader();
+}
+
+void LogFile::close(void) {
+  if (_file.isOpen()) {
+    sync();
+    _file.close();
+  }
+  _writing = false;
+}
+
+uint32_t LogFile::size(void) {
+  return _used;
+}
+
+uint32_t LogFile::capacity(void) {
+  return 512UL * _blocks;
+}
+
+LogFile::operator bool() {
+  return _file.isOpen();
+}
@@ -0,0 +1,78 @@
+/*
+
+ LogFile - circular log on a pre-allocated contiguous file
+
+ The file is created once with SdFile::createContiguous(). Its first
+ block is a header holding the head and the amount of data of the ring,
+ the other blocks hold the data. Records are written straight to the
+ card with a multiple block write, so appending never touches the FAT,
+ the directory or the block cache and its latency is bounded by the
+ programming time of one block. When the ring is full the oldest data
+ is overwritten.
+
+ The header is only written by sync() and close(). Data appended after
+ the last sync() is lost if power fails.
+
+ Whilst records are being appended the card is in a multiple block
+ write and the SdVolume cache buffer holds the block being filled.
+ Call sync() before using other files. Other SPI devices can be used
+ at any time.
+
+ License: GNU General Public License V3
+          (Because sdfatlib is licensed with this.)
+
+ */
+
+#ifndef __LOGFILE_H__
+#define __LOGFILE_H__
+
+#include <SD.h>
+
+// "LOG1" - marks a valid header block
+#define LOG_FILE_MAGIC 0X31474F4CUL
+
+// header block of a log file
+struct logheader_t {
+  uint32_t magic;   // LOG_FILE_MAGIC
+  uint32_t blocks;  // data blocks in the ring
+  uint32_t head;    // ring offset of the next byte to be written
+  uint32_t used;    // bytes held in the ring
+};
+
+class LogFile : public Print {
+ private:
+  SdFile _file;        // pre-allocated file
+  uint32_t _bgnBlock;  // header block, data follows
+  uint32_t _blocks;    // data blocks in the ring
+  uint32_t _head;      // ring offset of the next byte to be written
+  uint32_t _used;      // bytes held in the ring
+  uint32_t _readPos;   // bytes read from the oldest one
+  uint8_t *_buf;       // block being filled, borrowed from the cache
+  boolean _writing;    // multiple block write in progress
+  uint32_t _seqBlock;  // ring block the multiple block write started at
+
+  boolean startWrite(void);
+  boolean stopWrite(void);
+  boolean writeHeader(void);
+
+public:
+  LogFile(void);
+  // Open a log file, creating it with room for size bytes if missing
+  boolean open(const char *filepath, uint32_t size);
+  virtual size_t write(uint8_t);
+  virtual size_t write(const uint8_t *buf, size_t size);
+  // Read data, oldest first
+  int read(void *buf, uint16_t nbyte);
+  uint32_t available(void);
+  void rewind(void);
+  // Write pending data and the header
+  boolean sync(void);
+  void close(void);
+  uint32_t size(void);
+  uint32_t capacity(void);
+  operator bool();
+
+  using Print::write;
+};
+
+#endif
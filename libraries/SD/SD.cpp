@@ -332,6 +332,7 @@ boolean callback_rmdir(SdFile& parentDir, char *filePathComponent,
 
 
 
+#if defined(__AVR__)
 boolean SDClass::begin(uint8_t csPin) {
   /*
 
@@ -340,15 +341,175 @@ boolean SDClass::begin(uint8_t csPin) {
     Return true if initialization succeeds, false otherwise.
 
    */
-  return card.init(SPI_HALF_SPEED, csPin) &&
+#if SD_PATH_CACHE_SIZE
+  pathCacheClear();
+#endif
+  return card.init(SPI_FULL_SPEED, csPin) &&
          volume.init(card) &&
          root.openRoot(volume);
 }
+#else
+boolean SDClass::begin(const char *image) {
+  /*
+
+    Open a FAT image file in place of the SD card, for host builds.
+    Can be called again to mount another image.
+
+   */
+#if SD_PATH_CACHE_SIZE
+  pathCacheClear();
+#endif
+  root.close();
+  return card.begin(image) &&
+         volume.init(card) &&
+         root.openRoot(volume);
+}
+#endif
 
 
 
+#if SD_PATH_CACHE_SIZE
+// hash of the first `len` characters of a path. Case and repeated
+// separators don't matter
+static uint16_t pathHash(const char *path, int len) {
+  uint16_t hash = 0;
+  char prev = '/';
+
+  for (int i = 0; i < len; i++) {
+    char c = toupper(path[i]);
+    if (c == '/' && prev == '/')
+      continue;
+    prev = c;
+    hash = (hash << 5) + hash + c;
+  }
+  return hash;
+}
+
+// remember where the directory entry of the first `len` characters of
+// `path` is and the first cluster of the directory holding it, replacing
+// the least recently used path
+void SDClass::pathCacheAdd(const char *path, int len, SdFile &file,
+                           uint32_t parent) {
+  uint16_t hash = pathHash(path, len);
+  uint8_t slot = 0;
+
+  // the root directory has no entry
+  if (file.isRoot())
+    return;
+
+  for (uint8_t i = 0; i < SD_PATH_CACHE_SIZE; i++) {
+    if (pathCache[i].dirBlock && pathCache[i].hash == hash) {
+      slot = i;
+      break;
+    }
+    if (pathCache[i].age > pathCache[slot].age)
+      slot = i;
+  }
+
+  for (uint8_t i = 0; i < SD_PATH_CACHE_SIZE; i++) {
+    if (pathCache[i].age < pathCache[slot].age)
+      pathCache[i].age++;
+  }
+  pathCache[slot].dirBlock = file.dirBlock();
+  pathCache[slot].parent = parent;
+  pathCache[slot].hash = hash;
+  pathCache[slot].dirIndex = file.dirIndex();
+  pathCache[slot].age = 0;
+}
+
+// forget every path, directory entries may have moved
+void SDClass::pathCacheClear(void) {
+  for (uint8_t i = 0; i < SD_PATH_CACHE_SIZE; i++) {
+    pathCache[i].dirBlock = 0;
+    pathCache[i].age = i;
+  }
+}
+
+// open the first `len` characters of `path` at the remembered location
+// of its directory entry. Returns false if the path isn't in the cache,
+// the entry there now has another name or the parent directory, checked
+// the same way up to the root, is not the one it was found in. The hash
+// alone doesn't tell /D1016/LOG.TXT from /D1017/LOG.TXT
+boolean SDClass::pathCacheOpen(SdFile &file, const char *path, int len,
+                               uint8_t mode) {
+  uint16_t hash = pathHash(path, len);
+  const char *name = path;
+  int namelen, parentlen;
+  uint32_t parent;
+  char entryname[13];
+  dir_t entry;
+
+  // last component of the path
+  for (int i = 0; i < len; i++) {
+    if (path[i] == '/')
+      name = path + i + 1;
+  }
+  namelen = path + len - name;
+
+  // parent path without its trailing separators
+  parentlen = name - path;
+  while (parentlen > 0 && path[parentlen - 1] == '/')
+    parentlen--;
+
+  for (uint8_t i = 0; i < SD_PATH_CACHE_SIZE; i++) {
+    pathentry_t *p = &pathCache[i];
+    if (!p->dirBlock || p->hash != hash)
+      continue;
+
+    // truncate only once the name has been checked
+    if (!file.open(&volume, p->dirBlock, p->dirIndex, mode & ~O_TRUNC))
+      break;
+    if (!file.dirEntry(&entry))
+      break;
+    SdFile::dirName(entry, entryname);
+    if (namelen != (int)strlen(entryname) ||
+        strncasecmp(name, entryname, namelen)) {
+      break;
+    }
+
+    if (parentlen == 0) {
+      parent = root.firstCluster();
+    } else {
+      SdFile dir;
+      if (!pathCacheOpen(dir, path, parentlen, O_READ))
+        break;
+      parent = dir.firstCluster();
+      dir.close();
+    }
+    if (p->parent != parent)
+      break;
+    if ((mode & O_TRUNC) && !file.truncate(0))
+      break;
+
+    for (uint8_t j = 0; j < SD_PATH_CACHE_SIZE; j++) {
+      if (pathCache[j].age < p->age)
+        pathCache[j].age++;
+    }
+    p->age = 0;
+    return true;
+  }
+  file.close();
+  return false;
+}
+#endif
+
 // this little helper is used to traverse paths
 SdFile SDClass::getParentDir(const char *filepath, int *index) {
+#if SD_PATH_CACHE_SIZE
+  // directory seen before?
+  const char *last = strrchr(filepath, '/');
+  if (last && last != filepath) {
+    SdFile dir;
+    if (pathCacheOpen(dir, filepath, last - filepath, O_READ)) {
+      if (dir.isDir()) {
+        *index = (int)(last + 1 - filepath);
+        return dir;
+      }
+      dir.close();
+    }
+  }
+#endif
+
   // get parent directory
   SdFile d1 = root; // start with the mostparent, root!
   SdFile d2;
@@ -388,6 +549,11 @@ SdFile SDClass::getParentDir(const char *filepath, int *index) {
     }
     // move forward to the next subdirectory
     filepath += idx;
+#if SD_PATH_CACHE_SIZE
+    // every directory on the way, a cached path is checked up to the root
+    pathCacheAdd(origpath, filepath - origpath, *subdir,
+                 parent->firstCluster());
+#endif
 
     // we reuse the objects, close it.
     parent->close();
@@ -430,6 +596,26 @@ File SDClass::open(const char *filepath, uint8_t mode) {
 
   int pathidx;
 
+  // fail before a file is created or truncated
+  lastError = SD_ERROR_NONE;
+  if (!File::handleAvailable()) {
+    lastError = SD_ERROR_TOO_MANY_FILES;
+    return File();
+  }
+
+#if SD_PATH_CACHE_SIZE
+  // file opened before?
+  const char *origpath = filepath;
+  int pathlen = strlen(filepath);
+  SdFile cached;
+  if (pathCacheOpen(cached, filepath, pathlen, mode)) {
+    const char *name = strrchr(filepath, '/');
+    if (mode & (O_APPEND | O_WRITE)) 
+      cached.seekSet(cached.fileSize());
+    return File(cached, name ? name + 1 : filepath);
+  }
+#endif
+
   // do the interative search
   SdFile parentdir = getParentDir(filepath, &pathidx);
   // no more subdirs!
@@ -447,6 +633,9 @@ File SDClass::open(const char *filepath, uint8_t mode) {
   // failed to open a subdir!
   if (!parentdir.isOpen())
     return File();
+#if SD_PATH_CACHE_SIZE
+  uint32_t parentCluster = parentdir.firstCluster();
+#endif
 
   // there is a special case for the Root directory since its a static dir
   if (parentdir.isRoot()) {
@@ -465,6 +654,9 @@ File SDClass::open(const char *filepath, uint8_t mode) {
 
   if (mode & (O_APPEND | O_WRITE)) 
     file.seekSet(file.fileSize());
+#if SD_PATH_CACHE_SIZE
+  pathCacheAdd(origpath, pathlen, file, parentCluster);
+#endif
   return File(file, filepath);
 }
 
@@ -555,10 +747,16 @@ boolean SDClass::rmdir(char *filepath) {
     A rough equivalent to `mkdir -p`.
   
    */
+#if SD_PATH_CACHE_SIZE
+  pathCacheClear();
+#endif
   return walkPath(filepath, root, callback_rmdir);
 }
 
 boolean SDClass::remove(char *filepath) {
+#if SD_PATH_CACHE_SIZE
+  pathCacheClear();
+#endif
   return walkPath(filepath, root, callback_remove);
 }
 
@@ -567,6 +765,9 @@ boolean SDClass::remove(char *filepath) {
 File File::openNextFile(uint8_t mode) {
   dir_t p;
 
+  if (!flushBuffer())
+    return File();
+
   //Serial.print("\t\treading dir...");
   while (_file->readDir(&p) > 0) {
 
@@ -609,7 +810,7 @@ File File::openNextFile(uint8_t mode) {
 }
 
 void File::rewindDirectory(void) {  
-  if (isDirectory())
+  if (isDirectory() && flushBuffer())
     _file->rewind();
 }
 
@@ -23,15 +23,96 @@
 #define FILE_READ O_READ
 #define FILE_WRITE (O_READ | O_WRITE | O_CREAT)
 
+// Size of the buffer of each open File, zero to disable. Small writes
+// are collected in it and reads are served from it, so that print()
+// and read() don't go through SdFile one byte at a time. It has to be
+// a power of two from 16 to 128 so that it never spans two blocks.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_FILE_BUFFER_SIZE 64
+#else
+#define SD_FILE_BUFFER_SIZE 32
+#endif
+
+// Number of files that can be open at the same time. Open files are
+// taken from a static pool, they are never allocated on the heap.
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_MAX_OPEN_FILES 8
+#else
+#define SD_MAX_OPEN_FILES 4
+#endif
+
+// Number of paths whose directory entry location is remembered by
+// SDClass, zero to disable. A cached parent directory or file is opened
+// without scanning the directories of its path. Can be set on the
+// command line.
+#ifndef SD_PATH_CACHE_SIZE
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_PATH_CACHE_SIZE 8
+#else
+#define SD_PATH_CACHE_SIZE 4
+#endif
+#endif
+
+// SDClass::errorCode() values
+#define SD_ERROR_NONE 0
+#define SD_ERROR_TOO_MANY_FILES 1
+
+#if SD_FILE_BUFFER_SIZE
+// buffer of an open File
+struct filebuf_t {
+  uint32_t start;  // file position of data[0]
+  uint8_t count;   // bytes in data
+  uint8_t index;   // next byte to be read
+  uint8_t mode;    // FILE_BUF_EMPTY, FILE_BUF_READ or FILE_BUF_WRITE
+  uint8_t data[SD_FILE_BUFFER_SIZE];
+};
+#define FILE_BUF_EMPTY 0
+#define FILE_BUF_READ 1
+#define FILE_BUF_WRITE 2
+#endif
+
+#if SD_PATH_CACHE_SIZE
+// location of the directory entry of a path
+struct pathentry_t {
+  uint32_t dirBlock;  // block of the entry, zero if unused
+  uint32_t parent;    // first cluster of the parent directory
+  uint16_t hash;      // hash of the path
+  uint8_t dirIndex;   // index of the entry in dirBlock
+  uint8_t age;        // zero for the last one used
+};
+#endif
+
+// entry of the pool of open files
+struct filehandle_t {
+  SdFile file;
+#if SD_FILE_BUFFER_SIZE
+  filebuf_t buf;
+#endif
+  boolean used;
+};
+
 class File : public Stream {
  private:
   char _name[13]; // our name
   SdFile *_file;  // underlying file pointer
+  filehandle_t *_handle; // pool entry holding _file
+
+  static boolean handleAvailable(void);
+  void take(const File &f);
+  boolean fillBuffer(void);
+  boolean flushBuffer(void);
 
 public:
   File(SdFile f, const char *name);     // wraps an underlying SdFile
   File(void);      // 'empty' constructor
-  ~File(void);     // destructor
+  // A File owns its pool entry. Copying a File moves the open file to
+  // the copy and leaves the original closed
+  File(const File &f);
+  File &operator=(const File &f);
+  ~File(void);     // destructor, closes the file
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buf, size_t size);
   virtual int read();
@@ -51,22 +132,40 @@ public:
   void rewindDirectory(void);
   
   using Print::write;
+
+  friend class SDClass;
 };
 
 class SDClass {
 
 private:
   // These are required for initialisation and use of sdfatlib
-  Sd2Card card;
+  SdBlockDevice card;
   SdVolume volume;
   SdFile root;
   
   // my quick&dirty iterator, should be replaced
   SdFile getParentDir(const char *filepath, int *indx);
+
+#if SD_PATH_CACHE_SIZE
+  // recently opened paths, cleared by remove and rmdir
+  pathentry_t pathCache[SD_PATH_CACHE_SIZE];
+
+  void pathCacheAdd(const char *path, int len, SdFile &file,
+                    uint32_t parent);
+  void pathCacheClear(void);
+  boolean pathCacheOpen(SdFile &file, const char *path, int len,
+                        uint8_t mode);
+#endif
 public:
   // This needs to be called to set up the connection to the SD card
   // before other methods are used.
+#if defined(__AVR__)
   boolean begin(uint8_t csPin = SD_CHIP_SELECT_PIN);
+#else
+  // Host builds use a FAT image file instead of the card
+  boolean begin(const char *image);
+#endif
   
   // Open the specified file/directory with the supplied mode (e.g. read or
   // write, etc). Returns a File object for interacting with the file.
@@ -85,6 +184,10 @@ public:
   
   boolean rmdir(char *filepath);
 
+  // Reason for the failure of the last open(), SD_ERROR_TOO_MANY_FILES
+  // if all SD_MAX_OPEN_FILES files are open
+  uint8_t errorCode(void) { return lastError; }
+
 private:
 
   // This is used to determine the mode used to open a file
@@ -93,8 +196,12 @@ private:
   // it's probably not the best place for it.
   // It shouldn't be set directly--it is set via the parameters to `open`.
   int fileOpenMode;
+
+  // set by open
+  uint8_t lastError;
   
   friend class File;
+  friend class LogFile;
   friend boolean callback_openPath(SdFile&, char *, boolean, void *); 
 };
 
@@ -0,0 +1,102 @@
+/*
+  SD card ring logger
+ 
+ This example shows how to keep the most recent readings of three
+ analog sensors in a fixed size log on an SD card. The log file is
+ allocated once, when the oldest data is overwritten nothing is
+ allocated on the card and appending takes about the same time
+ every time.
+ 
+ Send any character on the serial port to dump the log.
+ 	
+ The circuit:
+ * analog sensors on analog ins 0, 1, and 2
+ * SD card attached to SPI bus as follows:
+ ** MOSI - pin 11
+ ** MISO - pin 12
+ ** CLK - pin 13
+ ** CS - pin 4
+ 
+ This example code is in the public domain.
+ 	 
+ */
+
+#include <SD.h>
+#include <LogFile.h>
+
+// On the Ethernet Shield, CS is pin 4. Note that even if it's not
+// used as the CS pin, the hardware CS pin (10 on most Arduino boards,
+// 53 on the Mega) must be left as an output or the SD library
+// functions will not work.
+const int chipSelect = 4;
+
+LogFile ringLog;
+int records = 0;
+
+void setup()
+{
+ // Open serial communications and wait for port to open:
+  Serial.begin(9600);
+   while (!Serial) {
+    ; // wait for serial port to connect. Needed for Leonardo only
+  }
+
+  Serial.print("Initializing SD card...");
+  // make sure that the default chip select pin is set to
+  // output, even if you don't use it:
+  pinMode(10, OUTPUT);
+  
+  // see if the card is present and can be initialized:
+  if (!SD.begin(chipSelect)) {
+    Serial.println("Card failed, or not present");
+    // don't do anything more:
+    return;
+  }
+  Serial.println("card initialized.");
+
+  // keep the last 64 KB, the file is created the first time
+  if (!ringLog.open("ring.log", 65536)) {
+    Serial.println("error opening ring.log");
+    return;
+  }
+  Serial.print(ringLog.size());
+  Serial.println(" bytes in the log");
+}
+
+void loop()
+{
+  if (!ringLog) {
+    return;
+  }
+
+  // read three sensors and log them
+  for (int analogPin = 0; analogPin < 3; analogPin++) {
+    ringLog.print(analogRead(analogPin));
+    if (analogPin < 2) {
+      ringLog.print(",");
+    }
+  }
+  ringLog.println();
+
+  // save the position of the log every 100 records. Records written
+  // after the last sync are lost if the power fails.
+  if (++records == 100) {
+    ringLog.sync();
+    records = 0;
+  }
+
+  // dump the log, oldest record first
+  if (Serial.available()) {
+    while (Serial.available()) {
+      Serial.read();
+    }
+    uint8_t buf[64];
+    int n;
+    ringLog.rewind();
+    while ((n = ringLog.read(buf, sizeof(buf))) > 0) {
+      Serial.write(buf, n);
+    }
+  }
+
+  delay(100);
+}
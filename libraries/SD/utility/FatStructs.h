@@ -28,6 +28,13 @@
  * http://www.microsoft.com/whdc/system/platform/firmware/fatgen.mspx
  */
 //------------------------------------------------------------------------------
+/**
+ * No padding between members.  The AVR has none, host compilers align
+ * members and would not match the on-disk layout of the boot block and
+ * the MBR.  Directory entries and FSINFO are aligned as they are.
+ */
+#define FAT_PACKED __attribute__((packed))
+//------------------------------------------------------------------------------
 /** Value for byte 510 of boot block or MBR */
 uint8_t const BOOTSIG0 = 0X55;
 /** Value for byte 511 of boot block or MBR */
@@ -90,7 +97,7 @@ struct partitionTable {
   uint32_t firstSector;
            /** Length of the partition, in blocks. */
   uint32_t totalSectors;
-};
+} FAT_PACKED;
 /** Type name for partitionTable */
 typedef struct partitionTable part_t;
 //------------------------------------------------------------------------------
@@ -114,7 +121,7 @@ struct masterBootRecord {
   uint8_t  mbrSig0;
            /** Second MBR signature byte. Must be 0XAA */
   uint8_t  mbrSig1;
-};
+} FAT_PACKED;
 /** Type name for masterBootRecord */
 typedef struct masterBootRecord mbr_t;
 //------------------------------------------------------------------------------
@@ -236,7 +243,7 @@ struct biosParmBlock {
            * should always set all of the bytes of this field to 0.
            */
   uint8_t  fat32Reserved[12];
-};
+} FAT_PACKED;
 /** Type name for biosParmBlock */
 typedef struct biosParmBlock bpb_t;
 //------------------------------------------------------------------------------
@@ -271,7 +278,7 @@ struct fat32BootSector {
   uint8_t  bootSectorSig0;
            /** must be 0XAA */
   uint8_t  bootSectorSig1;
-};
+} FAT_PACKED;
 //------------------------------------------------------------------------------
 // End Of Chain values for FAT entries
 /** FAT16 end of chain value used by Microsoft. */
@@ -288,6 +295,42 @@ uint32_t const FAT32MASK = 0X0FFFFFFF;
 /** Type name for fat32BootSector */
 typedef struct fat32BootSector fbs_t;
 //------------------------------------------------------------------------------
+/** Lead signature for a FSINFO sector */
+uint32_t const FSINFO_LEAD_SIG = 0X41615252;
+/** Struct signature for a FSINFO sector */
+uint32_t const FSINFO_STRUCT_SIG = 0X61417272;
+/**
+ * \struct fat32FSInfo
+ *
+ * \brief FSINFO sector for a FAT32 volume.
+ *
+ */
+struct fat32FSInfo {
+           /** must be 0X52, 0X52, 0X61, 0X41 */
+  uint32_t leadSignature;
+           /** must be zero */
+  uint8_t  reserved1[480];
+           /** must be 0X72, 0X72, 0X41, 0X61 */
+  uint32_t structSignature;
+           /**
+            * Contains the last known free cluster count on the volume.
+            * If the value is 0XFFFFFFFF, then the free count is unknown.
+            */
+  uint32_t freeCount;
+           /**
+            * Cluster number at which the driver should start looking for
+            * free clusters.  If the value is 0XFFFFFFFF, then there is no
+            * hint.
+            */
+  uint32_t nextFree;
+           /** must be zero */
+  uint8_t  reserved2[12];
+           /** must be 0X00, 0X00, 0X55, 0XAA */
+  uint8_t  tailSignature[4];
+};
+/** Type name for fat32FSInfo */
+typedef struct fat32FSInfo fsinfo_t;
+//------------------------------------------------------------------------------
 /**
  * \struct directoryEntry
  * \brief FAT short directory entry
@@ -32,6 +32,42 @@ static  uint8_t spiRec(void) {
   spiSend(0XFF);
   return SPDR;
 }
+#ifdef OPTIMIZE_HARDWARE_SPI
+//------------------------------------------------------------------------------
+// receive n bytes, n > 0.  Two bytes per iteration and the next transfer
+// is started before the byte just received is stored
+// SPIF to next SPDR write: in/sbrs, in, out = 5 cycles, the old loop
+// also had a st before the out, 7 cycles.  See README.md
+static void spiRead(uint8_t* dst, uint16_t n) {
+  uint8_t* last = dst + n - 1;
+  uint8_t b;
+
+  // start first spi transfer
+  SPDR = 0XFF;
+
+  // odd number of bytes before the last one
+  if ((n - 1) & 1) {
+    while (!(SPSR & (1 << SPIF)));
+    b = SPDR;
+    SPDR = 0XFF;
+    *dst++ = b;
+  }
+  while (dst < last) {
+    while (!(SPSR & (1 << SPIF)));
+    b = SPDR;
+    SPDR = 0XFF;
+    dst[0] = b;
+    while (!(SPSR & (1 << SPIF)));
+    b = SPDR;
+    SPDR = 0XFF;
+    dst[1] = b;
+    dst += 2;
+  }
+  // wait for last byte
+  while (!(SPSR & (1 << SPIF)));
+  *dst = SPDR;
+}
+#endif  // OPTIMIZE_HARDWARE_SPI
 #else  // SOFTWARE_SPI
 //------------------------------------------------------------------------------
 /** nop to tune soft SPI timing */
@@ -88,6 +124,77 @@ void spiSend(uint8_t data) {
 }
 #endif  // SOFTWARE_SPI
 //------------------------------------------------------------------------------
+#if SD_USE_CRC
+// CRC7 of a command with the end bit set
+static uint8_t crc7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t d = data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      crc <<= 1;
+      if ((d ^ crc) & 0X80) crc ^= 0X09;
+      d <<= 1;
+    }
+  }
+  return (crc << 1) | 1;
+}
+//------------------------------------------------------------------------------
+// CRC16-CCITT, polynomial 0X1021, of data sent to or read from the card
+static const uint16_t crc16Table[256] PROGMEM = {
+  0X0000, 0X1021, 0X2042, 0X3063, 0X4084, 0X50A5, 0X60C6, 0X70E7,
+  0X8108, 0X9129, 0XA14A, 0XB16B, 0XC18C, 0XD1AD, 0XE1CE, 0XF1EF,
+  0X1231, 0X0210, 0X3273, 0X2252, 0X52B5, 0X4294, 0X72F7, 0X62D6,
+  0X9339, 0X8318, 0XB37B, 0XA35A, 0XD3BD, 0XC39C, 0XF3FF, 0XE3DE,
+  0X2462, 0X3443, 0X0420, 0X1401, 0X64E6, 0X74C7, 0X44A4, 0X5485,
+  0XA56A, 0XB54B, 0X8528, 0X9509, 0XE5EE, 0XF5CF, 0XC5AC, 0XD58D,
+  0X3653, 0X2672, 0X1611, 0X0630, 0X76D7, 0X66F6, 0X5695, 0X46B4,
+  0XB75B, 0XA77A, 0X9719, 0X8738, 0XF7DF, 0XE7FE, 0XD79D, 0XC7BC,
+  0X48C4, 0X58E5, 0X6886, 0X78A7, 0X0840, 0X1861, 0X2802, 0X3823,
+  0XC9CC, 0XD9ED, 0XE98E, 0XF9AF, 0X8948, 0X9969, 0XA90A, 0XB92B,
+  0X5AF5, 0X4AD4, 0X7AB7, 0X6A96, 0X1A71, 0X0A50, 0X3A33, 0X2A12,
+  0XDBFD, 0XCBDC, 0XFBBF, 0XEB9E, 0X9B79, 0X8B58, 0XBB3B, 0XAB1A,
+  0X6CA6, 0X7C87, 0X4CE4, 0X5CC5, 0X2C22, 0X3C03, 0X0C60, 0X1C41,
+  0XEDAE, 0XFD8F, 0XCDEC, 0XDDCD, 0XAD2A, 0XBD0B, 0X8D68, 0X9D49,
+  0X7E97, 0X6EB6, 0X5ED5, 0X4EF4, 0X3E13, 0X2E32, 0X1E51, 0X0E70,
+  0XFF9F, 0XEFBE, 0XDFDD, 0XCFFC, 0XBF1B, 0XAF3A, 0X9F59, 0X8F78,
+  0X9188, 0X81A9, 0XB1CA, 0XA1EB, 0XD10C, 0XC12D, 0XF14E, 0XE16F,
+  0X1080, 0X00A1, 0X30C2, 0X20E3, 0X5004, 0X4025, 0X7046, 0X6067,
+  0X83B9, 0X9398, 0XA3FB, 0XB3DA, 0XC33D, 0XD31C, 0XE37F, 0XF35E,
+  0X02B1, 0X1290, 0X22F3, 0X32D2, 0X4235, 0X5214, 0X6277, 0X7256,
+  0XB5EA, 0XA5CB, 0X95A8, 0X8589, 0XF56E, 0XE54F, 0XD52C, 0XC50D,
+  0X34E2, 0X24C3, 0X14A0, 0X0481, 0X7466, 0X6447, 0X5424, 0X4405,
+  0XA7DB, 0XB7FA, 0X8799, 0X97B8, 0XE75F, 0XF77E, 0XC71D, 0XD73C,
+  0X26D3, 0X36F2, 0X0691, 0X16B0, 0X6657, 0X7676, 0X4615, 0X5634,
+  0XD94C, 0XC96D, 0XF90E, 0XE92F, 0X99C8, 0X89E9, 0XB98A, 0XA9AB,
+  0X5844, 0X4865, 0X7806, 0X6827, 0X18C0, 0X08E1, 0X3882, 0X28A3,
+  0XCB7D, 0XDB5C, 0XEB3F, 0XFB1E, 0X8BF9, 0X9BD8, 0XABBB, 0XBB9A,
+  0X4A75, 0X5A54, 0X6A37, 0X7A16, 0X0AF1, 0X1AD0, 0X2AB3, 0X3A92,
+  0XFD2E, 0XED0F, 0XDD6C, 0XCD4D, 0XBDAA, 0XAD8B, 0X9DE8, 0X8DC9,
+  0X7C26, 0X6C07, 0X5C64, 0X4C45, 0X3CA2, 0X2C83, 0X1CE0, 0X0CC1,
+  0XEF1F, 0XFF3E, 0XCF5D, 0XDF7C, 0XAF9B, 0XBFBA, 0X8FD9, 0X9FF8,
+  0X6E17, 0X7E36, 0X4E55, 0X5E74, 0X2E93, 0X3EB2, 0X0ED1, 0X1EF0
+};
+static uint16_t crc16(const uint8_t* data, uint16_t n) {
+  uint16_t crc = 0;
+  for (uint16_t i = 0; i < n; i++) {
+    crc = pgm_read_word(&crc16Table[(crc >> 8) ^ data[i]]) ^ (crc << 8);
+  }
+  return crc;
+}
+#else  // SD_USE_CRC
+// CRC16-CCITT without the table, only used for registers
+static uint16_t crc16(const uint8_t* data, uint16_t n) {
+  uint16_t crc = 0;
+  for (uint16_t i = 0; i < n; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t j = 0; j < 8; j++) {
+      crc = crc & 0X8000 ? (crc << 1) ^ 0X1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+#endif  // SD_USE_CRC
+//------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   // end read if in partialBlockRead mode
@@ -106,11 +213,21 @@ uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
   for (int8_t s = 24; s >= 0; s -= 8) spiSend(arg >> s);
 
   // send CRC
+#if SD_USE_CRC
+  uint8_t frame[5];
+  frame[0] = cmd | 0x40;
+  for (uint8_t i = 1; i < 5; i++) frame[i] = arg >> (32 - 8*i);
+  uint8_t crc = crc7(frame, 5);
+#else  // SD_USE_CRC
   uint8_t crc = 0XFF;
   if (cmd == CMD0) crc = 0X95;  // correct crc for CMD0 with arg 0
   if (cmd == CMD8) crc = 0X87;  // correct crc for CMD8 with arg 0X1AA
+#endif  // SD_USE_CRC
   spiSend(crc);
 
+  // skip stuff byte for stop read
+  if (cmd == CMD12) spiRec();
+
   // wait for response
   for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++);
   return status_;
@@ -258,6 +375,13 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
     }
     type(SD_CARD_TYPE_SD2);
   }
+#if SD_USE_CRC
+  // have the card check commands and data
+  if (cardCommand(CMD59, 1) > R1_IDLE_STATE) {
+    error(SD_CARD_ERROR_CMD59);
+    goto fail;
+  }
+#endif  // SD_USE_CRC
   // initialize card and send host supports SDHC if SD2
   arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
 
@@ -281,10 +405,16 @@ uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   chipSelectHigh();
 
 #ifndef SOFTWARE_SPI
-  return setSckRate(sckRateID);
-#else  // SOFTWARE_SPI
-  return true;
+  // step down from the requested rate until the CSD is read with a good CRC
+  for (;;) {
+    csd_t csd;
+    if (!setSckRate(sckRateID)) return false;
+    if (readCSD(&csd)) break;
+    if (sckRateID == 6) return false;
+    sckRateID++;
+  }
 #endif  // SOFTWARE_SPI
+  return true;
 
  fail:
   chipSelectHigh();
@@ -334,7 +464,6 @@ uint8_t Sd2Card::readBlock(uint32_t block, uint8_t* dst) {
  */
 uint8_t Sd2Card::readData(uint32_t block,
         uint16_t offset, uint16_t count, uint8_t* dst) {
-  uint16_t n;
   if (count == 0) return true;
   if ((count + offset) > 512) {
     goto fail;
@@ -355,24 +484,13 @@ uint8_t Sd2Card::readData(uint32_t block,
   }
 
 #ifdef OPTIMIZE_HARDWARE_SPI
-  // start first spi transfer
-  SPDR = 0XFF;
-
   // skip data before offset
   for (;offset_ < offset; offset_++) {
-    while (!(SPSR & (1 << SPIF)));
     SPDR = 0XFF;
-  }
-  // transfer data
-  n = count - 1;
-  for (uint16_t i = 0; i < n; i++) {
     while (!(SPSR & (1 << SPIF)));
-    dst[i] = SPDR;
-    SPDR = 0XFF;
   }
-  // wait for last byte
-  while (!(SPSR & (1 << SPIF)));
-  dst[n] = SPDR;
+  // transfer data
+  spiRead(dst, count);
 
 #else  // OPTIMIZE_HARDWARE_SPI
 
@@ -387,6 +505,20 @@ uint8_t Sd2Card::readData(uint32_t block,
 #endif  // OPTIMIZE_HARDWARE_SPI
 
   offset_ += count;
+#if SD_USE_CRC
+  if (count == 512) {
+    // whole block, check its crc
+    uint16_t crc = spiRec() << 8;
+    crc |= spiRec();
+    chipSelectHigh();
+    inBlock_ = 0;
+    if (crc != crc16(dst, 512)) {
+      error(SD_CARD_ERROR_READ_CRC);
+      return false;
+    }
+    return true;
+  }
+#endif  // SD_USE_CRC
   if (!partialBlockRead_ || offset_ >= 512) {
     // read rest of data, checksum and set chip select high
     readEnd();
@@ -398,6 +530,45 @@ uint8_t Sd2Card::readData(uint32_t block,
   return false;
 }
 //------------------------------------------------------------------------------
+/** Read one data block in a multiple block read sequence
+ *
+ * \param[out] dst Pointer to the location for the 512 byte block.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readData(uint8_t* dst) {
+  // wait for start of next block
+  if (!waitStartBlock()) return false;
+
+#ifdef OPTIMIZE_HARDWARE_SPI
+  // transfer data
+  spiRead(dst, 512);
+
+#else  // OPTIMIZE_HARDWARE_SPI
+
+  // transfer data
+  for (uint16_t i = 0; i < 512; i++) {
+    dst[i] = spiRec();
+  }
+#endif  // OPTIMIZE_HARDWARE_SPI
+
+#if SD_USE_CRC
+  uint16_t crc = spiRec() << 8;
+  crc |= spiRec();
+  if (crc != crc16(dst, 512)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    chipSelectHigh();
+    return false;
+  }
+#else  // SD_USE_CRC
+  // discard crc
+  spiRec();
+  spiRec();
+#endif  // SD_USE_CRC
+  return true;
+}
+//------------------------------------------------------------------------------
 /** Skip remaining data in a block when in partial block read mode. */
 void Sd2Card::readEnd(void) {
   if (inBlock_) {
@@ -422,6 +593,7 @@ void Sd2Card::readEnd(void) {
 /** read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+  uint16_t crc;
   if (cardCommand(cmd, 0)) {
     error(SD_CARD_ERROR_READ_REG);
     goto fail;
@@ -429,8 +601,12 @@ uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   if (!waitStartBlock()) goto fail;
   // transfer data
   for (uint16_t i = 0; i < 16; i++) dst[i] = spiRec();
-  spiRec();  // get first crc byte
-  spiRec();  // get second crc byte
+  crc = spiRec() << 8;
+  crc |= spiRec();
+  if (crc != crc16(dst, 16)) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
   chipSelectHigh();
   return true;
 
@@ -439,6 +615,43 @@ uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Start a read multiple blocks sequence.
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ *
+ * \note This function is used with readData() and readStop()
+ * for optimized multiple block reads.  SPI chip select is low
+ * until readStop() is called.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStart(uint32_t blockNumber) {
+  // use address if not SDHC card
+  if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (cardCommand(CMD18, blockNumber)) {
+    error(SD_CARD_ERROR_CMD18);
+    chipSelectHigh();
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+/** End a read multiple blocks sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStop(void) {
+  if (cardCommand(CMD12, 0)) {
+    error(SD_CARD_ERROR_CMD12);
+    chipSelectHigh();
+    return false;
+  }
+  chipSelectHigh();
+  return true;
+}
+//------------------------------------------------------------------------------
 /**
  * Set the SPI clock rate.
  *
@@ -543,28 +756,42 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
 //------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence */
 uint8_t Sd2Card::writeData(const uint8_t* src) {
+  chipSelectLow();
   // wait for previous write to finish
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
     error(SD_CARD_ERROR_WRITE_MULTIPLE);
     chipSelectHigh();
     return false;
   }
-  return writeData(WRITE_MULTIPLE_TOKEN, src);
+  if (!writeData(WRITE_MULTIPLE_TOKEN, src)) return false;
+
+  // release the bus between blocks
+  chipSelectHigh();
+  return true;
 }
 //------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
 uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
+#if SD_USE_CRC
+  uint16_t crc = crc16(src, 512);
+#else  // SD_USE_CRC
+  uint16_t crc = 0XFFFF;  // dummy crc
+#endif  // SD_USE_CRC
 #ifdef OPTIMIZE_HARDWARE_SPI
 
   // send data - optimized loop
   SPDR = token;
 
-  // send two byte per iteration
-  for (uint16_t i = 0; i < 512; i += 2) {
+  // send two byte per iteration, the next byte is loaded while the
+  // previous one is shifted out.  SPIF to SPDR write is 4 cycles instead
+  // of 6 with the load after the poll
+  for (const uint8_t* end = src + 512; src < end; src += 2) {
+    uint8_t b = src[0];
     while (!(SPSR & (1 << SPIF)));
-    SPDR = src[i];
+    SPDR = b;
+    b = src[1];
     while (!(SPSR & (1 << SPIF)));
-    SPDR = src[i+1];
+    SPDR = b;
   }
 
   // wait for last data byte
@@ -576,8 +803,8 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
     spiSend(src[i]);
   }
 #endif  // OPTIMIZE_HARDWARE_SPI
-  spiSend(0xff);  // dummy crc
-  spiSend(0xff);  // dummy crc
+  spiSend(crc >> 8);
+  spiSend(crc);
 
   status_ = spiRec();
   if ((status_ & DATA_RES_MASK) != DATA_RES_ACCEPTED) {
@@ -595,6 +822,8 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
  *
  * \note This function is used with writeData() and writeStop()
  * for optimized multiple block writes.
+ * Chip select is high between blocks so that other devices can use
+ * the SPI bus while the sequence is in progress.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -618,6 +847,7 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
     error(SD_CARD_ERROR_CMD25);
     goto fail;
   }
+  chipSelectHigh();
   return true;
 
  fail:
@@ -631,6 +861,7 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::writeStop(void) {
+  chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
@@ -82,6 +82,13 @@ uint8_t const SPI_SCK_PIN = 13;
 //------------------------------------------------------------------------------
 /** Protect block zero from write if nonzero */
 #define SD_PROTECT_BLOCK_ZERO 1
+/**
+ * Check CRCs if nonzero.  Commands are sent with their CRC7, blocks are
+ * read and written with their CRC16 and the card is told to check both
+ * with CMD59.  Costs 512 bytes of flash for the CRC16 table and a pass
+ * over each block.  Partial block reads are not checked.
+ */
+#define SD_USE_CRC 0
 /** init timeout ms */
 uint16_t const SD_INIT_TIMEOUT = 2000;
 /** erase timeout ms */
@@ -136,6 +143,14 @@ uint8_t const SD_CARD_ERROR_WRITE_PROGRAMMING = 0X14;
 uint8_t const SD_CARD_ERROR_WRITE_TIMEOUT = 0X15;
 /** incorrect rate selected */
 uint8_t const SD_CARD_ERROR_SCK_RATE = 0X16;
+/** card returned an error response for CMD12 (stop read multiple) */
+uint8_t const SD_CARD_ERROR_CMD12 = 0X17;
+/** card returned an error response for CMD18 (read multiple block) */
+uint8_t const SD_CARD_ERROR_CMD18 = 0X18;
+/** card returned an error response for CMD59 (CRC_ON_OFF) */
+uint8_t const SD_CARD_ERROR_CMD59 = 0X19;
+/** CRC of a data block or register read from the card is wrong */
+uint8_t const SD_CARD_ERROR_READ_CRC = 0X1A;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -184,6 +199,7 @@ class Sd2Card {
   uint8_t readBlock(uint32_t block, uint8_t* dst);
   uint8_t readData(uint32_t block,
           uint16_t offset, uint16_t count, uint8_t* dst);
+  uint8_t readData(uint8_t* dst);
   /**
    * Read a cards CID register. The CID contains card identification
    * information such as Manufacturer ID, Product name, Product serial
@@ -198,6 +214,8 @@ class Sd2Card {
     return readRegister(CMD9, csd);
   }
   void readEnd(void);
+  uint8_t readStart(uint32_t blockNumber);
+  uint8_t readStop(void);
   uint8_t setSckRate(uint8_t sckRateID);
   /** Return the card type: SD V1, SD V2 or SDHC */
   uint8_t type(void) const {return type_;}
@@ -24,7 +24,15 @@
  * SdFile and SdVolume classes
  */
 #include <avr/pgmspace.h>
+#if defined(__AVR__)
 #include "Sd2Card.h"
+/** Block device under SdVolume, the SD card on the SPI bus */
+typedef Sd2Card SdBlockDevice;
+#else  // defined(__AVR__)
+#include "SdImageFile.h"
+/** Block device under SdVolume, a FAT image file on the host */
+typedef SdImageFile SdBlockDevice;
+#endif  // defined(__AVR__)
 #include "FatStructs.h"
 #include "Print.h"
 //------------------------------------------------------------------------------
@@ -33,6 +41,58 @@
  */
 #define ALLOW_DEPRECATED_FUNCTIONS 1
 //------------------------------------------------------------------------------
+/**
+ * Number of 512 byte blocks in the SdVolume cache, one to eight.  With
+ * more than one block, the first block is kept for the FAT and the others
+ * are replaced least recently used first.  Dirty blocks are only written
+ * when replaced or by cacheFlush().  Can be set on the command line.
+ */
+#ifndef SD_CACHE_BLOCKS
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_CACHE_BLOCKS 4
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#define SD_CACHE_BLOCKS 1
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#endif  // SD_CACHE_BLOCKS
+
+#if SD_CACHE_BLOCKS < 1 || SD_CACHE_BLOCKS > 8
+#error SD_CACHE_BLOCKS must be 1 to 8
+#endif  // SD_CACHE_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * Size in bytes of the SdVolume map of FAT regions without free clusters,
+ * zero to disable.  Each bit covers a power of two clusters.  A bit is set
+ * when an allocation search finds no free cluster in its region and is
+ * cleared when a cluster in the region is freed.  Later searches skip
+ * regions that are set instead of reading their FAT blocks.  Can be set
+ * on the command line.
+ */
+#ifndef SD_FREE_MAP_BYTES
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_FREE_MAP_BYTES 64
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#define SD_FREE_MAP_BYTES 16
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#endif  // SD_FREE_MAP_BYTES
+//------------------------------------------------------------------------------
+/**
+ * Number of extents remembered by each SdFile, zero to disable.  An extent
+ * maps a run of file clusters to contiguous clusters on the volume.  They
+ * are recorded as the cluster chain is followed so that seekSet() can
+ * start from the nearest known cluster instead of the first one.  Can be
+ * set on the command line.
+ */
+#ifndef SD_FILE_EXTENTS
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)\
+  || defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__)
+#define SD_FILE_EXTENTS 4
+#else  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#define SD_FILE_EXTENTS 2
+#endif  // defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) ...
+#endif  // SD_FILE_EXTENTS
+//------------------------------------------------------------------------------
 // forward declaration since SdVolume is used in SdFile
 class SdVolume;
 //==============================================================================
@@ -222,6 +282,8 @@ class SdFile : public Print {
   uint8_t makeDir(SdFile* dir, const char* dirName);
   uint8_t open(SdFile* dirFile, uint16_t index, uint8_t oflag);
   uint8_t open(SdFile* dirFile, const char* fileName, uint8_t oflag);
+  uint8_t open(SdVolume* vol, uint32_t dirBlock,
+          uint8_t dirIndex, uint8_t oflag);
 
   uint8_t openRoot(SdVolume* vol);
   static void printDirName(const dir_t& dir, uint8_t width);
@@ -390,13 +452,34 @@ class SdFile : public Print {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+#if SD_FILE_EXTENTS
+  // clusters index to index + count - 1 of the file start at cluster
+  struct extent_t {
+    uint32_t index;
+    uint32_t cluster;
+    uint16_t count;
+  };
+  extent_t  extent_[SD_FILE_EXTENTS];  // known runs of the cluster chain
+  uint8_t   extentNext_;    // extent_ entry to be replaced next
+#endif  // SD_FILE_EXTENTS
 
   // private functions
   uint8_t addCluster(void);
   uint8_t addDirCluster(void);
   dir_t* cacheDirEntry(uint8_t action);
+  uint8_t contiguousBlocks(uint16_t maxBlocks, uint8_t alloc,
+          uint16_t* count, uint32_t* lastCluster);
   static void (*dateTime_)(uint16_t* date, uint16_t* time);
   static uint8_t make83Name(const char* str, uint8_t* name);
+#if SD_FILE_EXTENTS
+  void extentAdd(uint32_t index, uint32_t cluster, uint32_t count = 1);
+  void extentClear(void);
+  void extentFind(uint32_t index, uint32_t* n, uint32_t* cluster) const;
+#else  // SD_FILE_EXTENTS
+  void extentAdd(uint32_t index, uint32_t cluster, uint32_t count = 1) {}
+  void extentClear(void) {}
+  void extentFind(uint32_t index, uint32_t* n, uint32_t* cluster) const {}
+#endif  // SD_FILE_EXTENTS
   uint8_t openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
   dir_t* readDirCache(void);
 };
@@ -418,6 +501,8 @@ union cache_t {
   mbr_t    mbr;
            /** Used to access to a cached FAT boot sector. */
   fbs_t    fbs;
+           /** Used to access to a cached FAT32 FSINFO sector. */
+  fsinfo_t fsinfo;
 };
 //------------------------------------------------------------------------------
 /**
@@ -427,28 +512,31 @@ union cache_t {
 class SdVolume {
  public:
   /** Create an instance of SdVolume */
-  SdVolume(void) :allocSearchStart_(2), fatType_(0) {}
+  SdVolume(void) :allocSearchStart_(2), fatType_(0),
+    freeClusterCount_(0XFFFFFFFF), fsInfoBlock_(0), fsInfoDirty_(0) {}
   /** Clear the cache and returns a pointer to the cache.  Used by the WaveRP
    *  recorder to do raw write to the SD card.  Not for normal apps.
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
-    cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    cacheBlockNumber_[cacheCurrent_] = 0XFFFFFFFF;
+    return cacheBuffer_->data;
   }
   /**
    * Initialize a FAT volume.  Try partition one first then try super
    * floppy format.
    *
-   * \param[in] dev The Sd2Card where the volume is located.
+   * \param[in] dev The block device where the volume is located.
    *
    * \return The value one, true, is returned for success and
    * the value zero, false, is returned for failure.  Reasons for
    * failure include not finding a valid partition, not finding a valid
    * FAT file system or an I/O error.
    */
-  uint8_t init(Sd2Card* dev) { return init(dev, 1) ? true : init(dev, 0);}
-  uint8_t init(Sd2Card* dev, uint8_t part);
+  uint8_t init(SdBlockDevice* dev) {
+    return init(dev, 1) ? true : init(dev, 0);
+  }
+  uint8_t init(SdBlockDevice* dev, uint8_t part);
 
   // inline functions that return volume info
   /** \return The volume's cluster size in blocks. */
@@ -467,21 +555,25 @@ class SdVolume {
   uint32_t fatStartBlock(void) const {return fatStartBlock_;}
   /** \return The FAT type of the volume. Values are 12, 16 or 32. */
   uint8_t fatType(void) const {return fatType_;}
+  /** \return The free cluster count kept in the FSINFO sector of FAT32
+   *  volumes or 0XFFFFFFFF if unknown. */
+  uint32_t freeClusterCount(void) const {return freeClusterCount_;}
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount(void) const {return rootDirEntryCount_;}
   /** \return The logical block number for the start of the root directory
        on FAT16 volumes or the first cluster number on FAT32 volumes. */
   uint32_t rootDirStart(void) const {return rootDirStart_;}
-  /** return a pointer to the Sd2Card object for this volume */
-  static Sd2Card* sdCard(void) {return sdCard_;}
+  /** return a pointer to the block device for this volume */
+  static SdBlockDevice* sdCard(void) {return sdCard_;}
 //------------------------------------------------------------------------------
 #if ALLOW_DEPRECATED_FUNCTIONS
   // Deprecated functions  - suppress cpplint warnings with NOLINT comment
-  /** \deprecated Use: uint8_t SdVolume::init(Sd2Card* dev); */
-  uint8_t init(Sd2Card& dev) {return init(&dev);}  // NOLINT
+  /** \deprecated Use: uint8_t SdVolume::init(SdBlockDevice* dev); */
+  uint8_t init(SdBlockDevice& dev) {return init(&dev);}  // NOLINT
 
-  /** \deprecated Use: uint8_t SdVolume::init(Sd2Card* dev, uint8_t vol); */
-  uint8_t init(Sd2Card& dev, uint8_t part) {  // NOLINT
+  /** \deprecated Use: uint8_t SdVolume::init(SdBlockDevice* dev,
+   *  uint8_t vol); */
+  uint8_t init(SdBlockDevice& dev, uint8_t part) {  // NOLINT
     return init(&dev, part);
   }
 #endif  // ALLOW_DEPRECATED_FUNCTIONS
@@ -494,12 +586,19 @@ class SdVolume {
   static uint8_t const CACHE_FOR_READ = 0;
   // value for action argument in cacheRawBlock to indicate cache dirty
   static uint8_t const CACHE_FOR_WRITE = 1;
+  // cache slot for FAT blocks
+  static uint8_t const CACHE_FAT_SLOT = 0;
+  // first cache slot for data and directory blocks
+  static uint8_t const CACHE_DATA_SLOT = SD_CACHE_BLOCKS > 1 ? 1 : 0;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
-  static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+  static cache_t cacheBlocks_[SD_CACHE_BLOCKS];  // 512 byte device blocks
+  static cache_t* cacheBuffer_;       // block last used in the cache
+  static uint32_t cacheBlockNumber_[SD_CACHE_BLOCKS];  // block in each slot
+  static uint8_t cacheAge_[SD_CACHE_BLOCKS];  // zero for last slot used
+  static uint8_t cacheCurrent_;       // slot of cacheBuffer_
+  static SdBlockDevice* sdCard_;      // block device for cache
+  static uint8_t cacheDirty_;         // bit n set if slot n must be written
+  static uint32_t cacheMirrorBlock_;  // mirror FAT block for the FAT slot
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
   uint8_t blocksPerCluster_;    // cluster size in blocks
@@ -510,6 +609,13 @@ class SdVolume {
   uint8_t fatCount_;            // number of FATs on volume
   uint32_t fatStartBlock_;      // start block for first FAT
   uint8_t fatType_;             // volume type (12, 16, OR 32)
+  uint32_t freeClusterCount_;   // FSINFO free count, 0XFFFFFFFF if unknown
+  uint32_t fsInfoBlock_;        // FAT32 FSINFO block, zero if none
+  uint8_t fsInfoDirty_;         // fsInfoSync() will write FSINFO if true
+#if SD_FREE_MAP_BYTES
+  uint8_t freeMap_[SD_FREE_MAP_BYTES];  // bit set if region is full
+  uint8_t freeMapShift_;        // shift to convert cluster to freeMap_ bit
+#endif  // SD_FREE_MAP_BYTES
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
   //----------------------------------------------------------------------------
@@ -520,9 +626,20 @@ class SdVolume {
            return dataStartBlock_ + ((cluster - 2) << clusterSizeShift_);}
   uint32_t blockNumber(uint32_t cluster, uint32_t position) const {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
+  static uint32_t cacheBlockNumber(void) {
+    return cacheBlockNumber_[cacheCurrent_];
+  }
+  static uint8_t cacheFatBlock(uint32_t blockNumber);
+  static uint8_t cacheFind(uint32_t blockNumber);
   static uint8_t cacheFlush(void);
+  static uint8_t cacheFlushSlot(uint8_t slot);
+  static void cacheInvalidate(uint32_t blockNumber);
+  static uint8_t cacheLoad(uint8_t slot, uint32_t blockNumber, uint8_t read);
+  static uint8_t cacheNewBlock(uint32_t blockNumber);
   static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+  static void cacheSetDirty(void) {cacheDirty_ |= 1 << cacheCurrent_;}
+  static void cacheUse(uint8_t slot);
+  static uint8_t cacheVictim(void);
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
@@ -531,11 +648,27 @@ class SdVolume {
     return fatPut(cluster, 0x0FFFFFFF);
   }
   uint8_t freeChain(uint32_t cluster);
+#if SD_FREE_MAP_BYTES
+  uint8_t freeMapFull(uint32_t cluster) const {
+    uint16_t i = cluster >> freeMapShift_;
+    return freeMap_[i >> 3] & (1 << (i & 7));
+  }
+  void freeMapMark(uint32_t cluster, uint8_t full) {
+    uint16_t i = cluster >> freeMapShift_;
+    if (full) {
+      freeMap_[i >> 3] |= 1 << (i & 7);
+    } else {
+      freeMap_[i >> 3] &= ~(1 << (i & 7));
+    }
+  }
+#endif  // SD_FREE_MAP_BYTES
+  uint8_t fsInfoSync(void);
   uint8_t isEOC(uint32_t cluster) const {
     return  cluster >= (fatType_ == 16 ? FAT16EOC_MIN : FAT32EOC_MIN);
   }
   uint8_t readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
+  static uint8_t readBlocks(uint32_t block, uint8_t* dst, uint16_t count);
   uint8_t readData(uint32_t block, uint16_t offset,
     uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
@@ -543,5 +676,7 @@ class SdVolume {
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
+  static uint8_t writeBlocks(uint32_t block,
+    const uint8_t* src, uint16_t count);
 };
 #endif  // SdFat_h
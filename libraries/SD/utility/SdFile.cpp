@@ -56,11 +56,50 @@ uint8_t SdFile::addDirCluster(void) {
   return true;
 }
 //------------------------------------------------------------------------------
+// count blocks from the current position that are contiguous on the card,
+// up to maxBlocks.  The position must be at the start of a block and
+// curCluster_ must be the cluster for the position.  If alloc is true,
+// clusters are added at the end of the chain.  lastCluster returns the
+// cluster of the last block in the run.
+uint8_t SdFile::contiguousBlocks(uint16_t maxBlocks, uint8_t alloc,
+  uint16_t* count, uint32_t* lastCluster) {
+  uint32_t cluster = curCluster_;
+  uint32_t index = curPosition_ >> (vol_->clusterSizeShift_ + 9);
+  uint16_t n = vol_->blocksPerCluster_ - vol_->blockOfCluster(curPosition_);
+
+  while (n < maxBlocks) {
+    uint32_t next;
+    if (!vol_->fatGet(cluster, &next)) return false;
+    if (alloc && vol_->isEOC(next)) {
+      // add the free clusters that follow as one group - stop run if the
+      // next one is in use rather than search the FAT for a whole group
+      uint32_t need = ((maxBlocks - n - 1) >> vol_->clusterSizeShift_) + 1;
+      uint32_t avail = 0;
+      while (avail < need && cluster + avail + 1 <= vol_->clusterCount_ + 1) {
+        uint32_t f;
+        if (!vol_->fatGet(cluster + avail + 1, &f)) return false;
+        if (f != 0) break;
+        avail++;
+      }
+      if (avail == 0) break;
+      next = cluster;
+      if (!vol_->allocContiguous(avail, &next)) break;
+    }
+    if (next != (cluster + 1)) break;
+    cluster = next;
+    extentAdd(++index, cluster);
+    n += vol_->blocksPerCluster_;
+  }
+  *count = n < maxBlocks ? n : maxBlocks;
+  *lastCluster = cluster;
+  return true;
+}
+//------------------------------------------------------------------------------
 // cache a file's directory entry
 // return pointer to cached entry or null for failure
 dir_t* SdFile::cacheDirEntry(uint8_t action) {
   if (!SdVolume::cacheRawBlock(dirBlock_, action)) return NULL;
-  return SdVolume::cacheBuffer_.dir + dirIndex_;
+  return SdVolume::cacheBuffer_->dir + dirIndex_;
 }
 //------------------------------------------------------------------------------
 /**
@@ -142,6 +181,9 @@ uint8_t SdFile::createContiguous(SdFile* dirFile,
   }
   fileSize_ = size;
 
+  // whole file is one extent
+  extentAdd(0, firstCluster_, count);
+
   // insure sync() will update dir entry
   flags_ |= F_FILE_DIR_DIRTY;
   return sync();
@@ -184,6 +226,53 @@ void SdFile::dirName(const dir_t& dir, char* name) {
   }
   name[j] = 0;
 }
+#if SD_FILE_EXTENTS
+//------------------------------------------------------------------------------
+// remember that count clusters from cluster index of the file start at cluster
+void SdFile::extentAdd(uint32_t index, uint32_t cluster, uint32_t count) {
+  extent_t* e;
+  if (count > 0XFFFF) count = 0XFFFF;
+  for (e = extent_; e < &extent_[SD_FILE_EXTENTS]; e++) {
+    if (e->count == 0) continue;
+    uint32_t k = index - e->index;
+
+    // already known
+    if (k < e->count) return;
+
+    // extend an extent that ends just before index
+    if (k == e->count && cluster == (e->cluster + k)
+      && (e->count + count) <= 0XFFFF) {
+      e->count += count;
+      return;
+    }
+  }
+  // replace oldest extent
+  e = &extent_[extentNext_];
+  e->index = index;
+  e->cluster = cluster;
+  e->count = count;
+  if (++extentNext_ >= SD_FILE_EXTENTS) extentNext_ = 0;
+}
+//------------------------------------------------------------------------------
+// forget all extents
+void SdFile::extentClear(void) {
+  for (uint8_t i = 0; i < SD_FILE_EXTENTS; i++) extent_[i].count = 0;
+  extentNext_ = 0;
+}
+//------------------------------------------------------------------------------
+// move n and cluster to the known cluster nearest to but not after index
+void SdFile::extentFind(uint32_t index, uint32_t* n, uint32_t* cluster) const {
+  for (const extent_t* e = extent_; e < &extent_[SD_FILE_EXTENTS]; e++) {
+    if (e->count == 0 || e->index > index) continue;
+    uint32_t k = index - e->index;
+    if (k >= e->count) k = e->count - 1;
+    if ((e->index + k) > *n) {
+      *n = e->index + k;
+      *cluster = e->cluster + k;
+    }
+  }
+}
+#endif  // SD_FILE_EXTENTS
 //------------------------------------------------------------------------------
 /** List directory contents to Serial.
  *
@@ -314,7 +403,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
   if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) return false;
 
   // copy '.' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[0], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[0], &d, sizeof(d));
 
   // make entry for '..'
   d.name[1] = '.';
@@ -326,7 +415,7 @@ uint8_t SdFile::makeDir(SdFile* dir, const char* dirName) {
     d.firstClusterHigh = dir->firstCluster_ >> 16;
   }
   // copy '..' to block
-  memcpy(&SdVolume::cacheBuffer_.dir[1], &d, sizeof(d));
+  memcpy(&SdVolume::cacheBuffer_->dir[1], &d, sizeof(d));
 
   // set position after '..'
   curPosition_ = 2 * sizeof(d);
@@ -406,7 +495,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
       if (!emptyFound) {
         emptyFound = true;
         dirIndex_ = index;
-        dirBlock_ = SdVolume::cacheBlockNumber_;
+        dirBlock_ = SdVolume::cacheBlockNumber();
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
@@ -433,7 +522,7 @@ uint8_t SdFile::open(SdFile* dirFile, const char* fileName, uint8_t oflag) {
 
     // use first entry in cluster
     dirIndex_ = 0;
-    p = SdVolume::cacheBuffer_.dir;
+    p = SdVolume::cacheBuffer_->dir;
   }
   // initialize as empty file
   memset(p, 0, sizeof(dir_t));
@@ -498,10 +587,53 @@ uint8_t SdFile::open(SdFile* dirFile, uint16_t index, uint8_t oflag) {
   return openCachedEntry(index & 0XF, oflag);
 }
 //------------------------------------------------------------------------------
+/**
+ * Open a file or subdirectory by the location of its directory entry.
+ *
+ * No directory is searched.  The location of an open file is given by
+ * dirBlock() and dirIndex() and stays valid until the file is removed.
+ *
+ * \param[in] vol The volume where the file is located.
+ *
+ * \param[in] dirBlock The block that contains the directory entry.
+ *
+ * \param[in] dirIndex The index of the entry in \a dirBlock, 0 to 15.
+ *
+ * \param[in] oflag Values for \a oflag are constructed by a bitwise-inclusive
+ * OR of flags O_READ, O_WRITE, O_TRUNC, and O_SYNC.
+ *
+ * See open() by fileName for definition of flags and return values.
+ *
+ */
+uint8_t SdFile::open(SdVolume* vol, uint32_t dirBlock,
+        uint8_t dirIndex, uint8_t oflag) {
+  // error if already open
+  if (isOpen() || dirIndex > 0XF) return false;
+
+  // don't open existing file if O_CREAT and O_EXCL - user call error
+  if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) return false;
+
+  vol_ = vol;
+
+  // read entry into cache
+  if (!SdVolume::cacheRawBlock(dirBlock, SdVolume::CACHE_FOR_READ)) {
+    return false;
+  }
+  dir_t* p = SdVolume::cacheBuffer_->dir + dirIndex;
+
+  // error if empty slot or '.' or '..'
+  if (p->name[0] == DIR_NAME_FREE ||
+      p->name[0] == DIR_NAME_DELETED || p->name[0] == '.') {
+    return false;
+  }
+  // open cached entry
+  return openCachedEntry(dirIndex, oflag);
+}
+//------------------------------------------------------------------------------
 // open a cached directory entry. Assumes vol_ is initializes
 uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
-  dir_t* p = SdVolume::cacheBuffer_.dir + dirIndex;
+  dir_t* p = SdVolume::cacheBuffer_->dir + dirIndex;
 
   // write or truncate is an error for a directory or read-only file
   if (p->attributes & (DIR_ATT_READ_ONLY | DIR_ATT_DIRECTORY)) {
@@ -509,7 +641,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // remember location of directory entry on SD
   dirIndex_ = dirIndex;
-  dirBlock_ = SdVolume::cacheBlockNumber_;
+  dirBlock_ = SdVolume::cacheBlockNumber();
 
   // copy first cluster number for directory fields
   firstCluster_ = (uint32_t)p->firstClusterHigh << 16;
@@ -531,6 +663,7 @@ uint8_t SdFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  extentClear();
 
   // truncate file to zero length if requested
   if (oflag & O_TRUNC) return truncate(0);
@@ -570,6 +703,7 @@ uint8_t SdFile::openRoot(SdVolume* vol) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+  extentClear();
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -684,8 +818,27 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
           // get next cluster from FAT
           if (!vol_->fatGet(curCluster_, &curCluster_)) return -1;
         }
+        extentAdd(curPosition_ >> (vol_->clusterSizeShift_ + 9), curCluster_);
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+
+      // stream whole blocks that are contiguous on the card
+      if (offset == 0 && toRead >= 1024) {
+        uint16_t nb;
+        uint32_t lastCluster;
+        if (!contiguousBlocks(toRead >> 9, false, &nb, &lastCluster)) {
+          return -1;
+        }
+        if (nb > 1) {
+          if (!SdVolume::readBlocks(block, dst, nb)) return -1;
+          uint16_t nByte = 512U * nb;
+          curCluster_ = lastCluster;
+          dst += nByte;
+          curPosition_ += nByte;
+          toRead -= nByte;
+          continue;
+        }
+      }
     }
     uint16_t n = toRead;
 
@@ -694,13 +847,13 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
 
     // no buffering needed if n == 512 or user requests no buffering
     if ((unbufferedRead() || n == 512) &&
-      block != SdVolume::cacheBlockNumber_) {
+      SdVolume::cacheFind(block) == SD_CACHE_BLOCKS) {
       if (!vol_->readData(block, offset, n, dst)) return -1;
       dst += n;
     } else {
       // read block to cache and copy data to caller
       if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) return -1;
-      uint8_t* src = SdVolume::cacheBuffer_.data + offset;
+      uint8_t* src = SdVolume::cacheBuffer_->data + offset;
       uint8_t* end = src + n;
       while (src != end) *dst++ = *src++;
     }
@@ -754,7 +907,7 @@ dir_t* SdFile::readDirCache(void) {
   curPosition_ += 31;
 
   // return pointer to entry
-  return (SdVolume::cacheBuffer_.dir + i);
+  return (SdVolume::cacheBuffer_->dir + i);
 }
 //------------------------------------------------------------------------------
 /**
@@ -896,8 +1049,8 @@ uint8_t SdFile::rmRfStar(void) {
       if (!f.remove()) return false;
     }
     // position to next entry if required
-    if (curPosition_ != (32*(index + 1))) {
-      if (!seekSet(32*(index + 1))) return false;
+    if (curPosition_ != (32UL*(index + 1))) {
+      if (!seekSet(32UL*(index + 1))) return false;
     }
   }
   // don't try to delete root
@@ -931,16 +1084,22 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   uint32_t nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   uint32_t nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
-  if (nNew < nCur || curPosition_ == 0) {
-    // must follow chain from first cluster
-    curCluster_ = firstCluster_;
-  } else {
+  // cluster index and cluster to follow the chain from
+  uint32_t n = 0;
+  uint32_t cluster = firstCluster_;
+  if (nNew >= nCur && curPosition_ != 0) {
     // advance from curPosition
-    nNew -= nCur;
+    n = nCur;
+    cluster = curCluster_;
   }
-  while (nNew--) {
-    if (!vol_->fatGet(curCluster_, &curCluster_)) return false;
+  // start from a closer known cluster if possible
+  extentFind(nNew, &n, &cluster);
+
+  while (n < nNew) {
+    if (!vol_->fatGet(cluster, &cluster)) return false;
+    extentAdd(++n, cluster);
   }
+  curCluster_ = cluster;
   curPosition_ = pos;
   return true;
 }
@@ -958,6 +1117,9 @@ uint8_t SdFile::sync(void) {
   // only allow open files and directories
   if (!isOpen()) return false;
 
+  // update FAT32 free cluster hints
+  if (!vol_->fsInfoSync()) return false;
+
   if (flags_ & F_FILE_DIR_DIRTY) {
     dir_t* d = cacheDirEntry(SdVolume::CACHE_FOR_WRITE);
     if (!d) return false;
@@ -1096,6 +1258,9 @@ uint8_t SdFile::truncate(uint32_t length) {
   }
   fileSize_ = length;
 
+  // freed clusters may be in extents
+  extentClear();
+
   // need to update directory entry
   flags_ |= F_FILE_DIR_DIRTY;
 
@@ -1110,6 +1275,9 @@ uint8_t SdFile::truncate(uint32_t length) {
  *
  * \note Data is moved to the cache but may not be written to the
  * storage device until sync() is called.
+ * Runs of two or more whole blocks that are contiguous on the card
+ * bypass the cache and are written with one pre-erased multiple block
+ * command.
  *
  * \param[in] buf Pointer to the location of the data to be written.
  *
@@ -1158,6 +1326,7 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
           curCluster_ = next;
         }
       }
+      extentAdd(curPosition_ >> (vol_->clusterSizeShift_ + 9), curCluster_);
     }
     // max space in block
     uint16_t n = 512 - blockOffset;
@@ -1167,27 +1336,41 @@ size_t SdFile::write(const void* buf, uint16_t nbyte) {
 
     // block for data write
     uint32_t block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+
+    // stream whole blocks that are contiguous on the card
+    if (blockOffset == 0 && nToWrite >= 1024) {
+      uint16_t nb;
+      uint32_t lastCluster;
+      if (!contiguousBlocks(nToWrite >> 9, true, &nb, &lastCluster)) {
+        goto writeErrorReturn;
+      }
+      if (nb > 1) {
+        if (!SdVolume::writeBlocks(block, src, nb)) goto writeErrorReturn;
+        uint16_t nByte = 512U * nb;
+        curCluster_ = lastCluster;
+        src += nByte;
+        nToWrite -= nByte;
+        curPosition_ += nByte;
+        continue;
+      }
+    }
     if (n == 512) {
       // full block - don't need to use cache
       // invalidate cache if block is in cache
-      if (SdVolume::cacheBlockNumber_ == block) {
-        SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-      }
+      SdVolume::cacheInvalidate(block);
       if (!vol_->writeBlock(block, src)) goto writeErrorReturn;
       src += 512;
     } else {
       if (blockOffset == 0 && curPosition_ >= fileSize_) {
         // start of new block don't need to read into cache
-        if (!SdVolume::cacheFlush()) goto writeErrorReturn;
-        SdVolume::cacheBlockNumber_ = block;
-        SdVolume::cacheSetDirty();
+        if (!SdVolume::cacheNewBlock(block)) goto writeErrorReturn;
       } else {
         // rewrite part of block
         if (!SdVolume::cacheRawBlock(block, SdVolume::CACHE_FOR_WRITE)) {
           goto writeErrorReturn;
         }
       }
-      uint8_t* dst = SdVolume::cacheBuffer_.data + blockOffset;
+      uint8_t* dst = SdVolume::cacheBuffer_->data + blockOffset;
       uint8_t* end = dst + n;
       while (dst != end) *dst++ = *src++;
     }
@@ -0,0 +1,229 @@
+/* Arduino SdFat Library
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#if !defined(__AVR__)
+#include <string.h>
+#include "SdImageFile.h"
+// values for inSequence_
+uint8_t const SEQ_NONE = 0;
+uint8_t const SEQ_READ = 1;
+uint8_t const SEQ_WRITE = 2;
+//------------------------------------------------------------------------------
+/**
+ * Open an image file.
+ *
+ * \param[in] path Path of a FAT16 or FAT32 image, with or without an MBR.
+ * It is opened for update and is not extended.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::begin(const char* path) {
+  end();
+  file_ = fopen(path, "r+b");
+  if (!file_) return false;
+  if (fseek(file_, 0, SEEK_END)) goto fail;
+  blocks_ = ftell(file_) / 512;
+  if (blocks_ == 0) goto fail;
+  inSequence_ = SEQ_NONE;
+  return true;
+
+ fail:
+  end();
+  return false;
+}
+//------------------------------------------------------------------------------
+/** Zero the block and command counts and the modeled time. */
+void SdImageFile::clearStats(void) {
+  blocksRead_ = 0;
+  blocksWritten_ = 0;
+  commands_ = 0;
+  elapsed_ = 0;
+}
+//------------------------------------------------------------------------------
+// count a command, an error if a multiple block sequence is active
+uint8_t SdImageFile::command(void) {
+  if (!file_ || inSequence_ != SEQ_NONE) return false;
+  commands_++;
+  elapsed_ += timing_.command;
+  return true;
+}
+//------------------------------------------------------------------------------
+/** Close the image file. */
+void SdImageFile::end(void) {
+  if (file_) fclose(file_);
+  file_ = 0;
+  blocks_ = 0;
+}
+//------------------------------------------------------------------------------
+// fill a block of the image with the erased state, not counted
+uint8_t SdImageFile::eraseRaw(uint32_t block) {
+  uint8_t buf[512];
+  if (block >= blocks_) return true;
+  memset(buf, 0XFF, sizeof(buf));
+  if (fseek(file_, 512L * block, SEEK_SET)) return false;
+  return fwrite(buf, 1, 512, file_) == 512;
+}
+//------------------------------------------------------------------------------
+/**
+ * Read a 512 byte block.
+ *
+ * \param[in] block Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::readBlock(uint32_t block, uint8_t* dst) {
+  return readData(block, 0, 512, dst);
+}
+//------------------------------------------------------------------------------
+/**
+ * Read part of a 512 byte block.  The whole block is counted as
+ * transferred, as it is by Sd2Card.
+ *
+ * \param[in] block Logical block to be read.
+ * \param[in] offset Number of bytes to skip at start of block
+ * \param[in] count Number of bytes to read
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::readData(uint32_t block,
+        uint16_t offset, uint16_t count, uint8_t* dst) {
+  if (count == 0) return true;
+  if ((count + offset) > 512) return false;
+  if (!command()) return false;
+  return readRaw(block, offset, count, dst);
+}
+//------------------------------------------------------------------------------
+/** Read one data block in a multiple block read sequence */
+uint8_t SdImageFile::readData(uint8_t* dst) {
+  if (inSequence_ != SEQ_READ) return false;
+  return readRaw(block_++, 0, 512, dst);
+}
+//------------------------------------------------------------------------------
+// read from the image and add the transfer time of one block
+uint8_t SdImageFile::readRaw(uint32_t block, uint16_t offset,
+        uint16_t count, uint8_t* dst) {
+  if (block >= blocks_) return false;
+  if (fseek(file_, 512L * block + offset, SEEK_SET)) return false;
+  if (fread(dst, 1, count, file_) != count) return false;
+  blocksRead_++;
+  elapsed_ += timing_.transfer;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Start a read multiple blocks sequence.
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::readStart(uint32_t blockNumber) {
+  if (!command()) return false;
+  block_ = blockNumber;
+  inSequence_ = SEQ_READ;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * End a read multiple blocks sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::readStop(void) {
+  if (inSequence_ != SEQ_READ) return false;
+  inSequence_ = SEQ_NONE;
+  return command();
+}
+//------------------------------------------------------------------------------
+/**
+ * Write a 512 byte block.  Block zero is protected as it is by Sd2Card.
+ *
+ * \param[in] blockNumber Logical block to be written.
+ * \param[in] src Pointer to the location of the data to be written.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::writeBlock(uint32_t blockNumber, const uint8_t* src) {
+  if (blockNumber == 0) return false;
+  if (!command()) return false;
+  if (!writeRaw(blockNumber, src)) return false;
+  elapsed_ += timing_.program;
+  return true;
+}
+//------------------------------------------------------------------------------
+/** Write one data block in a multiple block write sequence */
+uint8_t SdImageFile::writeData(const uint8_t* src) {
+  if (inSequence_ != SEQ_WRITE) return false;
+  if (!writeRaw(block_++, src)) return false;
+  elapsed_ += timing_.programMultiple;
+  return true;
+}
+//------------------------------------------------------------------------------
+// write to the image and add the transfer time of one block
+uint8_t SdImageFile::writeRaw(uint32_t block, const uint8_t* src) {
+  if (block >= blocks_) return false;
+  if (fseek(file_, 512L * block, SEEK_SET)) return false;
+  if (fwrite(src, 1, 512, file_) != 512) return false;
+  blocksWritten_++;
+  elapsed_ += timing_.transfer;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Start a write multiple blocks sequence.
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ * \param[in] eraseCount The number of blocks to be pre-erased, one if
+ * zero.  The pre-erase command is counted, it does not change the time
+ * model.  Pre-erased blocks left unwritten by writeStop() are erased.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
+  if (blockNumber == 0) return false;
+  if (!command() || !command()) return false;
+  block_ = blockNumber;
+  eraseEnd_ = blockNumber + (eraseCount ? eraseCount : 1);
+  inSequence_ = SEQ_WRITE;
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * End a write multiple blocks sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdImageFile::writeStop(void) {
+  if (inSequence_ != SEQ_WRITE) return false;
+  inSequence_ = SEQ_NONE;
+  for (; block_ < eraseEnd_; block_++) {
+    if (!eraseRaw(block_)) return false;
+  }
+  return fflush(file_) == 0;
+}
+#endif  // !defined(__AVR__)
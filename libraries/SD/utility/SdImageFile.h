@@ -0,0 +1,112 @@
+/* Arduino SdFat Library
+ *
+ * This file is part of the Arduino SdFat Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino SdFat Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SdImageFile_h
+#define SdImageFile_h
+/**
+ * \file
+ * SdImageFile class
+ */
+#include <stdint.h>
+#include <stdio.h>
+//------------------------------------------------------------------------------
+/**
+ * \struct sdtiming_t
+ * \brief Time model of a card, in microseconds.
+ */
+struct sdtiming_t {
+  /** command sent to response or first data token */
+  uint32_t command;
+  /** one 512 byte block and its CRC over the bus */
+  uint32_t transfer;
+  /** busy time after a single block write */
+  uint32_t program;
+  /** busy time after each block of a multiple block write */
+  uint32_t programMultiple;
+};
+/**
+ * Default time model.  Roughly a class 4 card on a 16 MHz AVR
+ * with SCK at F_CPU/2.
+ */
+sdtiming_t const SD_IMAGE_TIMING = {100, 650, 1500, 400};
+//------------------------------------------------------------------------------
+/**
+ * \class SdImageFile
+ * \brief Block device for host builds that uses a FAT image file.
+ *
+ * SdImageFile has the block read and write functions of Sd2Card that
+ * SdVolume and SdFile use.  It takes the place of Sd2Card when the
+ * library is not built for AVR so that the FAT layer can be measured
+ * and checked on a PC.
+ *
+ * No time is spent waiting.  The time a card would take is added up
+ * with the model given to setTiming() and returned by elapsed(), so
+ * runs can be compared exactly.
+ *
+ * Pre-erased blocks of a multiple block write that are not written
+ * before writeStop() read as erased, 0XFF, afterwards.  A card leaves
+ * them undefined.
+ */
+class SdImageFile {
+ public:
+  /** Construct an instance of SdImageFile. */
+  SdImageFile(void) : file_(0), blocks_(0), inSequence_(0),
+    timing_(SD_IMAGE_TIMING) {clearStats();}
+  uint8_t begin(const char* path);
+  /** \return The number of 512 byte blocks in the image. */
+  uint32_t cardSize(void) const {return blocks_;}
+  /** \return The number of blocks read since clearStats(). */
+  uint32_t blocksRead(void) const {return blocksRead_;}
+  /** \return The number of blocks written since clearStats(). */
+  uint32_t blocksWritten(void) const {return blocksWritten_;}
+  void clearStats(void);
+  /** \return The number of commands since clearStats(). */
+  uint32_t commands(void) const {return commands_;}
+  /** \return Modeled card time in microseconds since clearStats(). */
+  uint64_t elapsed(void) const {return elapsed_;}
+  void end(void);
+  uint8_t readBlock(uint32_t block, uint8_t* dst);
+  uint8_t readData(uint32_t block,
+          uint16_t offset, uint16_t count, uint8_t* dst);
+  uint8_t readData(uint8_t* dst);
+  uint8_t readStart(uint32_t blockNumber);
+  uint8_t readStop(void);
+  /** Set the time model used by elapsed(). */
+  void setTiming(const sdtiming_t& timing) {timing_ = timing;}
+  uint8_t writeBlock(uint32_t blockNumber, const uint8_t* src);
+  uint8_t writeData(const uint8_t* src);
+  uint8_t writeStart(uint32_t blockNumber, uint32_t eraseCount);
+  uint8_t writeStop(void);
+ private:
+  FILE* file_;
+  uint32_t blocks_;
+  uint32_t block_;
+  uint32_t eraseEnd_;
+  uint8_t inSequence_;
+  sdtiming_t timing_;
+  uint32_t blocksRead_;
+  uint32_t blocksWritten_;
+  uint32_t commands_;
+  uint64_t elapsed_;
+  uint8_t command(void);
+  uint8_t eraseRaw(uint32_t block);
+  uint8_t readRaw(uint32_t block, uint16_t offset,
+          uint16_t count, uint8_t* dst);
+  uint8_t writeRaw(uint32_t block, const uint8_t* src);
+};
+#endif  // SdImageFile_h
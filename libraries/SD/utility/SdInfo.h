@@ -40,10 +40,14 @@ uint8_t const CMD8 = 0X08;
 uint8_t const CMD9 = 0X09;
 /** SEND_CID - read the card identification information (CID register) */
 uint8_t const CMD10 = 0X0A;
+/** STOP_TRANSMISSION - end multiple block read sequence */
+uint8_t const CMD12 = 0X0C;
 /** SEND_STATUS - read the card status register */
 uint8_t const CMD13 = 0X0D;
 /** READ_BLOCK - read a single data block from the card */
 uint8_t const CMD17 = 0X11;
+/** READ_MULTIPLE_BLOCK - read blocks of data until a STOP_TRANSMISSION */
+uint8_t const CMD18 = 0X12;
 /** WRITE_BLOCK - write a single data block to the card */
 uint8_t const CMD24 = 0X18;
 /** WRITE_MULTIPLE_BLOCK - write blocks of data until a STOP_TRANSMISSION */
@@ -59,6 +63,8 @@ uint8_t const CMD38 = 0X26;
 uint8_t const CMD55 = 0X37;
 /** READ_OCR - read the OCR register of a card */
 uint8_t const CMD58 = 0X3A;
+/** CRC_ON_OFF - turn CRC checking of commands and data on or off */
+uint8_t const CMD59 = 0X3B;
 /** SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
      pre-erased before writing */
 uint8_t const ACMD23 = 0X17;
@@ -20,11 +20,14 @@
 #include <SdFat.h>
 //------------------------------------------------------------------------------
 // raw block cache
-// init cacheBlockNumber_to invalid SD block number
-uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
-Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
+cache_t  SdVolume::cacheBlocks_[SD_CACHE_BLOCKS];  // cache for the device
+cache_t* SdVolume::cacheBuffer_ = SdVolume::cacheBlocks_;  // last block used
+// cacheBlockNumber_ set to invalid SD block number by init()
+uint32_t SdVolume::cacheBlockNumber_[SD_CACHE_BLOCKS];
+uint8_t  SdVolume::cacheAge_[SD_CACHE_BLOCKS];  // set by init()
+uint8_t  SdVolume::cacheCurrent_ = 0;  // slot of cacheBuffer_
+SdBlockDevice* SdVolume::sdCard_;    // pointer to block device
+uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write slots set
 uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
@@ -55,6 +58,14 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // last cluster of FAT
   uint32_t fatEnd = clusterCount_ + 1;
 
+#if SD_FREE_MAP_BYTES
+  // last cluster in a freeMap_ region has these bits set
+  uint32_t regionMask = (1UL << freeMapShift_) - 1;
+
+  // true if all clusters from the start of the region are in use
+  uint8_t regionFull = false;
+#endif  // SD_FREE_MAP_BYTES
+
   // search the FAT for free clusters
   for (uint32_t n = 0;; n++, endCluster++) {
     // can't find space checked all clusters
@@ -64,6 +75,18 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
     if (endCluster > fatEnd) {
       bgnCluster = endCluster = 2;
     }
+#if SD_FREE_MAP_BYTES
+    if (freeMapFull(endCluster)) {
+      // skip to the end of a region with no free cluster
+      uint32_t last = endCluster | regionMask;
+      if (last > fatEnd) last = fatEnd;
+      n += last - endCluster;
+      endCluster = last;
+      bgnCluster = last + 1;
+      continue;
+    }
+    if ((endCluster & regionMask) == 0 || endCluster == 2) regionFull = true;
+#endif  // SD_FREE_MAP_BYTES
     uint32_t f;
     if (!fatGet(endCluster, &f)) return false;
 
@@ -74,6 +97,19 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
       // done - found space
       break;
     }
+#if SD_FREE_MAP_BYTES
+    if (f == 0) regionFull = false;
+
+    // remember region if all of it was checked and is in use
+    if (regionFull &&
+      ((endCluster & regionMask) == regionMask || endCluster == fatEnd)) {
+      freeMapMark(endCluster, true);
+    }
+#endif  // SD_FREE_MAP_BYTES
+  }
+  // remember possible next free cluster, also when a file grows from it
+  if (setStart || bgnCluster == allocSearchStart_) {
+    allocSearchStart_ = endCluster + 1;
   }
   // mark end of chain
   if (!fatPutEOC(endCluster)) return false;
@@ -90,49 +126,130 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // return first cluster number to caller
   *curCluster = bgnCluster;
 
-  // remember possible next free cluster
-  if (setStart) allocSearchStart_ = bgnCluster + 1;
+  // update FSINFO hints
+  if (freeClusterCount_ != 0XFFFFFFFF) freeClusterCount_ -= count;
+  fsInfoDirty_ = fsInfoBlock_ != 0;
 
   return true;
 }
 //------------------------------------------------------------------------------
-uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
-      return false;
+// cache a FAT block in the FAT slot
+uint8_t SdVolume::cacheFatBlock(uint32_t blockNumber) {
+  uint8_t slot = cacheFind(blockNumber);
+  if (slot != CACHE_FAT_SLOT) {
+    // move block to the FAT slot if cached as data
+    if (slot != SD_CACHE_BLOCKS) {
+      if (!cacheFlushSlot(slot)) return false;
+      cacheBlockNumber_[slot] = 0XFFFFFFFF;
     }
+    if (!cacheLoad(CACHE_FAT_SLOT, blockNumber, true)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// return slot for blockNumber or SD_CACHE_BLOCKS if not in cache
+uint8_t SdVolume::cacheFind(uint32_t blockNumber) {
+  uint8_t i;
+  for (i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (cacheBlockNumber_[i] == blockNumber) break;
+  }
+  return i;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheFlush(void) {
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (!cacheFlushSlot(i)) return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+uint8_t SdVolume::cacheFlushSlot(uint8_t slot) {
+  if (cacheDirty_ & (1 << slot)) {
+    uint8_t* data = cacheBlocks_[slot].data;
+    if (!sdCard_->writeBlock(cacheBlockNumber_[slot], data)) return false;
+
     // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
+    if (slot == CACHE_FAT_SLOT && cacheMirrorBlock_) {
+      if (!sdCard_->writeBlock(cacheMirrorBlock_, data)) {
         return false;
       }
       cacheMirrorBlock_ = 0;
     }
-    cacheDirty_ = 0;
+    cacheDirty_ &= ~(1 << slot);
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+// drop blockNumber from the cache without writing it
+void SdVolume::cacheInvalidate(uint32_t blockNumber) {
+  uint8_t slot = cacheFind(blockNumber);
+  if (slot != SD_CACHE_BLOCKS) {
+    cacheBlockNumber_[slot] = 0XFFFFFFFF;
+    cacheDirty_ &= ~(1 << slot);
+  }
+}
+//------------------------------------------------------------------------------
+// write back the block in slot and replace it by blockNumber
+uint8_t SdVolume::cacheLoad(uint8_t slot, uint32_t blockNumber, uint8_t read) {
+  if (!cacheFlushSlot(slot)) return false;
+  cacheBlockNumber_[slot] = 0XFFFFFFFF;
+  if (read && !sdCard_->readBlock(blockNumber, cacheBlocks_[slot].data)) {
+    return false;
   }
+  cacheBlockNumber_[slot] = blockNumber;
+  return true;
+}
+//------------------------------------------------------------------------------
+// cache a block that will be overwritten - don't read it
+uint8_t SdVolume::cacheNewBlock(uint32_t blockNumber) {
+  uint8_t slot = cacheFind(blockNumber);
+  if (slot == SD_CACHE_BLOCKS) {
+    slot = cacheVictim();
+    if (!cacheLoad(slot, blockNumber, false)) return false;
+  }
+  cacheUse(slot);
+  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
 uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
+  uint8_t slot = cacheFind(blockNumber);
+  if (slot == SD_CACHE_BLOCKS) {
+    slot = cacheVictim();
+    if (!cacheLoad(slot, blockNumber, true)) return false;
   }
-  cacheDirty_ |= action;
+  cacheUse(slot);
+  if (action == CACHE_FOR_WRITE) cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
+// make slot the most recently used and the current cache block
+void SdVolume::cacheUse(uint8_t slot) {
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if (cacheAge_[i] < cacheAge_[slot]) cacheAge_[i]++;
+  }
+  cacheAge_[slot] = 0;
+  cacheCurrent_ = slot;
+  cacheBuffer_ = &cacheBlocks_[slot];
+}
+//------------------------------------------------------------------------------
+// return the least recently used data slot
+uint8_t SdVolume::cacheVictim(void) {
+  uint8_t slot = CACHE_DATA_SLOT;
+  for (uint8_t i = CACHE_DATA_SLOT + 1; i < SD_CACHE_BLOCKS; i++) {
+    if (cacheAge_[i] > cacheAge_[slot]) slot = i;
+  }
+  return slot;
+}
+//------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
+  if (!cacheNewBlock(blockNumber)) return false;
 
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  // loop take less flash than memset(cacheBuffer_->data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+    cacheBuffer_->data[i] = 0;
   }
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
@@ -152,13 +269,14 @@ uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
+  if (lba != cacheBlockNumber_[CACHE_FAT_SLOT]) {
+    if (!cacheFatBlock(lba)) return false;
   }
+  cache_t* fat = &cacheBlocks_[CACHE_FAT_SLOT];
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = fat->fat16[cluster & 0XFF];
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    *value = fat->fat32[cluster & 0X7F] & FAT32MASK;
   }
   return true;
 }
@@ -175,16 +293,17 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
+  if (lba != cacheBlockNumber_[CACHE_FAT_SLOT]) {
+    if (!cacheFatBlock(lba)) return false;
   }
   // store entry
+  cache_t* fat = &cacheBlocks_[CACHE_FAT_SLOT];
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    fat->fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    fat->fat32[cluster & 0X7F] = value;
   }
-  cacheSetDirty();
+  cacheDirty_ |= 1 << CACHE_FAT_SLOT;
 
   // mirror second FAT
   if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
@@ -193,9 +312,6 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
 //------------------------------------------------------------------------------
 // free a cluster chain
 uint8_t SdVolume::freeChain(uint32_t cluster) {
-  // clear free cluster location
-  allocSearchStart_ = 2;
-
   do {
     uint32_t next;
     if (!fatGet(cluster, &next)) return false;
@@ -203,16 +319,35 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
     // free cluster
     if (!fatPut(cluster, 0)) return false;
 
+    // start next search at first free cluster
+    if (cluster < allocSearchStart_) allocSearchStart_ = cluster;
+#if SD_FREE_MAP_BYTES
+    freeMapMark(cluster, false);
+#endif  // SD_FREE_MAP_BYTES
+    if (freeClusterCount_ != 0XFFFFFFFF) freeClusterCount_++;
+
     cluster = next;
   } while (!isEOC(cluster));
 
+  fsInfoDirty_ = fsInfoBlock_ != 0;
+  return true;
+}
+//------------------------------------------------------------------------------
+// write free cluster count and next free cluster hints to FAT32 FSINFO
+uint8_t SdVolume::fsInfoSync(void) {
+  if (!fsInfoDirty_) return true;
+  if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_WRITE)) return false;
+  fsinfo_t* fsi = &cacheBuffer_->fsinfo;
+  fsi->freeCount = freeClusterCount_;
+  fsi->nextFree = allocSearchStart_;
+  fsInfoDirty_ = false;
   return true;
 }
 //------------------------------------------------------------------------------
 /**
  * Initialize a FAT volume.
  *
- * \param[in] dev The SD card where the volume is located.
+ * \param[in] dev The block device where the volume is located.
  *
  * \param[in] part The partition to be used.  Legal values for \a part are
  * 1-4 to use the corresponding partition on a device formatted with
@@ -224,15 +359,22 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
  * failure include not finding a valid partition, not finding a valid
  * FAT file system in the specified partition or an I/O error.
  */
-uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
+uint8_t SdVolume::init(SdBlockDevice* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
+
+  // write back and empty the cache
+  if (!cacheFlush()) return false;
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    cacheBlockNumber_[i] = 0XFFFFFFFF;
+    cacheAge_[i] = i;
+  }
   sdCard_ = dev;
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheBuffer_->mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -242,7 +384,7 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     volumeStartBlock = p->firstSector;
   }
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  bpb_t* bpb = &cacheBuffer_->fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
@@ -282,6 +424,10 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   // divide by cluster size to get cluster count
   clusterCount_ >>= clusterSizeShift_;
 
+  // FSINFO block for FAT32, zero for FAT16
+  fsInfoBlock_ = bpb->fat32FSInfo;
+  if (fsInfoBlock_) fsInfoBlock_ += volumeStartBlock;
+
   // FAT type is determined by cluster count
   if (clusterCount_ < 4085) {
     fatType_ = 12;
@@ -291,5 +437,76 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     rootDirStart_ = bpb->fat32RootCluster;
     fatType_ = 32;
   }
+  allocSearchStart_ = 2;
+  freeClusterCount_ = 0XFFFFFFFF;
+  fsInfoDirty_ = false;
+  if (fatType_ != 32) fsInfoBlock_ = 0;
+
+#if SD_FREE_MAP_BYTES
+  // no region known to be full
+  freeMapShift_ = 0;
+  while (((clusterCount_ + 1) >> freeMapShift_) >= 8UL * SD_FREE_MAP_BYTES) {
+    freeMapShift_++;
+  }
+  for (uint8_t i = 0; i < SD_FREE_MAP_BYTES; i++) freeMap_[i] = 0;
+#endif  // SD_FREE_MAP_BYTES
+
+  // use FSINFO hints if valid
+  if (fsInfoBlock_) {
+    if (!cacheRawBlock(fsInfoBlock_, CACHE_FOR_READ)) return false;
+    fsinfo_t* fsi = &cacheBuffer_->fsinfo;
+    if (fsi->leadSignature != FSINFO_LEAD_SIG ||
+      fsi->structSignature != FSINFO_STRUCT_SIG) {
+      fsInfoBlock_ = 0;
+    } else {
+      if (fsi->freeCount <= clusterCount_) {
+        freeClusterCount_ = fsi->freeCount;
+      }
+      if (fsi->nextFree >= 2 && fsi->nextFree <= (clusterCount_ + 1)) {
+        allocSearchStart_ = fsi->nextFree;
+      }
+    }
+  }
   return true;
 }
+//------------------------------------------------------------------------------
+// read a run of contiguous blocks with a single multiple block command
+uint8_t SdVolume::readBlocks(uint32_t block, uint8_t* dst, uint16_t count) {
+  // card copy of a dirty cached block is stale
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if ((cacheBlockNumber_[i] - block) < count) {
+      if (!cacheFlushSlot(i)) return false;
+    }
+  }
+  if (!sdCard_->readStart(block)) return false;
+  for (uint16_t i = 0; i < count; i++, dst += 512) {
+    if (!sdCard_->readData(dst)) {
+      // end the multiple block command so the card accepts the next one
+      sdCard_->readStop();
+      return false;
+    }
+  }
+  return sdCard_->readStop();
+}
+//------------------------------------------------------------------------------
+// write a run of contiguous blocks with a single pre-erased multiple
+// block command
+uint8_t SdVolume::writeBlocks(uint32_t block,
+  const uint8_t* src, uint16_t count) {
+  // invalidate cached blocks of the run
+  for (uint8_t i = 0; i < SD_CACHE_BLOCKS; i++) {
+    if ((cacheBlockNumber_[i] - block) < count) {
+      cacheBlockNumber_[i] = 0XFFFFFFFF;
+      cacheDirty_ &= ~(1 << i);
+    }
+  }
+  if (!sdCard_->writeStart(block, count)) return false;
+  for (uint16_t i = 0; i < count; i++, src += 512) {
+    if (!sdCard_->writeData(src)) {
+      // end the multiple block command so the card accepts the next one
+      sdCard_->writeStop();
+      return false;
+    }
+  }
+  return sdCard_->writeStop();
+}
@@ -0,0 +1,307 @@
+/**
+ * adcsampler.cpp
+ *
+ * Shared ADC service
+ */
+
+#include "adcsampler.h"
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+
+/**
+ * ADC conversion complete
+ */
+ISR(ADC_vect)
+{
+  adc.handleInterrupt();
+}
+
+/**
+ * ADCSAMPLER
+ *
+ * Class constructor
+ */
+ADCSAMPLER::ADCSAMPLER(void)
+{
+  running = false;
+  vcc = 0;
+  callback = NULL;
+  rawHandler = NULL;
+}
+
+/**
+ * select
+ *
+ * Select ADC channel with AVcc as reference
+ *
+ * 'chan'  ADC channel
+ */
+void ADCSAMPLER::select(uint8_t chan)
+{
+  // ADC may have been switched off before sleeping
+  ADCSRA |= _BV(ADEN);
+
+  // analogRead() and others write ADMUX too, so check the live value
+  if (ADMUX == (_BV(REFS0) | chan))
+    return;
+
+  ADMUX = _BV(REFS0) | chan;
+
+  // Wait for the bandgap reference to settle
+  if (chan == ADC_CHANNEL_BANDGAP)
+    delayMicroseconds(ADC_BANDGAP_SETTLE_US);
+}
+
+/**
+ * arm
+ *
+ * Prepare a new oversampled conversion
+ */
+void ADCSAMPLER::arm(uint8_t chan, uint8_t extraBits, void (*func)(unsigned int))
+{
+  if (extraBits > ADC_MAX_EXTRA_BITS)
+    extraBits = ADC_MAX_EXTRA_BITS;
+
+  select(chan);
+  bits = extraBits;
+  target = 1 << (2 * extraBits);
+  count = 0;
+  sum = 0;
+  callback = func;
+  running = true;
+}
+
+/**
+ * sample
+ *
+ * Take an oversampled conversion on an ADC channel and wait for the
+ * result
+ *
+ * 'chan'       ADC channel (0-7 or ADC_CHANNEL_BANDGAP)
+ * 'extraBits'  Extra resolution bits
+ *
+ * Return:
+ *  Reading with 10 + extraBits bits
+ */
+unsigned int ADCSAMPLER::sample(uint8_t chan, uint8_t extraBits)
+{
+  bool irqOn = SREG & _BV(SREG_I);
+
+  // Let a free-running conversion finish. It can't without interrupts
+  if (irqOn)
+    while (running);
+  else
+    stop();
+
+  arm(chan, extraBits, NULL);
+  ADCSRA &= ~_BV(ADATE);
+
+  if (irqOn)
+  {
+    // Each sleep starts a new conversion unless one is still running
+    ADCSRA |= _BV(ADIE);
+    set_sleep_mode(SLEEP_MODE_ADC);
+    while (running)
+    {
+      cli();
+      if (running)
+      {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+      }
+      sei();
+    }
+  }
+  else
+  {
+    ADCSRA &= ~_BV(ADIE);
+    while (count < target)
+    {
+      ADCSRA |= _BV(ADSC);
+      loop_until_bit_is_clear(ADCSRA, ADSC);
+      sum += ADCW;
+      count++;
+    }
+    running = false;
+  }
+
+  return sum >> bits;
+}
+
+/**
+ * read
+ *
+ * Same as sample but taking an Arduino analog pin (A0 or 0)
+ */
+unsigned int ADCSAMPLER::read(uint8_t pin, uint8_t extraBits)
+{
+  if (pin >= A0)
+    pin -= A0;
+
+  return sample(pin & 0x07, extraBits);
+}
+
+/**
+ * start
+ *
+ * Start a free-running oversampled conversion and return. The result
+ * is passed to 'func' from the ADC interrupt
+ *
+ * 'pin'        Arduino analog pin
+ * 'extraBits'  Extra resolution bits
+ * 'func'       Completion callback
+ *
+ * Return:
+ *  false if another conversion is in progress
+ */
+bool ADCSAMPLER::start(uint8_t pin, uint8_t extraBits, void (*func)(unsigned int result))
+{
+  if (running)
+    return false;
+
+  if (pin >= A0)
+    pin -= A0;
+
+  arm(pin & 0x07, extraBits, func);
+
+  // Free-running mode
+  ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+  ADCSRA |= _BV(ADATE) | _BV(ADIE) | _BV(ADSC);
+
+  return true;
+}
+
+/**
+ * stop
+ *
+ * Abort the conversion in progress
+ */
+void ADCSAMPLER::stop(void)
+{
+  ADCSRA &= ~_BV(ADATE);
+  running = false;
+}
+
+/**
+ * readVcc
+ *
+ * Measure Vcc against the 1.1V bandgap and cache it
+ *
+ * 'extraBits'  Extra resolution bits
+ *
+ * Return:
+ *  Vcc in mV
+ */
+unsigned int ADCSAMPLER::readVcc(uint8_t extraBits)
+{
+  unsigned long raw;
+
+  if (extraBits > ADC_MAX_EXTRA_BITS)
+    extraBits = ADC_MAX_EXTRA_BITS;
+
+  raw = sample(ADC_CHANNEL_BANDGAP, extraBits);
+  if (raw == 0)
+    return vcc;
+
+  // Back-calculate AVcc in mV: 1100 mV * 1024 * 2^extraBits / reading
+  vcc = (1126400UL << extraBits) / raw;
+
+  return vcc;
+}
+
+/**
+ * getVcc
+ *
+ * Return cached Vcc in mV, measuring it the first time
+ */
+unsigned int ADCSAMPLER::getVcc(void)
+{
+  if (vcc == 0)
+    return readVcc();
+
+  return vcc;
+}
+
+/**
+ * readMillivolts
+ *
+ * Read voltage on analog pin, scaled with the cached Vcc
+ *
+ * 'pin'        Arduino analog pin
+ * 'extraBits'  Extra resolution bits
+ *
+ * Return:
+ *  Voltage in mV
+ */
+unsigned int ADCSAMPLER::readMillivolts(uint8_t pin, uint8_t extraBits)
+{
+  unsigned long ref = getVcc();
+
+  if (extraBits > ADC_MAX_EXTRA_BITS)
+    extraBits = ADC_MAX_EXTRA_BITS;
+
+  return (read(pin, extraBits) * ref) >> (10 + extraBits);
+}
+
+/**
+ * attachInterrupt
+ *
+ * Pass every raw conversion result to 'func' from the ADC interrupt
+ *
+ * 'func'  Conversion handler
+ */
+void ADCSAMPLER::attachInterrupt(void (*func)(unsigned int value))
+{
+  rawHandler = func;
+}
+
+/**
+ * detachInterrupt
+ *
+ * Back to oversampled conversions
+ */
+void ADCSAMPLER::detachInterrupt(void)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+  rawHandler = NULL;
+  SREG = oldSREG;
+}
+
+/**
+ * handleInterrupt
+ *
+ * ADC conversion complete. Called from ADC_vect
+ */
+void ADCSAMPLER::handleInterrupt(void)
+{
+  unsigned int value = ADCW;
+
+  if (rawHandler != NULL)
+  {
+    rawHandler(value);
+    return;
+  }
+
+  // Trailing free-running conversion after completion
+  if (!running)
+    return;
+
+  sum += value;
+  if (++count < target)
+    return;
+
+  ADCSRA &= ~_BV(ADATE);
+  running = false;
+  if (callback != NULL)
+    callback(sum >> bits);
+}
+
+/**
+ * Pre-instantiate ADCSAMPLER object
+ */
+ADCSAMPLER adc;
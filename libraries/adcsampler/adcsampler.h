@@ -0,0 +1,228 @@
+/**
+ * adcsampler.h
+ *
+ * Shared ADC service: oversampled conversions taken either in ADC noise
+ * reduction sleep (blocking) or free-running from the ADC interrupt
+ * (non-blocking, result passed to a callback), plus a cached Vcc
+ * measurement against the internal 1.1V bandgap.
+ *
+ * Oversampling by 4^n samples and decimating by 2^n adds n bits of
+ * resolution: read(pin, 2) returns a 12-bit value.
+ *
+ * All conversions use AVcc as reference, as analogRead() does by default.
+ */
+
+#ifndef _ADCSAMPLER_H
+#define _ADCSAMPLER_H
+
+#include "Arduino.h"
+
+/**
+ * Internal 1.1V bandgap channel
+ */
+#define ADC_CHANNEL_BANDGAP      0x0E
+
+/**
+ * Bandgap reference settling time after being selected (us)
+ */
+#define ADC_BANDGAP_SETTLE_US    2000
+
+/**
+ * Default extra bits for Vcc and millivolt readings
+ */
+#define ADC_VCC_BITS             2
+
+/**
+ * Max extra bits (4^6 = 4096 samples)
+ */
+#define ADC_MAX_EXTRA_BITS       6
+
+/**
+ * Class: ADCSAMPLER
+ *
+ * Description:
+ * ADC conversion engine
+ */
+class ADCSAMPLER
+{
+  private:
+    /**
+     * Accumulated samples
+     */
+    volatile unsigned long sum;
+
+    /**
+     * Samples taken / samples wanted
+     */
+    volatile unsigned int count;
+    unsigned int target;
+
+    /**
+     * Extra resolution bits of the current conversion
+     */
+    uint8_t bits;
+
+    /**
+     * True while a conversion is in progress
+     */
+    volatile bool running;
+
+    /**
+     * Cached Vcc in mV. 0 if never measured
+     */
+    unsigned int vcc;
+
+    /**
+     * Completion callback of the current conversion
+     */
+    void (*callback)(unsigned int result);
+
+    /**
+     * Raw conversion handler. Overrides sample accumulation when set
+     */
+    void (*rawHandler)(unsigned int value);
+
+    /**
+     * select
+     *
+     * Select ADC channel with AVcc as reference
+     *
+     * 'chan'  ADC channel
+     */
+    void select(uint8_t chan);
+
+    /**
+     * arm
+     *
+     * Prepare a new oversampled conversion
+     */
+    void arm(uint8_t chan, uint8_t extraBits, void (*func)(unsigned int));
+
+  public:
+    /**
+     * ADCSAMPLER
+     *
+     * Class constructor
+     */
+    ADCSAMPLER(void);
+
+    /**
+     * sample
+     *
+     * Take an oversampled conversion on an ADC channel and wait for the
+     * result. The MCU sleeps in ADC noise reduction mode during each
+     * conversion (clkIO, hence Timer0 and millis(), are halted meanwhile).
+     * Conversions are polled when called with interrupts disabled
+     *
+     * 'chan'       ADC channel (0-7 or ADC_CHANNEL_BANDGAP)
+     * 'extraBits'  Extra resolution bits
+     *
+     * Return:
+     *  Reading with 10 + extraBits bits
+     */
+    unsigned int sample(uint8_t chan, uint8_t extraBits=0);
+
+    /**
+     * read
+     *
+     * Same as sample but taking an Arduino analog pin (A0 or 0)
+     */
+    unsigned int read(uint8_t pin, uint8_t extraBits=0);
+
+    /**
+     * start
+     *
+     * Start a free-running oversampled conversion and return. The result
+     * is passed to 'func' from the ADC interrupt
+     *
+     * 'pin'        Arduino analog pin
+     * 'extraBits'  Extra resolution bits
+     * 'func'       Completion callback
+     *
+     * Return:
+     *  false if another conversion is in progress
+     */
+    bool start(uint8_t pin, uint8_t extraBits, void (*func)(unsigned int result));
+
+    /**
+     * stop
+     *
+     * Abort the conversion in progress
+     */
+    void stop(void);
+
+    /**
+     * busy
+     *
+     * Return true while a conversion is in progress
+     */
+    inline bool busy(void)
+    {
+      return running;
+    }
+
+    /**
+     * readVcc
+     *
+     * Measure Vcc against the 1.1V bandgap and cache it
+     *
+     * 'extraBits'  Extra resolution bits
+     *
+     * Return:
+     *  Vcc in mV
+     */
+    unsigned int readVcc(uint8_t extraBits=ADC_VCC_BITS);
+
+    /**
+     * getVcc
+     *
+     * Return cached Vcc in mV, measuring it the first time
+     */
+    unsigned int getVcc(void);
+
+    /**
+     * readMillivolts
+     *
+     * Read voltage on analog pin, scaled with the cached Vcc
+     *
+     * 'pin'        Arduino analog pin
+     * 'extraBits'  Extra resolution bits
+     *
+     * Return:
+     *  Voltage in mV
+     */
+    unsigned int readMillivolts(uint8_t pin, uint8_t extraBits=ADC_VCC_BITS);
+
+    /**
+     * attachInterrupt
+     *
+     * Pass every raw conversion result to 'func' from the ADC interrupt.
+     * Lets custom sampling engines own the ADC. sample(), start() and
+     * the Vcc functions can't be used until detachInterrupt() is called
+     *
+     * 'func'  Conversion handler
+     */
+    void attachInterrupt(void (*func)(unsigned int value));
+
+    /**
+     * detachInterrupt
+     *
+     * Back to oversampled conversions
+     */
+    void detachInterrupt(void);
+
+    /**
+     * handleInterrupt
+     *
+     * ADC conversion complete. Called from ADC_vect
+     */
+    void handleInterrupt(void);
+};
+
+/**
+ * Global ADCSAMPLER object
+ */
+extern ADCSAMPLER adc;
+
+#endif
+
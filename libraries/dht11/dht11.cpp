@@ -1,7 +1,7 @@
 //
 //    FILE: dht11.cpp
-// VERSION: 0.4.1
-// PURPOSE: DHT11 Temperature & Humidity Sensor library for Arduino
+// VERSION: 0.5.0
+// PURPOSE: DHT11 / DHT22 Temperature & Humidity Sensor library for Arduino
 // LICENSE: GPL v3 (http://www.gnu.org/licenses/gpl.html)
 //
 // DATASHEET: http://www.micro4you.com/files/sensor/DHT11.pdf
@@ -17,73 +17,209 @@
 // + added 1.0 support
 // Mod by Rob Tillaart - Version 0.4.1 (19/05/2012)
 // + added error codes
+// Version 0.5.0
+// + interrupt-timed edge capture, no busy loops
+// + non-blocking start()/update() with completion callback
+// + DHT22 support
+// + frames with edge periods out of the sensor timing are rejected
 //
 
 #include "dht11.h"
+#include <avr/interrupt.h>
+
+// Conversion owning the pin change interrupt
+static dht11 *active = NULL;
+
+dht11::dht11(uint8_t type)
+{
+        this->type = type;
+        state = IDLE;
+        callback = NULL;
+        humidity = temperature = 0;
+        humidity10 = temperature10 = 0;
+}
 
 // Return values:
 // DHTLIB_OK
 // DHTLIB_ERROR_CHECKSUM
 // DHTLIB_ERROR_TIMEOUT
+// DHTLIB_BUSY
+// DHTLIB_ERROR_PIN
+// DHTLIB_ERROR_TIMING
 int dht11::read(int pin)
 {
-        // BUFFER TO RECEIVE
-        uint8_t bits[5];
-        uint8_t cnt = 7;
-        uint8_t idx = 0;
+        int status;
+
+        // Timing relies on millis() and the pin change interrupt
+        if (!(SREG & _BV(SREG_I))) return DHTLIB_ERROR_TIMEOUT;
+
+        if ((status = start(pin)) != DHTLIB_OK) return status;
+
+        while ((status = update()) == DHTLIB_BUSY)
+                ;
+        return status;
+}
+
+// Pull the line low for the start pulse and return. update() releases
+// the line and starts capturing once the pulse is long enough
+int dht11::start(int pin, void (*callback)(int status))
+{
+        if (active != NULL && active->busy()) return DHTLIB_BUSY;
+        if (digitalPinToPCICR(pin) == NULL) return DHTLIB_ERROR_PIN;
+
+        this->pin = pin;
+        this->callback = callback;
+        pinReg = portInputRegister(digitalPinToPort(pin));
+        pinMask = digitalPinToBitMask(pin);
 
         // EMPTY BUFFER
-        for (int i=0; i< 5; i++) bits[i] = 0;
+        for (uint8_t i=0; i< 5; i++) bits[i] = 0;
+        edges = 0;
+        timingError = false;
+        active = this;
 
         // REQUEST SAMPLE
         pinMode(pin, OUTPUT);
         digitalWrite(pin, LOW);
-        delay(18);
-        digitalWrite(pin, HIGH);
-        delayMicroseconds(40);
-        pinMode(pin, INPUT);
-
-        // ACKNOWLEDGE or TIMEOUT
-        unsigned int loopCnt = 10000;
-        while(digitalRead(pin) == LOW)
-                if (loopCnt-- == 0) return DHTLIB_ERROR_TIMEOUT;
-
-        loopCnt = 10000;
-        while(digitalRead(pin) == HIGH)
-                if (loopCnt-- == 0) return DHTLIB_ERROR_TIMEOUT;
-
-        // READ OUTPUT - 40 BITS => 5 BYTES or TIMEOUT
-        for (int i=0; i<40; i++)
+        startTime = millis();
+        state = START;
+
+        return DHTLIB_OK;
+}
+
+int dht11::update(void)
+{
+        switch (state)
         {
-                loopCnt = 10000;
-                while(digitalRead(pin) == LOW)
-                        if (loopCnt-- == 0) return DHTLIB_ERROR_TIMEOUT;
-
-                unsigned long t = micros();
-
-                loopCnt = 10000;
-                while(digitalRead(pin) == HIGH)
-                        if (loopCnt-- == 0) return DHTLIB_ERROR_TIMEOUT;
-
-                if ((micros() - t) > 40) bits[idx] |= (1 << cnt);
-                if (cnt == 0)   // next byte?
-                {
-                        cnt = 7;    // restart at MSB
-                        idx++;      // next byte!
-                }
-                else cnt--;
+        case START:
+                // millis() may tick right after startTime was taken
+                if (millis() - startTime > (type == DHT22_TYPE ? DHT22_START_MS : DHT11_START_MS))
+                        release();
+                return DHTLIB_BUSY;
+        case CAPTURE:
+                if (edges >= DHT_FRAME_EDGES) return finish(decode());
+                if (millis() - startTime > DHT_CONVERSION_MS) return finish(DHTLIB_ERROR_TIMEOUT);
+                return DHTLIB_BUSY;
+        default:
+                return DHTLIB_OK;
         }
+}
+
+// Release the line (input + pull-up) and arm the pin change interrupt
+void dht11::release(void)
+{
+        uint8_t port = digitalPinToPort(pin);
+        uint8_t oldSREG = SREG;
+
+        cli();
+        *portModeRegister(port) &= ~pinMask;
+        *portOutputRegister(port) |= pinMask;
+        edges = 0;
+        timingError = false;
+        lastEdge = micros();
+        startTime = millis();
+        PCIFR = _BV(digitalPinToPCICRbit(pin));
+        *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+        *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+        state = CAPTURE;
+        SREG = oldSREG;
+}
+
+int dht11::finish(int status)
+{
+        uint8_t oldSREG = SREG;
+
+        cli();
+        *digitalPinToPCMSK(pin) &= ~_BV(digitalPinToPCMSKbit(pin));
+        state = IDLE;
+        active = NULL;
+        SREG = oldSREG;
+
+        if (callback != NULL) callback(status);
+        return status;
+}
 
-        // WRITE TO RIGHT VARS
-        // as bits[1] and bits[3] are allways zero they are omitted in formulas.
-        humidity    = bits[0];
-        temperature = bits[2];
+// Falling edge 0 starts the sensor response, edge 1 the first bit and
+// edge n (n >= 2) closes bit n - 2. The period of a bit tells its value
+void dht11::capture(unsigned long t)
+{
+        unsigned long dt = t - lastEdge;
+        uint8_t n = edges;
+
+        lastEdge = t;
+        if (n >= DHT_FRAME_EDGES) return;
+        edges = n + 1;
 
-        uint8_t sum = bits[0] + bits[2];  
+        if (n == 0)
+        {
+                if (dt > DHT_RESPONSE_MAX_US) timingError = true;
+                return;
+        }
+        if (n == 1)
+        {
+                if (dt < DHT_PREAMBLE_MIN_US || dt > DHT_PREAMBLE_MAX_US) timingError = true;
+                return;
+        }
+        n -= 2;
+        if (dt >= DHT_BIT1_MIN_US && dt <= DHT_BIT1_MAX_US) bits[n >> 3] |= (0x80 >> (n & 7));
+        else if (dt < DHT_BIT0_MIN_US || dt > DHT_BIT0_MAX_US) timingError = true;
+}
 
+int dht11::decode(void)
+{
+        uint8_t sum = bits[0] + bits[1] + bits[2] + bits[3];
+
+        if (timingError) return DHTLIB_ERROR_TIMING;
         if (bits[4] != sum) return DHTLIB_ERROR_CHECKSUM;
+
+        if (type == DHT22_TYPE)
+        {
+                humidity10 = word(bits[0], bits[1]);
+                temperature10 = word(bits[2] & 0x7F, bits[3]);
+                if (bits[2] & 0x80) temperature10 = -temperature10;
+                humidity = humidity10 / 10;
+                temperature = temperature10 / 10;
+        }
+        else
+        {
+                // DHT11: integral parts only, decimal bytes are always zero
+                humidity = bits[0];
+                temperature = bits[2];
+                humidity10 = humidity * 10;
+                temperature10 = temperature * 10;
+        }
         return DHTLIB_OK;
 }
+
+void dht11::pinChange(void)
+{
+        dht11 *dht = active;
+
+        // Falling edges only
+        if (dht == NULL || dht->state != CAPTURE) return;
+        if (*dht->pinReg & dht->pinMask) return;
+        dht->capture(micros());
+}
+
+// Default pin change handlers. Weak so that sketches can own the vectors
+#if defined(PCINT0_vect)
+ISR(PCINT0_vect, __attribute__((weak)))
+{
+        dht11::pinChange();
+}
+#endif
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect, __attribute__((weak)))
+{
+        dht11::pinChange();
+}
+#endif
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect, __attribute__((weak)))
+{
+        dht11::pinChange();
+}
+#endif
 //
 // END OF FILE
-//
\ No newline at end of file
+//
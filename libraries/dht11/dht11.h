@@ -1,7 +1,7 @@
 //
 //    FILE: dht11.h
-// VERSION: 0.4.1
-// PURPOSE: DHT11 Temperature & Humidity Sensor library for Arduino
+// VERSION: 0.5.0
+// PURPOSE: DHT11 / DHT22 Temperature & Humidity Sensor library for Arduino
 // LICENSE: GPL v3 (http://www.gnu.org/licenses/gpl.html)
 //
 // DATASHEET: http://www.micro4you.com/files/sensor/DHT11.pdf
@@ -22,18 +22,98 @@
 #include <WProgram.h>
 #endif
 
-#define DHT11LIB_VERSION "0.4.1"
+#define DHT11LIB_VERSION "0.5.0"
 
 #define DHTLIB_OK                0
 #define DHTLIB_ERROR_CHECKSUM   -1
 #define DHTLIB_ERROR_TIMEOUT    -2
+#define DHTLIB_BUSY             -3
+#define DHTLIB_ERROR_PIN        -4
+#define DHTLIB_ERROR_TIMING     -5
 
+// Sensor types
+#define DHT11_TYPE              11
+#define DHT22_TYPE              22
+
+// Host start pulse (ms)
+#define DHT11_START_MS          18
+#define DHT22_START_MS          2
+// Longest conversion once the line is released (ms)
+#define DHT_CONVERSION_MS       10
+// Falling edges in a frame: response + 40 bits + end of frame
+#define DHT_FRAME_EDGES         42
+// Accepted falling-to-falling edge periods (us). A missed, extra or late
+// edge shows up as a period outside these windows and fails the frame
+// instead of shifting the bits that follow
+#define DHT_RESPONSE_MAX_US     300     // Line release to response (20-200)
+#define DHT_PREAMBLE_MIN_US     120     // Response low + high (~160)
+#define DHT_PREAMBLE_MAX_US     200
+#define DHT_BIT0_MIN_US         60      // 0: 50 low + 26-28 high
+#define DHT_BIT0_MAX_US         95
+#define DHT_BIT1_MIN_US         105     // 1: 50 low + 70 high
+#define DHT_BIT1_MAX_US         140
+
+//
+// Edges are timestamped from the pin-change interrupt of the data pin, so
+// the read does not depend on loop timing and never blocks with interrupts
+// disabled. The library provides weak PCINT0..2 handlers; a sketch that
+// defines its own handler for the same vector must call
+// dht11::pinChange() from it.
+//
+// Non-blocking use:
+//   sensor.start(pin, callback);   // returns at once
+//   loop(): sensor.update();       // callback(status) once done
+//
 class dht11
 {
 public:
+    dht11(uint8_t type = DHT11_TYPE);
+
+    // Blocking read, kept for compatibility. Needs interrupts enabled
     int read(int pin);
-        int humidity;
-        int temperature;
+
+    // Start a conversion. Returns DHTLIB_OK or DHTLIB_BUSY
+    int start(int pin, void (*callback)(int status) = NULL);
+    // Drive the conversion from the main loop. Returns DHTLIB_BUSY while
+    // running, then the final status (also passed to the callback)
+    int update(void);
+    bool busy(void) { return state != IDLE; }
+
+    // Feed one falling edge timestamp (us). Called from interrupt context
+    void capture(unsigned long t);
+    // Check and convert a complete frame. Returns the read status
+    int decode(void);
+
+    // Pin change handler for the active conversion
+    static void pinChange(void);
+
+    // Whole units
+    int humidity;
+    int temperature;
+    // Tenths of a unit (full DHT22 resolution)
+    int humidity10;
+    int temperature10;
+
+    // Raw 40-bit frame
+    uint8_t bits[5];
+
+private:
+    enum { IDLE, START, CAPTURE };
+
+    uint8_t type;
+    volatile uint8_t state;
+    volatile uint8_t edges;
+    volatile bool timingError;
+    volatile unsigned long lastEdge;
+    unsigned long startTime;
+    void (*callback)(int status);
+
+    uint8_t pin;
+    volatile uint8_t *pinReg;
+    uint8_t pinMask;
+
+    void release(void);
+    int finish(int status);
 };
 #endif
 //
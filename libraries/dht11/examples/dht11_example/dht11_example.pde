@@ -83,6 +83,9 @@ void loop()
     case DHTLIB_ERROR_TIMEOUT:
                 Serial.println("Time out error");
                 break;
+    case DHTLIB_ERROR_TIMING:
+                Serial.println("Timing error");
+                break;
     default:
                 Serial.println("Unknown error");
                 break;
@@ -295,8 +295,8 @@ void CC1101::setSyncWord(uint8_t syncH, uint8_t syncL, bool save)
     // Save in EEPROM
     if (save)
     {
-      EEPROM.write(EEPROM_SYNC_WORD, syncH);
-      EEPROM.write(EEPROM_SYNC_WORD + 1, syncL);
+      EEPROM.writeAsync(EEPROM_SYNC_WORD, syncH);
+      EEPROM.writeAsync(EEPROM_SYNC_WORD + 1, syncL);
     }
   }
 }
@@ -330,7 +330,7 @@ void CC1101::setDevAddress(byte addr, bool save)
     devAddress = addr;
     // Save in EEPROM
     if (save)
-      EEPROM.write(EEPROM_DEVICE_ADDR, addr);  
+      EEPROM.writeAsync(EEPROM_DEVICE_ADDR, addr);  
   }
 }
 
@@ -350,7 +350,7 @@ void CC1101::setChannel(byte chnl, bool save)
     channel = chnl;
     // Save in EEPROM
     if (save)
-      EEPROM.write(EEPROM_FREQ_CHANNEL, chnl);
+      EEPROM.writeAsync(EEPROM_FREQ_CHANNEL, chnl);
   }
 }
 
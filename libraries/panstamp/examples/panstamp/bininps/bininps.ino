@@ -36,45 +36,62 @@
  * This sketch can be used to detect key/switch presses, binary alarms or
  * any other binary sensor. It can also be used to count pulses from a vaste
  * variety of devices such as energy meters, water meters, gas meters, etc.
- * You may want to add some delays in updateValues in order to better debounce
- * the binary states. We suggest to add external capacitors to the inputs as well.
- * Capacitor values and delays should depend on the nature and frequence of the
- * input signals.
+ * Edges are debounced and counted from the pin change interrupts. Debounce
+ * times can be adjusted with DEBOUNCE_BINARY_US and DEBOUNCE_COUNTER_US. We
+ * suggest to add external capacitors to the inputs as well. Capacitor values
+ * and debounce times should depend on the nature and frequence of the input
+ * signals.
  *
- * This device is low-power enabled so it will enter low-power mode just
- * after reading the binary states and transmitting them over the SWAP
- * network.
+ * This device is low-power enabled. It stays in power-down mode until an
+ * input changes or the periodic Tx interval elapses. The radio is only
+ * woken up when there is something to transmit. The time from wake-up to
+ * the end of the last transmission is available from REGI_WAKE_LATENCY.
+ *
+ * Counter changes can be reported in two modes, selected from the
+ * REGI_REPORT_CONFIG register:
+ * - Full: REGI_COUNTERS (16 bytes) is sent on every change
+ * - Delta: REGI_COUNTER_DELTA is sent with the changed counters only, as
+ *   varint deltas against the last report acknowledged through
+ *   REGI_COUNTER_ACK. Every Nth report is a full snapshot. Changes are
+ *   coalesced during a configurable window before reporting
  *
  * Associated Device Definition File, defining registers, endpoints and
  * configuration parameters:
  * bininps.xml (Binary/Counter input module)
  */
  
+#include <avr/sleep.h>
+#include <EEPROM.h>
 #include "regtable.h"
 #include "panstamp.h"
+#include "swstatus.h"
+#include "pinchange.h"
 
 /**
- * Interrupt masks
+ * Debounce times (us)
  */
-#define PCINTMASK0    0x03  // PB[0:1]
-#define PCINTMASK1    0x3F  // PC[0:5]
-#define PCINTMASK2    0xE8  // PD[3], PD[5:7]. These are counter inputs too
+#define DEBOUNCE_BINARY_US    10000
+#define DEBOUNCE_COUNTER_US   1000
 
 /**
- * Macros
+ * LED pin
  */
-#define pcEnableInterrupt()     PCICR = 0x07    // Enable Pin Change interrupts on all ports
-#define pcDisableInterrupt()    PCICR = 0x00    // Disable Pin Change interrupts
+#define LEDPIN               4
 
 /**
- * LED pin
+ * Pin change ports able to wake the MCU up
  */
-#define LEDPIN               4
+#define WAKE_PCINT_PORTS  (_BV(PCIE0) | _BV(PCIE1) | _BV(PCIE2))
+
+/**
+ * Time listening for REGI_COUNTER_ACK after a delta report (ms)
+ */
+#define ACK_LISTEN_MS     50
 
 /**
- * Pin Change Interrupt flag
+ * Microseconds from wake-up to the end of the last transmission
  */
-volatile boolean pcIRQ = false;
+unsigned long wakeLatency = 0;
 
 /**
  * Binary states
@@ -84,35 +101,83 @@ byte stateLowByte = 0, stateHighByte = 0;
 /**
  * Pure Binary inputs
  */
-uint8_t binaryPin[] = {0, 1, 0, 1, 2, 3, 4, 5};                                              // Binary pins (Atmega port bits)
-volatile uint8_t *binaryPort[] = {&PINB, &PINB, &PINC, &PINC, &PINC, &PINC, &PINC, &PINC};   // Binary ports (Atmega port)
-int lastStateBinary[] = {-1, -1, -1, -1, -1, -1, -1, -1};                                    // Initial pin states
+uint8_t binaryPin[] = {8, 9, 14, 15, 16, 17, 18, 19};   // Binary pins (Arduino digital pins): PB[0:1], PC[0:5]
 
 /**
  * Counters
  */
-uint8_t counterPin[] = {3, 5, 6, 7};                                // Counter pins (Atmega port bits)
-volatile uint8_t *counterPort[] = {&PIND, &PIND, &PIND, &PIND};     // Counter ports (Atmega port)
-unsigned long counter[] = {0, 0, 0, 0};                             // Initial counter values
-int lastStateCount[] = {-1, -1, -1, -1};                            // Initial pin states
+uint8_t counterPin[] = {3, 5, 6, 7};                    // Counter pins (Arduino digital pins): PD[3], PD[5:7]
+unsigned long counter[] = {0, 0, 0, 0};                 // Initial counter values
+#define COUNTER_INPUT0  sizeof(binaryPin)               // Input index of the first counter
+#define NB_OF_COUNTERS  sizeof(counterPin)
+
+/**
+ * Counter reporting modes
+ */
+#define REPORT_MODE_FULL      0    // Send REGI_COUNTERS on every change
+#define REPORT_MODE_DELTA     1    // Send REGI_COUNTER_DELTA
+
+/**
+ * Default reporting config
+ */
+#define DEFAULT_COALESCE_MS   0
+#define DEFAULT_SNAPSHOT_PERIOD  16
+
+/**
+ * Delta report: seq, base seq, flags and one varint per counter
+ */
+#define DELTA_HEADER_LEN      3
+#define DELTA_FLAG_SNAPSHOT   0x80  // Values are absolute and become the base
+
+/**
+ * EEPROM address of the reporting config
+ */
+#define EEPROM_REPORT_CONFIG  EEPROM_FIRST_CUSTOM
+
+/**
+ * Reporting config
+ */
+byte reportMode = REPORT_MODE_FULL;
+unsigned int coalesceWindow = DEFAULT_COALESCE_MS;    // ms
+byte snapshotPeriod = DEFAULT_SNAPSHOT_PERIOD;        // Reports between snapshots
+
+/**
+ * Delta reporting state. The base is also updated from setCounterAck
+ */
+byte reportSeq = 0;                     // Seq of the last delta report
+byte baseSeq = 0;                       // Seq of the report the deltas refer to
+byte reportsToSnapshot = 0;             // Reports left before the next snapshot
+unsigned long baseValue[] = {0, 0, 0, 0};   // Values known by the receiver
+unsigned long sentValue[] = {0, 0, 0, 0};   // Values in the last report
+
+/**
+ * pcEvent
+ *
+ * Process pin changes on a port and leave the sleep loop. The radio is
+ * woken up later from loop, only if there is something to send
+ *
+ * 'port'  Port index
+ */
+void pcEvent(uint8_t port)
+{
+  pinChange.handle(port);
+  panstamp.signalEvent();
+}
 
 /**
  * Pin Change Interrupt vectors
  */
 SIGNAL(PCINT0_vect)
 {
-  panstamp.wakeUp();
-  pcIRQ = true;
+  pcEvent(PINCHANGE_PORTB);
 }
 SIGNAL(PCINT1_vect)
 {
-  panstamp.wakeUp();
-  pcIRQ = true;
+  pcEvent(PINCHANGE_PORTC);
 }
 SIGNAL(PCINT2_vect)
 {
-  panstamp.wakeUp();
-  pcIRQ = true;
+  pcEvent(PINCHANGE_PORTD);
 }
 
 /**
@@ -128,41 +193,176 @@ SIGNAL(PCINT2_vect)
 byte updateValues(void)
 {
   byte i, res = 0;
-  int state;
+  byte lowByte = 0, highByte = 0;
+  unsigned int edges;
+
+  // Any input changed since the last call?
+  if (pinChange.changed())
+    res = 1;
 
-  stateLowByte = 0;
+  // Debounced states
   for(i=0 ; i<sizeof(binaryPin) ; i++)
+    lowByte |= pinChange.read(i) << i;
+
+  for(i=0 ; i<sizeof(counterPin) ; i++)
+    highByte |= pinChange.read(COUNTER_INPUT0 + i) << i;
+
+  if (lowByte != stateLowByte || highByte != stateHighByte)
+    res = 1;
+  stateLowByte = lowByte;
+  stateHighByte = highByte;
+
+  // Rising edges counted from the interrupts
+  edges = pinChange.update();
+  for(i=0 ; i<sizeof(counterPin) ; i++)
   {
-    state = bitRead(*binaryPort[i], binaryPin[i]);
-    stateLowByte |= state << i;
-    if (lastStateBinary[i] != state)
+    if (edges & (1 << (COUNTER_INPUT0 + i)))
     {
-      lastStateBinary[i] = state;
-      res = 1;
+      counter[i] = pinChange.count(COUNTER_INPUT0 + i);
+      res = 2;
     }
   }
 
-  stateHighByte = 0;
-  for(i=0 ; i<sizeof(counterPin) ; i++)
+  return res;
+}
+
+/**
+ * putVarint
+ *
+ * Write unsigned LEB128 varint: 7 bits per byte, LSB first, MSB set on
+ * all bytes but the last one
+ *
+ * 'buf'    Destination
+ * 'value'  Value to be written
+ *
+ * Return:
+ *  Number of bytes written
+ */
+byte putVarint(byte *buf, unsigned long value)
+{
+  byte len = 0;
+
+  while (value >= 0x80)
+  {
+    buf[len++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  buf[len++] = value;
+
+  return len;
+}
+
+/**
+ * sendCounterDelta
+ *
+ * Send changed counters as deltas against the last acknowledged values,
+ * or a full snapshot every snapshotPeriod reports
+ */
+void sendCounterDelta(void)
+{
+  byte i, len = DELTA_HEADER_LEN, flags = 0;
+  bool snapshot;
+  unsigned long value;
+  uint8_t oldSREG;
+
+  snapshot = (reportsToSnapshot == 0);
+
+  // The base may be changed by an ACK from the radio interrupt
+  oldSREG = SREG;
+  cli();
+  for(i=0 ; i<NB_OF_COUNTERS ; i++)
   {
-    state = bitRead(*counterPort[i], counterPin[i]);
-    stateHighByte |= state << i;
-    if (lastStateCount[i] != state)
+    value = snapshot ? counter[i] : counter[i] - baseValue[i];
+    if (snapshot || value > 0)
     {
-      if (res == 0)
-        res = 1;
-        
-      lastStateCount[i] = state;
-    
-      if (state == HIGH)
-      {
-        counter[i]++;
-        res = 2;
-      }
+      flags |= 1 << i;
+      len += putVarint(dtCounterDelta + len, value);
     }
   }
 
-  return res;
+  // No changes since the last ACK
+  if (flags == 0)
+  {
+    SREG = oldSREG;
+    return;
+  }
+
+  reportSeq++;
+  for(i=0 ; i<NB_OF_COUNTERS ; i++)
+    sentValue[i] = counter[i];
+
+  if (snapshot)
+  {
+    // Snapshots don't wait for an ACK
+    flags |= DELTA_FLAG_SNAPSHOT;
+    for(i=0 ; i<NB_OF_COUNTERS ; i++)
+      baseValue[i] = counter[i];
+    baseSeq = reportSeq;
+    reportsToSnapshot = snapshotPeriod;
+  }
+  else
+    reportsToSnapshot--;
+
+  dtCounterDelta[0] = reportSeq;
+  dtCounterDelta[1] = baseSeq;
+  dtCounterDelta[2] = flags;
+  SREG = oldSREG;
+
+  // Variable length status packet
+  SWSTATUS packet = SWSTATUS(REGI_COUNTER_DELTA, dtCounterDelta, len);
+  packet.send();
+}
+
+/**
+ * reportCounters
+ *
+ * Transmit counter values according to the reporting mode
+ */
+void reportCounters(void)
+{
+  if (reportMode == REPORT_MODE_DELTA)
+    sendCounterDelta();
+  else
+    getRegister(REGI_COUNTERS)->getData();
+}
+
+/**
+ * coalesce
+ *
+ * Stay idle during the coalescing window so that further changes, still
+ * counted from the interrupts, go in the same report
+ */
+void coalesce(void)
+{
+  unsigned long start = millis();
+
+  if (coalesceWindow == 0)
+    return;
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while ((unsigned long)(millis() - start) < coalesceWindow)
+    sleep_mode();
+}
+
+/**
+ * readReportConfig
+ *
+ * Read reporting config from EEPROM
+ */
+void readReportConfig(void)
+{
+  byte i, config[REPORT_CONFIG_LEN];
+  bool blank = true;
+
+  for(i=0 ; i<sizeof(config) ; i++)
+  {
+    config[i] = EEPROM.read(EEPROM_REPORT_CONFIG + i);
+    if (config[i] != 0xFF)
+      blank = false;
+  }
+
+  if (!blank)
+    getRegister(REGI_REPORT_CONFIG)->setData(config);
 }
 
 /**
@@ -177,15 +377,11 @@ void setup()
   pinMode(LEDPIN, OUTPUT);
   digitalWrite(LEDPIN, LOW);
 
-  // Set pins as inputs
-  DDRB &= ~PCINTMASK0;
-  DDRC &= ~PCINTMASK1;  
-  DDRD &= ~PCINTMASK2;
-
-  // Set PC interrupt masks
-  PCMSK0 = PCINTMASK0;
-  PCMSK1 = PCINTMASK1;
-  PCMSK2 = PCINTMASK2;
+  // Binary inputs first, then counters
+  for(i=0 ; i<(int)sizeof(binaryPin) ; i++)
+    pinChange.addInput(binaryPin[i], DEBOUNCE_BINARY_US);
+  for(i=0 ; i<(int)sizeof(counterPin) ; i++)
+    pinChange.addInput(counterPin[i], DEBOUNCE_COUNTER_US);
   
   // Init panStamp
   panstamp.init();
@@ -208,7 +404,13 @@ void setup()
   getRegister(REGI_TXINTERVAL)->getData();
   // Transmit power voltage
   getRegister(REGI_VOLTSUPPLY)->getData();
+  // Read and transmit reporting config
+  readReportConfig();
+  getRegister(REGI_REPORT_CONFIG)->getData();
   
+  // Enable Pin Change Interrupts
+  pinChange.begin();
+
   updateValues();
   // Transmit initial binary states
   getRegister(REGI_BININPUTS)->getData();
@@ -217,9 +419,6 @@ void setup()
   
   // Switch to Rx OFF state
   panstamp.enterSystemState(SYSTATE_RXOFF);
-
-  // Enable Pin Change Interrupts
-  pcEnableInterrupt();
 }
 
 /**
@@ -229,18 +428,30 @@ void setup()
  */
 void loop()
 {
-  // Sleep for panstamp.txInterval seconds (register 10)
-  panstamp.goToSleep();
+  byte res;
 
-  pcDisableInterrupt();
+  // micros() stops whilst powered down. Don't take the edge waking us up
+  // for a bounce
+  pinChange.sleep();
 
-  if (pcIRQ)
+  // Sleep until an input changes or for panstamp.txInterval seconds
+  // (register 10)
+  if (panstamp.sleepUntilEvent(WAKE_PCINT_PORTS) == WAKE_EVENT)
   {
-    switch(updateValues())
+    // Let further changes join this report
+    coalesce();
+
+    // Bounces only? Back to sleep without waking the radio up
+    if ((res = updateValues()) == 0)
+      return;
+
+    panstamp.wakeUp();
+
+    switch(res)
     {
       case 2:
         // Transmit counter values
-        getRegister(REGI_COUNTERS)->getData();
+        reportCounters();
       case 1:
         // Transmit binary states
         getRegister(REGI_BININPUTS)->getData();
@@ -248,17 +459,24 @@ void loop()
       default:
         break;
     }
-    //Ready to receive new PC interrupts
-    pcIRQ = false;
+    wakeLatency = micros() - panstamp.wakeTime;
+
+    // Give the server a chance to acknowledge the delta report
+    if (res == 2 && reportMode == REPORT_MODE_DELTA)
+    {
+      panstamp.cc1101.setRxState();
+      delay(ACK_LISTEN_MS);
+    }
   }
   else
   {    
     // Just send states and counter values periodically, according to the value
     // of panstamp.txInterval (register 10)
+    panstamp.wakeUp();
+    updateValues();
     getRegister(REGI_COUNTERS)->getData();
     getRegister(REGI_BININPUTS)->getData();
+    getRegister(REGI_WAKE_LATENCY)->getData();
   }
-
-  pcEnableInterrupt();
 }
 
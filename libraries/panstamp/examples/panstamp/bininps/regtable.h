@@ -37,8 +37,20 @@
 DEFINE_REGINDEX_START()
   REGI_VOLTSUPPLY,
   REGI_BININPUTS,
-  REGI_COUNTERS
+  REGI_COUNTERS,
+  REGI_COUNTER_DELTA,
+  REGI_COUNTER_ACK,
+  REGI_REPORT_CONFIG,
+  REGI_WAKE_LATENCY
 DEFINE_REGINDEX_END()
 
+/**
+ * Register buffers also accessed from the main sketch
+ */
+#define DELTA_REPORT_MAXLEN   23    // 3-byte header + 4 varints of up to 5 bytes
+#define REPORT_CONFIG_LEN     4
+extern byte dtCounterDelta[DELTA_REPORT_MAXLEN];
+extern byte dtReportConfig[REPORT_CONFIG_LEN];
+
 #endif
 
@@ -27,6 +27,7 @@
 #include <EEPROM.h>
 #include "product.h"
 #include "panstamp.h"
+#include "adcsampler.h"
 #include "regtable.h"
 
 /**
@@ -51,6 +52,18 @@ REGISTER regBinInputs(dtBinInputs, sizeof(dtBinInputs), &updtBinInputs, NULL);
 // 4-byte counter registers (4 regs)
 byte dtCounters[16];    // Pulse counters
 REGISTER regCounters(dtCounters, sizeof(dtCounters), &updtCounters, NULL);
+// Counter delta report. Sent with its actual length by sendCounterDelta
+byte dtCounterDelta[DELTA_REPORT_MAXLEN];
+REGISTER regCounterDelta(dtCounterDelta, sizeof(dtCounterDelta), NULL, NULL);
+// Seq of the last delta report received by the server
+byte dtCounterAck[1];
+REGISTER regCounterAck(dtCounterAck, sizeof(dtCounterAck), NULL, &setCounterAck);
+// Reporting mode, coalescing window (ms) and reports between snapshots
+byte dtReportConfig[REPORT_CONFIG_LEN];
+REGISTER regReportConfig(dtReportConfig, sizeof(dtReportConfig), NULL, &setReportConfig);
+// Wake-to-transmit latency of the last event (us)
+static byte dtWakeLatency[4];
+REGISTER regWakeLatency(dtWakeLatency, sizeof(dtWakeLatency), &updtWakeLatency, NULL);
 
 /**
  * Initialize table of registers
@@ -58,7 +71,11 @@ REGISTER regCounters(dtCounters, sizeof(dtCounters), &updtCounters, NULL);
 DECLARE_REGISTERS_START()
   &regVoltSupply,
   &regBinInputs,
-  &regCounters
+  &regCounters,
+  &regCounterDelta,
+  &regCounterAck,
+  &regReportConfig,
+  &regWakeLatency
 DECLARE_REGISTERS_END()
 
 /**
@@ -81,14 +98,8 @@ const void updtVoltSupply(byte rId)
 {
   unsigned short result;
   
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
 
   /**
    * register[eId]->member can be replaced by regVoltSupply in this case since
@@ -133,3 +144,70 @@ const void updtCounters(byte rId)
   }
 }
 
+/**
+ * updtWakeLatency
+ *
+ * Update wake-to-transmit latency register
+ *
+ * 'rId'  Register ID
+ */
+const void updtWakeLatency(byte rId)
+{
+  byte i;
+
+  for(i=0 ; i<sizeof(dtWakeLatency) ; i++)
+    dtWakeLatency[i] = (wakeLatency >> 8 * (3-i)) & 0xFF;
+}
+
+/**
+ * setCounterAck
+ *
+ * Delta report received by the server. Its values become the base for
+ * the next deltas
+ *
+ * 'rId'  Register ID
+ * 'ack'  Seq of the report received
+ */
+const void setCounterAck(byte rId, byte *ack)
+{
+  byte i;
+
+  dtCounterAck[0] = ack[0];
+
+  // Only the last report can be acknowledged
+  if (ack[0] != reportSeq || ack[0] == baseSeq)
+    return;
+
+  for(i=0 ; i<NB_OF_COUNTERS ; i++)
+    baseValue[i] = sentValue[i];
+  baseSeq = ack[0];
+}
+
+/**
+ * setReportConfig
+ *
+ * Set counter reporting config
+ *
+ * 'rId'     Register ID
+ * 'config'  Mode, coalescing window (ms, 2 bytes) and reports between
+ *           snapshots
+ */
+const void setReportConfig(byte rId, byte *config)
+{
+  byte i;
+
+  // Update register
+  memcpy(dtReportConfig, config, sizeof(dtReportConfig));
+
+  reportMode = config[0];
+  coalesceWindow = config[1];
+  coalesceWindow = (coalesceWindow << 8) | config[2];
+  snapshotPeriod = config[3];
+
+  // Start with a snapshot
+  reportsToSnapshot = 0;
+
+  // Save config settings in EEPROM
+  for(i=0 ; i<sizeof(dtReportConfig) ; i++)
+    EEPROM.writeAsync(EEPROM_REPORT_CONFIG + i, dtReportConfig[i]);
+}
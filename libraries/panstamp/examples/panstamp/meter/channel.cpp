@@ -26,6 +26,108 @@
 
 #include "channel.h"
 
+/**
+ * Channel table
+ */
+CHANNEL *CHANNEL::table[CHANNEL_MAX];
+byte CHANNEL::nbOfChannels = 0;
+
+/**
+ * Scanning state, only touched from the ADC interrupt once sampling starts
+ */
+static byte voltageChannel;          // ADC channel of the AC voltage signal
+static byte scanIndex;               // Channel whose current is being read
+static bool scanVoltage;             // True while converting the voltage
+static CHANNEL *pending;             // Current sample waiting for the next voltage sample
+static int pendingCurrent;
+static unsigned int lastVoltage;     // Last voltage sample (Q15)
+static unsigned int zeroCount;       // Consecutive zero voltage conversions
+static bool zcArmed;                 // Voltage was below CHANNEL_ZC_LOW
+static unsigned long zcLast;         // Time of the last zero-crossing (us)
+static volatile bool noVac = false;  // True while the VAC signal is missing
+static volatile bool vacLost = false;
+
+/**
+ * mulQ15
+ *
+ * Multiply Q15 value by a 32-bit factor without overflowing 32 bits
+ *
+ * 'q'  Q15 value (0 to 32768)
+ * 'k'  Factor
+ *
+ * Return:
+ *  q * k / 32768
+ */
+static unsigned long mulQ15(unsigned int q, unsigned long k)
+{
+  return (((unsigned long)q * (k >> 16)) << 1) + (((unsigned long)q * (k & 0xFFFF)) >> 15);
+}
+
+/**
+ * mulQ15s
+ *
+ * Signed version of mulQ15
+ */
+static long mulQ15s(long q, unsigned long k)
+{
+  if (q < 0)
+    return -(long)mulQ15(-q, k);
+
+  return mulQ15(q, k);
+}
+
+/**
+ * isqrt
+ *
+ * Integer square root, calculated digit by digit with shifts and
+ * subtractions only
+ *
+ * 'x'  Radicand
+ *
+ * Return:
+ *  floor(sqrt(x))
+ */
+static unsigned int isqrt(unsigned long x)
+{
+  unsigned long res = 0;
+  unsigned long bit = 1UL << 30;
+
+  while (bit > x)
+    bit >>= 2;
+
+  while (bit)
+  {
+    if (x >= res + bit)
+    {
+      x -= res + bit;
+      res = (res >> 1) + bit;
+    }
+    else
+      res >>= 1;
+    bit >>= 2;
+  }
+
+  return res;
+}
+
+/**
+ * rmsQ15
+ *
+ * RMS value of a Q15 signal from its mean square
+ *
+ * 'meanSq'  Mean square (Q15)
+ *
+ * Return:
+ *  RMS value (Q15)
+ */
+static unsigned int rmsQ15(long meanSq)
+{
+  if (meanSq <= 0)
+    return 0;
+
+  return isqrt((unsigned long)meanSq << 15);
+}
+
 /**
  * CHANNEL
  * 
@@ -43,191 +145,434 @@ CHANNEL::CHANNEL(void)
  * 'vcc'     Voltage supply
  * 'vPin'    Arduino analog pin connected to the AC voltage signal
  * 'iPin'    Arduino analog pin connected to the AC current signal
- * 'vScale'  Scaling factor for the voltage signal
- * 'iScale'  Scaling factor for the current signal
- * 'pShift'  Power factor offset (obtained during calibration)
+ * 'vScale'  Scaling factor for the voltage signal (1/100)
+ * 'iScale'  Scaling factor for the current signal (1/100)
+ * 'phase'   Phase correction (see setPhase)
  */
-CHANNEL::CHANNEL(unsigned int vcc, int vPin, int iPin, float vScale, float iScale, float pfShift)
+CHANNEL::CHANNEL(unsigned int vcc, int vPin, int iPin, unsigned int vScale, unsigned int iScale, char phase)
 {
   enable = true;
   frequency = 50;
   voltageSupply = vcc;
-  voltagePin = vPin;
-  currentPin = iPin;
-  voltageScale = vScale;
-  currentScale = iScale;
-  pfOffset = pfShift;
-  peakVoltage = 0;
-  peakCurrent = 0;
+  voltagePin = (vPin >= A0) ? vPin - A0 : vPin;
+  currentPin = (iPin >= A0) ? iPin - A0 : iPin;
+  rmsVoltage = 0;
+  rmsCurrent = 0;
+  appPower = 0;
+  actPower = 0;
+  powerFactor = 0;
   initialKwh = 0;
   kwh = 0;
+  energyRem = 0;
   lastTime = 0;
+  memset(&acc, 0, sizeof(acc));
+  winReady = false;
+  synced = false;
+
+  setScales(vScale, iScale);
+  setPhase(phase);
+
+  // Register channel in the sampling engine
+  if (nbOfChannels < CHANNEL_MAX)
+    table[nbOfChannels++] = this;
 }
 
 /**
- * update
+ * setScales
  * 
- * Update AC channel readings
+ * Set scaling factors and recalculate the fixed-point conversion factors
  *
- * Return:
- *    0 if the function still needs to take additional samples
- *    1 if the function read the necessary amount of samples
- *    2 if the function detected no VAC signal after reading the samples
+ * 'vScale'  Scaling factor for the voltage signal (1/100)
+ * 'iScale'  Scaling factor for the current signal (1/100)
  */
-byte CHANNEL::update(void) 
+void CHANNEL::setScales(unsigned int vScale, unsigned int iScale)
+{
+  voltageScale = vScale;
+  currentScale = iScale;
+
+  // Pin voltage at full scale is Vcc. AC voltage = (pin * 8.5 + offset) * vScale
+  kVolt = (uint64_t)voltageSupply * ACVOLT_SCALE_X10 * voltageScale / 10000;
+  // Rectifier offset referred to the pin, in Q15
+  offVolt = ((unsigned long)ACVOLT_OFFSET_DIODE << 15) / ((unsigned long)voltageSupply * ACVOLT_SCALE_X10 / 10);
+  // AC current = (pin - Vcc/2) * iScale. Q15 current full scale is Vcc/2
+  kCurrent = (unsigned long)voltageSupply * currentScale / 200;
+  // 1/100 V x mA = 1/10000 W
+  kPower = (uint64_t)kVolt * kCurrent / 10000;
+}
+
+/**
+ * setPhase
+ * 
+ * Set phase correction between the current transformer and the voltage
+ * signal
+ *
+ * 'shift'  Phase lead of the current signal in 1/128 of the interval
+ *          between voltage samples. 0 = no correction
+ */
+void CHANNEL::setPhase(char shift)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  phaseWeight = CHANNEL_PHASE_NONE + 2 * (int)shift;
+  SREG = oldSREG;
+}
+
+/**
+ * Cost of a current sample in the ADC interrupt, excluding the interrupt
+ * entry, the adcsampler dispatch and the channel scan, which are the same
+ * as with the old peak * 0.707 code. These are operation counts taken from
+ * the source. The cycles are hand estimates at 20 cycles per 16x16->32
+ * multiply (__mulhisi3), 8 per 32-bit shift by 15 and 20 per 32-bit add
+ * to a RAM accumulator. They are not measured.
+ *
+ *                          multiplies  32-bit adds  cycles (v > 0 / v = 0)
+ *   old, averaged voltage      1            2            104 / 10
+ *   new, interpolated          4            6            272 / 124
+ *
+ * Half of the samples fall on the rectified half-cycle, so a sample costs
+ * about 57 cycles before and 206 cycles now, including zero-crossing
+ * detection. Two conversions per sample leave 1664 cycles at 16 MHz and
+ * a prescaler of 64
+ */
+
+/**
+ * accumulate
+ *
+ * Add voltage/current sample pair. Called from the ADC interrupt
+ *
+ * 'v'  Voltage sample (Q15)
+ * 'i'  Current sample (Q15)
+ */
+void CHANNEL::accumulate(unsigned int v, int i)
+{
+  acc.sumI += i;
+  acc.sumI2 += ((long)i * i) >> 15;
+  acc.nbI++;
+
+  // Voltage only seen on the positive half-cycles through the rectifier
+  if (v > 0)
+  {
+    acc.sumV += v;
+    acc.sumV2 += ((long)(int)v * (int)v) >> 15;
+    acc.sumVI += ((long)(int)v * i) >> 15;
+    acc.sumIV += i;
+    acc.nbV++;
+  }
+
+  // No zero-crossings. Wait for the next one
+  if (acc.nbI == CHANNEL_MAX_SAMPLES)
+  {
+    memset(&acc, 0, sizeof(acc));
+    synced = false;
+  }
+}
+
+/**
+ * cycleEnd
+ *
+ * Zero-crossing detected. Called from the ADC interrupt
+ *
+ * 'now'  Time of the zero-crossing (us)
+ */
+void CHANNEL::cycleEnd(unsigned long now)
 {
-  unsigned long adcV1, adcV2, adcI;
-  float voltage, current;
-  static double accumulated;
-  static int i = 0;
-  const float peakToRMS = 0.707106781;       // Peak to RMS conversion factor
-  unsigned long currentTime, elapsedTime = 0;
-  double energy;
-  bool getEnergy = false;
-  const float scale = ACVOLT_SCALE;
-  static byte noVacCount = 0;
-  
-  //Read voltage and current
-  adcV1 = analogRead(voltagePin);    // First AC voltage reading
-  adcI = analogRead(currentPin);     // AC current reading
-  adcV2 = analogRead(voltagePin);    // Second AC current reading
-  adcV1 += adcV2;
-  adcV1 /= 2;                        // Average between both voltage readings. This should give us
-                                     // an approximate value of the voltage at the moment of reading
-                                     // the current value
-
-  // Discard 0 and negative voltages since we are working with a rectified voltage signal
-  if (adcV1 > 0)
+  if (synced)
   {
-    noVacCount = 0;                    // VAC signal detected
-    // Process AC voltage
-    adcV1 = adcV1 * voltageSupply;
-    adcV1 *= scale;
-    voltage = adcV1 / 1023;
-    voltage += ACVOLT_OFFSET_DIODE;    // Apply offset
-    voltage *= voltageScale;
-    voltage /= 1000;                   // convert to volts
-    //Process AC current
-    adcI = adcI * voltageSupply;
-    current = adcI / 1023;
-    current -= voltageSupply/2;        // Apply offset
-    current *= currentScale;
-    current /= 1000;                   // Convert to amps
-    // Update peak current
-    if (current > peakCurrent)
-      peakCurrent = current;
-
-    // Update peak voltage
-    if (voltage > peakVoltage)
-      peakVoltage = voltage;
-
-    // Prepare for active power calculation
-    accumulated += voltage * current;
-    i++;
-            
-    // When a given amount of samples is read
-    if (i == NB_OF_SAMPLES)
+    if (++acc.cycles < CHANNEL_WINDOW_CYCLES)
+      return;
+
+    // Window completed. Hand it over to update()
+    acc.duration = now - acc.start;
+    win = acc;
+    winReady = true;
+  }
+
+  // Start new window
+  memset(&acc, 0, sizeof(acc));
+  acc.start = now;
+  synced = true;
+}
+
+/**
+ * sampleIsr
+ *
+ * ADC conversion handler. Conversions alternate between the voltage pin
+ * and the current pin of the next enabled channel. Each current sample is
+ * paired with a voltage interpolated between the voltage samples taken
+ * before and after it
+ *
+ * 'value'  Raw ADC reading
+ */
+void CHANNEL::sampleIsr(unsigned int value)
+{
+  byte i;
+
+  if (scanVoltage)
+  {
+    unsigned int v = value << 5;
+
+    // Look for VAC losses
+    if (value > 0)
     {
-      // Read current time
-      currentTime = millis();
-      
-      if (lastTime > 0)
-      {
-        // Elapsed time between readings
-        elapsedTime = currentTime - lastTime;  
-        // Calculate KWh this time
-        getEnergy = true;
-      }
-      // Update last time
-      lastTime = currentTime;
-      // Active power (W)
-      if (accumulated < 0)
-        accumulated = 0;
-      actPower = accumulated / NB_OF_SAMPLES;
-      accumulated = 0;
-      // RMS voltage (V)
-      rmsVoltage = peakVoltage * peakToRMS;
-      peakVoltage = 0;
-      // RMS current (A)
-      rmsCurrent = peakCurrent * peakToRMS;
-      peakCurrent = 0;
-      // Apparent power (VA)
-      appPower = rmsVoltage * rmsCurrent;
-      // Power factor
-      powerFactor = actPower / appPower;
-      // Can't be greater than 1
-      if (powerFactor > 1.0)
+      zeroCount = 0;
+      noVac = false;
+    }
+    else if (zeroCount < CHANNEL_NOVAC_SAMPLES)
+    {
+      if (++zeroCount == CHANNEL_NOVAC_SAMPLES)
       {
-        powerFactor = 1;
-        actPower = appPower;
+        noVac = true;
+        vacLost = true;
       }
-      
-      i = 0;
+    }
+
+    if (pending != NULL)
+    {
+      // Voltage at the time of the current sample, with phase correction
+      long vi = (long)((int)v - (int)lastVoltage) * pending->phaseWeight;
+      vi = lastVoltage + (vi >> 8);
+      if (vi < 0)
+        vi = 0;
+      else if (vi > 0x7FFF)
+        vi = 0x7FFF;
+      pending->accumulate(vi, pendingCurrent);
+      pending = NULL;
+    }
+    lastVoltage = v;
+
+    // Rising edge of the rectified voltage closes AC cycles
+    if (value <= CHANNEL_ZC_LOW)
+      zcArmed = true;
+    else if (zcArmed && value >= CHANNEL_ZC_HIGH)
+    {
+      unsigned long now = micros();
 
-      // Power factor offset to be applied?
-      if (pfOffset > 0 && powerFactor < 1.0)
+      zcArmed = false;
+      if (now - zcLast >= CHANNEL_ZC_HOLDOFF)
       {
-        // Correct power factor
-        powerFactor += pfOffset;
-        if (powerFactor > 1)
-          powerFactor = 1;
-          
-        // Back calculate active power
-        actPower = appPower * powerFactor;
+        zcLast = now;
+        for(i=0 ; i<nbOfChannels ; i++)
+          table[i]->cycleEnd(now);
       }
+    }
 
-      // Energy consumed
-      if (getEnergy)
+    // Move to the next enabled channel. Keep on the voltage pin otherwise
+    for(i=0 ; i<nbOfChannels ; i++)
+    {
+      if (++scanIndex >= nbOfChannels)
+        scanIndex = 0;
+      if (table[scanIndex]->enable)
       {
-        energy = actPower * elapsedTime;
-        energy /= 3600000;      // Wh        
-        kwh += energy/1000.0;   // KWh
+        ADMUX = _BV(REFS0) | table[scanIndex]->currentPin;
+        scanVoltage = false;
+        break;
       }
-
-      return CHANNEL_SAMPLES_COMPLETED;    
     }
   }
   else
   {
-    if (++noVacCount > 16)
-      return CHANNEL_NO_VAC_SIGNAL;
+    pending = table[scanIndex];
+    pendingCurrent = ((int)value - 512) << 6;
+    ADMUX = _BV(REFS0) | voltageChannel;
+    scanVoltage = true;
   }
-  
-  return CHANNEL_SAMPLES_NOT_COMPLETED;
+
+  // Start next conversion
+  ADCSRA |= _BV(ADSC);
+}
+
+/**
+ * update
+ * 
+ * Process the last window of samples completed by the ADC interrupt
+ *
+ * Return:
+ *    0 if no new window is available
+ *    1 if new readings were calculated
+ *    2 if no VAC signal is detected
+ */
+byte CHANNEL::update(void) 
+{
+  ACCUM w;
+  long meanV, meanI, meanIV, sq, pw;
+  unsigned int rms;
+  unsigned long volts, amps, currentTime;
+  uint8_t oldSREG;
+
+  if (noVac)
+    return CHANNEL_NO_VAC_SIGNAL;
+
+  if (!winReady)
+    return CHANNEL_SAMPLES_NOT_COMPLETED;
+
+  // Take window
+  oldSREG = SREG;
+  cli();
+  w = win;
+  winReady = false;
+  SREG = oldSREG;
+
+  if (w.nbI == 0)
+    return CHANNEL_SAMPLES_NOT_COMPLETED;
+
+  // Line frequency
+  frequency = ((unsigned long)w.cycles * 1000000UL + w.duration / 2) / w.duration;
+
+  // DC offset of the current signal
+  meanI = w.sumI / (long)w.nbI;
+
+  // RMS current (mA)
+  sq = w.sumI2 / (long)w.nbI - ((meanI * meanI) >> 15);
+  amps = mulQ15(rmsQ15(sq), kCurrent);
+  rmsCurrent = (amps > 0xFFFF) ? 0xFFFF : amps;
+
+  if (w.nbV == 0)
+  {
+    rmsVoltage = 0;
+    actPower = 0;
+  }
+  else
+  {
+    // RMS voltage (1/100 V). The mean square over the positive half-cycles
+    // equals that over the whole cycle. Add rectifier offset: (v + o)^2
+    meanV = w.sumV / (long)w.nbV;
+    sq = w.sumV2 / (long)w.nbV + ((2 * (long)offVolt * meanV + (long)offVolt * offVolt) >> 15);
+    rms = rmsQ15(sq);
+    volts = mulQ15(rms, kVolt);
+    rmsVoltage = (volts > 0xFFFF) ? 0xFFFF : volts;
+
+    // Active power (1/10 W): mean of (v + o) * (i - DC)
+    meanIV = w.sumIV / (long)w.nbV;
+    pw = w.sumVI / (long)w.nbV + (((long)offVolt * meanIV) >> 15)
+         - (((meanV + offVolt) * meanI) >> 15);
+    pw = mulQ15s(pw, kPower);
+    actPower = (pw < 0) ? 0 : pw;
+  }
+
+  // Apparent power (1/10 VA)
+  appPower = (unsigned long)rmsVoltage * rmsCurrent / 10000;
+
+  // Power factor. Can't be greater than 1
+  if (appPower == 0)
+  {
+    powerFactor = 0;
+    actPower = 0;
+  }
+  else if (actPower >= appPower)
+  {
+    powerFactor = 100;
+    actPower = appPower;
+  }
+  else
+    powerFactor = actPower * 100 / appPower;
+
+  // Energy consumed
+  currentTime = millis();
+  if (lastTime > 0)
+  {
+    energyRem += actPower * (currentTime - lastTime);
+    while (energyRem >= ENERGY_UNIT_DWMS)
+    {
+      energyRem -= ENERGY_UNIT_DWMS;
+      kwh++;
+    }
+  }
+  lastTime = currentTime;
+
+  return CHANNEL_SAMPLES_COMPLETED;
 }
 
 /**
  * run
  * 
- * Run channel readings and calculations
+ * Run channel calculations and print the new readings
  *
  * Return:
  *   Code returned by update()
  */
 byte CHANNEL::run(void)
 {
-  byte res = CHANNEL_SAMPLES_NOT_COMPLETED;
-  // Read the necessary amount of samples and run calculations after that
-  while(res != CHANNEL_SAMPLES_COMPLETED)
+  byte res = update();
+
+  if (res == CHANNEL_SAMPLES_COMPLETED)
   {
-    res = update();    
-    
-    if (res == CHANNEL_NO_VAC_SIGNAL)
-      break;
+    Serial.print(rmsVoltage, DEC);
+    Serial.print(" ");
+    Serial.print(rmsCurrent, DEC);
+    Serial.print(" ");
+    Serial.print(appPower, DEC);
+    Serial.print(" ");
+    Serial.print(actPower, DEC);
+    Serial.print(" ");
+    Serial.print(powerFactor, DEC);
+    Serial.print(" ");
+    Serial.println(kwh, DEC);
   }
-  
-  Serial.print(rmsVoltage, DEC);
-  Serial.print(" ");
-  Serial.print(rmsCurrent, DEC);
-  Serial.print(" ");
-  Serial.print(appPower, DEC);
-  Serial.print(" ");
-  Serial.print(actPower, DEC);
-  Serial.print(" ");
-  Serial.print(powerFactor, DEC);
-  Serial.print(" ");
-  Serial.println(kwh, DEC);
-  
+
+  return res;
+}
+
+/**
+ * begin
+ * 
+ * Start sampling all channels from the ADC interrupt. The ADC can't be
+ * used for anything else until end() is called
+ */
+void CHANNEL::begin(void)
+{
+  uint8_t oldSREG;
+
+  if (nbOfChannels == 0)
+    return;
+
+  voltageChannel = table[0]->voltagePin;
+  scanIndex = nbOfChannels - 1;
+  scanVoltage = true;
+  pending = NULL;
+  zeroCount = 0;
+  zcArmed = false;
+  zcLast = micros() - CHANNEL_ZC_HOLDOFF;
+  noVac = false;
+
+  adc.attachInterrupt(sampleIsr);
+
+  oldSREG = SREG;
+  cli();
+  // Single conversions, each one started from the interrupt
+  ADMUX = _BV(REFS0) | voltageChannel;
+  ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADIE) | CHANNEL_ADC_PRESCALER;
+  ADCSRA |= _BV(ADSC);
+  SREG = oldSREG;
+}
+
+/**
+ * end
+ * 
+ * Stop sampling and release the ADC
+ */
+void CHANNEL::end(void)
+{
+  adc.detachInterrupt();
+  // Back to the default 128 prescaler
+  ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+/**
+ * powerFail
+ * 
+ * Return true once each time the VAC signal is lost
+ */
+bool CHANNEL::powerFail(void)
+{
+  bool res;
+  uint8_t oldSREG = SREG;
+
+  cli();
+  res = vacLost;
+  vacLost = false;
+  SREG = oldSREG;
+
   return res;
 }
 
@@ -28,11 +28,23 @@
 #define _CHANNEL_H
 
 #include "Arduino.h"
+#include "adcsampler.h"
 
 /**
  * Definition section
  */
-#define NB_OF_SAMPLES       80
+#define CHANNEL_WINDOW_CYCLES   5     // AC cycles per measurement window
+
+/**
+ * Samples per channel and window after which the window is discarded
+ * if no zero-crossing was seen
+ */
+#define CHANNEL_MAX_SAMPLES     4096
+
+/**
+ * Maximum number of channels handled by the sampling engine
+ */
+#define CHANNEL_MAX         7
 
 /**
  * Offset introduced in the AC voltage signal by the half-wave rectifier
@@ -41,9 +53,48 @@
 #define ACVOLT_OFFSET_DIODE 350
 
 /**
- * AC voltage scale due to the voltage divider
+ * AC voltage scale due to the voltage divider (x10)
+ */
+#define ACVOLT_SCALE_X10    85
+
+/**
+ * Consecutive zero voltage conversions before reporting a VAC loss.
+ * Each voltage conversion is followed by a current one, 52 us each, so
+ * about 107 ms whatever the number of channels
+ */
+#define CHANNEL_NOVAC_SAMPLES  1024
+
+/**
+ * Zero-crossing detection on the rectified voltage signal (ADC counts).
+ * A crossing is a rise above ZC_HIGH after having been below ZC_LOW
+ */
+#define CHANNEL_ZC_LOW      2
+#define CHANNEL_ZC_HIGH     8
+
+/**
+ * Minimum time between zero-crossings (us). Ignores crossings above 70 Hz
+ */
+#define CHANNEL_ZC_HOLDOFF  14285
+
+/**
+ * Voltage interpolation weight (1/256) for no phase correction: halfway
+ * between the voltage samples around the current sample
+ */
+#define CHANNEL_PHASE_NONE  128
+
+/**
+ * 1/100 KWh in 1/10 W x ms
  */
-#define ACVOLT_SCALE        8.5
+#define ENERGY_UNIT_DWMS    360000000UL
+
+/**
+ * ADC clock prescaler. ~250 KHz ADC clock, 13 clocks per conversion
+ */
+#if F_CPU > 8000000L
+#define CHANNEL_ADC_PRESCALER   (_BV(ADPS2) | _BV(ADPS1))   // 64
+#else
+#define CHANNEL_ADC_PRESCALER   (_BV(ADPS2) | _BV(ADPS0))   // 32
+#endif
 
 /**
  * Return codes
@@ -56,7 +107,10 @@
  * Class: CHANNEL
  * 
  * Description:
- * AC channel class
+ * AC channel class. Samples are taken from the ADC interrupt, alternating
+ * the shared voltage pin with the current pin of each enabled channel.
+ * Samples are kept in Q15 (1.0 = ADC full scale) and accumulated per
+ * channel. Physical values are calculated once per window in fixed point
  */
 class CHANNEL
 {
@@ -77,80 +131,153 @@ class CHANNEL
     byte currentPin;
 
     /**
-     * Peak voltage in volts
+     * Scaling factors (1/100)
      */
-    float peakVoltage;
+    unsigned int voltageScale;
+    unsigned int currentScale;
 
     /**
-     * Peak current in mA
+     * Fixed-point conversion factors, calculated by setScales:
+     * kVolt:     1/100 V per Q15 voltage unit
+     * offVolt:   Rectifier offset in Q15 voltage units
+     * kCurrent:  mA per Q15 current unit
+     * kPower:    1/10 W per Q15 voltage x current unit
      */
-    float peakCurrent;
-    
+    unsigned long kVolt;
+    unsigned int offVolt;
+    unsigned long kCurrent;
+    unsigned long kPower;
+
+    /**
+     * Weight (1/256) of the voltage sample taken after the current sample
+     */
+    int phaseWeight;
+
+    /**
+     * Window accumulators, in Q15. Voltage and power sums only take the
+     * positive half-cycles seen through the rectifier. Windows start and
+     * end on zero-crossings of the voltage signal
+     */
+    struct ACCUM
+    {
+      long sumV;      // Sum of v
+      long sumV2;     // Sum of v^2
+      long sumVI;     // Sum of v*i
+      long sumIV;     // Sum of i while v > 0
+      long sumI;      // Sum of i
+      long sumI2;     // Sum of i^2
+      unsigned int nbV;  // Samples with v > 0
+      unsigned int nbI;  // All samples
+      byte cycles;       // AC cycles
+      unsigned long start;     // Time of the first zero-crossing (us)
+      unsigned long duration;  // Window length (us)
+    };
+
+    /**
+     * Running accumulators, only touched from the ADC interrupt
+     */
+    ACCUM acc;
+
+    /**
+     * Last completed window, handed over to update()
+     */
+    ACCUM win;
+    volatile bool winReady;
+
+    /**
+     * True once the running window started on a zero-crossing
+     */
+    bool synced;
+
     /**
      * Time when the last measurements were taken (ms)
      */
     unsigned long lastTime;
-    
-  public:  
+
     /**
-     * Scaling factor for the AC voltage signal coming from the voltage transformer
+     * Energy not yet accounted in kwh (1/10 W x ms)
      */
-    float voltageScale;
+    unsigned long energyRem;
 
     /**
-     * Scaling factor for the AC voltage signal coming from the current transformer
+     * accumulate
+     *
+     * Add voltage/current sample pair. Called from the ADC interrupt
+     *
+     * 'v'  Voltage sample (Q15)
+     * 'i'  Current sample (Q15)
      */
-    float currentScale;
+    void accumulate(unsigned int v, int i);
 
     /**
-     * Power factor offset (obtained during calibration)
+     * cycleEnd
+     *
+     * Zero-crossing detected. Called from the ADC interrupt
+     *
+     * 'now'  Time of the zero-crossing (us)
      */
-    float pfOffset;
-    
+    void cycleEnd(unsigned long now);
+
+    /**
+     * Channel table and scanning state
+     */
+    static CHANNEL *table[CHANNEL_MAX];
+    static byte nbOfChannels;
+
+    /**
+     * sampleIsr
+     *
+     * ADC conversion handler
+     *
+     * 'value'  Raw ADC reading
+     */
+    static void sampleIsr(unsigned int value);
+
+  public:  
     /**
      * Enable/disable reading
      */
     bool enable;
     
     /**
-     * AC frequency
+     * AC frequency (Hz), measured over the last window
      */
     byte frequency;
     
     /**
-     * RMS voltage
+     * RMS voltage in 1/100 V
      */
-    float rmsVoltage;
+    unsigned int rmsVoltage;
 
     /**
-     * RMS current
+     * RMS current in mA
      */
-    float rmsCurrent;
+    unsigned int rmsCurrent;
 
     /**
-     * Apparent power
+     * Apparent power in 1/10 VA
      */
-    float appPower;
+    unsigned long appPower;
 
     /**
-     * Active (real) power
+     * Active (real) power in 1/10 W
      */
-    float actPower;
+    unsigned long actPower;
 
     /**
-     * Power factor
+     * Power factor in 1/100
      */
-    float powerFactor;
+    byte powerFactor;
     
     /**
-     * Initial energy consummed in KWh
+     * Initial energy consummed in 1/100 KWh
      */
-    double initialKwh;
+    unsigned long initialKwh;
     
     /**
-     * Energy consumed in KWh
+     * Energy consumed in 1/100 KWh
      */
-    double kwh;
+    unsigned long kwh;
 
     /**
      * CHANNEL
@@ -167,33 +294,78 @@ class CHANNEL
      * 'vcc'     Voltage supply
      * 'vPin'    Arduino analog pin connected to the AC voltage signal
      * 'iPin'    Arduino analog pin connected to the AC current signal
-     * 'vScale'  Scaling factor for the voltage signal
-     * 'iScale'  Scaling factor for the current signal
-     * 'pfShift' Power factor offset to be applied (obtained during calibration)
+     * 'vScale'  Scaling factor for the voltage signal (1/100)
+     * 'iScale'  Scaling factor for the current signal (1/100)
+     * 'phase'   Phase correction (see setPhase)
      */
-    CHANNEL(unsigned int vcc, int vPin, int iPin, float vScale=1.0, float iScale=1.0, float pfShift=0.0);
+    CHANNEL(unsigned int vcc, int vPin, int iPin, unsigned int vScale=100, unsigned int iScale=100, char phase=0);
+
+    /**
+     * setScales
+     * 
+     * Set scaling factors and recalculate the fixed-point conversion factors
+     *
+     * 'vScale'  Scaling factor for the voltage signal (1/100)
+     * 'iScale'  Scaling factor for the current signal (1/100)
+     */
+    void setScales(unsigned int vScale, unsigned int iScale);
+
+    /**
+     * setPhase
+     * 
+     * Set phase correction between the current transformer and the voltage
+     * signal. The voltage paired with each current sample is interpolated
+     * between the voltage samples taken before and after it
+     *
+     * 'shift'  Phase lead of the current signal in 1/128 of the interval
+     *          between voltage samples. 0 = no correction. Range -128 to
+     *          127, +/-1.9 degrees at 50 Hz
+     */
+    void setPhase(char shift);
 
     /**
      * update
      * 
-     * Update AC channel readings
+     * Process the last window of samples completed by the ADC interrupt
      *
      * Return:
-     *    0 if the function still needs to take additional samples
-     *    1 if the function read the necessary amount of samples
-     *    2 if the function detected no VAC signal after reading the samples
+     *    0 if no new window is available
+     *    1 if new readings were calculated
+     *    2 if no VAC signal is detected
      */
     byte update(void);
     
     /**
      * run
      * 
-     * Run channel readings and calculations
+     * Run channel calculations and print the new readings
      *
      * Return:
      *   Code returned by update()
      */
     byte run(void);
+
+    /**
+     * begin
+     * 
+     * Start sampling all channels from the ADC interrupt. The ADC can't be
+     * used for anything else until end() is called
+     */
+    static void begin(void);
+
+    /**
+     * end
+     * 
+     * Stop sampling and release the ADC
+     */
+    static void end(void);
+
+    /**
+     * powerFail
+     * 
+     * Return true once each time the VAC signal is lost
+     */
+    static bool powerFail(void);
 };
 
 #endif
@@ -68,14 +68,8 @@
 CHANNEL *channels[NB_OF_CHANNELS];
 
 /**
- * Interrupt masks
+ * Debounce time for the pulse inputs (us)
  */
-#define PCINTMASK    0xE0  // PD[5:7]
-
-/**
- * PCINT macros
- */
-#define pcEnableInterrupt()     PCICR = 0x04    // Enable Pin Change interrupt on Port D
-#define pcDisableInterrupt()    PCICR = 0x00    // Disable Pin Change interrupts
+#define COUNTER_DEBOUNCE_US      200
 
 #endif
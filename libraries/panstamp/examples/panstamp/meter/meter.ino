@@ -40,6 +40,8 @@
  */
 
 #include "TimerOne.h"
+#include "adcsampler.h"
+#include "pinchange.h"
 #include "meter.h"
 
 /**
@@ -60,9 +62,8 @@ volatile boolean pcIRQ = false;
 /**
  * Counters
  */
-const uint8_t counterPin[] = {5, 6, 7};        // Counter pins (Atmega port bits) on Port D
+const uint8_t counterPin[] = {5, 6, 7};        // Counter pins (Arduino digital pins) on Port D
 static unsigned long counters[] = {0, 0, 0};   // Initial counter values
-static int lastStateCount[] = {-1, -1, -1};    // Initial pin states
 
 /**
  * Timer 1 ticks
@@ -82,6 +83,8 @@ unsigned int voltageSupply = 3260;
 
 SIGNAL(PCINT2_vect)
 {
+  // Count edges right away
+  pinChange.handle(PINCHANGE_PORTD);
   pcIRQ = true;
 }
 
@@ -98,24 +101,13 @@ SIGNAL(PCINT2_vect)
  */
 byte updateCounters(void)
 {
-  byte i, res = 0;
-  byte state;
+  byte i, res;
+
+  // Collect the edges counted from the PCINT interrupt
+  res = pinChange.update();
 
   for(i=0 ; i<sizeof(counterPin) ; i++)
-  {
-    state = bitRead(PIND, counterPin[i]);
-    
-    if (lastStateCount[i] != state)
-    {      
-      lastStateCount[i] = state;
-    
-      if (state == HIGH)
-      {
-        counters[i]++;
-        res |= (1 << i);
-      }
-    }
-  }
+    counters[i] = pinChange.count(i);
 
   return res;
 }
@@ -131,14 +123,8 @@ unsigned int readVoltSupply(void)
 {
   unsigned int result;
    
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
 
   return result;
 }
@@ -203,7 +189,7 @@ void readInitValues(void)
     if (setToZero)
       channels[i]->initialKwh = 0;
     else
-      channels[i]->initialKwh = tmpValue / 100.0;
+      channels[i]->initialKwh = tmpValue;
   }
 
   // Read configuration for the pulse inputs
@@ -221,36 +207,72 @@ void readInitValues(void)
   }
 }
 
+/**
+ * Readings being saved by saveValues, big endian as read by readInitValues
+ */
+static byte savedKwh[NB_OF_CHANNELS][CONFIG_INITKWH_SIZE];
+static byte savedCounters[NB_OF_COUNTERS][sizeof(counters[0])];
+
+/**
+ * Record queued by saveNext: 0 for the KWh readings, 1 + counter index
+ * for the pulse counters. NB_OF_COUNTERS + 1 when no save is running
+ */
+static byte saveRecord = NB_OF_COUNTERS + 1;
+static uint16_t saveDone;
+
+/**
+ * saveNext
+ *
+ * Queue as much of the running save as the EEPROM queue takes without
+ * waiting. Called from every loop pass
+ */
+void saveNext(void)
+{
+  bool done;
+
+  while (saveRecord <= NB_OF_COUNTERS)
+  {
+    if (saveRecord == 0)
+      done = EEPROM.writeBlockAsync(EEPROM_INITIAL_KWH0, savedKwh[0],
+                                    sizeof(savedKwh), &saveDone);
+    else
+      done = EEPROM.writeBlockAsync(EEPROM_CONFIG_PULSE0 + CONFIG_PULSEINPL_SIZE * (saveRecord - 1),
+                                    savedCounters[saveRecord - 1],
+                                    sizeof(savedCounters[0]), &saveDone);
+    if (!done)
+      return;
+    saveRecord++;
+    saveDone = 0;
+  }
+}
+
 /**
  * saveValues
  * 
- * Save values in EEPROM
+ * Save values in EEPROM. The readings are taken now and written in pieces
+ * by saveNext, more than the EEPROM queue holds at once
  */
 void saveValues(void) 
 {
-  byte i, j, val;
-  unsigned long tmpValue;
+  byte i, j;
 
   // Save current KWh readings from channels
   for(i=0 ; i < NB_OF_CHANNELS ; i++)
   {
-    tmpValue = channels[i]->kwh * 100;
-    for(j=0 ; j<sizeof(tmpValue) ; j++)
-    {
-      val = (tmpValue >> (8 * (3-j))) & 0xFF;
-      EEPROM.write(EEPROM_INITIAL_KWH0 + CONFIG_INITKWH_SIZE * i + j, val);
-    }
+    for(j=0 ; j<CONFIG_INITKWH_SIZE ; j++)
+      savedKwh[i][j] = (channels[i]->kwh >> (8 * (3-j))) & 0xFF;
   }
 
   // Save current readings from pulse inputs
   for(i=0 ; i < NB_OF_COUNTERS ; i++)
   {
     for(j=0 ; j<sizeof(counters[0]) ; j++)
-    {
-      val = (counters[i] >> (8 * (3-j))) & 0xFF;
-      EEPROM.write(EEPROM_CONFIG_PULSE0 + CONFIG_PULSEINPL_SIZE * i + j, val);
-    }
+      savedCounters[i][j] = (counters[i] >> (8 * (3-j))) & 0xFF;
   }
+
+  saveRecord = 0;
+  saveDone = 0;
+  saveNext();
 }
 
 /**
@@ -260,6 +282,8 @@ void saveValues(void)
  */
 void setup()
 {
+  byte i;
+
   pinMode(LEDPIN, OUTPUT);
   digitalWrite(LEDPIN, LOW);
    
@@ -267,29 +291,24 @@ void setup()
   voltageSupply = readVoltSupply();
  
   // Create energy channel objects
-  static CHANNEL channel0(voltageSupply, PIN_ACVOLTAGE, 0, 17.75, 5);
+  static CHANNEL channel0(voltageSupply, PIN_ACVOLTAGE, 0, 1775, 500);
   channels[0] = &channel0;
-  static CHANNEL channel1(voltageSupply, PIN_ACVOLTAGE, 1, 17.75, 5);
+  static CHANNEL channel1(voltageSupply, PIN_ACVOLTAGE, 1, 1775, 500);
   channels[1] = &channel1;
-  static CHANNEL channel2(voltageSupply, PIN_ACVOLTAGE, 2, 17.75, 5);
+  static CHANNEL channel2(voltageSupply, PIN_ACVOLTAGE, 2, 1775, 500);
   channels[2] = &channel2;
-  static CHANNEL channel3(voltageSupply, PIN_ACVOLTAGE, 3, 17.75, 5);
+  static CHANNEL channel3(voltageSupply, PIN_ACVOLTAGE, 3, 1775, 500);
   channels[3] = &channel3;
-  static CHANNEL channel4(voltageSupply, PIN_ACVOLTAGE, 4, 17.75, 5);
+  static CHANNEL channel4(voltageSupply, PIN_ACVOLTAGE, 4, 1775, 500);
   channels[4] = &channel4;
-  static CHANNEL channel5(voltageSupply, PIN_ACVOLTAGE, 5, 17.75, 5);
+  static CHANNEL channel5(voltageSupply, PIN_ACVOLTAGE, 5, 1775, 500);
   channels[5] = &channel5;
-  static CHANNEL channel6(voltageSupply, PIN_ACVOLTAGE, 6, 17.75, 5);
+  static CHANNEL channel6(voltageSupply, PIN_ACVOLTAGE, 6, 1775, 500);
   channels[6] = &channel6;
 
-  // Pulse inputs
-  // Set pins as inputs
-  DDRD &= ~PCINTMASK;
-
-  // Set PC interrupt mask
-  PCMSK0 = 0;
-  PCMSK1 = 0;
-  PCMSK2 = PCINTMASK;
+  // Pulse inputs. Input index = counter index
+  for(i=0 ; i<sizeof(counterPin) ; i++)
+    pinChange.addInput(counterPin[i], COUNTER_DEBOUNCE_US);
 
   // Init panStamp
   panstamp.init();
@@ -311,12 +330,15 @@ void setup()
   // Read initial configuration settings from EEPROM
   readInitValues();
 
+  // Start sampling the energy channels from the ADC interrupt
+  CHANNEL::begin();
+
   // Initialize Timer1
   Timer1.initialize(TIMER1_TICK_PERIOD_US);
   Timer1.attachInterrupt(isrT1event);
 
   // Enable PCINT interrupt on counter pins
-  pcEnableInterrupt();
+  pinChange.begin();
 }
 
 /**
@@ -326,17 +348,19 @@ void setup()
  */
 void loop()
 { 
-  // Measure energy data
+  // Process the sampling windows completed by the ADC interrupt
   for(channelNb=0 ; channelNb < NB_OF_CHANNELS ; channelNb++)
   {
     if (channels[channelNb]->enable)
-    {
-      // Read power data
-      if (channels[channelNb]->run() == CHANNEL_NO_VAC_SIGNAL)
-        saveValues();  // NO VAC signal detected. Save data in EEPROM
-    }
+      channels[channelNb]->run();
   }
 
+  // NO VAC signal detected. Save data in EEPROM
+  if (CHANNEL::powerFail())
+    saveValues();
+  else
+    saveNext();
+
   if (transmit)
   {
     transmit = false;
@@ -354,6 +378,9 @@ void loop()
   // Read pulses
   if (pcIRQ)
   {
+    //Ready to receive new PC interrupts
+    pcIRQ = false;
+
     byte res = updateCounters();
     byte mask;
     if (res)
@@ -369,8 +396,6 @@ void loop()
         }
       }
     }
-    //Ready to receive new PC interrupts
-    pcIRQ = false;
   }
 
   delay(100);
@@ -50,7 +50,7 @@ DEFINE_COMMON_REGISTERS()
 // and Energy in KWh
 static byte dtChannelsEnergy[NB_OF_CHANNELS][14];       
 // Voltage transformer scaling factor [0-655.35], current transformer scaling
-// factor [0-655.35], power factor offset [0.0-0.99] and channel enable [0, 1]
+// factor [0-655.35], phase correction [-128, 127] and channel enable [0, 1]
 static byte dtChannelsConfig[NB_OF_CHANNELS][CONFIG_CHANNEL_SIZE];
 // Pulse counts
 static byte dtPulseCount[NB_OF_COUNTERS][4];
@@ -156,31 +156,31 @@ const void updtChannelEnergy(byte rId)
   dtChannelsEnergy[channel][0] = channels[channel]->frequency;
   
   // RMS voltage (in volts)
-  tmpValue = channels[channel]->rmsVoltage;
+  tmpValue = channels[channel]->rmsVoltage / 100;
   dtChannelsEnergy[channel][1] = (tmpValue >> 8) & 0xFF;
   dtChannelsEnergy[channel][2] = tmpValue & 0xFF;
   
   // RMS current (in 1/100 amps)
-  tmpValue = channels[channel]->rmsCurrent * 100;
+  tmpValue = channels[channel]->rmsCurrent / 10;
   dtChannelsEnergy[channel][3] = (tmpValue >> 8) & 0xFF;
   dtChannelsEnergy[channel][4] = tmpValue & 0xFF;
   
   // Apparent power (in VA)
-  tmpValue = channels[channel]->appPower;
+  tmpValue = channels[channel]->appPower / 10;
   dtChannelsEnergy[channel][5] = (tmpValue >> 8) & 0xFF;
   dtChannelsEnergy[channel][6] = tmpValue & 0xFF;
   
   // Active power (in W)
-  tmpValue = channels[channel]->actPower;
+  tmpValue = channels[channel]->actPower / 10;
   dtChannelsEnergy[channel][7] = (tmpValue >> 8) & 0xFF;
   dtChannelsEnergy[channel][8] = tmpValue & 0xFF;
   
   // Power factor (1/100)
-  tmpValue = channels[channel]->powerFactor * 100;
+  tmpValue = channels[channel]->powerFactor;
   dtChannelsEnergy[channel][9] = tmpValue & 0xFF;
 
   // KWh
-  tmpValue = (channels[channel]->initialKwh + channels[channel]->kwh) * 100;
+  tmpValue = channels[channel]->initialKwh + channels[channel]->kwh;
   dtChannelsEnergy[channel][10] = (tmpValue >> 24) & 0xFF;
   dtChannelsEnergy[channel][11] = (tmpValue >> 16) & 0xFF;
   dtChannelsEnergy[channel][12] = (tmpValue >> 8) & 0xFF;
@@ -198,24 +198,23 @@ const void updtChannelEnergy(byte rId)
 const void setChannelConfig(byte rId, byte *config)
 {
   int channel = rId - REGI_CHANNEL_CONFIG_0;
-  unsigned int tmpValue;
+  unsigned int vScale, iScale;
   byte i;
   
   // Update register
   memcpy(dtChannelsConfig[channel], config, sizeof(dtChannelsConfig[channel]));
 
   // Voltage scale
-  tmpValue = config[0];
-  tmpValue = (tmpValue << 8) | config[1];
-  channels[channel]->voltageScale = tmpValue / 100.0;
+  vScale = config[0];
+  vScale = (vScale << 8) | config[1];
   
   // Current scale
-  tmpValue = config[2];
-  tmpValue = (tmpValue << 8) | config[3];
-  channels[channel]->currentScale = tmpValue / 100.0;
+  iScale = config[2];
+  iScale = (iScale << 8) | config[3];
+  channels[channel]->setScales(vScale, iScale);
   
-  // Power factor offset
-  channels[channel]->pfOffset = config[4] / 100.0;
+  // Phase correction
+  channels[channel]->setPhase((char)config[4]);
 
   // Enable
   channels[channel]->enable = config[5] & 0x01;
@@ -224,7 +223,7 @@ const void setChannelConfig(byte rId, byte *config)
   Serial.println(sizeof(dtChannelsConfig[channel]), HEX);
   for(i=0 ; i<sizeof(dtChannelsConfig[channel]) ; i++)
   {
-    EEPROM.write(EEPROM_CONFIG_CHANNEL0 + CONFIG_CHANNEL_SIZE * channel + i, dtChannelsConfig[channel][i]);
+    EEPROM.writeAsync(EEPROM_CONFIG_CHANNEL0 + CONFIG_CHANNEL_SIZE * channel + i, dtChannelsConfig[channel][i]);
   }
 }
 
@@ -284,6 +283,6 @@ const void setPulseConfig(byte rId, byte *config)
   
   // Save config settings in EEPROM
   for(i=0 ; i<sizeof(dtPulseConfig[input]) ; i++)
-    EEPROM.write(EEPROM_CONFIG_PULSE0 + CONFIG_PULSEINPL_SIZE * input + i, dtPulseConfig[input][i]);
+    EEPROM.writeAsync(EEPROM_CONFIG_PULSE0 + CONFIG_PULSEINPL_SIZE * input + i, dtPulseConfig[input][i]);
 }
 
@@ -27,6 +27,7 @@
 #include <EEPROM.h>
 #include "product.h"
 #include "panstamp.h"
+#include "adcsampler.h"
 #include "regtable.h"
 
 /**
@@ -77,14 +78,8 @@ const void updtVoltSupply(byte rId)
 {
   unsigned short result;
   
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
 
   /**
    * register[eId]->member can be replaced by regVoltSupply in this case since
@@ -28,7 +28,10 @@
  *
  * Description:
  * Device providing 4 programmable pulse outputs.
- * Frequency range: 0-200 Hz
+ * Frequency range: 0-255 Hz
+ *
+ * Edges are timed by Timer1, which only interrupts on the next edge due
+ * and stops when all outputs are off
  *
  * Pulse outputs : pins 4, 5, 6 and 8
  *
@@ -42,19 +45,10 @@
 #include "regtable.h"
 #include "panstamp.h"
 #include "TimerOne.h"
+#include "pulseout.h"
 
-/**
- * Timer 1
- */
-#define TIMER1_TICK_PERIOD_US    2500  // Timer1 tick = 2.5 ms
-// Tick countes
-int tickCount[] = {0, 0, 0, 0};
 // Output frequencies
 byte outFrequency[] = {0, 0, 0, 0};
-// Total ticks per period
-long maxTicks[] = {0, 0, 0, 0};
-// Total ticks per high level
-long highTicks[] = {0, 0, 0, 0};
 
 /**
  * LED pin
@@ -62,34 +56,9 @@ long highTicks[] = {0, 0, 0, 0};
 #define LEDPIN  4
 
 /**
- * Pulse output pins (Atmega pins)
- */
-#define PULSEPORT PORTC
-#define PULSEDIR  DDRC
-uint8_t pulseBit[] = {0, 1, 2, 3};
-
-/**
- * isrT1event
- *
- * Timer1 interrupt routine
+ * Pulse output pins (Arduino digital pins): PC[0:3]
  */
-void isrT1event(void)
-{
-  int i;
-   
-  for(i=0 ; i<sizeof(pulseBit) ; i++)
-  {
-    tickCount[i]++;
-  
-    if (tickCount[i] == highTicks[i])
-      bitSet(PULSEPORT, pulseBit[i]);
-    else if (tickCount[i] >= maxTicks[i])
-    {
-      bitClear(PULSEPORT, pulseBit[i]);
-      tickCount[i] = 0;
-    }
-  }
-}
+uint8_t pulsePin[] = {14, 15, 16, 17};
 
 /**
  * setup
@@ -103,12 +72,9 @@ void setup()
   pinMode(LEDPIN, OUTPUT);
   digitalWrite(LEDPIN, LOW);
 
-  // Configure and initialize output pins
-  for(i=0 ; i<sizeof(pulseBit) ; i++)
-  {
-    bitSet(PULSEDIR, pulseBit[i]);
-    bitClear(PULSEPORT, pulseBit[i]);
-  }
+  // Configure and initialize output pins. Output index = register index
+  for(i=0 ; i<(int)sizeof(pulsePin) ; i++)
+    pulseOut.addOutput(pulsePin[i]);
 
   // Init panStamp
   panstamp.init();
@@ -123,11 +89,6 @@ void setup()
   getRegister(REGI_FREQUENCY1)->getData();
   getRegister(REGI_FREQUENCY2)->getData();
   getRegister(REGI_FREQUENCY3)->getData();
-  
-  // Init Timer1
-  Timer1.initialize(TIMER1_TICK_PERIOD_US);
-  // Attach interrupt function to Timer1
-  Timer1.attachInterrupt(isrT1event);
 }
 
 /**
@@ -0,0 +1,214 @@
+/**
+ * pulseout.cpp
+ *
+ * Copyright (c) 2012 Daniel Berenguer <dberenguer@usapiens.com>
+ * 
+ * This file is part of the panStamp project.
+ * 
+ * panStamp  is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ * 
+ * panStamp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with panStamp; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 
+ * USA
+ */
+
+#include "pulseout.h"
+
+/**
+ * PULSEOUT
+ * 
+ * Class constructor
+ */
+PULSEOUT::PULSEOUT(void)
+{
+  nbOfOutputs = 0;
+  step = 0;
+  running = false;
+}
+
+/**
+ * timerEvent
+ *
+ * Timer1 interrupt routine
+ */
+void PULSEOUT::timerEvent(void)
+{
+  pulseOut.nextStep();
+}
+
+/**
+ * nextStep
+ *
+ * Toggle due outputs and program the next step
+ */
+void PULSEOUT::nextStep(void)
+{
+  uint8_t i;
+  long next = PULSEOUT_MAX_STEP;
+  OUTPUT_PIN *out;
+
+  for(i=0 ; i<nbOfOutputs ; i++)
+  {
+    out = &outputs[i];
+    if (!out->active)
+      continue;
+
+    out->remaining -= step;
+
+    // Due or too close to be scheduled apart
+    if (out->remaining <= PULSEOUT_MIN_STEP)
+    {
+      *out->pin = out->mask;
+      out->level = !out->level;
+      out->remaining += out->level ? out->high : out->low;
+
+      // Output started in the middle of a step. Restart its phase
+      if (out->remaining <= PULSEOUT_MIN_STEP)
+        out->remaining = out->level ? out->high : out->low;
+    }
+
+    if (out->remaining < next)
+      next = out->remaining;
+  }
+
+  // Period starting now. Counter is still close to BOTTOM
+  step = next;
+  ICR1 = step;
+}
+
+/**
+ * addOutput
+ * 
+ * Add output pin
+ *
+ * 'pin'  Arduino digital pin
+ *
+ * Return:
+ *  Output index. -1 if the table is full
+ */
+int8_t PULSEOUT::addOutput(uint8_t pin)
+{
+  OUTPUT_PIN *out;
+  uint8_t port = digitalPinToPort(pin);
+
+  if (nbOfOutputs == PULSEOUT_MAX || port == NOT_A_PIN)
+    return -1;
+
+  out = &outputs[nbOfOutputs];
+  out->port = portOutputRegister(port);
+  out->pin = portInputRegister(port);
+  out->mask = digitalPinToBitMask(pin);
+  out->active = false;
+  out->level = false;
+
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+
+  return nbOfOutputs++;
+}
+
+/**
+ * setFrequency
+ * 
+ * Set output frequency. 50% duty cycle
+ *
+ * 'output'   Output index
+ * 'milliHz'  Frequency in mHz. 0 turns the output off (low)
+ *
+ * Return:
+ *  false if the frequency is out of range
+ */
+bool PULSEOUT::setFrequency(uint8_t output, unsigned long milliHz)
+{
+  OUTPUT_PIN *out;
+  unsigned long period = 0;
+  uint8_t i, oldSREG;
+  bool active = false;
+
+  if (output >= nbOfOutputs)
+    return false;
+
+  out = &outputs[output];
+
+  if (milliHz > 0)
+  {
+    period = 1000000000UL / milliHz / PULSEOUT_US_PER_UNIT;
+    if (period < 4 * PULSEOUT_MIN_STEP || period > 0x7FFFFFFFUL)
+      return false;
+  }
+
+  oldSREG = SREG;
+  cli();
+
+  if (milliHz == 0)
+  {
+    out->active = false;
+    *out->port &= ~out->mask;
+  }
+  else
+  {
+    out->high = period / 2;
+    out->low = period - out->high;
+
+    // Start low. Running outputs keep their phase
+    if (!out->active)
+    {
+      *out->port &= ~out->mask;
+      out->level = false;
+      out->remaining = out->low;
+      if (running)
+      {
+        // The step in progress will be deducted on the next interrupt.
+        // Its elapsed part is unknown, so count it as just started
+        out->remaining += step;
+      }
+      out->active = true;
+    }
+  }
+
+  for(i=0 ; i<nbOfOutputs ; i++)
+    active |= outputs[i].active;
+
+  if (active && !running)
+  {
+    // Start Timer1 on the nearest edge
+    step = PULSEOUT_MAX_STEP;
+    for(i=0 ; i<nbOfOutputs ; i++)
+    {
+      if (outputs[i].active && outputs[i].remaining < step)
+        step = outputs[i].remaining;
+    }
+    Timer1.initialize(PULSEOUT_INIT_US);
+    Timer1.stop();
+    TCNT1 = 1;
+    ICR1 = step;
+    TIFR1 = _BV(TOV1);
+    Timer1.attachInterrupt(timerEvent);
+    running = true;
+  }
+  else if (!active && running)
+  {
+    // Nothing to do. Stop Timer1
+    Timer1.detachInterrupt();
+    Timer1.stop();
+    running = false;
+  }
+
+  SREG = oldSREG;
+
+  return true;
+}
+
+/**
+ * Pre-instantiate PULSEOUT object
+ */
+PULSEOUT pulseOut;
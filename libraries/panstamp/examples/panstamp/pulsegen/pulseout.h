@@ -0,0 +1,155 @@
+/**
+ * pulseout.h
+ *
+ * Copyright (c) 2012 Daniel Berenguer <dberenguer@usapiens.com>
+ * 
+ * This file is part of the panStamp project.
+ * 
+ * panStamp  is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ * 
+ * panStamp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with panStamp; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 
+ * USA
+ */
+
+#ifndef _PULSEOUT_H
+#define _PULSEOUT_H
+
+#include "Arduino.h"
+#include "TimerOne.h"
+
+/**
+ * Max number of pulse outputs
+ */
+#define PULSEOUT_MAX            4
+
+/**
+ * Timer1 runs in phase and frequency correct mode with the /8 prescaler.
+ * One ICR1 unit is then 16/F_CPU(MHz) us of interrupt period
+ */
+#define PULSEOUT_US_PER_UNIT    (16000000L / F_CPU)
+
+/**
+ * Initial Timer1 period. Makes TimerOne pick the /8 prescaler at 8 and 16 MHz
+ */
+#define PULSEOUT_INIT_US        20000
+
+/**
+ * Longest Timer1 step (units). Bounds the delay of the first edge of an
+ * output started whilst others are running
+ */
+#define PULSEOUT_MAX_STEP       (20000 / PULSEOUT_US_PER_UNIT)
+
+/**
+ * Shortest Timer1 step (units). ICR1 has to stay ahead of TCNT1 when
+ * written from the interrupt. Edges closer than this to the current one
+ * are taken together
+ */
+#define PULSEOUT_MIN_STEP       100
+
+/**
+ * Class: PULSEOUT
+ * 
+ * Description:
+ * Square wave outputs driven from the Timer1 interrupt. Each output keeps
+ * the time left to its next edge and the timer is programmed to fire on
+ * the nearest one, so the interrupt only runs on edges. The timer stops
+ * when all outputs are off
+ */
+class PULSEOUT
+{
+  private:
+    /**
+     * Output descriptor
+     */
+    struct OUTPUT_PIN
+    {
+      volatile uint8_t *port;   // Output register
+      volatile uint8_t *pin;    // Input register. Writing a 1 toggles the output
+      uint8_t mask;             // Bit mask
+      bool active;              // Output running
+      bool level;               // Current level
+      unsigned long high;       // High time (units)
+      unsigned long low;        // Low time (units)
+      long remaining;           // Time to the next edge (units)
+    };
+
+    /**
+     * Outputs
+     */
+    OUTPUT_PIN outputs[PULSEOUT_MAX];
+    uint8_t nbOfOutputs;
+
+    /**
+     * Length of the Timer1 step in progress (units)
+     */
+    unsigned int step;
+
+    /**
+     * True while Timer1 is running
+     */
+    bool running;
+
+    /**
+     * timerEvent
+     *
+     * Timer1 interrupt routine
+     */
+    static void timerEvent(void);
+
+    /**
+     * nextStep
+     *
+     * Toggle due outputs and program the next step
+     */
+    void nextStep(void);
+
+  public:
+    /**
+     * PULSEOUT
+     * 
+     * Class constructor
+     */
+    PULSEOUT(void);
+
+    /**
+     * addOutput
+     * 
+     * Add output pin
+     *
+     * 'pin'  Arduino digital pin
+     *
+     * Return:
+     *  Output index. -1 if the table is full
+     */
+    int8_t addOutput(uint8_t pin);
+
+    /**
+     * setFrequency
+     * 
+     * Set output frequency. 50% duty cycle
+     *
+     * 'output'   Output index
+     * 'milliHz'  Frequency in mHz. 0 turns the output off (low)
+     *
+     * Return:
+     *  false if the frequency is out of range
+     */
+    bool setFrequency(uint8_t output, unsigned long milliHz);
+};
+
+/**
+ * Global PULSEOUT object
+ */
+extern PULSEOUT pulseOut;
+
+#endif
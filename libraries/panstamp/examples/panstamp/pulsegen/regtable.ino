@@ -80,16 +80,12 @@ DEFINE_COMMON_CALLBACKS()
  */
 const void setFrequency(byte rId, byte *freq)
 {
-  byte index = rId - 11;
-  float msec = (float)(TIMER1_TICK_PERIOD_US) / 1000;
-  float tmp;
+  byte index = rId - REGI_FREQUENCY0;
   
   // Update register
   memcpy(regTable[rId]->value, freq, regTable[rId]->length);
   
-  // Calculate amount of ticks
-  tmp = 1000.0 / (freq[0] * msec);
-  maxTicks[index] = tmp;
-  highTicks[index] = maxTicks[index] / 2;
+  // Program output (mHz)
+  pulseOut.setFrequency(index, freq[0] * 1000UL);
 }
 
@@ -27,6 +27,7 @@
 #include <EEPROM.h>
 #include "product.h"
 #include "panstamp.h"
+#include "adcsampler.h"
 #include "regtable.h"
 #include "sensor.h"
 
@@ -81,23 +82,14 @@ const void updtVoltSupply(byte rId)
 {  
   unsigned long result;
 
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
   voltageSupply = result;     // Update global variable Vcc
   
   #ifdef VOLT_SUPPLY_A7
   
   // Read voltage supply from A7
-  unsigned short ref = voltageSupply;
-  result = analogRead(7);
-  result *= ref;
-  result /= 1024;
+  result = adc.readMillivolts(7);
   #endif
 
   /**
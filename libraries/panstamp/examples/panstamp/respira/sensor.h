@@ -37,18 +37,8 @@ byte dtAirSensor[4];	// Air quality (CO + NO2) sensor
  * Pin definitions
  */
 // Temperature + Humidity (DHT22 sensor)
-#define PORTW_DHT_DATA    PORTD
-#define PORTR_DHT_DATA    PIND
-#define PORTD_DHT_DATA    DDRD
-#define BIT_DHT_DATA      6
 #define PIN_DHT_DATA      6
 
-#define setDataPin()      bitSet(PORTW_DHT_DATA, BIT_DHT_DATA)
-#define clearDataPin()    bitClear(PORTW_DHT_DATA, BIT_DHT_DATA)
-#define getDataPin()      bitRead(PORTR_DHT_DATA, BIT_DHT_DATA)
-#define setDataInput()    bitClear(PORTD_DHT_DATA, BIT_DHT_DATA)
-#define setDataOutput()   bitSet(PORTD_DHT_DATA, BIT_DHT_DATA)
-
 #define PIN_PWRDHT        5
 #define dhtSensorON()     digitalWrite(PIN_PWRDHT, HIGH);
 #define dhtSensorOFF()    digitalWrite(PIN_PWRDHT, LOW);
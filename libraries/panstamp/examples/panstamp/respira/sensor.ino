@@ -25,121 +25,41 @@
  */
 
 #include "Arduino.h"
+#include "dht11.h"
 #include "sensor.h"
 
-/**
- * Local functions
- */
-int sensor_ReadByte(void);
-
-/**
- * sensor_ReadByte
- *
- * Read data byte from DHT11 sensor
- */
-int sensor_ReadByte(void)
-{
-  byte i, result = 0;
-  unsigned int count = 20000;
-
-  for(i=0; i< 8; i++)
-  {
-    while(!getDataPin())
-    {
-      if (--count == 0)
-        return -1;
-    }
-    delayMicroseconds(30);
-		
-    if (getDataPin())
-      result |=(1<<(7-i));
-
-    count = 20000;
-
-    while(getDataPin())
-    {
-      if (--count == 0)
-        return -1;
-    }
-  }
-  return result;
-}
-
 /**
  * sensor_ReadTempHum
  *
- * Read temperature and humidity values from DHT11 sensor
+ * Read temperature and humidity values from DHT22 sensor
  *
  * Return -1 in case of error. Return 0 otherwise
  */
 int sensor_ReadTempHum(void)
 {
   int temperature, humidity, chk;
-  
-  byte dhtData[5];
-  byte i, dhtCrc;
-  boolean success = false;
+  dht11 sensor(DHT22_TYPE);
 
   // Power ON sensor
   dhtSensorON();
   delay(1500);
-  
-  setDataOutput();
-  setDataPin();
-   
-  // Start condition
-  clearDataPin();
-  delay(18);
-  setDataPin();
-  delayMicroseconds(40);	
-  setDataInput();
-  delayMicroseconds(40);
-
-  if (!getDataPin())
-  {
-    // Start condition met
-    delayMicroseconds(80);	
-    if (getDataPin())
-    {
-      // Start condition met
-      delayMicroseconds(80);
-
-      // Now ready for data reception 
-      for (i=0; i<5; i++)
-      {
-        if ((chk = sensor_ReadByte()) < 0)
-          return -1;
-          
-        dhtData[i] = (byte)chk;
-      }
-      success = true;
-    }
-  }
-
-  setDataOutput();
-  clearDataPin();
+
+  // Edges are timed from the pin change interrupt
+  chk = sensor.read(PIN_DHT_DATA);
+
+  // Don't feed the unpowered sensor through the pull-up
+  pinMode(PIN_DHT_DATA, OUTPUT);
+  digitalWrite(PIN_DHT_DATA, LOW);
 
   // Power OFF sensor
   dhtSensorOFF();
-  
-  if (!success)
+
+  if (chk != DHTLIB_OK)
     return -1;
 
-  dhtCrc = dhtData[0] + dhtData[1] + dhtData[2] + dhtData[3];
-
-  // check check_sum
-  if(dhtData[4]!= dhtCrc)
-    return -1;  // CRC error
-
-  // Prepare values for 2-decimal format:
-  int sign = 1;
-  if (dhtData[2] & 0x80)
-  {
-    sign = -1;
-    dhtData[2] &= 0x7F; 
-  }
-  temperature = sign * word(dhtData[2], dhtData[3]) + 500;  // 50.0 ºC offset in order to accept negative temperatures
-  humidity = word(dhtData[0], dhtData[1]);
+  // 50.0 ºC offset in order to accept negative temperatures
+  temperature = sensor.temperature10 + 500;
+  humidity = sensor.humidity10;
 
   dtHtSensor[0] = (temperature >> 8) & 0xFF;
   dtHtSensor[1] = temperature & 0xFF;
@@ -27,6 +27,7 @@
 #include <EEPROM.h>
 #include "product.h"
 #include "panstamp.h"
+#include "adcsampler.h"
 #include "regtable.h"
 
 /**
@@ -48,7 +49,10 @@ static byte dtVoltSupply[2];
 REGISTER regVoltSupply(dtVoltSupply, sizeof(dtVoltSupply), &updtVoltSupply, NULL);
 // Sensor value register (dual sensor)
 static byte dtSensor[4];
-REGISTER regSensor(dtSensor, sizeof(dtSensor), &updtSensor, NULL);
+// Updated from the sensor table, which transmits it at the end of each
+// sampling cycle. No updater: a remote query returns the reading of the
+// last cycle without powering the sensors up
+REGISTER regSensor(dtSensor, sizeof(dtSensor), NULL, NULL);
 
 /**
  * Initialize table of registers
@@ -78,23 +82,14 @@ const void updtVoltSupply(byte rId)
 {  
   unsigned long result;
   
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
   voltageSupply = result;     // Update global variable Vcc
   
   #ifdef VOLT_SUPPLY_A7
   
   // Read voltage supply from A7
-  unsigned short ref = voltageSupply;
-  result = analogRead(7);
-  result *= ref;
-  result /= 1024;
+  result = adc.readMillivolts(7);
   #endif
 
   /**
@@ -108,30 +103,41 @@ const void updtVoltSupply(byte rId)
 }
 
 /**
- * updtSensor
+ * readSensor0
  *
- * Measure sensor data and update register
+ * Sample sensor 0 (already powered) into the first half of REGI_SENSOR
  *
- * 'rId'  Register ID
+ * Return:
+ *  Always true
  */
-const void updtSensor(byte rId)
+bool readSensor0(void)
 {
-  // Power sensors
-  digitalWrite(POWER_0_PIN, HIGH);
-  digitalWrite(POWER_1_PIN, HIGH);
-  delay(10);
-  // Read analog values
-  unsigned int adcValue0 = analogRead(SENSOR_0_PIN);
-  unsigned int adcValue1 = analogRead(SENSOR_1_PIN);
-  // Unpower sensors
-  digitalWrite(POWER_0_PIN, LOW);
-  digitalWrite(POWER_1_PIN, LOW);
-  
-  // Update register value
-  dtSensor[0] = (adcValue0 >> 8) & 0xFF;
-  dtSensor[1] = adcValue0 & 0xFF;
-  dtSensor[2] = (adcValue1 >> 8) & 0xFF;
-  dtSensor[3] = adcValue1 & 0xFF;
+  // Average of 16 noise-reduced samples
+  unsigned int adcValue = adc.read(SENSOR_0_PIN, 2) >> 2;
+
+  dtSensor[0] = (adcValue >> 8) & 0xFF;
+  dtSensor[1] = adcValue & 0xFF;
+
+  return true;
+}
+
+/**
+ * readSensor1
+ *
+ * Sample sensor 1 (already powered) into the second half of REGI_SENSOR
+ *
+ * Return:
+ *  Always true
+ */
+bool readSensor1(void)
+{
+  // Average of 16 noise-reduced samples
+  unsigned int adcValue = adc.read(SENSOR_1_PIN, 2) >> 2;
+
+  dtSensor[2] = (adcValue >> 8) & 0xFF;
+  dtSensor[3] = adcValue & 0xFF;
+
+  return true;
 }
 
 
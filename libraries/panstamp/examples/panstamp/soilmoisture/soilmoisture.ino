@@ -41,6 +41,7 @@
  
 #include "regtable.h"
 #include "panstamp.h"
+#include "sensorpipe.h"
 
 /**
  * Uncomment if you are reading Vcc from A7. All battery-boards do this
@@ -59,6 +60,16 @@
 #define POWER_0_PIN   16    // Digital pin used to powwer sensor 0
 #define SENSOR_1_PIN  5     // Analog pin - sensor 1
 #define POWER_1_PIN   18    // Digital pin used to powwer sensor 1
+#define SENSOR_SETTLE 10    // Settling time after power-up (ms)
+
+/**
+ * Sensor table. Both sensors are powered up together and transmitted in
+ * REGI_SENSOR once sampled
+ */
+const SENSOR sensors[] = {
+  {POWER_0_PIN, SENSOR_SETTLE, readSensor0, REGI_SENSOR},
+  {POWER_1_PIN, SENSOR_SETTLE, readSensor1, REGI_SENSOR}
+};
 
 /**
  * setup
@@ -73,10 +84,7 @@ void setup()
   digitalWrite(LEDPIN, LOW);
 
   // Initialize power pins
-  pinMode(POWER_0_PIN, OUTPUT);
-  digitalWrite(POWER_0_PIN, LOW);
-  pinMode(POWER_1_PIN, OUTPUT);
-  digitalWrite(POWER_1_PIN, LOW);
+  sensorPipe.begin(sensors, sizeof(sensors)/sizeof(SENSOR));
 
   // Init panStamp
   panstamp.init();
@@ -114,8 +122,8 @@ void loop()
 {
   
   Serial.println("test in loop");
-  // Transmit sensor data
-  getRegister(REGI_SENSOR)->getData();
+  // Sample and transmit sensor data
+  sensorPipe.run();
   // Transmit power voltage
   getRegister(REGI_VOLTSUPPLY)->getData();
 
@@ -57,18 +57,8 @@
  */
 // Temperature + Humidity (DHT11 or DHT22)
 #ifdef TEMPHUM
-#define PORTW_DHT_DATA    PORTC
-#define PORTR_DHT_DATA    PINC
-#define PORTD_DHT_DATA    DDRC
-#define BIT_DHT_DATA      2
 #define PIN_DHT_DATA      16
 
-#define setDataPin()      bitSet(PORTW_DHT_DATA, BIT_DHT_DATA)
-#define clearDataPin()    bitClear(PORTW_DHT_DATA, BIT_DHT_DATA)
-#define getDataPin()      bitRead(PORTR_DHT_DATA, BIT_DHT_DATA)
-#define setDataInput()    bitClear(PORTD_DHT_DATA, BIT_DHT_DATA)
-#define setDataOutput()   bitSet(PORTD_DHT_DATA, BIT_DHT_DATA)
-
 #define PIN_PWRDHT        15
 #define dhtSensorON()     digitalWrite(PIN_PWRDHT, HIGH);
 #define dhtSensorOFF()    digitalWrite(PIN_PWRDHT, LOW);
@@ -28,158 +28,59 @@
 #include "sensor.h"
 
 #ifdef TEMPHUM
-#ifdef DHT11
 #include "dht11.h"
-#endif
 #elif TEMPPRESS
 #include "Wire.h"
 #include "Adafruit_BMP085.h"
 Adafruit_BMP085 bmp;
 #endif
 
-/**
- * Local functions
- */
 #ifdef TEMPHUM
-int sensor_ReadByte(void);
-
-/**
- * sensor_ReadByte
- *
- * Read data byte from DHT11 sensor
- */
-int sensor_ReadByte(void)
-{
-  byte i, result = 0;
-  unsigned int count = 20000;
-
-  for(i=0; i< 8; i++)
-  {
-    while(!getDataPin())
-    {
-      if (--count == 0)
-        return -1;
-    }
-    delayMicroseconds(30);
-		
-    if (getDataPin())
-      result |=(1<<(7-i));
-
-    count = 20000;
-
-    while(getDataPin())
-    {
-      if (--count == 0)
-        return -1;
-    }
-  }
-  return result;
-}
-
 /**
  * sensor_ReadTempHum
  *
- * Read temperature and humidity values from DHT11 sensor
+ * Read temperature and humidity values from DHT11/DHT22 sensor
  *
  * Return -1 in case of error. Return 0 otherwise
  */
 int sensor_ReadTempHum(void)
 {
   int temperature, humidity, chk;
-  
-  #ifdef DHT11
-
-  dht11 sensor;
-  
-  dhtSensorON();
-  delay(1500);   
-  chk = sensor.read(PIN_DHT_DATA);
-  dhtSensorOFF();
 
-  if (chk != DHTLIB_OK)
-    return -1;
-
-  temperature = sensor.temperature * 10 + 500;
-  humidity = sensor.humidity * 10;
-  
+  #ifdef DHT11
+  dht11 sensor(DHT11_TYPE);
   #elif DHT22
-
-  byte dhtData[5];
-  byte i, dhtCrc;
-  boolean success = false;
+  dht11 sensor(DHT22_TYPE);
+  #endif
 
   // Power ON sensor
   dhtSensorON();
   delay(1500);
-  
-  setDataOutput();
-  setDataPin();
-   
-  // Start condition
-  clearDataPin();
-  delay(18);
-  setDataPin();
-  delayMicroseconds(40);	
-  setDataInput();
-  delayMicroseconds(40);
 
-  if (!getDataPin())
-  {
-    // Start condition met
-    delayMicroseconds(80);	
-    if (getDataPin())
-    {
-      // Start condition met
-      delayMicroseconds(80);
-
-      // Now ready for data reception 
-      for (i=0; i<5; i++)
-      {
-        if ((chk = sensor_ReadByte()) < 0)
-          return -1;
-          
-        dhtData[i] = (byte)chk;
-      }
-      success = true;
-    }
-  }
+  // Edges are timed from the pin change interrupt
+  chk = sensor.read(PIN_DHT_DATA);
 
-  setDataOutput();
-  //setDataPin();
-  clearDataPin();
+  // Don't feed the unpowered sensor through the pull-up
+  pinMode(PIN_DHT_DATA, OUTPUT);
+  digitalWrite(PIN_DHT_DATA, LOW);
 
   // Power OFF sensor
   dhtSensorOFF();
-  
-  if (!success)
-    return -1;
-
-  dhtCrc = dhtData[0] + dhtData[1] + dhtData[2] + dhtData[3];
 
-  // check check_sum
-  if(dhtData[4]!= dhtCrc)
-    return -1;  // CRC error
-
-  // Prepare values for 2-decimal format:
-  int sign = 1;
-  if (dhtData[2] & 0x80)
-  {
-    sign = -1;
-    dhtData[2] &= 0x7F; 
-  }
-  temperature = sign * word(dhtData[2], dhtData[3]) + 500;  // 50.0 ºC offset in order to accept negative temperatures
-  humidity = word(dhtData[0], dhtData[1]);
+  if (chk != DHTLIB_OK)
+    return -1;
 
-  #endif
+  // 50.0 ºC offset in order to accept negative temperatures
+  temperature = sensor.temperature10 + 500;
+  humidity = sensor.humidity10;
 
   dtSensor[0] = (temperature >> 8) & 0xFF;
   dtSensor[1] = temperature & 0xFF;
   dtSensor[2] = (humidity >> 8) & 0xFF;
   dtSensor[3] = humidity & 0xFF;
-   
+
   return 0;
 }
-
 #elif TEMP
 /**
  * sensor_ReadTemp
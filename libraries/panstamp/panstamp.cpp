@@ -47,6 +47,10 @@ PANSTAMP::PANSTAMP(void)
 {
   statusReceived = NULL;
   repeater = NULL;
+  sleepLoops = 0;
+  sleepStep = SLEEP_STEP_NONE;
+  eventPending = false;
+  wakeTime = 0;
 }
 
 /**
@@ -188,6 +192,11 @@ void isrGDO0event(void)
   enableIRQ_GDO0();
 }
 
+/**
+ * Sleeping periods ended by the watchdog or the RTC, asleep or not
+ */
+static volatile byte stepsElapsed = 0;
+
 /**
  * ISR(WDT_vect)
  *
@@ -195,6 +204,7 @@ void isrGDO0event(void)
  */
 ISR(WDT_vect)
 {
+  stepsElapsed++;
 }
 
 /**
@@ -225,6 +235,7 @@ void PANSTAMP::setup_watchdog(byte time)
  */
 ISR(TIMER2_OVF_vect)
 {
+  stepsElapsed++;
 }
 
 /**
@@ -297,6 +308,9 @@ void PANSTAMP::reset()
   systemState = SYSTATE_RESTART;
   getRegister(REGI_SYSSTATE)->sendSwapStatus();
 
+  // Commit pending EEPROM writes before restarting
+  EEPROM.flush();
+
   // Reset panStamp
   wdt_disable();  
   wdt_enable(WDTO_15MS);
@@ -330,6 +344,7 @@ void PANSTAMP::sleepWd(byte time)
   set_sleep_mode(SLEEP_MODE_PWR_DOWN);
   sleep_enable();
   setup_watchdog(time);
+  sleepStep = SLEEP_STEP_NONE;
   delayMicroseconds(10);
   // Disable ADC
   ADCSRA &= ~(1 << ADEN);
@@ -368,6 +383,7 @@ void PANSTAMP::sleepRtc(byte time)
   set_sleep_mode(SLEEP_MODE_PWR_SAVE);
   sleep_enable();
   setup_rtc(time);
+  sleepStep = SLEEP_STEP_NONE;
   delayMicroseconds(10);
   // Disable ADC
   ADCSRA &= ~(1 << ADEN);
@@ -422,41 +438,76 @@ void PANSTAMP::wakeUp(bool rxOn)
 void PANSTAMP::goToSleep(void)
 {
   // Get the amount of seconds to sleep from the internal register
-  int intInterval = (txInterval[0] * 0x100) + txInterval[1];
-  int i, loops;
+  unsigned int intInterval = (txInterval[0] * 0x100) + txInterval[1];
+  unsigned int i, loops;
   byte minTime;
   
   // No interval? Then return
   if (intInterval == 0)
     return;
 
+  minTime = getSleepStep(intInterval, &loops);
+
+  systemState = SYSTATE_RXOFF;
+
+  // Sleep
+  for (i=0 ; i<loops ; i++)
+  {
+    // Exit sleeping loop?
+    if (systemState == SYSTATE_RXON)
+      break;
+
+    if (rtcCrystal)
+      sleepRtc(minTime);
+    else
+      sleepWd(minTime);
+  }
+  systemState = SYSTATE_RXON;
+}
+
+/**
+ * getSleepStep
+ *
+ * Get the longest watchdog or RTC period that divides a sleeping
+ * interval
+ *
+ * 'interval'  Sleeping interval in seconds
+ * 'loops'     Number of periods needed to complete the interval
+ *
+ * Return:
+ *  WDTO_xx or RTC_xx period
+ */
+byte PANSTAMP::getSleepStep(unsigned int interval, unsigned int *loops)
+{
+  byte minTime;
+
   // Search the maximum sleep time passed as argument to sleepWd that best
   // suits our desired interval
-  if (intInterval % 8 == 0)
+  if (interval % 8 == 0)
   {
-    loops = intInterval / 8;
+    *loops = interval / 8;
     
     if (rtcCrystal)
       minTime = RTC_8S;
     else
       minTime = WDTO_8S;
   }
-  else if (intInterval % 4 == 0)
+  else if (interval % 4 == 0)
   {
     if (rtcCrystal)
     {
-      loops = intInterval / 2;
+      *loops = interval / 2;
       minTime = RTC_2S;
     }
     else
     {
-      loops = intInterval / 4;
+      *loops = interval / 4;
       minTime = WDTO_4S;
     }
   }
-  else if (intInterval % 2 == 0)
+  else if (interval % 2 == 0)
   {
-    loops = intInterval / 2;
+    *loops = interval / 2;
     if (rtcCrystal)    
       minTime = RTC_2S;
     else
@@ -464,28 +515,159 @@ void PANSTAMP::goToSleep(void)
   }
   else
   {
-    loops = intInterval;
+    *loops = interval;
     if (rtcCrystal)
       minTime = RTC_1S;
     else
       minTime = WDTO_1S;
   }
 
+  return minTime;
+}
+
+/**
+ * sleepUntilEvent
+ *
+ * Sleep in power-down mode until signalEvent is called from an
+ * interrupt or until the end of the periodic Tx interval. The radio
+ * stays in power-down state when returning. Call wakeUp before
+ * transmitting. The watchdog or the RTC keeps running across events so
+ * that the next call resumes the Tx interval where it was instead of
+ * restarting it or the current period
+ *
+ * 'pcMask'  Pin change ports (PCICR bits) able to wake the MCU
+ *
+ * Return:
+ *  WAKE_INTERVAL or WAKE_EVENT
+ */
+WAKESOURCE PANSTAMP::sleepUntilEvent(byte pcMask)
+{
+  unsigned int intInterval = (txInterval[0] * 0x100) + txInterval[1];
+  unsigned int loops;
+  byte minTime = 0, steps;
+  WAKESOURCE source;
+
+  if (intInterval > 0)
+  {
+    minTime = getSleepStep(intInterval, &loops);
+    // Start a new interval if the previous one elapsed or changed
+    if (sleepLoops == 0 || minTime != sleepStep)
+    {
+      sleepLoops = loops;
+      sleepStep = SLEEP_STEP_NONE;
+    }
+    else if (sleepLoops > loops)
+      sleepLoops = loops;
+  }
+  else if (sleepStep != SLEEP_STEP_NONE)
+  {
+    // No interval. Stop the periods left running
+    if (rtcCrystal)
+      TIMSK2 = 0x00;
+    else
+      WDTCSR &= ~_BV(WDIE);
+    sleepStep = SLEEP_STEP_NONE;
+  }
+
+  // Arm pin change ports
+  PCICR |= pcMask;
+
+  // Power-down CC1101 once. It is only woken up to transmit
+  cc1101.setPowerDownState();
   systemState = SYSTATE_RXOFF;
 
-  // Sleep
-  for (i=0 ; i<loops ; i++)
+  while (true)
   {
-    // Exit sleeping loop?
-    if (systemState == SYSTATE_RXON)
+    // Interrupts disabled so that no event is lost before sleeping
+    cli();
+
+    // Periods ended since the last pass, including whilst awake
+    if (sleepStep != SLEEP_STEP_NONE)
+    {
+      steps = stepsElapsed;
+      stepsElapsed = 0;
+      sleepLoops = (steps < sleepLoops) ? sleepLoops - steps : 0;
+    }
+
+    if (eventPending)
+    {
+      eventPending = false;
+      source = WAKE_EVENT;
       break;
+    }
+    if (intInterval > 0 && sleepLoops == 0)
+    {
+      source = WAKE_INTERVAL;
+      break;
+    }
 
-    if (rtcCrystal)
-      sleepRtc(minTime);
+    // Start the watchdog or the RTC, or resume the period in progress. No
+    // timer if there is no interval
+    if (intInterval > 0)
+    {
+      if (rtcCrystal)
+      {
+        set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+        if (sleepStep == SLEEP_STEP_NONE)
+          setup_rtc(minTime);
+        else
+        {
+          // An overflow flagged whilst awake fires right away
+          TIMSK2 = 0x01;
+        }
+      }
+      else
+      {
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        if (sleepStep == SLEEP_STEP_NONE)
+        {
+          wdt_reset();
+          setup_watchdog(minTime);
+        }
+      }
+      if (sleepStep == SLEEP_STEP_NONE)
+      {
+        sleepStep = minTime;
+        stepsElapsed = 0;
+      }
+    }
     else
-      sleepWd(minTime);
+      set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+
+    // Disable ADC
+    ADCSRA &= ~(1 << ADEN);
+    // Unpower functions
+    PRR = 0xFF;
+    sleep_enable();
+    // The instruction following sei is always executed so any interrupt
+    // pending from here wakes the MCU up right away
+    sei();
+    sleep_cpu();
+
+    // ZZZZZZZZ...
+
+    sleep_disable();
+    power_all_enable();
+    ADCSRA |= (1 << ADEN);
+    // Timer 2 keeps counting. Its overflows are flagged until resumed
+    if (rtcCrystal)
+      TIMSK2 = 0x00;
   }
-  systemState = SYSTATE_RXON;
+  sei();
+
+  wakeTime = micros();
+
+  return source;
+}
+
+/**
+ * signalEvent
+ *
+ * End sleepUntilEvent. To be called from ISRs
+ */
+void PANSTAMP::signalEvent(void)
+{
+  eventPending = true;
 }
 
 /**
@@ -557,8 +739,8 @@ void PANSTAMP::setTxInterval(byte* interval, bool save)
   // Save in EEPROM
   if (save)
   {
-    EEPROM.write(EEPROM_TX_INTERVAL, interval[0]);
-    EEPROM.write(EEPROM_TX_INTERVAL + 1, interval[1]);
+    EEPROM.writeAsync(EEPROM_TX_INTERVAL, interval[0]);
+    EEPROM.writeAsync(EEPROM_TX_INTERVAL + 1, interval[1]);
   }
 }
 
@@ -46,6 +46,7 @@
 #define RTC_1S       0x05   // Timer 2 prescaler = 128
 #define RTC_2S       0x06   // Timer 2 prescaler = 256
 #define RTC_8S       0x07   // Timer 2 prescaler = 1024
+#define SLEEP_STEP_NONE  0xFF   // No sleepUntilEvent period running
 
 /**
  * Macros
@@ -77,6 +78,15 @@ enum SYSTATE
   SYSTATE_LOWBAT
 };
 
+/**
+ * Wake-up sources returned by sleepUntilEvent
+ */
+enum WAKESOURCE
+{
+  WAKE_INTERVAL = 0,    // Sleeping interval elapsed
+  WAKE_EVENT            // Event signalled from an interrupt
+};
+
 
 /**
  * Class: PANSTAMP
@@ -107,6 +117,37 @@ class PANSTAMP
      */
     void setup_rtc(byte time);
 
+    /**
+     * getSleepStep
+     *
+     * Get the longest watchdog or RTC period that divides a sleeping
+     * interval
+     *
+     * 'interval'  Sleeping interval in seconds
+     * 'loops'     Number of periods needed to complete the interval
+     *
+     * Return:
+     *  WDTO_xx or RTC_xx period
+     */
+    byte getSleepStep(unsigned int interval, unsigned int *loops);
+
+    /**
+     * Sleeping periods left before the end of the current interval
+     */
+    unsigned int sleepLoops;
+
+    /**
+     * WDTO_xx or RTC_xx period the watchdog or the RTC is running for
+     * sleepUntilEvent. SLEEP_STEP_NONE if stopped or set up for another
+     * purpose
+     */
+    byte sleepStep;
+
+    /**
+     * Set from ISRs to end sleepUntilEvent
+     */
+    volatile bool eventPending;
+
   public:
     /**
      * repeater
@@ -145,6 +186,12 @@ class PANSTAMP
      */
     byte txInterval[2];
 
+    /**
+     * micros() when sleepUntilEvent last woke up. Used to measure
+     * wake-to-transmit latencies
+     */
+    unsigned long wakeTime;
+
     /**
      * Smart encryption password
      */
@@ -246,6 +293,29 @@ class PANSTAMP
      */
     void goToSleep(void);
 
+    /**
+     * sleepUntilEvent
+     *
+     * Sleep in power-down mode until signalEvent is called from an
+     * interrupt or until the end of the periodic Tx interval. The radio
+     * stays in power-down state when returning. Call wakeUp before
+     * transmitting. The Tx interval is resumed, not restarted, by the next
+     * call after an event
+     *
+     * 'pcMask'  Pin change ports (PCICR bits) able to wake the MCU
+     *
+     * Return:
+     *  WAKE_INTERVAL or WAKE_EVENT
+     */
+    WAKESOURCE sleepUntilEvent(byte pcMask);
+
+    /**
+     * signalEvent
+     *
+     * End sleepUntilEvent. To be called from ISRs
+     */
+    void signalEvent(void);
+
     /**
      * enterSystemState
      *
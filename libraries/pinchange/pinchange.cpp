@@ -0,0 +1,283 @@
+/**
+ * pinchange.cpp
+ *
+ * Pin change engine: binary inputs and pulse counters
+ */
+
+#include "pinchange.h"
+
+/**
+ * PINCHANGE
+ *
+ * Class constructor
+ */
+PINCHANGE::PINCHANGE(void)
+{
+  uint8_t i;
+
+  nbOfInputs = 0;
+  events = 0;
+  lastEvents = 0;
+
+  for(i=0 ; i<PINCHANGE_NB_OF_PORTS ; i++)
+  {
+    watch[i] = 0;
+    level[i] = 0;
+  }
+}
+
+/**
+ * readPort
+ *
+ * Read input register of a port
+ *
+ * 'port'  Port index
+ */
+uint8_t PINCHANGE::readPort(uint8_t port)
+{
+  switch(port)
+  {
+    case PINCHANGE_PORTB:
+      return PINB;
+    case PINCHANGE_PORTC:
+      return PINC;
+    default:
+      return PIND;
+  }
+}
+
+/**
+ * addInput
+ *
+ * Add input pin. To be called before begin()
+ *
+ * 'pin'       Arduino digital pin
+ * 'debounce'  Debounce time in us
+ *
+ * Return:
+ *  Input index. -1 if the pin has no PCINT or the table is full
+ */
+int8_t PINCHANGE::addInput(uint8_t pin, unsigned int debounce)
+{
+  INPUT_PIN *input;
+
+  if (digitalPinToPCICR(pin) == NULL || nbOfInputs == PINCHANGE_MAX_INPUTS)
+    return -1;
+
+  pinMode(pin, INPUT);
+
+  input = &inputs[nbOfInputs];
+  input->port = digitalPinToPCICRbit(pin);
+  input->mask = _BV(digitalPinToPCMSKbit(pin));
+  input->debounce = debounce;
+  input->last = 0;
+  input->edges = 0;
+  seen[nbOfInputs] = 0;
+  counts[nbOfInputs] = 0;
+  watch[input->port] |= input->mask;
+
+  return nbOfInputs++;
+}
+
+/**
+ * begin
+ *
+ * Take initial snapshots and enable the pin change interrupts
+ */
+void PINCHANGE::begin(void)
+{
+  uint8_t i, oldSREG = SREG;
+
+  cli();
+  for(i=0 ; i<PINCHANGE_NB_OF_PORTS ; i++)
+    level[i] = readPort(i) & watch[i];
+
+  PCMSK0 |= watch[PINCHANGE_PORTB];
+  PCMSK1 |= watch[PINCHANGE_PORTC];
+  PCMSK2 |= watch[PINCHANGE_PORTD];
+
+  for(i=0 ; i<PINCHANGE_NB_OF_PORTS ; i++)
+  {
+    if (watch[i])
+    {
+      PCIFR = _BV(i);
+      PCICR |= _BV(i);
+    }
+  }
+  SREG = oldSREG;
+}
+
+/**
+ * end
+ *
+ * Disable the pin change interrupts of the inputs
+ */
+void PINCHANGE::end(void)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  PCMSK0 &= ~watch[PINCHANGE_PORTB];
+  PCMSK1 &= ~watch[PINCHANGE_PORTC];
+  PCMSK2 &= ~watch[PINCHANGE_PORTD];
+  SREG = oldSREG;
+}
+
+/**
+ * sleep
+ *
+ * Expire the debounce lock-outs before a power-down sleep. A lock-out
+ * in progress is waited out first so that its bounces stay filtered
+ */
+void PINCHANGE::sleep(void)
+{
+  uint8_t i, oldSREG;
+  unsigned long now;
+  bool expired;
+  INPUT_PIN *input;
+
+  for(i=0 ; i<nbOfInputs ; i++)
+  {
+    input = &inputs[i];
+    do
+    {
+      oldSREG = SREG;
+      cli();
+      now = micros();
+      expired = (now - input->last >= input->debounce);
+      // Any time after this one is out of the lock-out
+      if (expired)
+        input->last = now - input->debounce;
+      SREG = oldSREG;
+    }
+    while (!expired);
+  }
+
+  // A level left behind now would not raise the interrupt that wakes us
+  resync();
+}
+
+/**
+ * handle
+ *
+ * Process pin changes on a port. To be called from PCINTx_vect
+ *
+ * 'port'  Port index (PINCHANGE_PORTB, PINCHANGE_PORTC or PINCHANGE_PORTD)
+ */
+void PINCHANGE::handle(uint8_t port)
+{
+  uint8_t i, state, diff;
+  unsigned long now;
+  INPUT_PIN *input;
+
+  state = readPort(port);
+  diff = (state ^ level[port]) & watch[port];
+
+  if (diff == 0)
+    return;
+
+  now = micros();
+
+  for(i=0 ; i<nbOfInputs ; i++)
+  {
+    input = &inputs[i];
+    if (input->port != port || !(diff & input->mask))
+      continue;
+
+    // Still bouncing from the last edge
+    if (now - input->last < input->debounce)
+      continue;
+
+    input->last = now;
+    level[port] ^= input->mask;
+    if (state & input->mask)
+      input->edges++;
+    events++;
+  }
+}
+
+/**
+ * resync
+ *
+ * Take the pins whose lock-out is over again. The last transition of a
+ * bounce may have fallen within the lock-out, leaving the debounced level
+ * on the wrong state with no edge to come that would correct it
+ */
+void PINCHANGE::resync(void)
+{
+  uint8_t i, oldSREG = SREG;
+
+  cli();
+  for(i=0 ; i<PINCHANGE_NB_OF_PORTS ; i++)
+  {
+    if (watch[i])
+      handle(i);
+  }
+  SREG = oldSREG;
+}
+
+/**
+ * update
+ *
+ * Fold the edges counted by the ISR into the 32-bit counts
+ *
+ * Return:
+ *  Bit mask of the inputs that counted new rising edges
+ */
+unsigned int PINCHANGE::update(void)
+{
+  uint8_t i;
+  unsigned int edges, res = 0;
+
+  resync();
+
+  for(i=0 ; i<nbOfInputs ; i++)
+  {
+    // Re-read until stable. The ISR may update one byte in between
+    do
+      edges = inputs[i].edges;
+    while (edges != inputs[i].edges);
+
+    if (edges != seen[i])
+    {
+      counts[i] += (unsigned int)(edges - seen[i]);
+      seen[i] = edges;
+      res |= 1 << i;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * changed
+ *
+ * Return true if any input changed since the last call
+ */
+bool PINCHANGE::changed(void)
+{
+  uint8_t ev = events;
+
+  if (ev == lastEvents)
+    return false;
+
+  lastEvents = ev;
+  return true;
+}
+
+/**
+ * read
+ *
+ * Read debounced input level
+ *
+ * 'input'  Input index
+ */
+bool PINCHANGE::read(uint8_t input)
+{
+  return (level[inputs[input].port] & inputs[input].mask) != 0;
+}
+
+/**
+ * Pre-instantiate PINCHANGE object
+ */
+PINCHANGE pinChange;
@@ -0,0 +1,219 @@
+/**
+ * pinchange.h
+ *
+ * Pin change engine: binary inputs and pulse counters updated from the
+ * PCINT interrupts. The ISR XORs the new port snapshot with the last
+ * debounced one and only visits the pins that changed. Each pin has its
+ * own lock-out debounce time: an edge closer than that to the previous
+ * accepted edge is ignored.
+ *
+ * Usage:
+ *
+ *   SIGNAL(PCINT2_vect) { pinChange.handle(PINCHANGE_PORTD); }
+ *
+ *   setup():  pinChange.addInput(5, 200); pinChange.begin();
+ *   loop():   if (pinChange.update() & 0x01) ... pinChange.count(0) ...
+ *
+ * Timer0 stops in power-down mode, so micros() does not advance whilst
+ * sleeping. Call sleep() before powering down or the edge that wakes the
+ * MCU up may be taken for a bounce of the last one.
+ *
+ * Edge counts are 16-bit free-running values written by the ISR only.
+ * update() folds them into the 32-bit counts without disabling
+ * interrupts, so it has to run at least once every 65535 edges per pin.
+ * It also takes the pins again once their lock-out is over, in case a
+ * bounce ended on a level the ISR ignored.
+ */
+
+#ifndef _PINCHANGE_H
+#define _PINCHANGE_H
+
+#include "Arduino.h"
+
+/**
+ * Max number of inputs
+ */
+#define PINCHANGE_MAX_INPUTS   16
+
+/**
+ * Port indexes (PCICR bits)
+ */
+#define PINCHANGE_PORTB        0
+#define PINCHANGE_PORTC        1
+#define PINCHANGE_PORTD        2
+#define PINCHANGE_NB_OF_PORTS  3
+
+/**
+ * Class: PINCHANGE
+ *
+ * Description:
+ * Interrupt-driven binary inputs and pulse counters
+ */
+class PINCHANGE
+{
+  private:
+    /**
+     * Input descriptor
+     */
+    struct INPUT_PIN
+    {
+      uint8_t port;              // Port index
+      uint8_t mask;              // Bit mask within the port
+      unsigned int debounce;     // Debounce time (us)
+      unsigned long last;        // Time of the last accepted edge (us)
+      volatile unsigned int edges;  // Rising edges, free-running
+    };
+
+    /**
+     * Inputs
+     */
+    INPUT_PIN inputs[PINCHANGE_MAX_INPUTS];
+    uint8_t nbOfInputs;
+
+    /**
+     * Watched bits and debounced levels per port
+     */
+    uint8_t watch[PINCHANGE_NB_OF_PORTS];
+    volatile uint8_t level[PINCHANGE_NB_OF_PORTS];
+
+    /**
+     * Accepted edges on any input, free-running
+     */
+    volatile uint8_t events;
+    uint8_t lastEvents;
+
+    /**
+     * Edge counts seen by update() and 32-bit counts
+     */
+    unsigned int seen[PINCHANGE_MAX_INPUTS];
+    unsigned long counts[PINCHANGE_MAX_INPUTS];
+
+    /**
+     * readPort
+     *
+     * Read input register of a port
+     *
+     * 'port'  Port index
+     */
+    uint8_t readPort(uint8_t port);
+
+    /**
+     * resync
+     *
+     * Take the pins whose lock-out is over again and accept the changes
+     * that were ignored as bounces
+     */
+    void resync(void);
+
+  public:
+    /**
+     * PINCHANGE
+     *
+     * Class constructor
+     */
+    PINCHANGE(void);
+
+    /**
+     * addInput
+     *
+     * Add input pin. To be called before begin()
+     *
+     * 'pin'       Arduino digital pin
+     * 'debounce'  Debounce time in us
+     *
+     * Return:
+     *  Input index. -1 if the pin has no PCINT or the table is full
+     */
+    int8_t addInput(uint8_t pin, unsigned int debounce=0);
+
+    /**
+     * begin
+     *
+     * Take initial snapshots and enable the pin change interrupts
+     */
+    void begin(void);
+
+    /**
+     * end
+     *
+     * Disable the pin change interrupts of the inputs
+     */
+    void end(void);
+
+    /**
+     * sleep
+     *
+     * Expire the debounce lock-outs before a power-down sleep. A lock-out
+     * in progress is waited out first so that its bounces stay filtered
+     */
+    void sleep(void);
+
+    /**
+     * handle
+     *
+     * Process pin changes on a port. To be called from PCINTx_vect
+     *
+     * 'port'  Port index (PINCHANGE_PORTB, PINCHANGE_PORTC or PINCHANGE_PORTD)
+     */
+    void handle(uint8_t port);
+
+    /**
+     * update
+     *
+     * Fold the edges counted by the ISR into the 32-bit counts. A pin
+     * that settled on a new level within its lock-out is taken again
+     * here
+     *
+     * Return:
+     *  Bit mask of the inputs that counted new rising edges
+     */
+    unsigned int update(void);
+
+    /**
+     * changed
+     *
+     * Return true if any input changed since the last call
+     */
+    bool changed(void);
+
+    /**
+     * read
+     *
+     * Read debounced input level
+     *
+     * 'input'  Input index
+     */
+    bool read(uint8_t input);
+
+    /**
+     * count
+     *
+     * Rising edges counted as of the last call to update()
+     *
+     * 'input'  Input index
+     */
+    inline unsigned long count(uint8_t input)
+    {
+      return counts[input];
+    }
+
+    /**
+     * setCount
+     *
+     * Set count of an input
+     *
+     * 'input'  Input index
+     * 'value'  New count
+     */
+    inline void setCount(uint8_t input, unsigned long value)
+    {
+      counts[input] = value;
+    }
+};
+
+/**
+ * Global PINCHANGE object
+ */
+extern PINCHANGE pinChange;
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * scheduler.cpp
+ *
+ * Cooperative task scheduler
+ */
+
+#include "scheduler.h"
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+
+/**
+ * TASK
+ *
+ * Class constructor
+ *
+ * 'func'  Function to run
+ */
+TASK::TASK(void (*func)(void))
+{
+  callback = func;
+  period = 0;
+  due = 0;
+  armed = false;
+  ready = false;
+  next = NULL;
+}
+
+/**
+ * every
+ *
+ * Run the task periodically
+ *
+ * 'interval'  Period in ms
+ * 'first'     Delay before the first run in ms
+ */
+void TASK::every(unsigned long interval, unsigned long first)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  period = interval;
+  due = millis() + first;
+  armed = true;
+  SREG = oldSREG;
+}
+
+/**
+ * after
+ *
+ * Run the task once after a delay. Replaces any pending timer
+ *
+ * 'delay'  Delay in ms
+ */
+void TASK::after(unsigned long delay)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  period = 0;
+  due = millis() + delay;
+  armed = true;
+  SREG = oldSREG;
+}
+
+/**
+ * stop
+ *
+ * Disarm the task timer and drop any pending signal
+ */
+void TASK::stop(void)
+{
+  armed = false;
+  ready = false;
+}
+
+/**
+ * SCHEDULER
+ *
+ * Class constructor
+ */
+SCHEDULER::SCHEDULER(void)
+{
+  tasks = NULL;
+}
+
+/**
+ * add
+ *
+ * Register task with the scheduler
+ *
+ * 'task'  Task to be added
+ */
+void SCHEDULER::add(TASK *task)
+{
+  TASK *t;
+
+  // Already registered?
+  for(t=tasks ; t != NULL ; t=t->next)
+  {
+    if (t == task)
+      return;
+  }
+
+  task->next = tasks;
+  tasks = task;
+}
+
+/**
+ * dispatch
+ *
+ * Run every task that is signalled or due
+ *
+ * Return:
+ *  true if at least one task ran
+ */
+bool SCHEDULER::dispatch(void)
+{
+  TASK *t;
+  bool ran = false, fire;
+  unsigned long now;
+  uint8_t oldSREG;
+
+  for(t=tasks ; t != NULL ; t=t->next)
+  {
+    fire = false;
+    now = millis();
+
+    // Timers may be re-armed from interrupt context
+    oldSREG = SREG;
+    cli();
+    if (t->ready)
+    {
+      t->ready = false;
+      fire = true;
+    }
+    // Wrap-safe comparison against the due time
+    else if (t->armed && (long)(now - t->due) >= 0)
+    {
+      fire = true;
+      if (t->period == 0)
+        t->armed = false;
+      else
+      {
+        t->due += t->period;
+        // Too far behind? Don't try to catch up with missed runs
+        if ((long)(now - t->due) >= 0)
+          t->due = now + t->period;
+      }
+    }
+    SREG = oldSREG;
+
+    if (fire)
+    {
+      t->callback();
+      ran = true;
+    }
+  }
+
+  return ran;
+}
+
+/**
+ * run
+ *
+ * Dispatch pending tasks or idle-sleep until the next interrupt.
+ * To be called from loop()
+ */
+void SCHEDULER::run(void)
+{
+  TASK *t;
+
+  if (dispatch())
+    return;
+
+  // Nothing ran. Sleep unless an ISR signalled a task meanwhile.
+  // Timer0 wakes us up at least once per millisecond
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  for(t=tasks ; t != NULL ; t=t->next)
+  {
+    if (t->ready)
+    {
+      sei();
+      return;
+    }
+  }
+  sleep_enable();
+  sei();        // The instruction after SEI is always executed
+  sleep_cpu();
+  sleep_disable();
+}
+
+/**
+ * Pre-instantiate SCHEDULER object
+ */
+SCHEDULER scheduler;
@@ -0,0 +1,183 @@
+/**
+ * scheduler.h
+ *
+ * Cooperative task scheduler for sketches that must stay responsive to
+ * radio commands. Tasks are statically allocated, run to completion from
+ * loop() and never block; the MCU idles between them.
+ *
+ * Usage:
+ *
+ *   void sample(void) { ... }
+ *   TASK sampleTask(sample);
+ *
+ *   setup():  scheduler.add(&sampleTask); sampleTask.every(5000);
+ *   loop():   scheduler.run();
+ *
+ * Interrupt handlers hand work over to the main loop with TASK::signal()
+ * or re-arm a timer with TASK::after().
+ */
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include "Arduino.h"
+
+class SCHEDULER;
+
+/**
+ * Class: TASK
+ *
+ * Description:
+ * Unit of work run by the scheduler
+ */
+class TASK
+{
+  friend class SCHEDULER;
+
+  private:
+    /**
+     * Function run each time the task fires
+     */
+    void (*callback)(void);
+
+    /**
+     * Period in ms. 0 for one-shot tasks
+     */
+    unsigned long period;
+
+    /**
+     * Next due time in ms (millis() time base)
+     */
+    unsigned long due;
+
+    /**
+     * True while the timer is armed
+     */
+    volatile bool armed;
+
+    /**
+     * Set from interrupt context to run the task on the next pass
+     */
+    volatile bool ready;
+
+    /**
+     * Next task in the scheduler list
+     */
+    TASK *next;
+
+  public:
+    /**
+     * TASK
+     *
+     * Class constructor
+     *
+     * 'func'  Function to run
+     */
+    TASK(void (*func)(void));
+
+    /**
+     * every
+     *
+     * Run the task periodically
+     *
+     * 'interval'  Period in ms
+     * 'first'     Delay before the first run in ms
+     */
+    void every(unsigned long interval, unsigned long first=0);
+
+    /**
+     * after
+     *
+     * Run the task once after a delay. Replaces any pending timer.
+     * Safe to call from interrupt context
+     *
+     * 'delay'  Delay in ms
+     */
+    void after(unsigned long delay);
+
+    /**
+     * stop
+     *
+     * Disarm the task timer and drop any pending signal
+     */
+    void stop(void);
+
+    /**
+     * signal
+     *
+     * Queue the task to run on the next scheduler pass.
+     * Safe to call from interrupt context
+     */
+    inline void signal(void)
+    {
+      ready = true;
+    }
+
+    /**
+     * isArmed
+     *
+     * Return true while the task timer is running
+     */
+    inline bool isArmed(void)
+    {
+      return armed;
+    }
+};
+
+/**
+ * Class: SCHEDULER
+ *
+ * Description:
+ * Timer list and ready queue for TASK objects
+ */
+class SCHEDULER
+{
+  private:
+    /**
+     * First task in the list
+     */
+    TASK *tasks;
+
+  public:
+    /**
+     * SCHEDULER
+     *
+     * Class constructor
+     */
+    SCHEDULER(void);
+
+    /**
+     * add
+     *
+     * Register task with the scheduler
+     *
+     * 'task'  Task to be added
+     */
+    void add(TASK *task);
+
+    /**
+     * dispatch
+     *
+     * Run every task that is signalled or due
+     *
+     * Return:
+     *  true if at least one task ran
+     */
+    bool dispatch(void);
+
+    /**
+     * run
+     *
+     * Dispatch pending tasks or idle-sleep until the next interrupt.
+     * To be called from loop()
+     */
+    void run(void);
+};
+
+/**
+ * Global SCHEDULER object
+ */
+extern SCHEDULER scheduler;
+
+#endif
+
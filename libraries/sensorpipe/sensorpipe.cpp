@@ -0,0 +1,231 @@
+/**
+ * sensorpipe.cpp
+ *
+ * Sensor sampling pipeline driven by a declarative table
+ */
+
+#include "sensorpipe.h"
+#include "panstamp.h"
+#include <avr/sleep.h>
+
+/**
+ * SENSORPIPE
+ *
+ * Class constructor
+ */
+SENSORPIPE::SENSORPIPE(void)
+{
+  sensors = NULL;
+  nbOfSensors = 0;
+  pending = 0;
+  startTime = 0;
+}
+
+/**
+ * begin
+ *
+ * Set the sensor table and switch all power pins off
+ *
+ * 'table'  Sensor table
+ * 'count'  Number of sensors in the table
+ */
+void SENSORPIPE::begin(const SENSOR *table, byte count)
+{
+  byte i;
+
+  if (count > SENSORPIPE_MAX_SENSORS)
+    count = SENSORPIPE_MAX_SENSORS;
+
+  sensors = table;
+  nbOfSensors = count;
+  pending = 0;
+
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    if (sensors[i].powerPin != SENSOR_NO_POWER)
+    {
+      pinMode(sensors[i].powerPin, OUTPUT);
+      digitalWrite(sensors[i].powerPin, LOW);
+    }
+  }
+}
+
+/**
+ * start
+ *
+ * Power all sensors up and start a sampling cycle. Ignored if a cycle
+ * is already in progress
+ */
+void SENSORPIPE::start(void)
+{
+  byte i;
+
+  if (busy() || nbOfSensors == 0)
+    return;
+
+  // All rails together so that settling times overlap
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    if (sensors[i].powerPin != SENSOR_NO_POWER)
+      digitalWrite(sensors[i].powerPin, HIGH);
+    pending |= 1 << i;
+  }
+
+  startTime = millis();
+}
+
+/**
+ * poll
+ *
+ * Sample the sensors whose settling time has elapsed. Registers are
+ * transmitted once all sensors have been sampled
+ *
+ * Return:
+ *  True when the cycle is complete
+ */
+bool SENSORPIPE::poll(void)
+{
+  byte i;
+  unsigned int mask;
+  unsigned long elapsed;
+
+  if (!busy())
+    return false;
+
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    mask = 1 << i;
+    if (!(pending & mask))
+      continue;
+
+    elapsed = millis() - startTime;
+    if (elapsed < sensors[i].settle)
+      continue;
+
+    if (sensors[i].sample())
+    {
+      pending &= ~mask;
+      powerOff(i);
+    }
+  }
+
+  if (busy())
+    return false;
+
+  transmit();
+
+  return true;
+}
+
+/**
+ * nextDue
+ *
+ * Return:
+ *  Time in ms before the next sensor needs to be polled
+ */
+unsigned long SENSORPIPE::nextDue(void)
+{
+  byte i;
+  unsigned long elapsed, wait, minWait = 0xFFFFFFFF;
+
+  if (!busy())
+    return minWait;
+
+  elapsed = millis() - startTime;
+
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    if (!(pending & (1 << i)))
+      continue;
+
+    // Settled but still being polled
+    if (elapsed >= sensors[i].settle)
+      return 0;
+
+    wait = sensors[i].settle - elapsed;
+    if (wait < minWait)
+      minWait = wait;
+  }
+
+  return minWait;
+}
+
+/**
+ * run
+ *
+ * Run a complete sampling cycle, idling between samples
+ */
+void SENSORPIPE::run(void)
+{
+  start();
+
+  while (!poll())
+  {
+    if (!busy())
+      return;
+
+    // Timer0 wakes us up every millisecond
+    if (nextDue() > 0)
+    {
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+    }
+  }
+}
+
+/**
+ * powerOff
+ *
+ * Switch the power pin of a sensor off unless another pending sensor
+ * uses it
+ *
+ * 'index'  Sensor index
+ */
+void SENSORPIPE::powerOff(byte index)
+{
+  byte i;
+  uint8_t pin = sensors[index].powerPin;
+
+  if (pin == SENSOR_NO_POWER)
+    return;
+
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    if ((pending & (1 << i)) && sensors[i].powerPin == pin)
+      return;
+  }
+
+  digitalWrite(pin, LOW);
+}
+
+/**
+ * transmit
+ *
+ * Transmit every register of the table once
+ */
+void SENSORPIPE::transmit(void)
+{
+  byte i, j;
+  byte regId;
+
+  for(i=0 ; i<nbOfSensors ; i++)
+  {
+    regId = sensors[i].regId;
+    if (regId == SENSOR_NO_REG)
+      continue;
+
+    // Already transmitted for a previous sensor?
+    for(j=0 ; j<i ; j++)
+    {
+      if (sensors[j].regId == regId)
+        break;
+    }
+    if (j == i)
+      getRegister(regId)->getData();
+  }
+}
+
+/**
+ * Pre-instantiate SENSORPIPE object
+ */
+SENSORPIPE sensorPipe;
@@ -0,0 +1,176 @@
+/**
+ * sensorpipe.h
+ *
+ * Sensor sampling pipeline driven by a declarative table. Every sensor
+ * has a power pin, a settling time, a sampling function and the register
+ * transmitted with its reading. All power rails are switched on together
+ * at the start of a cycle and each sensor is sampled as soon as its own
+ * settling time has elapsed, so that settling times overlap: a cycle
+ * lasts as long as the slowest sensor instead of the sum of all of them.
+ * A rail is switched off as soon as the last sensor using it is done.
+ *
+ * Usage:
+ *
+ *   bool readSoil(void) { dtSoil[0] = ...; return true; }
+ *
+ *   const SENSOR sensors[] = {
+ *     {POWER_PIN, 10, readSoil, REGI_SOIL},
+ *   };
+ *
+ *   setup():  sensorPipe.begin(sensors, sizeof(sensors)/sizeof(SENSOR));
+ *   loop():   sensorPipe.run();        // Blocking, idles meanwhile
+ *
+ * Non-blocking sketches call start() and then poll() until it returns
+ * true, waiting nextDue() ms between calls.
+ *
+ * Sampling functions return false when they have to be polled again,
+ * e.g. while a conversion started from the previous call is in progress.
+ */
+
+#ifndef _SENSORPIPE_H
+#define _SENSORPIPE_H
+
+#include "Arduino.h"
+
+/**
+ * Max number of sensors in a table
+ */
+#define SENSORPIPE_MAX_SENSORS  16
+
+/**
+ * Sensor not powered from a pin
+ */
+#define SENSOR_NO_POWER         0xFF
+
+/**
+ * No register to be transmitted
+ */
+#define SENSOR_NO_REG           0xFF
+
+/**
+ * Sensor table entry
+ */
+struct SENSOR
+{
+  uint8_t powerPin;           // Pin powering the sensor or SENSOR_NO_POWER
+  unsigned int settle;        // Time from power-up to the first sample (ms)
+  bool (*sample)(void);       // Sampling function. False to be polled again
+  byte regId;                 // Register to be transmitted or SENSOR_NO_REG
+};
+
+/**
+ * Class: SENSORPIPE
+ *
+ * Description:
+ * Power-gated sensor sampling scheduler
+ */
+class SENSORPIPE
+{
+  private:
+    /**
+     * Sensor table
+     */
+    const SENSOR *sensors;
+
+    /**
+     * Number of sensors
+     */
+    byte nbOfSensors;
+
+    /**
+     * Sensors still to be sampled in this cycle (bit i = sensor i)
+     */
+    unsigned int pending;
+
+    /**
+     * millis() at the start of the cycle
+     */
+    unsigned long startTime;
+
+    /**
+     * powerOff
+     *
+     * Switch the power pin of a sensor off unless another pending sensor
+     * uses it
+     *
+     * 'index'  Sensor index
+     */
+    void powerOff(byte index);
+
+    /**
+     * transmit
+     *
+     * Transmit every register of the table once
+     */
+    void transmit(void);
+
+  public:
+    /**
+     * SENSORPIPE
+     *
+     * Class constructor
+     */
+    SENSORPIPE(void);
+
+    /**
+     * begin
+     *
+     * Set the sensor table and switch all power pins off
+     *
+     * 'table'  Sensor table
+     * 'count'  Number of sensors in the table
+     */
+    void begin(const SENSOR *table, byte count);
+
+    /**
+     * start
+     *
+     * Power all sensors up and start a sampling cycle. Ignored if a cycle
+     * is already in progress
+     */
+    void start(void);
+
+    /**
+     * poll
+     *
+     * Sample the sensors whose settling time has elapsed. Registers are
+     * transmitted once all sensors have been sampled
+     *
+     * Return:
+     *  True when the cycle is complete
+     */
+    bool poll(void);
+
+    /**
+     * nextDue
+     *
+     * Return:
+     *  Time in ms before the next sensor needs to be polled
+     */
+    unsigned long nextDue(void);
+
+    /**
+     * run
+     *
+     * Run a complete sampling cycle, idling between samples
+     */
+    void run(void);
+
+    /**
+     * busy
+     *
+     * Return:
+     *  True while a cycle is in progress
+     */
+    inline bool busy(void)
+    {
+      return pending != 0;
+    }
+};
+
+/**
+ * Global SENSORPIPE object
+ */
+extern SENSORPIPE sensorPipe;
+
+#endif
@@ -1,6 +1,32 @@
 #include <Arduino.h>
 #include "utils.h"
 
-bool timeElapsed(int previous, int interval){
-	return (millis() - previous ) >= interval;
+INTERVAL::INTERVAL(unsigned long ms){
+	period = ms;
+	last = 0;
+}
+
+bool INTERVAL::due(void){
+	unsigned long now = millis();
+
+	if((unsigned long)(now - last) < period)
+		return false;
+
+	last += period;
+	// Too far behind? Don't try to catch up with missed periods
+	if((unsigned long)(now - last) >= period)
+		last = now;
+	return true;
+}
+
+void INTERVAL::restart(void){
+	last = millis();
+}
+
+void INTERVAL::setPeriod(unsigned long ms){
+	period = ms;
+}
+
+unsigned long INTERVAL::elapsed(void){
+	return millis() - last;
 }
@@ -1,6 +1,37 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-extern bool timeElapsed(int previous, int interval);
+/**
+ * Wrap-safe periodic timer on the 32-bit millis() time base.
+ * Elapsed times are computed as unsigned differences so they stay right
+ * across the 49.7-day millis() rollover.
+ *
+ * Usage:
+ *
+ *   INTERVAL sampling(500);
+ *   loop():  if (sampling.due()) { ... }
+ */
+class INTERVAL
+{
+	private:
+		unsigned long last;
+		unsigned long period;
+
+	public:
+		INTERVAL(unsigned long ms);
+
+		// True once per period. Re-arms from the previous due time so the
+		// period doesn't drift with loop latency
+		bool due(void);
+
+		// Start counting the period from now
+		void restart(void);
+
+		// Change the period
+		void setPeriod(unsigned long ms);
+
+		// Time since the last due time or restart (ms)
+		unsigned long elapsed(void);
+};
 
 #endif
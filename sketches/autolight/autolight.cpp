@@ -4,6 +4,7 @@
 #include <digitalWriteFast.h>
 #include <EEPROM.h>
 #include <utils.h>
+#include "adcsampler.h"
 #include "product.h"
 #include "panstamp.h"
 #include "regtable.h"
@@ -11,32 +12,67 @@
 
 reading light_data;
 
-#define LIGHT_LOW_LIMIT 80
-
+/**
+ * Light sensor. Sampled from the ADC interrupt every LIGHT_SAMPLE_MILLIS
+ * as a 12-bit oversampled value
+ */
 #define A5_PHOTO A5
-int A5_MIN  = 100;
-int A5_MAX = 100;
-#define A5_READS 10
-int A5_READS_OVER = 0;
-int A5_READS_UNDER = 0;
+#define LIGHT_SAMPLE_MILLIS 250
+#define LIGHT_EXTRA_BITS 2
+
+/**
+ * Light estimate: EWMA with alpha = 1/2^LIGHT_EWMA_SHIFT (~4 s time
+ * constant), kept with LIGHT_AVG_FRAC fractional bits
+ */
+#define LIGHT_EWMA_SHIFT 4
+#define LIGHT_AVG_FRAC 4
+
+/**
+ * Auto-ranging. The range follows the darkest and brightest estimates
+ * seen, and shrinks by 1/2^RANGE_DECAY_SHIFT every RANGE_DECAY_MILLIS so
+ * that a single flash doesn't stretch it for ever
+ */
+#define RANGE_MIN_SPAN 64
+#define RANGE_DECAY_MILLIS 60000UL
+#define RANGE_DECAY_SHIFT 8
+
+/**
+ * Hysteresis thresholds in 1/256 of the range. The relay switches on
+ * below LIGHT_ON_LIMIT and off above LIGHT_OFF_LIMIT
+ */
+#define LIGHT_ON_LIMIT 192	// 75 %
+#define LIGHT_OFF_LIMIT 218	// 85 %
 
-int A5_LIGHT = 0;
+static volatile unsigned int lightAvg = 0;
+static volatile bool lightPrimed = false;
+static volatile bool lightReady = false;
 
-int INTERVAL_MILLIS = 500;
-int PREVIOUS_MILLIS = 0;
+unsigned int lightMin = 0;
+unsigned int lightMax = 0;
+unsigned int lightOnLevel = 0;
+unsigned int lightOffLevel = 0;
+
+INTERVAL sampleTimer(LIGHT_SAMPLE_MILLIS);
+INTERVAL decayTimer(RANGE_DECAY_MILLIS);
 
 #define D3_RELAY 3
 #define D3_ON	 0
 
+bool relayOn = false;
+
 void setup();
 void loop();
 
 
 void setup_photocell();
 void loop_photocell();
+void light_sample(unsigned int value);
+void update_range(unsigned int level);
+void set_levels();
+void decay_range();
 
 void setup_relay();
-void loop_relay();
+void loop_relay(unsigned int level);
 
 /**
  * setup
@@ -57,13 +93,22 @@ void setup()
  */
 void loop()
 {
-  DDRB = 1 << 12;
-
-  bool can_loop = timeElapsed(PREVIOUS_MILLIS, INTERVAL_MILLIS);
-	PREVIOUS_MILLIS = millis();
-	if(can_loop){
+	if(sampleTimer.due())
 		loop_photocell();
-		loop_relay();
+
+	if(decayTimer.due())
+		decay_range();
+
+	if(lightReady){
+		unsigned int level;
+
+		noInterrupts();
+		lightReady = false;
+		level = lightAvg >> LIGHT_AVG_FRAC;
+		interrupts();
+
+		update_range(level);
+		loop_relay(level);
 	}
 }
 
@@ -71,47 +116,100 @@ void loop()
 void setup_photocell(){
 	//set pin A5 to INPUT
 	pinModeFast(A5_PHOTO, INPUT);
-	A5_MAX = analogRead(A5_PHOTO);
+	lightMin = lightMax = adc.read(A5_PHOTO, LIGHT_EXTRA_BITS);
+	set_levels();
 }
 
+/**
+ * Start an oversampled conversion. light_sample() gets the result from
+ * the ADC interrupt
+ */
 void loop_photocell(){
-	int current = analogRead(A5_PHOTO);
-	if(current < A5_MIN){
-		A5_MIN = current;
-	}else if(current > A5_MAX){
-		A5_MAX = current;
+	adc.start(A5_PHOTO, LIGHT_EXTRA_BITS, light_sample);
+}
+
+/**
+ * Fold a new sample into the EWMA. Runs from the ADC interrupt
+ */
+void light_sample(unsigned int value){
+	long sample = (long)value << LIGHT_AVG_FRAC;
+
+	if(!lightPrimed){
+		lightAvg = sample;
+		lightPrimed = true;
+	}else{
+		lightAvg += (sample - (long)lightAvg) >> LIGHT_EWMA_SHIFT;
 	}
-	A5_LIGHT = map(current, A5_MIN, A5_MAX, 0, 100);
-	if (A5_LIGHT < LIGHT_LOW_LIMIT){
-		if(A5_READS_UNDER > 0){
-			A5_READS_UNDER--;	
-		}
-		if(A5_READS_OVER < 10){
-			A5_READS_OVER = 10;
-		}
+	lightReady = true;
+}
+
+/**
+ * Widen the range if needed
+ */
+void update_range(unsigned int level){
+	if(level < lightMin){
+		lightMin = level;
+	}else if(level > lightMax){
+		lightMax = level;
 	}else{
-		if(A5_READS_OVER > 0){
-			A5_READS_OVER--;
-		}
-		if(A5_READS_UNDER < 10){
-			A5_READS_UNDER = 10;
-		}
+		return;
 	}
+	set_levels();
+}
+
+/**
+ * Recompute the switching levels. They only change with the range so no
+ * division is done per sample
+ */
+void set_levels(){
+	unsigned long span = lightMax - lightMin;
+
+	lightOnLevel = lightMin + ((span * LIGHT_ON_LIMIT) >> 8);
+	lightOffLevel = lightMin + ((span * LIGHT_OFF_LIMIT) >> 8);
 #ifdef TRACE 
-	Serial.print("Light: ");
-	Serial.println(A5_LIGHT);
+	Serial.print("Range: ");
+	Serial.print(lightMin);
+	Serial.print(" - ");
+	Serial.println(lightMax);
 #endif
 }
 
+/**
+ * Shrink the range towards its middle
+ */
+void decay_range(){
+	unsigned int step = (lightMax - lightMin) >> RANGE_DECAY_SHIFT;
+
+	if(lightMax - lightMin <= RANGE_MIN_SPAN || step == 0)
+		return;
+	lightMin += step;
+	lightMax -= step;
+	set_levels();
+}
+
 void setup_relay(){
 	//set pin D3 to OUTPUT
 	pinModeFast(D3_RELAY, OUTPUT);
+	digitalWriteFast(D3_RELAY, LOW);
 }
 
-void loop_relay(){
-	if(A5_READS_UNDER == 0){
-		digitalWrite(D3_RELAY, HIGH);
-	}else if(A5_READS_OVER == 0){
-		digitalWrite(D3_RELAY, LOW);
+/**
+ * Switch the relay on in the dark, off in the light, with hysteresis.
+ * Nothing is switched until the range is wide enough to be meaningful
+ */
+void loop_relay(unsigned int level){
+	if(lightMax - lightMin < RANGE_MIN_SPAN)
+		return;
+
+	if(!relayOn && level < lightOnLevel){
+		digitalWriteFast(D3_RELAY, HIGH);
+		relayOn = true;
+	}else if(relayOn && level > lightOffLevel){
+		digitalWriteFast(D3_RELAY, LOW);
+		relayOn = false;
 	}
+#ifdef TRACE 
+	Serial.print("Light: ");
+	Serial.println(level);
+#endif
 }
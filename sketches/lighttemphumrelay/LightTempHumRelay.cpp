@@ -2,29 +2,43 @@
 #include <EEPROM.h>
 #include "product.h"
 #include "panstamp.h"
+#include "adcsampler.h"
 #include "regtable.h"
 #include <dht11.h>
+#include "scheduler.h"
+#include "sensorpipe.h"
 
 #define LEDRED  PD5
 #define LEDGRN  PD3
 
+// Task timing (ms)
+#define SENSOR_PERIOD     5000
+#define TEMPHUM_SETTLE    1500
+#define LIGHT_SETTLE      200
+#define LED_ACK_TIME      100
+#define SYNC_BLINK_STEPS  24    // 6 x (green, off, red, off)
+
 const void updateVoltage(byte rId);
-const void updateLightSensor(byte rId);
-const void updateTempHumSensor(byte rId);
 const void setSendSensorStates( byte rId, byte *state);
 const void selectRelay( byte rId, byte *state);
 const void switchRelay( byte rId, byte *state);
 const void updateRelayStates(byte rId);
+const void setRelayStates( byte rId, byte *state);
 const void setSendRelayStates( byte rId, byte *state);
 
-void readTempHum();
+void readTempHum(int status);
+bool sampleTempHum();
+bool sampleLight();
+
+void taskSensors();
+void taskSyncBlink();
+void taskRelayReport();
+void taskSensorReport();
 
 void setup();
 void loop();
 
 void setupOutPin(int p);
-void addPinSet(uint8_t sensorPin, uint8_t mode, uint8_t pwr);
-void setupSensorPin(uint8_t sensorPin, uint8_t mode, uint8_t pwr);
 void setupRelayPin(uint8_t sPin);
 void setupRelays();
 
@@ -35,6 +49,15 @@ void ledRedGreen();
 
 void onRelay(uint8_t relay);
 void offRelay(uint8_t relay);
+void writeRelays(uint8_t states);
+
+dht11 DHT(DHT11_TYPE);
+
+TASK sensorTask(taskSensors);
+TASK syncBlinkTask(taskSyncBlink);
+TASK ledOffTask(ledOff);
+TASK relayReportTask(taskRelayReport);
+TASK sensorReportTask(taskSensorReport);
 
 uint8_t oPinsNum = 0;
 uint8_t oPins[] = { 0, 0, 0, 0, 0};
@@ -45,32 +68,6 @@ void setupOutPin(int p){
   oPinsNum++;
 }
 
-uint8_t sPinsNum = 0;
-uint8_t sPins[] = {0,0,0,0,0,0,0,0};
-uint8_t mPins[] = {0,0,0,0,0,0,0,0};
-uint8_t pPins[] = {0,0,0,0,0,0,0,0}; 
-void addPinSet(uint8_t sPin, uint8_t mode, uint8_t pwr){
-  sPins[sPinsNum] = sPin;
-  mPins[sPinsNum] = mode;
-  pPins[sPinsNum] = pwr;
-  sPinsNum++;
-}
-void setupSensorPin(uint8_t sPin, uint8_t mode, uint8_t pwr){
-  //setup power pin
-  pinMode(pwr, OUTPUT);
-  //turn off power pin initially
-  digitalWrite(pwr, LOW);
-
-  pinMode(sPin, mode);
-  if(mode == OUTPUT){  
-    digitalWrite(sPin, HIGH);
-
-  }else{
-    //enable pull-up resistor
-    digitalWrite(sPin, HIGH);   
-  }
-}
-
 void setupRelayPin(uint8_t sPin){
   pinMode(sPin, OUTPUT);
   digitalWrite(sPin, LOW);
@@ -85,28 +82,81 @@ void setupRelayPin(uint8_t sPin){
 #define SENSOR_LIGHT_MODE   INPUT
 
 
-#define SENSOR_RELAY  A3
-#define SENSOR_RELAY_MODE   OUTPUT
-#define SENSOR_RELAY_PWR  A2
+// Sensor table. Both sensors are powered up together every SENSOR_PERIOD
+// ms. Their registers are transmitted on request only
+const SENSOR sensors[] = {
+  {SENSOR_LIGHT_PWR, LIGHT_SETTLE, sampleLight, SENSOR_NO_REG},
+  {SENSOR_DHT_11_PWR, TEMPHUM_SETTLE, sampleTempHum, SENSOR_NO_REG}
+};
 
-static uint8_t relays[] = { A3, A2, A6, A7, PD3, PD5, PD6, PD7};
-static uint8_t relays_states[] = { 0, 0, 0, 0, 0, 0 ,0, 0 };
+// No pin for relays 5 and 6: PD3 and PD5 drive the LEDs
+#define RELAY_NOPIN 0xFF
+static uint8_t relays[] = { A3, A2, A6, A7, RELAY_NOPIN, RELAY_NOPIN, PD6, PD7};
 static uint8_t relays_count = 8;
-static uint8_t send_states = 0;
+// Relay states, bit i = relay i
+static volatile uint8_t relays_states = 0;
+
+// Port masks precomputed by setupRelays(). Relays are driven with one
+// read-modify-write per port so that all of them switch together.
+#define RELAY_PORTC  0
+#define RELAY_PORTD  1
+#define RELAY_NOPORT 0xFF
+static uint8_t relays_port[8];          // RELAY_PORTx for each relay
+static uint8_t relays_bit[8];           // Port bit for each relay
+static uint8_t relays_port_mask[2];     // All relay bits in PORTC / PORTD
+
 void setupRelays(){
   uint8_t count = relays_count;
+  uint8_t port;
+  relays_port_mask[RELAY_PORTC] = 0;
+  relays_port_mask[RELAY_PORTD] = 0;
   for(int i = 0; i < count; i++){
+    relays_port[i] = RELAY_NOPORT;
+    relays_bit[i] = 0;
+    // A6/A7 are analog-only inputs and can't drive a relay. Same for
+    // RELAY_NOPIN
+    if(relays[i] >= NUM_DIGITAL_PINS)
+      continue;
     setupRelayPin(relays[i]);
-    relays_states[i] = 0;
+    port = digitalPinToPort(relays[i]);
+    if(port == PC)
+      relays_port[i] = RELAY_PORTC;
+    else if(port == PD)
+      relays_port[i] = RELAY_PORTD;
+    else
+      continue;
+    relays_bit[i] = digitalPinToBitMask(relays[i]);
+    relays_port_mask[relays_port[i]] |= relays_bit[i];
+  }
+  writeRelays(0);
+}
+/**
+ * writeRelays
+ *
+ * Switch all relays at once
+ *
+ * 'states'  Bit i set = relay i on
+ */
+void writeRelays(uint8_t states){
+  uint8_t out[2] = {0, 0};
+  for(uint8_t i = 0; i < relays_count; i++){
+    if((states & (1 << i)) && relays_port[i] != RELAY_NOPORT)
+      out[relays_port[i]] |= relays_bit[i];
   }
+  uint8_t oldSREG = SREG;
+  cli();
+  PORTC = (PORTC & ~relays_port_mask[RELAY_PORTC]) | out[RELAY_PORTC];
+  PORTD = (PORTD & ~relays_port_mask[RELAY_PORTD]) | out[RELAY_PORTD];
+  relays_states = states;
+  SREG = oldSREG;
 }
 void onRelay(uint8_t relay){
-  digitalWrite(relays[relay], HIGH);
-  relays_states[relay] = 1;
+  if(relay < relays_count)
+    writeRelays(relays_states | (1 << relay));
 }
 void offRelay(uint8_t relay){
-  digitalWrite(relays[relay], LOW);  
-  relays_states[relay] = 0;
+  if(relay < relays_count)
+    writeRelays(relays_states & ~(1 << relay));
 }
 
 void ledOff(){
@@ -142,9 +192,10 @@ void setup()
   // Init panStamp
 
   setupRelays();
-  addPinSet(SENSOR_DHT_11, SENSOR_DHT_11_MODE, SENSOR_DHT_11_PWR);
-  addPinSet(SENSOR_RELAY, SENSOR_RELAY_MODE, SENSOR_RELAY_PWR);
-  addPinSet(SENSOR_LIGHT, SENSOR_LIGHT_MODE, SENSOR_LIGHT_PWR);
+  // Sensors stay unpowered between readings
+  sensorPipe.begin(sensors, sizeof(sensors)/sizeof(SENSOR));
+  pinMode(SENSOR_DHT_11, SENSOR_DHT_11_MODE);
+  pinMode(SENSOR_LIGHT, SENSOR_LIGHT_MODE);
 
 
   panstamp.init();
@@ -161,21 +212,16 @@ void setup()
   panstamp.enterSystemState(SYSTATE_SYNC);
 
   //Serial.println("\tListening for commands...");
-  // During 3 seconds, listen the network for possible commands whilst the LED blinks
-  for(int i=0 ; i<6 ; i++)
-  {
-    ledGreen();
-    delay(1000);
-    ledOff();
-    delay(1000);
-    ledRed();
-    delay(1000);
-    ledOff();
-    delay(3000);
-  }
+  // Listen the network for possible commands whilst the LED blinks.
+  // taskSyncBlink switches to Rx ON state once the pattern is over
+  scheduler.add(&syncBlinkTask);
+  syncBlinkTask.signal();
 
-  // Switch to Rx OFF state
-  panstamp.enterSystemState(SYSTATE_RXON);
+  scheduler.add(&sensorTask);
+  sensorTask.signal();
+  scheduler.add(&ledOffTask);
+  scheduler.add(&relayReportTask);
+  scheduler.add(&sensorReportTask);
 
   //Serial.print("Product Code: ");
   //Serial.println(getRegister(REGI_PRODUCTCODE)->value[8], DEC);
@@ -194,7 +240,7 @@ void setup()
   //Serial.print("Relays On/Off Register: ");
   //Serial.println(REGI_I_RELAYSWITCH, DEC);
   //Serial.print("Relays States: ");
-  //Serial.println(REGI_O_RELAYS_STATES, DEC);
+  //Serial.println(REGI_IO_RELAYS_STATES, DEC);
   //Serial.print("Request Relays States: ");
   //Serial.println(REGI_I_SEND_RELAYS_STATES, DEC);
 
@@ -207,20 +253,125 @@ void setup()
  */
 void loop()
 {
-  readTempHum();
-  if(send_states == 1){
-    getRegister(REGI_O_RELAYS_STATES)->getData();
-    send_states = 0;
+  // Run due tasks or idle until the next interrupt
+  scheduler.run();
+}
+
+/**
+ * taskSyncBlink
+ *
+ * Blink the LEDs while in SYNC state, then enter Rx ON state
+ */
+void taskSyncBlink()
+{
+  static uint8_t step = 0;
+
+  if(step == SYNC_BLINK_STEPS){
     ledOff();
+    // Switch to Rx ON state
+    panstamp.enterSystemState(SYSTATE_RXON);
+    return;
+  }
+
+  switch(step++ % 4){
+    case 0:
+      ledGreen();
+      syncBlinkTask.after(1000);
+      break;
+    case 1:
+      ledOff();
+      syncBlinkTask.after(1000);
+      break;
+    case 2:
+      ledRed();
+      syncBlinkTask.after(1000);
+      break;
+    default:
+      ledOff();
+      syncBlinkTask.after(3000);
+      break;
+  }
+}
+
+/**
+ * taskSensors
+ *
+ * Start a sampling cycle of the sensor table, poll it until every sensor
+ * has been sampled, then wait for the next period
+ */
+void taskSensors()
+{
+  static unsigned long cycleStart;
+  unsigned long elapsed, wait;
+
+  if(!sensorPipe.busy()){
+    ledRedGreen();
+    cycleStart = millis();
+    sensorPipe.start();
+  }
+
+  if(sensorPipe.poll()){
+    elapsed = millis() - cycleStart;
+    sensorTask.after(elapsed < SENSOR_PERIOD ? SENSOR_PERIOD - elapsed : 0);
+    return;
+  }
+
+  // Sensors still settling or converting
+  wait = sensorPipe.nextDue();
+  sensorTask.after(wait > 0 ? wait : 1);
+}
+
+/**
+ * sampleTempHum
+ *
+ * Start a DHT11 conversion on the first call, then drive it until
+ * readTempHum() gets the result
+ *
+ * Return:
+ *  True once the conversion is over
+ */
+bool sampleTempHum()
+{
+  static bool converting = false;
+
+  if(converting){
+    if(DHT.busy())
+      DHT.update();
+    if(DHT.busy())
+      return false;
+    converting = false;
+    return true;
   }
-  //getRegister(REGI_O_VOLTSUPPLY)->getData();
-  delay(200);
-  //getRegister(REGI_O_SENSOR_LIGHT)->getData();
-  delay(200);
-  //getRegister(REGI_O_SENSOR_TEMP_HUM)->getData();
-  //delay(200);
-  //getRegister(REGI_O_RELAYS_STATES)->getData();
-  //delay(1000);
+
+  if(DHT.start(SENSOR_DHT_11, readTempHum) != DHTLIB_OK){
+    readTempHum(DHTLIB_ERROR_PIN);
+    return true;
+  }
+  converting = true;
+  return false;
+}
+
+/**
+ * taskRelayReport
+ *
+ * Transmit relay states as requested from the network
+ */
+void taskRelayReport()
+{
+  getRegister(REGI_IO_RELAYS_STATES)->getData();
+  ledOff();
+}
+
+/**
+ * taskSensorReport
+ *
+ * Transmit the latest sensor readings as requested from the network
+ */
+void taskSensorReport()
+{
+  getRegister(REGI_O_VOLTSUPPLY)->getData();
+  getRegister(REGI_O_SENSOR_LIGHT)->getData();
+  getRegister(REGI_O_SENSOR_TEMP_HUM)->getData();
 }
 
 /**
@@ -241,11 +392,11 @@ DEFINE_COMMON_REGISTERS()
   REGISTER regVoltage(dtVoltage, sizeof(dtVoltage), &updateVoltage, NULL);
 
   static byte dtSensor[2];
-  REGISTER regSensorLight(dtSensor, sizeof(dtSensor), &updateLightSensor, NULL);
+  REGISTER regSensorLight(dtSensor, sizeof(dtSensor), NULL, NULL);
 
   // Sensor value register (dual sensor)
   static byte dtSensorTempHum[4];
-  REGISTER regSensorTempHum(dtSensorTempHum, sizeof(dtSensorTempHum), &updateTempHumSensor, NULL);
+  REGISTER regSensorTempHum(dtSensorTempHum, sizeof(dtSensorTempHum), NULL, NULL);
 
   static byte dtSendSensorStates[1];
   REGISTER regSendSensorStates(dtSendSensorStates, sizeof(dtSendSensorStates), NULL, &setSendSensorStates);
@@ -256,8 +407,9 @@ DEFINE_COMMON_REGISTERS()
   static byte dtRelaySwitch[1];
   REGISTER regRelaySwitch(dtRelaySwitch, sizeof(dtRelaySwitch), NULL, &switchRelay );
 
-  static byte dtRelayStates[8];
-  REGISTER regRelayStates(dtRelayStates, sizeof(dtRelayStates), &updateRelayStates, NULL);
+  // Relay states bitmask. Writing it switches all relays in one command
+  static byte dtRelayStates[1];
+  REGISTER regRelayStates(dtRelayStates, sizeof(dtRelayStates), &updateRelayStates, &setRelayStates);
 
   static byte dtSendRelayStates[1];
   REGISTER regSendRelayStates(dtSendRelayStates, sizeof(dtSendRelayStates), NULL, &setSendRelayStates);
@@ -292,23 +444,13 @@ const void updateVoltage(byte rId)
 {  
   unsigned long result;
 
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
-  uint8_t voltageSupply = result;     // Update global variable Vcc
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
 
 #ifdef VOLT_SUPPLY_A7
 
   // Read voltage supply from A7
-  unsigned short ref = voltageSupply;
-  result = analogRead(7);
-  result *= ref;
-  result /= 1024;
+  result = adc.readMillivolts(7);
 #endif
 
   /**
@@ -321,63 +463,54 @@ const void updateVoltage(byte rId)
   regTable[rId]->value[1] = result & 0xFF;
   //return 0;
 }
-const void updateLightSensor(byte rId)
-{
-  //setupSensorPin(SENSOR_LIGHT,SENSOR_LIGHT_MODE, SENSOR_LIGHT_PWR  );
-  pinMode(SENSOR_LIGHT_PWR, OUTPUT);
-  digitalWrite(SENSOR_LIGHT_PWR, LOW);
-
-  pinMode(SENSOR_LIGHT, INPUT);
-  digitalWrite(SENSOR_LIGHT_PWR, HIGH);
-  delay(200);
-
-  int lumin = analogRead(SENSOR_LIGHT);
-  digitalWrite(SENSOR_LIGHT_PWR, LOW);
-  int val = map(lumin, 0, 1023, 0, 100);
-
+/**
+ * sampleLight
+ *
+ * Sample the (already powered) light sensor into its register.
+ * Registers without an updater report the latest sample
+ *
+ * Return:
+ *  Always true
+ */
+bool sampleLight(){
+  // 12-bit oversampled reading
+  unsigned int lumin = adc.read(SENSOR_LIGHT, 2);
+  // Rounded percentage, 4095 is 100 %
+  int val = ((unsigned long)lumin * 100 + 2047) / 4095;
 
+  noInterrupts();
   dtSensor[0] = (val >> 8) & 0xFF;
   dtSensor[1] = val & 0xFF;
-  //return 0;
-}
-void readTempHum(){
-  int temperature, humidity, chk;
-  int pwr = SENSOR_DHT_11_PWR;
-  int sPin = SENSOR_DHT_11;
-  int mode = SENSOR_DHT_11_MODE;
-  //setupSensorPin(SENSOR_DHT_11,SENSOR_DHT_11_MODE, SENSOR_DHT_11_PWR  );
-
-  //setup power pin
-  pinMode(pwr, OUTPUT);
-  //turn off power pin initially
-  digitalWrite(pwr, LOW);
-
-  pinMode(sPin, mode);
-  //enable pull-up resistor
-  //digitalWrite(sPin, HIGH);   
-
-  ledRedGreen();
-  dht11 DHT;
-  digitalWrite(SENSOR_DHT_11_PWR, HIGH);
-  delay(1500);
+  interrupts();
 
-  chk = DHT.read(sPin);
-  digitalWrite(SENSOR_DHT_11_PWR, LOW);
-  if(chk != DHTLIB_OK){
-    int tmp = chk;
+  return true;
+}
+/**
+ * readTempHum
+ *
+ * DHT11 conversion done: update its register. The sensor is powered
+ * down by the sensor pipeline
+ *
+ * 'status'  DHTLIB_xxx read status
+ */
+void readTempHum(int status){
+  int temperature, humidity;
 
+  if(status != DHTLIB_OK){
     ledRed();
     return;
   }
   ledGreen();
 
-  temperature = DHT.temperature * 10 + 500;
-  humidity = DHT.humidity * 10;
+  temperature = DHT.temperature10 + 500;
+  humidity = DHT.humidity10;
 
+  noInterrupts();
   dtSensorTempHum[0] = (temperature >> 8) & 0xFF;
   dtSensorTempHum[1] = temperature & 0xFF;
   dtSensorTempHum[2] = (humidity >> 8) & 0xFF;
   dtSensorTempHum[3] = humidity & 0xFF;
+  interrupts();
 
 /*
   //Serial.print("Temp: ");
@@ -396,11 +529,6 @@ void readTempHum(){
 */
 
 }
-const void updateTempHumSensor(byte rId)
-{
-  readTempHum();
-}
-
 const void setSendSensorStates( byte rId, byte *state)
 {
 
@@ -409,12 +537,8 @@ const void setSendSensorStates( byte rId, byte *state)
   uint8_t req = dtSendSensorStates[0];
 
   if(req == 1){
-    // Transmit relays states
-    delay(20);
-    getRegister(REGI_O_VOLTSUPPLY)->getData();
-    getRegister(REGI_O_SENSOR_LIGHT)->getData();
-    getRegister(REGI_O_SENSOR_TEMP_HUM)->getData();
-    delay(2000);
+    // Transmit sensor states from the main loop
+    sensorReportTask.signal();
   }
   //return 0;
 }
@@ -440,15 +564,17 @@ const void switchRelay( byte rId, byte *s)
   }else if(next == 0){
         offRelay(relay); 
   }
-  delay(100);
-  ledOff();
+  ledOffTask.after(LED_ACK_TIME);
 }
 const void updateRelayStates(byte rId)
 {  
-  uint8_t relays_count = 8;
-  for(int i = 0; i < relays_count; i++){
-    dtRelayStates[i] = relays_states[i];  
-  }   
+  dtRelayStates[0] = relays_states;
+}
+const void setRelayStates( byte rId, byte *s)
+{
+  writeRelays(s[0]);
+  // setData() reports the new states right after this
+  dtRelayStates[0] = relays_states;
 }
 const void setSendRelayStates( byte rId, byte *state)
 {
@@ -461,6 +587,6 @@ const void setSendRelayStates( byte rId, byte *state)
 
   if(req == 1){
     ledRedGreen();
-    send_states = 1;
+    relayReportTask.signal();
   }
 }
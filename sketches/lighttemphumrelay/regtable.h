@@ -15,7 +15,7 @@ DEFINE_REGINDEX_START()
   REGI_I_SEND_SENSOR_STATES,
   REGI_I_RELAYSELECT,
   REGI_I_RELAYSWITCH,
-  REGI_O_RELAYS_STATES,
+  REGI_IO_RELAYS_STATES,
   REGI_I_SEND_RELAYS_STATES
   // First index here = 11
 DEFINE_REGINDEX_END()
@@ -0,0 +1,51 @@
+/**
+ * product.h
+ *
+ * Copyright (c) 2011 Daniel Berenguer <dberenguer@usapiens.com>
+ * 
+ * This file is part of the panStamp project.
+ * 
+ * panStamp  is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ * 
+ * panStamp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with panStamp; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 
+ * USA
+ * 
+ * Author: Daniel Berenguer
+ * Creation date: 04/29/2013
+ */
+
+#ifndef _PRODUCT_H
+#define _PRODUCT_H
+
+/**
+ * Hardware version
+ */
+#define HARDWARE_VERSION        0x00000100
+
+/**
+ * Firmware version
+ */
+#define FIRMWARE_VERSION        0x00000100
+
+/**
+ * Manufacturer SWAP ID
+ */
+#define SWAP_MANUFACT_ID        0x0000002D
+
+/**
+ * Product SWAP ID
+ */
+#define SWAP_PRODUCT_ID         0x00000002
+
+#endif
+
@@ -0,0 +1,256 @@
+/**
+ * ranger.cpp
+ *
+ * HC-SR04 ultrasonic ranging with the Timer1 input capture unit
+ */
+
+#include "ranger.h"
+
+/**
+ * Timer1 overflows, extending the 16-bit timer during long echoes
+ */
+static volatile unsigned int t1Overflows = 0;
+
+/**
+ * Timestamp of the rising edge of the echo
+ */
+static unsigned long riseStamp;
+
+/**
+ * Timer1 overflow
+ */
+ISR(TIMER1_OVF_vect)
+{
+  t1Overflows++;
+}
+
+/**
+ * Echo edge captured on ICP1
+ */
+ISR(TIMER1_CAPT_vect)
+{
+  unsigned int icr = ICR1;
+  unsigned int ovf = t1Overflows;
+  unsigned long stamp;
+
+  // Overflow not serviced yet but older than the capture
+  if ((TIFR1 & _BV(TOV1)) && icr < 0x8000)
+    ovf++;
+
+  stamp = ((unsigned long)ovf << 16) | icr;
+
+  if (TCCR1B & _BV(ICES1))
+  {
+    // Rising edge. Wait for the falling one
+    riseStamp = stamp;
+    TCCR1B &= ~_BV(ICES1);
+    TIFR1 = _BV(ICF1);
+  }
+  else
+  {
+    ranger.echoTicks = stamp - riseStamp;
+    ranger.echoDone = true;
+    TIMSK1 &= ~_BV(ICIE1);
+  }
+}
+
+/**
+ * RANGER
+ *
+ * Class constructor
+ */
+RANGER::RANGER(void)
+{
+  state = IDLE;
+  shots = 1;
+  taken = 0;
+  filter = RANGER_MEDIAN;
+  result = 0;
+  valid = 0;
+  echoDone = false;
+  echoTicks = 0;
+}
+
+/**
+ * begin
+ *
+ * Configure pins and Timer1
+ */
+void RANGER::begin(void)
+{
+  pinMode(RANGER_PWR_PIN, OUTPUT);
+  digitalWrite(RANGER_PWR_PIN, LOW);
+  pinMode(RANGER_TRG_PIN, OUTPUT);
+  digitalWrite(RANGER_TRG_PIN, LOW);
+  pinMode(RANGER_ECHO_PIN, INPUT);
+
+  // Normal mode, timer stopped until a burst starts
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TIMSK1 = 0;
+}
+
+/**
+ * start
+ *
+ * Power the sensor up and start a burst. Ignored if busy
+ *
+ * 'count'  Number of shots (1 to RANGER_MAX_SHOTS)
+ * 'mode'   RANGER_AVERAGE or RANGER_MEDIAN
+ */
+void RANGER::start(byte count, RANGER_FILTER mode)
+{
+  if (busy())
+    return;
+
+  if (count == 0)
+    count = 1;
+  else if (count > RANGER_MAX_SHOTS)
+    count = RANGER_MAX_SHOTS;
+
+  shots = count;
+  filter = mode;
+  taken = 0;
+
+  // Start Timer1 with the input capture noise canceler
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1) | _BV(ICF1);
+  TCCR1B = _BV(ICNC1) | RANGER_PRESCALER;
+  TIMSK1 = _BV(TOIE1);
+
+  digitalWrite(RANGER_PWR_PIN, HIGH);
+  stateTime = millis();
+  state = SETTLING;
+}
+
+/**
+ * run
+ *
+ * Progress the burst. To be called from loop()
+ *
+ * Return:
+ *  True when a burst has just finished
+ */
+bool RANGER::run(void)
+{
+  unsigned long now = millis(), width;
+
+  switch (state)
+  {
+    case SETTLING:
+    case GAP:
+      if ((unsigned long)(now - stateTime) < (state == SETTLING ? RANGER_SETTLE_MS : RANGER_GAP_MS))
+        break;
+      trigger();
+      stateTime = now;
+      state = ECHO;
+      break;
+    case ECHO:
+      if (!echoDone)
+      {
+        if ((unsigned long)(now - stateTime) < RANGER_TIMEOUT_MS)
+          break;
+        // No echo. Stop listening
+        TIMSK1 &= ~_BV(ICIE1);
+      }
+      width = echoDone ? (echoTicks >> RANGER_TICK_SHIFT) : 0;
+      // No-target pulse
+      if (width > RANGER_MAX_ECHO_US * 2UL)
+        width = 0;
+      widths[taken++] = width;
+
+      if (taken >= shots)
+      {
+        finish();
+        return true;
+      }
+      stateTime = now;
+      state = GAP;
+      break;
+    default:
+      break;
+  }
+
+  return false;
+}
+
+/**
+ * distance
+ *
+ * Return:
+ *  Distance of the last burst in mm. 0 if no echo
+ */
+unsigned int RANGER::distance(void)
+{
+  return (result * RANGER_MM_PER_HALFUS) >> 16;
+}
+
+/**
+ * trigger
+ *
+ * Arm the capture unit and send a trigger pulse
+ */
+void RANGER::trigger(void)
+{
+  uint8_t oldSREG = SREG;
+
+  cli();
+  echoDone = false;
+  TCCR1B |= _BV(ICES1);
+  TIFR1 = _BV(ICF1);
+  TIMSK1 |= _BV(ICIE1);
+  SREG = oldSREG;
+
+  digitalWrite(RANGER_TRG_PIN, HIGH);
+  delayMicroseconds(RANGER_TRIGGER_US);
+  digitalWrite(RANGER_TRG_PIN, LOW);
+}
+
+/**
+ * finish
+ *
+ * Filter the burst and power the sensor down
+ */
+void RANGER::finish(void)
+{
+  byte i, j;
+  unsigned long w, sum = 0;
+  unsigned long sorted[RANGER_MAX_SHOTS];
+
+  // Sensor and Timer1 off
+  digitalWrite(RANGER_PWR_PIN, LOW);
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  state = IDLE;
+
+  // Shots with an echo, in ascending order
+  valid = 0;
+  for(i=0 ; i<taken ; i++)
+  {
+    w = widths[i];
+    if (w == 0)
+      continue;
+    sum += w;
+    for(j=valid ; j>0 && sorted[j-1] > w ; j--)
+      sorted[j] = sorted[j-1];
+    sorted[j] = w;
+    valid++;
+  }
+
+  if (valid == 0)
+    result = 0;
+  else if (filter == RANGER_MEDIAN)
+  {
+    if (valid & 1)
+      result = sorted[valid >> 1];
+    else
+      result = (sorted[(valid >> 1) - 1] + sorted[valid >> 1]) >> 1;
+  }
+  else
+    result = (sum + (valid >> 1)) / valid;
+}
+
+/**
+ * Pre-instantiate RANGER object
+ */
+RANGER ranger;
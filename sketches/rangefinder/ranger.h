@@ -0,0 +1,231 @@
+/**
+ * ranger.h
+ *
+ * HC-SR04 ultrasonic ranging with the Timer1 input capture unit. The echo
+ * pulse is timestamped in hardware on ICP1 (Arduino pin 8), so its width
+ * doesn't depend on interrupt latency. Widths are reported in 0.5 us
+ * units.
+ *
+ * A measurement is a burst of several shots, filtered by average or
+ * median. start() returns at once. run() has to be called from loop()
+ * and returns true when the burst is over.
+ *
+ * Timer1 is owned by this driver whilst it is running. The driver defines
+ * ISR(TIMER1_OVF_vect), so it can't be linked together with TimerOne.
+ */
+
+#ifndef _RANGER_H
+#define _RANGER_H
+
+#include "Arduino.h"
+
+/**
+ * Pins
+ */
+#define RANGER_PWR_PIN       6    // Sensor power
+#define RANGER_TRG_PIN       3    // Trigger
+#define RANGER_ECHO_PIN      8    // Echo. Must be ICP1 (PB0)
+
+/**
+ * Timing (ms)
+ */
+#define RANGER_SETTLE_MS     20   // Power-up to first trigger
+#define RANGER_TIMEOUT_MS    40   // Trigger to end of echo. No echo = 38 ms
+#define RANGER_GAP_MS        60   // Between shots, for echoes to die out
+
+/**
+ * Longest echo taken for a target (us). 4 m is 23 ms. Without a target the
+ * sensor still ends the echo pulse, after about 38 ms
+ */
+#define RANGER_MAX_ECHO_US   30000
+
+/**
+ * Trigger pulse width (us)
+ */
+#define RANGER_TRIGGER_US    10
+
+/**
+ * Max shots per burst
+ */
+#define RANGER_MAX_SHOTS     9
+
+/**
+ * Timer1 prescaler and ticks per 0.5 us (as a shift)
+ */
+#if F_CPU == 16000000L
+#define RANGER_PRESCALER     _BV(CS11)   // 1/8: 0.5 us per tick
+#define RANGER_TICK_SHIFT    0
+#elif F_CPU == 8000000L
+#define RANGER_PRESCALER     _BV(CS10)   // 1/1: 0.125 us per tick
+#define RANGER_TICK_SHIFT    2
+#else
+#error "ranger: F_CPU must be 8 or 16 MHz"
+#endif
+
+/**
+ * Millimeters per 0.5 us of echo, in 1/65536: 343 m/s, round trip
+ */
+#define RANGER_MM_PER_HALFUS 5620UL
+
+/**
+ * Burst filters
+ */
+enum RANGER_FILTER
+{
+  RANGER_AVERAGE = 0,
+  RANGER_MEDIAN
+};
+
+/**
+ * Class: RANGER
+ *
+ * Description:
+ * Input capture ranging driver
+ */
+class RANGER
+{
+  private:
+    /**
+     * Burst states
+     */
+    enum
+    {
+      IDLE = 0,
+      SETTLING,
+      ECHO,
+      GAP
+    } state;
+
+    /**
+     * Shots wanted / taken
+     */
+    byte shots;
+    byte taken;
+
+    /**
+     * Burst filter
+     */
+    RANGER_FILTER filter;
+
+    /**
+     * Echo widths of the burst (0.5 us). 0 for shots without echo
+     */
+    unsigned long widths[RANGER_MAX_SHOTS];
+
+    /**
+     * millis() at the start of the current state
+     */
+    unsigned long stateTime;
+
+    /**
+     * Filtered echo width of the last burst (0.5 us)
+     */
+    unsigned long result;
+
+    /**
+     * Number of shots with an echo in the last burst
+     */
+    byte valid;
+
+    /**
+     * trigger
+     *
+     * Arm the capture unit and send a trigger pulse
+     */
+    void trigger(void);
+
+    /**
+     * finish
+     *
+     * Filter the burst and power the sensor down
+     */
+    void finish(void);
+
+  public:
+    /**
+     * Set from the capture interrupt
+     */
+    volatile bool echoDone;
+    volatile unsigned long echoTicks;
+
+    /**
+     * RANGER
+     *
+     * Class constructor
+     */
+    RANGER(void);
+
+    /**
+     * begin
+     *
+     * Configure pins and Timer1
+     */
+    void begin(void);
+
+    /**
+     * start
+     *
+     * Power the sensor up and start a burst. Ignored if busy
+     *
+     * 'count'  Number of shots (1 to RANGER_MAX_SHOTS)
+     * 'mode'   RANGER_AVERAGE or RANGER_MEDIAN
+     */
+    void start(byte count, RANGER_FILTER mode);
+
+    /**
+     * run
+     *
+     * Progress the burst. To be called from loop()
+     *
+     * Return:
+     *  True when a burst has just finished
+     */
+    bool run(void);
+
+    /**
+     * busy
+     *
+     * Return true whilst a burst is in progress
+     */
+    inline bool busy(void)
+    {
+      return state != IDLE;
+    }
+
+    /**
+     * echoWidth
+     *
+     * Return:
+     *  Filtered echo width of the last burst in 0.5 us. 0 if no echo
+     */
+    inline unsigned long echoWidth(void)
+    {
+      return result;
+    }
+
+    /**
+     * validShots
+     *
+     * Return:
+     *  Number of shots with an echo in the last burst
+     */
+    inline byte validShots(void)
+    {
+      return valid;
+    }
+
+    /**
+     * distance
+     *
+     * Return:
+     *  Distance of the last burst in mm. 0 if no echo
+     */
+    unsigned int distance(void);
+};
+
+/**
+ * Global RANGER object
+ */
+extern RANGER ranger;
+
+#endif
@@ -1,65 +1,73 @@
 #include <Arduino.h> 
+#include <EEPROM.h>
+#include <utils.h>
+#include "product.h"
+#include "panstamp.h"
+#include "regtable.h"
+#include "ranger.h"
 
-#define LEDPIN 13
+/**
+ * LED pin. Pin 13 is the SPI clock of the radio on panStamps
+ */
+#define LEDPIN 4
 
-#define RNG_PWR 2
-#define RNG_TRG 3
-#define RNG_ECH 4
+/**
+ * Time between bursts (ms)
+ */
+#define RANGE_PERIOD_MS 1000
+
+/**
+ * Default burst
+ */
+#define RANGE_DEFAULT_SHOTS   5
+#define RANGE_DEFAULT_FILTER  RANGER_MEDIAN
 
 void setup();
 void loop();
-void prepareSensor();
-long readSensor();
-long microToInch(long micro);
-long microToCm(long micro);
+unsigned int mmToInch(unsigned int mm);
 
-void prepareSensor()
-{
-  
-  pinMode(RNG_PWR, OUTPUT);
-  digitalWrite(RNG_PWR, LOW);
-  pinMode(RNG_TRG, OUTPUT);
-  digitalWrite(RNG_TRG, LOW);
-  pinMode(RNG_ECH, INPUT);
+const void updtDistance(byte rId);
+const void setRangeConfig(byte rId, byte *config);
 
-}
-long readSensor()
-{
-   long r;
-   digitalWrite(LEDPIN, HIGH);
-   digitalWrite(RNG_PWR, HIGH);
-   delay(20);
-   digitalWrite(RNG_TRG, HIGH);
-   delayMicroseconds(5);
-   digitalWrite(RNG_TRG, LOW);
-   r = pulseIn(RNG_ECH, HIGH);
-
-   
-   digitalWrite(LEDPIN, LOW);
-   return r * 10;
-}
-long microToInch(long micro)
-{
-  return (((micro / 74) / 2) / 10);
-}
-long microToCm(long micro)
+INTERVAL rangeTimer(RANGE_PERIOD_MS);
+
+byte rangeShots = RANGE_DEFAULT_SHOTS;
+RANGER_FILTER rangeFilter = RANGE_DEFAULT_FILTER;
+
+/**
+ * mmToInch
+ *
+ * Convert mm to inches without a division: 1/25.4 = 2580/65536
+ */
+unsigned int mmToInch(unsigned int mm)
 {
-  return (((micro / 29) / 2) / 10);
+  return ((unsigned long)mm * 2580) >> 16;
 }
 
-
+/**
+ * setup
+ *
+ * Arduino setup function
+ */
 void setup()
 {
-
   uint8_t i;
 	Serial.begin(38400);
-	// Init panStamp
   pinMode(LEDPIN, OUTPUT);
 
+	// Init panStamp
+  panstamp.init();
 	//panstamp.cc1101.setCarrierFreq(CFREQ_433);
 	Serial.println("rangetest starting up...");
 
-  prepareSensor();
+  ranger.begin();
+
+  // Transmit product code
+  getRegister(REGI_PRODUCTCODE)->getData();
+
+  // Enter SYNC state
+  panstamp.enterSystemState(SYSTATE_SYNC);
+
 	// During 3 seconds, listen the network for possible commands whilst the LED blinks
 	for(i=0 ; i<6 ; i++)
 	{
@@ -69,6 +77,11 @@ void setup()
 		delay(400);
 	}
 
+  // Transmit burst config
+  getRegister(REGI_RANGE_CONFIG)->getData();
+
+  // Switch to Rx ON state
+  panstamp.enterSystemState(SYSTATE_RXON);
 }
 
 /**
@@ -78,11 +91,102 @@ void setup()
  */
 void loop()
 {
-  
-  long d = readSensor();
-  Serial.print( "dist: ");
-  Serial.print( microToCm(d) );
-  Serial.println( " cm ");
-  delay(100);
+  // Start a new burst. The echoes are timed by the input capture unit
+  if(rangeTimer.due() && !ranger.busy()){
+    digitalWrite(LEDPIN, HIGH);
+    ranger.start(rangeShots, rangeFilter);
+  }
+
+  if(ranger.run()){
+    digitalWrite(LEDPIN, LOW);
+
+    // Transmit distance
+    getRegister(REGI_DISTANCE)->getData();
+
+    Serial.print( "dist: ");
+    Serial.print( ranger.distance() );
+    Serial.print( " mm, ");
+    Serial.print( mmToInch(ranger.distance()) );
+    Serial.print( " in, ");
+    Serial.print( ranger.validShots() );
+    Serial.println( " echoes");
+  }
+}
+
+/**
+ * Declaration of common callback functions
+ */
+DECLARE_COMMON_CALLBACKS()
+
+/**
+ * Definition of common registers
+ */
+DEFINE_COMMON_REGISTERS()
+
+/*
+ * Definition of custom registers
+ */
+// Distance (mm), shots with an echo and shots in the last burst
+static byte dtDistance[4];
+REGISTER regDistance(dtDistance, sizeof(dtDistance), &updtDistance, NULL);
+// Shots per burst and filter (0 = average, 1 = median)
+static byte dtRangeConfig[2] = {RANGE_DEFAULT_SHOTS, RANGE_DEFAULT_FILTER};
+REGISTER regRangeConfig(dtRangeConfig, sizeof(dtRangeConfig), NULL, &setRangeConfig);
+
+/**
+ * Initialize table of registers
+ */
+DECLARE_REGISTERS_START()
+  &regDistance,
+  &regRangeConfig
+DECLARE_REGISTERS_END()
+
+/**
+ * Definition of common getter/setter callback functions
+ */
+DEFINE_COMMON_CALLBACKS()
+
+/**
+ * Definition of custom getter/setter callback functions
+ */
+
+/**
+ * updtDistance
+ *
+ * Update distance register from the last burst
+ *
+ * 'rId'  Register ID
+ */
+const void updtDistance(byte rId)
+{
+  unsigned int mm = ranger.distance();
+
+  dtDistance[0] = (mm >> 8) & 0xFF;
+  dtDistance[1] = mm & 0xFF;
+  dtDistance[2] = ranger.validShots();
+  dtDistance[3] = rangeShots;
+}
+
+/**
+ * setRangeConfig
+ *
+ * Set shots per burst and filter. Applied from the next burst
+ *
+ * 'rId'     Register ID
+ * 'config'  Shots, filter
+ */
+const void setRangeConfig(byte rId, byte *config)
+{
+  byte shots = config[0];
+
+  if(shots == 0)
+    shots = 1;
+  else if(shots > RANGER_MAX_SHOTS)
+    shots = RANGER_MAX_SHOTS;
+
+  rangeShots = shots;
+  rangeFilter = config[1] == RANGER_AVERAGE ? RANGER_AVERAGE : RANGER_MEDIAN;
 
+  dtRangeConfig[0] = rangeShots;
+  dtRangeConfig[1] = rangeFilter;
 }
@@ -0,0 +1,17 @@
+#ifndef _REGTABLE_H
+#define _REGTABLE_H
+
+#include "Arduino.h"
+#include "register.h"
+#include "commonregs.h"
+
+/**
+ * Register indexes
+ */
+DEFINE_REGINDEX_START()
+  REGI_DISTANCE,
+  REGI_RANGE_CONFIG
+  // First index here = 11
+DEFINE_REGINDEX_END()
+
+#endif
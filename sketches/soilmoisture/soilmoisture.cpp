@@ -6,6 +6,16 @@
 uint8_t SENSOR_0_PIN =  A1;    // Analog pin - sensor 0
 uint8_t POWER_0_PIN  = A0;    // Digital pin used to powwer sensor 0
 
+/**
+ * Sensor table. Sensors are sampled and REGI_SENSOR transmitted by
+ * sensorPipe.run()
+ */
+#define SENSOR_SETTLE 10    // Settling time after power-up (ms)
+const SENSOR sensors[] = {
+  {POWER_0_PIN, SENSOR_SETTLE, readSensor0, REGI_SENSOR}
+  //{POWER_1_PIN, SENSOR_SETTLE, readSensor1, REGI_SENSOR}
+};
+
 
 /**
  * setup
@@ -19,10 +29,7 @@ void setup()
   digitalWrite(LEDPIN, LOW);
 
   // Initialize power pins
-  pinMode(POWER_0_PIN, OUTPUT);
-  digitalWrite(POWER_0_PIN, LOW);
-  //pinMode(POWER_1_PIN, OUTPUT);
-  //digitalWrite(POWER_1_PIN, LOW);
+  sensorPipe.begin(sensors, sizeof(sensors)/sizeof(SENSOR));
 
   // Init panStamp
   panstamp.init();
@@ -66,8 +73,8 @@ void loop()
   panstamp.sleepWd(WDTO_2S);
 
   // Serial.println("looped s...");
-  // Transmit sensor data
-  getRegister(REGI_SENSOR)->getData();
+  // Sample and transmit sensor data
+  sensorPipe.run();
   // Serial.println("looped...");
   // Transmit power voltage
   getRegister(REGI_VOLTSUPPLY)->getData();
@@ -86,23 +93,14 @@ const void updtVoltSupply(byte rId)
 {  
   unsigned long result;
   
-  // Read 1.1V reference against AVcc
-  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  delay(2); // Wait for Vref to settle
-  ADCSRA |= _BV(ADSC); // Convert
-  while (bit_is_set(ADCSRA,ADSC));
-  result = ADCL;
-  result |= ADCH << 8;
-  result = 1126400L / result; // Back-calculate AVcc in mV
+  // Measure AVcc against the 1.1V bandgap
+  result = adc.readVcc();
   voltageSupply = result;     // Update global variable Vcc
   
   #ifdef VOLT_SUPPLY_A7
   
   // Read voltage supply from A7
-  unsigned short ref = voltageSupply;
-  result = analogRead(7);
-  result *= ref;
-  result /= 1024;
+  result = adc.readMillivolts(7);
   #endif
 
   /**
@@ -118,31 +116,26 @@ const void updtVoltSupply(byte rId)
 }
 
 /**
- * updtSensor
+ * readSensor0
  *
- * Measure sensor data and update register
+ * Sample sensor 0 (already powered) into REGI_SENSOR. The second sensor
+ * is not fitted
  *
- * 'rId'  Register ID
+ * Return:
+ *  Always true
  */
-const void updtSensor(byte rId)
+bool readSensor0(void)
 {
-  // Power sensors
-  digitalWrite(POWER_0_PIN, HIGH);
-  //digitalWrite(POWER_1_PIN, HIGH);
-  delay(10);
-  // Read analog values
-  unsigned int adcValue0 = analogRead(SENSOR_0_PIN);
-  unsigned int adcValue1 = 0;
-  //unsigned int adcValue1 = analogRead(SENSOR_1_PIN);
-  // Unpower sensors
-  digitalWrite(POWER_0_PIN, LOW);
-  //digitalWrite(POWER_1_PIN, LOW);
+  // Average of 16 noise-reduced samples
+  unsigned int adcValue0 = adc.read(SENSOR_0_PIN, 2) >> 2;
   
   // Update register value
   dtSensor[0] = (adcValue0 >> 8) & 0xFF;
   dtSensor[1] = adcValue0 & 0xFF;
   dtSensor[2] = 0xFF;
   dtSensor[3] = 0xFF;
+
+  return true;
 }
 
 
@@ -3,6 +3,8 @@
 #include "product.h"
 #include "regtable.h"
 #include "panstamp.h"
+#include "adcsampler.h"
+#include "sensorpipe.h"
 
 /**
  * Uncomment if you are reading Vcc from A7. All battery-boards do this
@@ -17,7 +19,7 @@
 void setup();
 void loop();
 const void updtVoltSupply(byte rId);
-const void updtSensor(byte rId);
+bool readSensor0(void);
 /**
  * Declaration of common callback functions
  */
@@ -37,7 +39,10 @@ static byte dtVoltSupply[2];
 REGISTER regVoltSupply(dtVoltSupply, sizeof(dtVoltSupply), &updtVoltSupply, NULL);
 // Sensor value register (dual sensor)
 static byte dtSensor[4];
-REGISTER regSensor(dtSensor, sizeof(dtSensor), &updtSensor, NULL);
+// Updated from the sensor table, which transmits it at the end of each
+// sampling cycle. No updater: a remote query returns the reading of the
+// last cycle without powering the sensors up
+REGISTER regSensor(dtSensor, sizeof(dtSensor), NULL, NULL);
 
 /**
  * Initialize table of registers
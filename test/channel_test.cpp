@@ -0,0 +1,269 @@
+/**
+ * channel_test.cpp
+ *
+ * Meter channel arithmetic: RMS, power, power factor, frequency and phase
+ * correction, with the ADC interrupt fed by simulated 50 Hz signals
+ */
+
+#include <math.h>
+#include <Arduino.h>
+#include "channel.h"
+#include "unit.h"
+
+#define VCC_MV          3300
+#define VOLTAGE_PIN     A7
+#define CONVERSION_US   52
+
+/**
+ * Simulated line and loads
+ */
+static double lineVrms = 230.0;
+static double lineHz = 50.0;
+
+struct LOAD
+{
+  double irms;        // A
+  double lagDeg;      // Current lag
+  double ctLeadUs;    // Current transformer phase lead
+  int adcOffset;      // Error of the current midpoint (ADC counts)
+};
+
+static LOAD loads[2];
+
+static CHANNEL ch0(VCC_MV, VOLTAGE_PIN, A0, 1775, 500);
+static CHANNEL ch1(VCC_MV, VOLTAGE_PIN, A1, 1775, 500);
+
+static unsigned int toAdc(double volts)
+{
+  long counts = lround(volts / (VCC_MV / 1000.0) * 1024);
+
+  return counts < 0 ? 0 : counts > 1023 ? 1023 : counts;
+}
+
+/**
+ * ADC reading of a channel at time t (us)
+ */
+static unsigned int convert(uint8_t mux, double t)
+{
+  double w = 2 * M_PI * lineHz / 1e6;
+
+  if (mux == VOLTAGE_PIN - A0)
+  {
+    // Voltage divider behind a half-wave rectifier, see setScales
+    double vac = lineVrms * M_SQRT2 * sin(w * t);
+    double pin = (vac / 17.75 - ACVOLT_OFFSET_DIODE / 1000.0) / 8.5;
+    return pin > 0 ? toAdc(pin) : 0;
+  }
+
+  LOAD *l = &loads[mux];
+  double i = l->irms * M_SQRT2 * sin(w * (t + l->ctLeadUs) - l->lagDeg * M_PI / 180);
+  return toAdc(VCC_MV / 2000.0 + i / 5) + l->adcOffset;
+}
+
+/**
+ * Play the ADC for 'ms' milliseconds. Each interrupt has to start the
+ * next conversion
+ */
+static void sample(unsigned long ms)
+{
+  unsigned long end = hostMicros + ms * 1000;
+
+  while (hostMicros < end)
+  {
+    unsigned long t = hostMicros;
+
+    if (bit_is_clear(ADCSRA, ADSC))
+    {
+      CHECK(!"conversion not started");
+      return;
+    }
+    hostMicros += CONVERSION_US;
+    ADCW = convert(ADMUX & 0x0F, t);
+    ADCSRA &= ~_BV(ADSC);
+    ADC_vect();
+  }
+}
+
+/**
+ * Sample until both channels have a new window
+ */
+static void measure(void)
+{
+  bool done0 = false, done1 = false;
+
+  for (int i = 0; i < 50 && !(done0 && done1); i++)
+  {
+    sample(20);
+    if (ch0.update() == CHANNEL_SAMPLES_COMPLETED)
+      done0 = true;
+    if (ch1.update() == CHANNEL_SAMPLES_COMPLETED)
+      done1 = true;
+  }
+  CHECK(done0 && done1);
+}
+
+/**
+ * |value - expected| within 'pct' percent
+ */
+#define CHECK_NEAR(value, expected, pct)                                  \
+  do {                                                                    \
+    double _v = (value), _e = (expected);                                 \
+    if (fabs(_v - _e) > fabs(_e) * (pct) / 100)                           \
+    {                                                                     \
+      printf("%s:%d: %s == %.0f, expected %.0f +/- %g%%\n",               \
+             __FILE__, __LINE__, #value, _v, _e, (double)(pct));          \
+      unitFailures++;                                                     \
+    }                                                                     \
+  } while (0)
+
+static void setLoads(double i0, double lag0, double i1, double lag1)
+{
+  memset(loads, 0, sizeof(loads));
+  loads[0].irms = i0;
+  loads[0].lagDeg = lag0;
+  loads[1].irms = i1;
+  loads[1].lagDeg = lag1;
+  ch0.setPhase(0);
+  ch1.setPhase(0);
+  lineVrms = 230.0;
+  lineHz = 50.0;
+  // Drop the window that was running when the conditions changed
+  measure();
+}
+
+static void testResistive(void)
+{
+  setLoads(2.0, 0, 0.5, 0);
+  measure();
+
+  CHECK_EQ(ch0.frequency, 50);
+  CHECK_NEAR(ch0.rmsVoltage, 23000, 1.5);
+  CHECK_NEAR(ch0.rmsCurrent, 2000, 1.5);
+  CHECK_NEAR(ch0.actPower, 4600, 2);
+  CHECK_NEAR(ch0.appPower, 4600, 2);
+  CHECK(ch0.powerFactor >= 98);
+
+  // The other channel sees its own current against the same voltage
+  CHECK_NEAR(ch1.rmsVoltage, 23000, 1.5);
+  CHECK_NEAR(ch1.rmsCurrent, 500, 2);
+  CHECK_NEAR(ch1.actPower, 1150, 3);
+}
+
+static void testInductive(void)
+{
+  setLoads(2.0, 60, 1.0, 30);
+  measure();
+
+  CHECK_NEAR(ch0.rmsCurrent, 2000, 1.5);
+  CHECK_NEAR(ch0.actPower, 2300, 2);
+  CHECK_NEAR(ch0.powerFactor, 50, 4);
+  CHECK_NEAR(ch1.actPower, 2300 * sqrt(3) / 2, 2);
+  CHECK_NEAR(ch1.powerFactor, 87, 3);
+}
+
+/**
+ * A current transformer lead of 50 us (0.9 degree) reads 2.7 % too much
+ * power on a 60 degree load. setPhase() takes it back
+ */
+static void testPhaseCorrection(void)
+{
+  double expected = 2300;
+
+  setLoads(2.0, 60, 2.0, 60);
+  loads[0].ctLeadUs = 50;
+  loads[1].ctLeadUs = 50;
+  // 50 us in 1/128 of the 104 us between voltage samples
+  ch1.setPhase(62);
+  measure();
+  measure();
+
+  CHECK(ch0.actPower > expected * 1.02);
+  CHECK_NEAR(ch1.actPower, expected, 1);
+  CHECK_NEAR(ch0.rmsCurrent, ch1.rmsCurrent, 0.5);
+
+  // Correction the wrong way doubles the error
+  ch1.setPhase(-62);
+  measure();
+  measure();
+  CHECK(ch1.actPower > expected * 1.045);
+}
+
+/**
+ * An offset of the current midpoint does not show in current or power
+ */
+static void testCurrentOffset(void)
+{
+  setLoads(2.0, 0, 2.0, 0);
+  loads[1].adcOffset = 25;
+  measure();
+  measure();
+
+  CHECK_NEAR(ch1.rmsCurrent, ch0.rmsCurrent, 0.5);
+  CHECK_NEAR(ch1.actPower, ch0.actPower, 0.5);
+}
+
+static void testFrequency(void)
+{
+  setLoads(1.0, 0, 1.0, 0);
+  lineHz = 60.0;
+  lineVrms = 120.0;
+  measure();
+  measure();
+
+  CHECK_EQ(ch0.frequency, 60);
+  CHECK_NEAR(ch0.rmsVoltage, 12000, 2);
+  CHECK_NEAR(ch0.actPower, 1200, 3);
+}
+
+/**
+ * Energy is accounted between updates. 460 W for 80 s is 1/100 kWh
+ */
+static void testEnergy(void)
+{
+  unsigned long kwh;
+
+  setLoads(2.0, 0, 0, 0);
+  kwh = ch0.kwh;
+  for (int i = 0; i < 800; i++)
+  {
+    sample(100);
+    ch0.update();
+    ch1.update();
+  }
+
+  CHECK_EQ(ch0.kwh - kwh, 1);
+  CHECK_EQ(ch1.actPower, 0);
+}
+
+static void testNoVac(void)
+{
+  setLoads(1.0, 0, 1.0, 0);
+  CHECK(!CHANNEL::powerFail());
+
+  lineVrms = 0;
+  sample(200);
+  CHECK_EQ(ch0.update(), CHANNEL_NO_VAC_SIGNAL);
+  CHECK(CHANNEL::powerFail());
+  CHECK(!CHANNEL::powerFail());
+
+  lineVrms = 230.0;
+  sample(10);
+  measure();
+  CHECK_NEAR(ch0.rmsVoltage, 23000, 1.5);
+}
+
+int main(void)
+{
+  CHANNEL::begin();
+
+  RUN(testResistive);
+  RUN(testInductive);
+  RUN(testPhaseCorrection);
+  RUN(testCurrentOffset);
+  RUN(testFrequency);
+  RUN(testEnergy);
+  RUN(testNoVac);
+
+  CHANNEL::end();
+  return UNIT_RESULT();
+}
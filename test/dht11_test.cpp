@@ -0,0 +1,198 @@
+/**
+ * dht11_test.cpp
+ *
+ * DHT11/DHT22 frame capture and decoding, with the sensor waveform played
+ * on a host pin through the pin change handler
+ */
+
+#include <Arduino.h>
+#include <dht11.h>
+#include "unit.h"
+
+#define DHT_PIN   4
+
+/**
+ * Falling edge periods of a frame (us), as the sensor sends it
+ */
+struct FRAME
+{
+  unsigned int period[DHT_FRAME_EDGES];
+  uint8_t edges;
+};
+
+static void makeFrame(FRAME *f, const uint8_t *bytes)
+{
+  f->period[0] = 30;
+  f->period[1] = 160;
+  for (uint8_t i = 0; i < 40; i++)
+    f->period[2 + i] = (bytes[i >> 3] & (0x80 >> (i & 7))) ? 120 : 77;
+  f->edges = DHT_FRAME_EDGES;
+}
+
+static void makeFrame(FRAME *f, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+  uint8_t bytes[5] = {b0, b1, b2, b3, (uint8_t)(b0 + b1 + b2 + b3)};
+
+  makeFrame(f, bytes);
+}
+
+/**
+ * Run a conversion: start pulse, then the frame edges. 'late' delays the
+ * handler of edge 'lateEdge' by that many us, as another ISR would
+ */
+static int play(dht11 *dht, const FRAME *f, int lateEdge = -1, unsigned int late = 0)
+{
+  unsigned long t;
+  int status;
+
+  hostSetPin(DHT_PIN, HIGH);
+  CHECK_EQ(dht->start(DHT_PIN), DHTLIB_OK);
+  CHECK_EQ(digitalRead(DHT_PIN), LOW);
+
+  // Start pulse, then the line is released
+  while ((status = dht->update()) == DHTLIB_BUSY && bit_is_clear(PCMSK2, DHT_PIN))
+    hostMicros += 1000;
+  CHECK_EQ(status, DHTLIB_BUSY);
+  hostSetPin(DHT_PIN, HIGH);
+
+  t = hostMicros;
+  for (uint8_t i = 0; i < f->edges; i++)
+  {
+    t += f->period[i];
+    hostMicros = t + (i == lateEdge ? late : 0);
+    hostSetPin(DHT_PIN, LOW);
+    dht11::pinChange();
+    // Rising edges are ignored
+    hostMicros = t + 50;
+    hostSetPin(DHT_PIN, HIGH);
+    dht11::pinChange();
+  }
+
+  while ((status = dht->update()) == DHTLIB_BUSY)
+    hostMicros += 1000;
+  CHECK(!dht->busy());
+
+  return status;
+}
+
+static void testDht11(void)
+{
+  dht11 dht(DHT11_TYPE);
+  FRAME f;
+
+  makeFrame(&f, 45, 0, 23, 0);
+  CHECK_EQ(play(&dht, &f), DHTLIB_OK);
+  CHECK_EQ(dht.humidity, 45);
+  CHECK_EQ(dht.temperature, 23);
+  CHECK_EQ(dht.temperature10, 230);
+}
+
+static void testDht22Negative(void)
+{
+  dht11 dht(DHT22_TYPE);
+  FRAME f;
+
+  // 65.2 %, -10.1 C
+  makeFrame(&f, 0x02, 0x8C, 0x80, 0x65);
+  CHECK_EQ(play(&dht, &f), DHTLIB_OK);
+  CHECK_EQ(dht.humidity10, 652);
+  CHECK_EQ(dht.temperature10, -101);
+  CHECK_EQ(dht.temperature, -10);
+}
+
+static void testChecksum(void)
+{
+  dht11 dht(DHT11_TYPE);
+  uint8_t bytes[5] = {45, 0, 23, 0, 69};
+  FRAME f;
+
+  makeFrame(&f, bytes);
+  CHECK_EQ(play(&dht, &f), DHTLIB_ERROR_CHECKSUM);
+}
+
+/**
+ * Small handler latency is tolerated
+ */
+static void testJitter(void)
+{
+  dht11 dht(DHT11_TYPE);
+  FRAME f;
+
+  makeFrame(&f, 45, 0, 23, 0);
+  CHECK_EQ(play(&dht, &f, 10, 12), DHTLIB_OK);
+  CHECK_EQ(dht.humidity, 45);
+}
+
+/**
+ * A handler delayed beyond the bit timing, by the radio ISR for instance,
+ * fails the frame
+ */
+static void testLateEdge(void)
+{
+  dht11 dht(DHT11_TYPE);
+  FRAME f;
+
+  makeFrame(&f, 45, 0, 23, 0);
+  CHECK_EQ(play(&dht, &f, 12, 70), DHTLIB_ERROR_TIMING);
+  makeFrame(&f, 45, 0, 23, 0);
+  CHECK_EQ(play(&dht, &f, 5, 20), DHTLIB_ERROR_TIMING);
+}
+
+/**
+ * A missed edge merges two bit periods. With a glitch later on the frame
+ * still counts 42 edges, and the bits in between would be shifted
+ */
+static void testMissedEdge(void)
+{
+  dht11 dht(DHT11_TYPE);
+  FRAME f;
+  uint8_t i;
+
+  makeFrame(&f, 45, 0, 23, 0);
+  f.period[10] += f.period[11];
+  for (i = 11; i < 30; i++)
+    f.period[i] = f.period[i + 1];
+  f.period[30] = 20;
+  CHECK_EQ(play(&dht, &f), DHTLIB_ERROR_TIMING);
+
+  // Without the glitch the frame never completes
+  makeFrame(&f, 45, 0, 23, 0);
+  f.period[10] += f.period[11];
+  for (i = 11; i < DHT_FRAME_EDGES - 1; i++)
+    f.period[i] = f.period[i + 1];
+  f.edges--;
+  CHECK_EQ(play(&dht, &f), DHTLIB_ERROR_TIMEOUT);
+}
+
+static void testBusy(void)
+{
+  dht11 a(DHT11_TYPE), b(DHT11_TYPE);
+  FRAME f;
+
+  CHECK_EQ(a.start(DHT_PIN), DHTLIB_OK);
+  CHECK_EQ(b.start(DHT_PIN), DHTLIB_BUSY);
+  makeFrame(&f, 1, 0, 2, 0);
+  hostMicros += 30000;
+  while (a.update() == DHTLIB_BUSY)
+    hostMicros += 1000;
+  CHECK_EQ(play(&b, &f), DHTLIB_OK);
+  CHECK_EQ(a.start(11), DHTLIB_OK);
+  CHECK_EQ(a.update(), DHTLIB_BUSY);
+  hostMicros += 30000;
+  while (a.update() == DHTLIB_BUSY)
+    hostMicros += 1000;
+  CHECK_EQ(a.start(30), DHTLIB_ERROR_PIN);
+}
+
+int main(void)
+{
+  RUN(testDht11);
+  RUN(testDht22Negative);
+  RUN(testChecksum);
+  RUN(testJitter);
+  RUN(testLateEdge);
+  RUN(testMissedEdge);
+  RUN(testBusy);
+
+  return UNIT_RESULT();
+}
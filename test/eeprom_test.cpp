@@ -0,0 +1,172 @@
+/**
+ * eeprom_test.cpp
+ *
+ * EEPROM write queue against the simulated EEPROM controller
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "unit.h"
+
+static void reset(void)
+{
+  sei();
+  EEPROM.flush();
+  memset(hostEeprom, 0xFF, sizeof(hostEeprom));
+  hostEepromWrites = 0;
+  hostEepromFaults = 0;
+}
+
+/**
+ * Queued bytes reach the EEPROM in order. Cells that already hold the
+ * value take no write cycle
+ */
+static void testRetire(void)
+{
+  reset();
+  for (int i = 0; i < 10; i++)
+    EEPROM.writeAsync(i, i);
+  EEPROM.writeAsync(3, 0x33);
+  EEPROM.writeAsync(20, 0xFF);
+  EEPROM.flush();
+
+  for (int i = 0; i < 10; i++)
+    CHECK_EQ(hostEeprom[i], i == 3 ? 0x33 : i);
+  CHECK_EQ(EEPROM.pending(), 0);
+  CHECK_EQ(hostEepromWrites, 11);
+  CHECK_EQ(hostEepromFaults, 0);
+}
+
+/**
+ * read() returns the latest queued value of a cell before it is written
+ */
+static void testReadFromQueue(void)
+{
+  reset();
+  hostEeprom[12] = 0x5A;
+
+  // Keep EE_READY from running so that everything stays queued
+  cli();
+  EEPROM.writeAsync(10, 1);
+  EEPROM.writeAsync(11, 2);
+  EEPROM.writeAsync(10, 3);
+  CHECK_EQ(EEPROM.pending(), 3);
+  CHECK_EQ(EEPROM.read(10), 3);
+  CHECK_EQ(EEPROM.read(11), 2);
+  CHECK_EQ(EEPROM.read(12), 0x5A);
+  CHECK_EQ(hostEeprom[10], 0xFF);
+  sei();
+
+  EEPROM.flush();
+  CHECK_EQ(hostEeprom[10], 3);
+  CHECK_EQ(hostEeprom[11], 2);
+  CHECK_EQ(EEPROM.read(10), 3);
+  CHECK_EQ(hostEepromFaults, 0);
+}
+
+/**
+ * A full queue makes writeAsync() wait for EE_READY to free a slot
+ */
+static void testQueueFull(void)
+{
+  reset();
+  for (int i = 0; i < 4 * EEPROM_QUEUE_SIZE; i++)
+  {
+    EEPROM.writeAsync(100 + i, i);
+    CHECK(EEPROM.pending() < EEPROM_QUEUE_SIZE);
+  }
+  EEPROM.flush();
+
+  for (int i = 0; i < 4 * EEPROM_QUEUE_SIZE; i++)
+    CHECK_EQ(hostEeprom[100 + i], i);
+  CHECK_EQ(hostEepromFaults, 0);
+}
+
+/**
+ * With interrupts disabled, as from an ISR, a full queue is drained by
+ * polling and flush() waits for the last write cycle. The I flag is left
+ * as it was
+ */
+static void testFlushInterruptsOff(void)
+{
+  reset();
+  cli();
+  for (int i = 0; i < 3 * EEPROM_QUEUE_SIZE; i++)
+    EEPROM.writeAsync(200 + i, 0x80 | i);
+  CHECK(EEPROM.pending() > 0);
+  EEPROM.flush();
+
+  CHECK(bit_is_clear(SREG, SREG_I));
+  CHECK_EQ(EEPROM.pending(), 0);
+  CHECK(bit_is_clear(EECR, EEPE));
+  CHECK(bit_is_clear(EECR, EERIE));
+  for (int i = 0; i < 3 * EEPROM_QUEUE_SIZE; i++)
+    CHECK_EQ(hostEeprom[200 + i], 0x80 | i);
+  CHECK_EQ(hostEepromFaults, 0);
+  sei();
+}
+
+/**
+ * write() keeps program order with writes still queued
+ */
+static void testWriteOrder(void)
+{
+  reset();
+  EEPROM.writeAsync(300, 1);
+  EEPROM.writeAsync(300, 2);
+  EEPROM.write(300, 3);
+  CHECK_EQ(hostEeprom[300], 3);
+  CHECK_EQ(EEPROM.pending(), 0);
+}
+
+/**
+ * A block longer than the queue, like the meter readings saved on power
+ * failure, is queued in pieces by writeBlockAsync() without ever waiting
+ */
+static void testBlockNoWait(void)
+{
+  uint8_t block[40];
+  uint16_t done = 0;
+  int passes = 0;
+
+  reset();
+  for (uint16_t i = 0; i < sizeof(block); i++)
+    block[i] = 0x40 + i;
+
+  // With EE_READY held off, waiting would mean draining by polling
+  cli();
+  CHECK_EQ(EEPROM.availableForWrite(), EEPROM_QUEUE_SIZE - 1);
+  CHECK(!EEPROM.writeBlockAsync(400, block, sizeof(block), &done));
+  CHECK_EQ(done, EEPROM_QUEUE_SIZE - 1);
+  CHECK_EQ(EEPROM.availableForWrite(), 0);
+  CHECK(!EEPROM.writeBlockAsync(400, block, sizeof(block), &done));
+  CHECK_EQ(done, EEPROM_QUEUE_SIZE - 1);
+  CHECK_EQ(hostEepromWrites, 0);
+  sei();
+
+  // Loop passes pick up the rest as the queue drains
+  while (!EEPROM.writeBlockAsync(400, block, sizeof(block), &done))
+    passes++;
+  CHECK(passes > 0);
+  CHECK_EQ(done, sizeof(block));
+  EEPROM.flush();
+
+  for (uint16_t i = 0; i < sizeof(block); i++)
+    CHECK_EQ(hostEeprom[400 + i], 0x40 + i);
+  CHECK_EQ(hostEepromFaults, 0);
+}
+
+int main(void)
+{
+  hostStartTicks();
+
+  RUN(testRetire);
+  RUN(testReadFromQueue);
+  RUN(testQueueFull);
+  RUN(testFlushInterruptsOff);
+  RUN(testWriteOrder);
+  RUN(testBlockNoWait);
+
+  hostStopTicks();
+  return UNIT_RESULT();
+}
@@ -0,0 +1,82 @@
+/**
+ * Arduino.h
+ *
+ * Host stand-in for the Arduino core, enough to build the libraries under
+ * test with the native compiler. Note that int is 32 bits and long 64 bits
+ * here, against 16 and 32 bits on the AVR
+ */
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <Print.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define word(h, l)  ((word)(((h) << 8) | (l)))
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define INPUT_PULLUP 2
+
+/**
+ * Time. Only moves when a test sets hostMicros or calls delay()
+ */
+extern unsigned long hostMicros;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/**
+ * Digital pins of the ATmega328P "standard" variant: 0-7 on port D,
+ * 8-13 on port B, 14-19 (A0-A5) on port C. A6 and A7 are analog only
+ */
+#define NUM_DIGITAL_PINS  20
+
+#define A0  14
+#define A1  15
+#define A2  16
+#define A3  17
+#define A4  18
+#define A5  19
+#define A6  20
+#define A7  21
+
+#define NOT_A_PORT  0
+#define PB  2
+#define PC  3
+#define PD  4
+
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t *portInputRegister(uint8_t port);
+volatile uint8_t *portModeRegister(uint8_t port);
+volatile uint8_t *portOutputRegister(uint8_t port);
+
+#define digitalPinToPCICR(p)    (((p) >= 0 && (p) <= 21) ? (&PCICR) : ((volatile uint8_t *)0))
+#define digitalPinToPCICRbit(p) (((p) <= 7) ? 2 : (((p) <= 13) ? 0 : 1))
+#define digitalPinToPCMSK(p)    (((p) <= 7) ? (&PCMSK2) : (((p) <= 13) ? (&PCMSK0) : (&PCMSK1)))
+#define digitalPinToPCMSKbit(p) (((p) <= 7) ? (p) : (((p) <= 13) ? ((p) - 8) : ((p) - 14)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+/**
+ * Drive an input pin from a test
+ */
+void hostSetPin(uint8_t pin, uint8_t val);
+
+#endif
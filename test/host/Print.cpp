@@ -0,0 +1,85 @@
+/**
+ * Print.cpp
+ *
+ * Host stand-in for the Arduino Print class
+ */
+
+#include <string.h>
+#include "Print.h"
+
+HostSerial Serial;
+
+size_t Print::write(const char *str)
+{
+  return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  if (base < 2)
+    base = 10;
+  *str = '\0';
+  do
+  {
+    unsigned long m = n;
+    n /= base;
+    char c = m - base * n;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+
+  return write(str);
+}
+
+size_t Print::print(const char *str)
+{
+  return write(str);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == 10 && n < 0)
+    return print('-') + printNumber(-n, 10);
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::println(void)
+{
+  return write((const uint8_t *)"\r\n", 2);
+}
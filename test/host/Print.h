@@ -0,0 +1,84 @@
+/**
+ * Print.h
+ *
+ * Host stand-in for the Arduino Print and Stream classes. print() formats
+ * through write() as the core does
+ */
+
+#ifndef _HOST_PRINT_H
+#define _HOST_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+  private:
+    int write_error;
+    size_t printNumber(unsigned long n, uint8_t base);
+
+  protected:
+    void setWriteError(int err = 1) { write_error = err; }
+
+  public:
+    Print() : write_error(0) {}
+    virtual ~Print() {}
+
+    int getWriteError() { return write_error; }
+    void clearWriteError() { setWriteError(0); }
+
+    virtual size_t write(uint8_t) = 0;
+    size_t write(const char *str);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+
+    size_t println(void);
+    template <typename T> size_t println(T val)
+    {
+      return print(val) + println();
+    }
+    template <typename T> size_t println(T val, int base)
+    {
+      return print(val, base) + println();
+    }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+/**
+ * Serial port. Output is dropped
+ */
+class HostSerial : public Stream
+{
+  public:
+    void begin(unsigned long) {}
+    virtual size_t write(uint8_t) { return 1; }
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+    using Print::write;
+};
+
+extern HostSerial Serial;
+
+#endif
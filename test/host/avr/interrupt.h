@@ -0,0 +1,30 @@
+/**
+ * avr/interrupt.h
+ *
+ * Host stand-in. Vectors are plain functions called by the host models
+ */
+
+#ifndef _HOST_AVR_INTERRUPT_H
+#define _HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)  extern "C" void vector(void) __VA_ARGS__; \
+                          extern "C" void vector(void)
+
+#define cli()   (SREG &= ~_BV(SREG_I))
+#define sei()   (SREG |= _BV(SREG_I))
+
+#define EE_READY_vect   hostVectorEeReady
+#define PCINT0_vect     hostVectorPcint0
+#define PCINT1_vect     hostVectorPcint1
+#define PCINT2_vect     hostVectorPcint2
+#define ADC_vect        hostVectorAdc
+
+extern "C" void EE_READY_vect(void) __attribute__((weak));
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT1_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * avr/io.h
+ *
+ * Host stand-in for the AVR register file. Registers without side effects
+ * are plain variables. The EEPROM controller is modelled in host.cpp: a
+ * write cycle takes HOST_EEPROM_TICKS ticks of the host timer and EE_READY
+ * is raised from the timer while EERIE and the I flag are set
+ */
+
+#ifndef _HOST_AVR_IO_H
+#define _HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit)            (1 << (bit))
+#define _SFR_IO_ADDR(reg)   0
+#define bit_is_set(reg, bit)    ((reg) & _BV(bit))
+#define bit_is_clear(reg, bit)  (!((reg) & _BV(bit)))
+#define loop_until_bit_is_set(reg, bit)    do { } while (bit_is_clear(reg, bit))
+#define loop_until_bit_is_clear(reg, bit)  do { } while (bit_is_set(reg, bit))
+
+/**
+ * Status register
+ */
+extern volatile uint8_t SREG;
+#define SREG_I  7
+
+/**
+ * I/O ports. PINx follows PORTx for outputs, tests drive the inputs
+ */
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t PINC, DDRC, PORTC;
+extern volatile uint8_t PIND, DDRD, PORTD;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/**
+ * Pin change interrupts
+ */
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+#define PCIE0   0
+#define PCIE1   1
+#define PCIE2   2
+
+/**
+ * ADC. Tests play the converter: they set ADCW and call ADC_vect
+ */
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+extern volatile uint16_t ADCW;
+
+#define MUX0    0
+#define MUX1    1
+#define MUX2    2
+#define MUX3    3
+#define ADLAR   5
+#define REFS0   6
+#define REFS1   7
+
+#define ADPS0   0
+#define ADPS1   1
+#define ADPS2   2
+#define ADIE    3
+#define ADIF    4
+#define ADATE   5
+#define ADSC    6
+#define ADEN    7
+
+#define ADTS0   0
+#define ADTS1   1
+#define ADTS2   2
+
+/**
+ * EEPROM
+ */
+#define EERE    0
+#define EEPE    1
+#define EEMPE   2
+#define EERIE   3
+
+#define HOST_EEPROM_SIZE    1024
+#define HOST_EEPROM_TICKS   4
+
+class HostEECR
+{
+  public:
+    HostEECR &operator=(uint8_t val);
+    HostEECR &operator|=(uint8_t val);
+    HostEECR &operator&=(uint8_t val);
+    operator uint8_t(void) const;
+};
+
+extern HostEECR EECR;
+extern volatile uint16_t EEAR;
+extern volatile uint8_t EEDR;
+
+/**
+ * EEPROM contents and statistics, for the tests
+ */
+extern uint8_t hostEeprom[HOST_EEPROM_SIZE];
+extern volatile unsigned long hostEepromWrites;
+extern volatile unsigned long hostEepromFaults;
+extern volatile bool hostEepromHold;
+
+/**
+ * Start a write cycle, replaces the EEMPE/EEPE strobe
+ */
+void hostEepromStartWrite(void);
+#define EEPROM_START_WRITE()  hostEepromStartWrite()
+
+/**
+ * Start and stop the host timer that retires write cycles and raises
+ * interrupts
+ */
+void hostStartTicks(void);
+void hostStopTicks(void);
+
+#endif
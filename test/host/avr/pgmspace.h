@@ -0,0 +1,24 @@
+/**
+ * avr/pgmspace.h
+ *
+ * Host stand-in. Program memory is ordinary memory
+ */
+
+#ifndef _HOST_AVR_PGMSPACE_H
+#define _HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P                    const char *
+#define PSTR(s)                  (s)
+
+#define pgm_read_byte(addr)      (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)      (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)     (*(const uint32_t *)(addr))
+
+#define strcpy_P(dst, src)       strcpy((dst), (src))
+#define strlen_P(src)            strlen(src)
+
+#endif
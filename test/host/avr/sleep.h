@@ -0,0 +1,22 @@
+/**
+ * avr/sleep.h
+ *
+ * Host stand-in. Sleeping returns at once
+ */
+
+#ifndef _HOST_AVR_SLEEP_H
+#define _HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          1
+#define SLEEP_MODE_PWR_DOWN     2
+#define SLEEP_MODE_PWR_SAVE     3
+#define SLEEP_MODE_STANDBY      6
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+#define sleep_mode()
+
+#endif
@@ -0,0 +1,245 @@
+/**
+ * host.cpp
+ *
+ * Peripheral models behind the host register file
+ */
+
+#include <signal.h>
+#include <sys/time.h>
+#include <Arduino.h>
+
+/**
+ * Interrupts are on once the sketch runs
+ */
+volatile uint8_t SREG = _BV(SREG_I);
+
+/**
+ * Time
+ */
+unsigned long hostMicros = 0;
+
+unsigned long millis(void)
+{
+  return hostMicros / 1000;
+}
+
+unsigned long micros(void)
+{
+  return hostMicros;
+}
+
+void delay(unsigned long ms)
+{
+  hostMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  hostMicros += us;
+}
+
+/**
+ * I/O ports
+ */
+volatile uint8_t PINB, DDRB, PORTB;
+volatile uint8_t PINC, DDRC, PORTC;
+volatile uint8_t PIND, DDRD, PORTD;
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+uint8_t digitalPinToPort(uint8_t pin)
+{
+  if (pin <= 7)
+    return PD;
+  if (pin <= 13)
+    return PB;
+  if (pin < NUM_DIGITAL_PINS)
+    return PC;
+  return NOT_A_PORT;
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin)
+{
+  if (pin <= 7)
+    return _BV(pin);
+  if (pin <= 13)
+    return _BV(pin - 8);
+  return _BV(pin - 14);
+}
+
+volatile uint8_t *portInputRegister(uint8_t port)
+{
+  return port == PB ? &PINB : port == PC ? &PINC : &PIND;
+}
+
+volatile uint8_t *portModeRegister(uint8_t port)
+{
+  return port == PB ? &DDRB : port == PC ? &DDRC : &DDRD;
+}
+
+volatile uint8_t *portOutputRegister(uint8_t port)
+{
+  return port == PB ? &PORTB : port == PC ? &PORTC : &PORTD;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  if (port == NOT_A_PORT)
+    return;
+  if (mode == OUTPUT)
+    *portModeRegister(port) |= mask;
+  else
+  {
+    *portModeRegister(port) &= ~mask;
+    if (mode == INPUT_PULLUP)
+      *portOutputRegister(port) |= mask;
+    else
+      *portOutputRegister(port) &= ~mask;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  if (port == NOT_A_PORT)
+    return;
+  if (val)
+    *portOutputRegister(port) |= mask;
+  else
+    *portOutputRegister(port) &= ~mask;
+  if (*portModeRegister(port) & mask)
+    hostSetPin(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+  uint8_t port = digitalPinToPort(pin);
+
+  if (port == NOT_A_PORT)
+    return LOW;
+  return (*portInputRegister(port) & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+void hostSetPin(uint8_t pin, uint8_t val)
+{
+  uint8_t port = digitalPinToPort(pin);
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  if (port == NOT_A_PORT)
+    return;
+  if (val)
+    *portInputRegister(port) |= mask;
+  else
+    *portInputRegister(port) &= ~mask;
+}
+
+/**
+ * ADC
+ */
+volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+volatile uint16_t ADCW;
+
+/**
+ * EEPROM controller
+ */
+HostEECR EECR;
+volatile uint16_t EEAR;
+volatile uint8_t EEDR;
+
+uint8_t hostEeprom[HOST_EEPROM_SIZE];
+volatile unsigned long hostEepromWrites = 0;
+volatile unsigned long hostEepromFaults = 0;
+volatile bool hostEepromHold = false;
+
+static volatile uint8_t eecrBits = 0;     // EERIE and EEMPE
+static volatile uint8_t eepromBusy = 0;   // Ticks left of the write cycle
+static uint16_t eepromAddr;               // Cell being programmed
+static uint8_t eepromData;
+
+HostEECR &HostEECR::operator=(uint8_t val)
+{
+  eecrBits = val & (_BV(EERIE) | _BV(EEMPE));
+  // EEAR and EEDR can't be used while a write cycle runs
+  if (val & _BV(EERE))
+  {
+    if (eepromBusy)
+      hostEepromFaults++;
+    else
+      EEDR = hostEeprom[EEAR % HOST_EEPROM_SIZE];
+  }
+  return *this;
+}
+
+HostEECR &HostEECR::operator|=(uint8_t val)
+{
+  return *this = eecrBits | val;
+}
+
+HostEECR &HostEECR::operator&=(uint8_t val)
+{
+  return *this = eecrBits & val;
+}
+
+HostEECR::operator uint8_t(void) const
+{
+  return eecrBits | (eepromBusy ? _BV(EEPE) : 0);
+}
+
+void hostEepromStartWrite(void)
+{
+  if (eepromBusy)
+  {
+    hostEepromFaults++;
+    return;
+  }
+  eepromAddr = EEAR % HOST_EEPROM_SIZE;
+  eepromData = EEDR;
+  eepromBusy = HOST_EEPROM_TICKS;
+  hostEepromWrites++;
+}
+
+/**
+ * Host timer. Retires write cycles and raises EE_READY as the AVR does:
+ * level triggered, with the I flag cleared while the handler runs
+ */
+static void tick(int)
+{
+  if (eepromBusy && !hostEepromHold && --eepromBusy == 0)
+    hostEeprom[eepromAddr] = eepromData;
+
+  if (!eepromBusy && (eecrBits & _BV(EERIE)) && (SREG & _BV(SREG_I)) &&
+      EE_READY_vect != NULL)
+  {
+    SREG &= ~_BV(SREG_I);
+    EE_READY_vect();
+    SREG |= _BV(SREG_I);
+  }
+}
+
+void hostStartTicks(void)
+{
+  struct sigaction sa;
+  struct itimerval it;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = tick;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = 50;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+void hostStopTicks(void)
+{
+  struct itimerval it;
+
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_REAL, &it, NULL);
+}
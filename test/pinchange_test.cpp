@@ -0,0 +1,105 @@
+/**
+ * pinchange_test.cpp
+ *
+ * Pin change engine: lock-out debounce and edge counting, with the PCINT
+ * interrupt called by hand
+ */
+
+#include <Arduino.h>
+#include "pinchange.h"
+#include "unit.h"
+
+#define PIN        5      // PD5
+#define DEBOUNCE   200
+
+static PINCHANGE pc;
+
+/**
+ * Set the pin at time 't' (us) and run the interrupt
+ */
+static void edge(unsigned long t, uint8_t val)
+{
+  hostMicros = t;
+  hostSetPin(PIN, val);
+  pc.handle(PINCHANGE_PORTD);
+}
+
+/**
+ * Edges within the lock-out of the last accepted one are ignored
+ */
+static void testBounce(void)
+{
+  hostMicros = 10000;
+  edge(10000, HIGH);
+  edge(10050, LOW);
+  edge(10100, HIGH);
+  CHECK_EQ(pc.update(), 0x01);
+  CHECK_EQ(pc.count(0), 1);
+  CHECK(pc.read(0));
+
+  edge(11000, LOW);
+  edge(12000, HIGH);
+  CHECK_EQ(pc.update(), 0x01);
+  CHECK_EQ(pc.count(0), 2);
+  CHECK(pc.read(0));
+}
+
+/**
+ * A bounce ending within the lock-out on the other level is taken by
+ * update() once the lock-out is over
+ */
+static void testBounceEndsInLockout(void)
+{
+  edge(20000, LOW);
+  CHECK(!pc.read(0));
+
+  edge(21000, HIGH);
+  edge(21050, LOW);
+  CHECK(pc.read(0));
+
+  // Lock-out still running, nothing to take yet
+  hostMicros = 21100;
+  pc.update();
+  CHECK(pc.read(0));
+
+  hostMicros = 21300;
+  pc.update();
+  CHECK(!pc.read(0));
+  CHECK(pc.changed());
+
+  // The next rising edge counts
+  unsigned long n = pc.count(0);
+  edge(22000, HIGH);
+  CHECK_EQ(pc.update(), 0x01);
+  CHECK_EQ(pc.count(0), n + 1);
+}
+
+/**
+ * sleep() waits the lock-out out and leaves the level matching the pin,
+ * so that the next change raises the interrupt that wakes the MCU
+ */
+static void testSleep(void)
+{
+  edge(30000, LOW);
+  edge(31000, HIGH);
+  edge(31010, LOW);
+  CHECK(pc.read(0));
+
+  // No time passes on the host unless we move it
+  hostMicros = 31500;
+  pc.sleep();
+  CHECK(!pc.read(0));
+}
+
+int main(void)
+{
+  CHECK_EQ(pc.addInput(PIN, DEBOUNCE), 0);
+  pc.begin();
+
+  RUN(testBounce);
+  RUN(testBounceEndsInLockout);
+  RUN(testSleep);
+
+  pc.end();
+  return UNIT_RESULT();
+}
@@ -0,0 +1,331 @@
+/**
+ * sd_bench.cpp
+ *
+ * FAT layer benchmarks on FAT16 and FAT32 images through SdImageFile. Times are
+ * the ones of the card time model (SD_IMAGE_TIMING), not host times, so
+ * runs can be compared exactly
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include "sdimage.h"
+
+#define IMAGE "bin/sd_bench.img"
+#define IMAGE32 "bin/sd_bench32.img"
+
+static SdBlockDevice *card;
+static uint8_t buf[4096];
+static uint32_t seed = 1;
+
+/**
+ * Deterministic pseudo-random numbers
+ */
+static uint32_t random32(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void mount(void)
+{
+  if (!sdImageCreate(IMAGE, 65536, 4) || !SD.begin(IMAGE))
+  {
+    printf("can't mount %s\n", IMAGE);
+    exit(1);
+  }
+  card = SdVolume::sdCard();
+}
+
+/**
+ * Print the card time and activity since the last clearStats()
+ *
+ * 'name'   Scenario
+ * 'ops'    Operations done, for the time per operation
+ * 'unit'   Name of one operation
+ * 'bytes'  Data moved, for the throughput. 0 to skip
+ */
+static void report(const char *name, uint32_t ops, const char *unit, uint32_t bytes)
+{
+  double us = card->elapsed();
+
+  printf("%-24s %9.1f ms %9.1f us/%-6s", name, us / 1000, us / ops, unit);
+  if (bytes)
+    printf(" %6.0f KB/s", bytes / 1.024 / us * 1000);
+  else
+    printf(" %11s", "");
+  printf(" %7u rd %7u wr %7u cmd\n", (unsigned)card->blocksRead(),
+         (unsigned)card->blocksWritten(), (unsigned)card->commands());
+}
+
+/**
+ * Write a file of `size` bytes in `chunk` byte writes
+ */
+static void writeFile(const char *path, uint32_t size, uint16_t chunk)
+{
+  File f = SD.open(path, FILE_WRITE);
+
+  for (uint32_t i = 0; i < size; i += chunk)
+    f.write(buf, chunk);
+  f.close();
+}
+
+/**
+ * Read a whole file in `chunk` byte reads
+ */
+static void readFile(const char *path, uint16_t chunk)
+{
+  File f = SD.open(path);
+
+  while (f.read(buf, chunk) > 0)
+    ;
+  f.close();
+}
+
+/**
+ * 1 MB appended in 512 byte writes
+ */
+static void benchSequentialWrite(void)
+{
+  card->clearStats();
+  writeFile("/SEQ.BIN", 1048576, 512);
+  report("sequential write", 2048, "block", 1048576);
+}
+
+/**
+ * 64 bytes read at random positions of the 1 MB file
+ */
+static void benchRandomRead(void)
+{
+  File f = SD.open("/SEQ.BIN");
+
+  card->clearStats();
+  for (int i = 0; i < 1000; i++)
+  {
+    f.seek(random32() % (1048576 - 64));
+    f.read(buf, 64);
+  }
+  f.close();
+  report("random read", 1000, "read", 0);
+}
+
+/**
+ * 200 small files created in a subdirectory
+ */
+static void benchCreate(void)
+{
+  char path[20];
+
+  SD.mkdir((char *)"/MANY");
+  card->clearStats();
+  for (int i = 0; i < 200; i++)
+  {
+    sprintf(path, "/MANY/F%03d.TXT", i);
+    writeFile(path, 32, 32);
+  }
+  report("file creation", 200, "file", 0);
+}
+
+/**
+ * 100 byte records appended to three files in turn, two in the root and
+ * one in a subdirectory, each file synced every 10 records as a logger
+ * would. The FAT, directory and data blocks of the files compete for
+ * the cache
+ */
+static void benchInterleavedAppend(void)
+{
+  const char *paths[3] = {"/APP.A", "/APP.B", "/APPDIR/APP.C"};
+  File files[3];
+
+  SD.mkdir((char *)"/APPDIR");
+  for (int k = 0; k < 3; k++)
+    files[k] = SD.open(paths[k], FILE_WRITE);
+
+  card->clearStats();
+  for (int i = 0; i < 3000; i++)
+  {
+    files[i % 3].write(buf, 100);
+    if (i % 30 >= 27)
+      files[i % 3].flush();
+  }
+  for (int k = 0; k < 3; k++)
+    files[k].close();
+  report("interleaved append", 3000, "record", 300000);
+}
+
+/**
+ * Two files grown one cluster at a time in turn, so that their clusters
+ * alternate, then read back against a contiguous file of the same size
+ */
+static void benchFragmentation(void)
+{
+  File a = SD.open("/FRAG.A", FILE_WRITE);
+  File b = SD.open("/FRAG.B", FILE_WRITE);
+
+  card->clearStats();
+  for (int i = 0; i < 256; i++)
+  {
+    a.write(buf, 2048);
+    b.write(buf, 2048);
+  }
+  a.close();
+  b.close();
+  report("fragmented write", 2048, "block", 1048576);
+
+  card->clearStats();
+  readFile("/FRAG.A", 4096);
+  report("fragmented read", 1024, "block", 524288);
+
+  writeFile("/CONT.BIN", 524288, 4096);
+  card->clearStats();
+  readFile("/CONT.BIN", 4096);
+  report("contiguous read", 1024, "block", 524288);
+}
+
+/**
+ * Files of 256 clusters grown `run` clusters at a time in turn with
+ * another one, then read 64 bytes at a time at random positions and
+ * backwards from the end. Seeks follow the cluster chain from the
+ * nearest extent SdFile knows, the first cluster without extents
+ *
+ * 'run'   Clusters per fragment
+ */
+static void benchFragmentedSeek(uint8_t run)
+{
+  char name[40], pathA[20], pathB[20];
+  File a, b;
+
+  sprintf(pathA, "/SEEK%u.A", run);
+  sprintf(pathB, "/SEEK%u.B", run);
+  a = SD.open(pathA, FILE_WRITE);
+  b = SD.open(pathB, FILE_WRITE);
+  for (int i = 0; i < 256; i += run)
+  {
+    for (int j = 0; j < run; j++)
+      a.write(buf, 2048);
+    for (int j = 0; j < run; j++)
+      b.write(buf, 2048);
+  }
+  a.close();
+  b.close();
+
+  a = SD.open(pathA);
+  card->clearStats();
+  for (int i = 0; i < 1000; i++)
+  {
+    a.seek(random32() % (524288 - 64));
+    a.read(buf, 64);
+  }
+  sprintf(name, "random read, runs of %u", run);
+  report(name, 1000, "read", 0);
+
+  card->clearStats();
+  for (uint32_t pos = 524288 - 64; pos >= 524288 - 64 * 1000; pos -= 64)
+  {
+    a.seek(pos);
+    a.read(buf, 64);
+  }
+  sprintf(name, "backward read, runs of %u", run);
+  report(name, 1000, "read", 0);
+  a.close();
+}
+
+/**
+ * Card time models for benchStreaming
+ */
+static const struct
+{
+  const char *name;
+  sdtiming_t timing;
+} models[] = {
+  {"class 4", SD_IMAGE_TIMING},
+  {"slow program", {100, 650, 3000, 300}},
+  {"slow command", {800, 650, 1500, 400}},
+};
+
+/**
+ * 1 MB written and read back block at a time, with 512 byte calls, and
+ * as CMD25/CMD18 runs, with 4 KB calls, under each card time model
+ */
+static void benchStreaming(void)
+{
+  char name[40];
+  double t[2];
+  uint16_t chunk[2] = {512, 4096};
+
+  for (uint8_t m = 0; m < sizeof(models) / sizeof(models[0]); m++)
+  {
+    card->setTiming(models[m].timing);
+    for (uint8_t c = 0; c < 2; c++)
+    {
+      SD.remove((char *)"/STREAM.BIN");
+      card->clearStats();
+      writeFile("/STREAM.BIN", 1048576, chunk[c]);
+      t[c] = card->elapsed();
+      sprintf(name, "write %u, %s", chunk[c], models[m].name);
+      report(name, 2048, "block", 1048576);
+    }
+    printf("%-24s %9.1f x\n", "  streaming gain", t[0] / t[1]);
+
+    for (uint8_t c = 0; c < 2; c++)
+    {
+      card->clearStats();
+      readFile("/STREAM.BIN", chunk[c]);
+      t[c] = card->elapsed();
+      sprintf(name, "read %u, %s", chunk[c], models[m].name);
+      report(name, 2048, "block", 1048576);
+    }
+    printf("%-24s %9.1f x\n", "  streaming gain", t[0] / t[1]);
+  }
+  card->setTiming(SD_IMAGE_TIMING);
+}
+
+/**
+ * First cluster allocated after mounting a FAT32 volume whose first
+ * 50000 clusters are in use, starting from the FSINFO next free hint and
+ * with the hint made invalid so that the search starts at cluster 2
+ */
+static void benchAllocAfterMount(void)
+{
+  uint8_t block[512];
+
+  if (!sdImageCreate32(IMAGE32, 70000, 1) || !SD.begin(IMAGE32))
+  {
+    printf("can't mount %s\n", IMAGE32);
+    exit(1);
+  }
+  card = SdVolume::sdCard();
+  writeFile("/FULL.BIN", 50000L * 512, 4096);
+
+  SD.begin(IMAGE32);
+  card->clearStats();
+  writeFile("/NEW1.BIN", 512, 512);
+  report("alloc after mount, hint", 1, "file", 0);
+
+  // FSINFO next free 0XFFFFFFFF is unknown
+  card->readBlock(1, block);
+  memset(block + 492, 0xFF, 4);
+  card->writeBlock(1, block);
+  SD.begin(IMAGE32);
+  card->clearStats();
+  writeFile("/NEW2.BIN", 512, 512);
+  report("alloc after mount, none", 1, "file", 0);
+}
+
+int main(void)
+{
+  memset(buf, 0xA5, sizeof(buf));
+  mount();
+  printf("SD_FILE_EXTENTS %u, SD_CACHE_BLOCKS %u\n", SD_FILE_EXTENTS, SD_CACHE_BLOCKS);
+
+  benchSequentialWrite();
+  benchRandomRead();
+  benchCreate();
+  benchInterleavedAppend();
+  benchFragmentation();
+  benchFragmentedSeek(1);
+  benchFragmentedSeek(16);
+  benchStreaming();
+  benchAllocAfterMount();
+
+  return 0;
+}
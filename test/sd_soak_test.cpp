@@ -0,0 +1,229 @@
+/**
+ * sd_soak_test.cpp
+ *
+ * A million open/close cycles through SDClass and File, counting the
+ * heap the SD library uses. Linked with malloc and free wrapped, see
+ * the Makefile
+ */
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <new>
+#include <Arduino.h>
+#include <SD.h>
+#include "sdimage.h"
+#include "unit.h"
+
+#define IMAGE   "bin/sd_soak_test.img"
+#define CYCLES  1000000UL
+
+/**
+ * Heap accounting
+ */
+static size_t heapUsed, heapPeak;
+static unsigned long heapCalls;
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void __real_free(void *ptr);
+extern "C" void *__real_calloc(size_t n, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+
+static void heapAdd(void *ptr)
+{
+  if (!ptr)
+    return;
+  heapCalls++;
+  heapUsed += malloc_usable_size(ptr);
+  if (heapUsed > heapPeak)
+    heapPeak = heapUsed;
+}
+
+static void heapRemove(void *ptr)
+{
+  if (ptr)
+    heapUsed -= malloc_usable_size(ptr);
+}
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+  void *ptr = __real_malloc(size);
+
+  heapAdd(ptr);
+  return ptr;
+}
+
+extern "C" void __wrap_free(void *ptr)
+{
+  heapRemove(ptr);
+  __real_free(ptr);
+}
+
+extern "C" void *__wrap_calloc(size_t n, size_t size)
+{
+  void *ptr = __real_calloc(n, size);
+
+  heapAdd(ptr);
+  return ptr;
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size)
+{
+  heapRemove(ptr);
+  ptr = __real_realloc(ptr, size);
+  heapAdd(ptr);
+  return ptr;
+}
+
+// libstdc++ calls the real malloc, new and delete go through the wrappers
+void *operator new(size_t size)
+{
+  void *ptr = __wrap_malloc(size);
+
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  __wrap_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  __wrap_free(ptr);
+}
+
+static void heapReset(void)
+{
+  heapUsed = heapPeak = 0;
+  heapCalls = 0;
+}
+
+static const char *paths[] = {
+  "/LOG.TXT", "/DATA/A.BIN", "/DATA/B.BIN", "/DATA/SUB/C.BIN"
+};
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+
+static void mount(void)
+{
+  CHECK(sdImageCreate(IMAGE, 65536, 4));
+  CHECK(SD.begin(IMAGE));
+  CHECK(SD.mkdir((char *)"/DATA/SUB"));
+  for (uint8_t i = 0; i < NPATHS; i++)
+  {
+    File f = SD.open(paths[i], FILE_WRITE);
+
+    CHECK(f);
+    CHECK_EQ(f.print(paths[i]), strlen(paths[i]));
+    f.close();
+  }
+}
+
+/**
+ * Opening more than SD_MAX_OPEN_FILES files fails without leaking a
+ * pool entry. A copy takes the open file from the original
+ */
+static void testPoolExhaustion(void)
+{
+  File files[SD_MAX_OPEN_FILES];
+  File f;
+
+  mount();
+  heapReset();
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++)
+  {
+    files[i] = SD.open(paths[i % NPATHS]);
+    CHECK(files[i]);
+  }
+  f = SD.open(paths[0]);
+  CHECK(!f);
+  CHECK_EQ(SD.errorCode(), SD_ERROR_TOO_MANY_FILES);
+
+  f = files[0];
+  CHECK(f);
+  CHECK(!files[0]);
+  CHECK_EQ(f.read(), '/');
+  f.close();
+
+  files[0] = SD.open(paths[1]);
+  CHECK(files[0]);
+  CHECK_EQ(SD.errorCode(), SD_ERROR_NONE);
+  for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++)
+    files[i].close();
+  CHECK_EQ(heapCalls, 0);
+}
+
+/**
+ * Reads and appends mixed in, up to three files open
+ * at a time. The pool entries are never lost and the heap is never used
+ */
+static void testSoak(void)
+{
+  File held[2];
+  unsigned long failed = 0;
+  uint32_t logSize;
+
+  mount();
+  {
+    File f = SD.open(paths[0]);
+    logSize = f.size();
+  }
+  heapReset();
+  for (unsigned long i = 0; i < CYCLES; i++)
+  {
+    const char *path = paths[i % NPATHS];
+    File f;
+
+    if (i % 1000 == 999)
+    {
+      f = SD.open(paths[0], FILE_WRITE);
+      if (f.write('.') != 1)
+        failed++;
+      logSize++;
+    }
+    else
+    {
+      f = SD.open(path);
+      if (f.read() != '/')
+        failed++;
+    }
+    if (!f)
+      failed++;
+
+    // Keep files open across cycles, handed over by copying
+    if (i % 7 == 0)
+      held[(i / 7) & 1] = f;
+    else
+      f.close();
+  }
+  held[0].close();
+  held[1].close();
+
+  printf("  %lu cycles, %lu heap calls, heap high-water mark %lu bytes\n",
+         CYCLES, heapCalls, (unsigned long)heapPeak);
+  CHECK_EQ(failed, 0);
+  CHECK_EQ(heapPeak, 0);
+
+  // All pool entries are free again
+  {
+    File files[SD_MAX_OPEN_FILES];
+
+    for (uint8_t i = 0; i < SD_MAX_OPEN_FILES; i++)
+    {
+      files[i] = SD.open(paths[i % NPATHS]);
+      CHECK(files[i]);
+    }
+  }
+  {
+    File f = SD.open(paths[0]);
+    CHECK_EQ(f.size(), logSize);
+  }
+}
+
+int main(void)
+{
+  RUN(testPoolExhaustion);
+  RUN(testSoak);
+  return UNIT_RESULT();
+}
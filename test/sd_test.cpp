@@ -0,0 +1,787 @@
+/**
+ * sd_test.cpp
+ *
+ * SD library on FAT16 and FAT32 images through SdImageFile
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+#include <LogFile.h>
+#include "sdimage.h"
+#include "unit.h"
+
+// One image per build variant, named after the test binary
+static char image[64], image32[64];
+#define IMAGE image
+#define IMAGE32 image32
+
+// FAT32 blocks: 70000 blocks of one block clusters give 68870 clusters
+#define BLOCKS32      70000
+#define FAT_START32   32
+
+static void mount(void)
+{
+  CHECK(sdImageCreate(IMAGE, 65536, 4));
+  CHECK(SD.begin(IMAGE));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+/**
+ * Both FAT copies on the card hold the same blocks
+ */
+static bool fatMirrored(void)
+{
+  SdBlockDevice *card = SdVolume::sdCard();
+  uint8_t boot[512], fat1[512], fat2[512];
+  uint32_t fatStart, fatBlocks;
+
+  if (!card->readBlock(0, boot) || boot[16] != 2)
+    return false;
+  fatStart = get16(boot + 14);
+  fatBlocks = get16(boot + 22) ? get16(boot + 22) : get32(boot + 36);
+  for (uint32_t i = 0; i < fatBlocks; i++)
+  {
+    if (!card->readBlock(fatStart + i, fat1) ||
+        !card->readBlock(fatStart + fatBlocks + i, fat2) ||
+        memcmp(fat1, fat2, 512))
+    {
+      printf("FAT block %u differs\n", (unsigned)i);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The FAT32 volume is used without SDClass so that the free cluster count
+ * can be seen. Its blocks are read and written behind its back only while
+ * nothing is cached for writing, and it is mounted again afterwards
+ */
+static SdImageFile card32;
+static SdVolume vol32;
+static SdFile root32;
+
+static bool mount32(void)
+{
+  root32.close();
+  return vol32.init(&card32, 0) && root32.openRoot(&vol32);
+}
+
+static bool create32(void)
+{
+  return sdImageCreate32(IMAGE32, BLOCKS32, 1) && card32.begin(IMAGE32) &&
+         mount32();
+}
+
+/**
+ * Entry of a cluster in the first FAT
+ */
+static uint32_t fatGet32(uint32_t cluster)
+{
+  uint8_t block[512];
+
+  if (!card32.readBlock(FAT_START32 + cluster / 128, block))
+    return 0xFFFFFFFF;
+  return get32(block + 4 * (cluster % 128)) & 0x0FFFFFFF;
+}
+
+/**
+ * Set the entry of a cluster in both FATs
+ */
+static bool fatPut32(uint32_t cluster, uint32_t value)
+{
+  uint32_t fatBlocks = vol32.blocksPerFat();
+  uint8_t block[512];
+
+  for (uint32_t b = FAT_START32; b <= FAT_START32 + fatBlocks; b += fatBlocks)
+  {
+    uint8_t *p = block + 4 * (cluster % 128);
+
+    if (!card32.readBlock(b + cluster / 128, block))
+      return false;
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    if (!card32.writeBlock(b + cluster / 128, block))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Free clusters counted in the first FAT
+ */
+static uint32_t fatFree32(void)
+{
+  uint32_t fatEnd = vol32.clusterCount() + 1, count = 0;
+  uint8_t block[512];
+
+  for (uint32_t cluster = 2; cluster <= fatEnd; cluster++)
+  {
+    if (cluster == 2 || cluster % 128 == 0)
+      if (!card32.readBlock(FAT_START32 + cluster / 128, block))
+        return 0;
+    if ((get32(block + 4 * (cluster % 128)) & 0x0FFFFFFF) == 0)
+      count++;
+  }
+  return count;
+}
+
+/**
+ * FSINFO hints as they are on the card
+ */
+static bool fsInfoGet(uint32_t *freeCount, uint32_t *nextFree)
+{
+  uint8_t block[512];
+
+  if (!card32.readBlock(1, block) || get32(block) != 0x41615252)
+    return false;
+  *freeCount = get32(block + 488);
+  *nextFree = get32(block + 492);
+  return true;
+}
+
+static bool fsInfoPut(uint32_t freeCount, uint32_t nextFree)
+{
+  uint8_t block[512];
+
+  if (!card32.readBlock(1, block))
+    return false;
+  for (int i = 0; i < 4; i++)
+  {
+    block[488 + i] = freeCount >> (8 * i);
+    block[492 + i] = nextFree >> (8 * i);
+  }
+  return card32.writeBlock(1, block);
+}
+
+/**
+ * Append bytes to a file of the FAT32 volume, creating it if needed
+ */
+static bool append32(const char *name, uint32_t count)
+{
+  SdFile f;
+  uint8_t buf[512];
+
+  memset(buf, 0x5A, sizeof(buf));
+  if (!f.open(&root32, name, O_CREAT | O_APPEND | O_WRITE))
+    return false;
+  while (count)
+  {
+    uint16_t n = count < sizeof(buf) ? count : sizeof(buf);
+
+    if (f.write(buf, n) != n)
+      return false;
+    count -= n;
+  }
+  return f.close();
+}
+
+static uint32_t firstCluster32(const char *name)
+{
+  SdFile f;
+
+  if (!f.open(&root32, name, O_READ))
+    return 0;
+  return f.firstCluster();
+}
+
+/**
+ * Pattern byte at a position of a stream
+ */
+static uint8_t pattern(uint32_t pos)
+{
+  return (pos * 7 + (pos >> 9)) & 0xFF;
+}
+
+/**
+ * Data written through File reads back after the volume is mounted again
+ */
+static void testReadBack(void)
+{
+  uint8_t buf[1000];
+  File f;
+
+  mount();
+  CHECK(SD.mkdir((char *)"/DATA"));
+  f = SD.open("/DATA/A.BIN", FILE_WRITE);
+  CHECK(f);
+  for (uint32_t i = 0; i < 20000; i += sizeof(buf))
+  {
+    for (uint32_t j = 0; j < sizeof(buf); j++)
+      buf[j] = pattern(i + j);
+    CHECK_EQ(f.write(buf, sizeof(buf)), sizeof(buf));
+  }
+  f.close();
+
+  CHECK(SD.begin(IMAGE));
+  f = SD.open("/DATA/A.BIN");
+  CHECK(f);
+  CHECK_EQ(f.size(), 20000);
+  CHECK(f.seek(12345));
+  CHECK_EQ(f.read(buf, 100), 100);
+  for (uint32_t j = 0; j < 100; j++)
+    CHECK_EQ(buf[j], pattern(12345 + j));
+  f.close();
+}
+
+/**
+ * Pre-erased blocks of a multiple block write that are not written read
+ * as erased after writeStop. The blocks after them are untouched
+ */
+static void testPreErase(void)
+{
+  SdBlockDevice *card;
+  uint8_t buf[512];
+  uint32_t block = 65536 - 8;
+
+  mount();
+  card = SdVolume::sdCard();
+  memset(buf, 0x55, sizeof(buf));
+  for (uint32_t i = 0; i < 5; i++)
+    CHECK(card->writeBlock(block + i, buf));
+
+  memset(buf, 0xAA, sizeof(buf));
+  CHECK(card->writeStart(block, 4));
+  CHECK(card->writeData(buf));
+  CHECK(card->writeStop());
+
+  CHECK(card->readBlock(block, buf));
+  CHECK_EQ(buf[511], 0xAA);
+  for (uint32_t i = 1; i < 4; i++)
+  {
+    CHECK(card->readBlock(block + i, buf));
+    CHECK_EQ(buf[0], 0xFF);
+  }
+  CHECK(card->readBlock(block + 4, buf));
+  CHECK_EQ(buf[0], 0x55);
+}
+
+/**
+ * The oldest data of a full LogFile ring, after the head, survives sync()
+ * and read() stopping the multiple block write early
+ */
+static void testLogFileWrap(void)
+{
+  LogFile log;
+  uint8_t buf[600];
+  uint32_t written = 0, cap, i;
+
+  mount();
+  CHECK(log.open("/RING.LOG", 8 * 512));
+  cap = log.capacity();
+  CHECK_EQ(cap, 8 * 512);
+
+  // Wrap once, leaving the head in the middle of a block
+  while (written < cap + 700)
+  {
+    for (i = 0; i < 100; i++)
+      buf[i] = pattern(written + i);
+    CHECK_EQ(log.write(buf, 100), 100);
+    written += 100;
+    if (written % 1300 == 0)
+      CHECK(log.sync());
+  }
+  CHECK(log.sync());
+
+  // Sequences stopped within the block they started in
+  for (int k = 0; k < 2; k++)
+  {
+    for (i = 0; i < 50; i++)
+      buf[i] = pattern(written + i);
+    CHECK_EQ(log.write(buf, 50), 50);
+    written += 50;
+    CHECK(log.sync());
+  }
+
+  CHECK_EQ(log.available(), cap);
+  for (i = 0; i < cap; i += sizeof(buf))
+  {
+    uint16_t n = cap - i < sizeof(buf) ? cap - i : sizeof(buf);
+    CHECK_EQ(log.read(buf, n), n);
+    for (uint16_t j = 0; j < n; j++)
+      CHECK_EQ(buf[j], pattern(written - cap + i + j));
+  }
+  log.close();
+
+  // Reopened from the header
+  CHECK(log.open("/RING.LOG", 0));
+  CHECK_EQ(log.available(), cap);
+  CHECK_EQ(log.read(buf, 10), 10);
+  CHECK_EQ(buf[0], pattern(written - cap));
+  log.close();
+}
+
+/**
+ * Appends to several files in turn keep a FAT, a directory and several
+ * data blocks in use at the same time. With more than one cache block
+ * they stay cached and are written back when replaced
+ */
+static void testInterleavedAppend(void)
+{
+  const char *paths[3] = {"/A.LOG", "/B.LOG", "/DIR/C.LOG"};
+  File files[3];
+  uint8_t buf[100];
+  uint32_t size[3] = {0, 0, 0};
+
+  mount();
+  CHECK(SD.mkdir((char *)"/DIR"));
+  for (int k = 0; k < 3; k++)
+  {
+    files[k] = SD.open(paths[k], FILE_WRITE);
+    CHECK(files[k]);
+  }
+  for (int i = 0; i < 600; i++)
+  {
+    int k = i % 3;
+    uint16_t n = 1 + (i * 37) % sizeof(buf);
+
+    for (uint16_t j = 0; j < n; j++)
+      buf[j] = pattern(size[k] + j) ^ k;
+    CHECK_EQ(files[k].write(buf, n), n);
+    size[k] += n;
+
+    // Reopened from time to time, as a logger closing its files would
+    if (i % 50 == 49)
+    {
+      files[k].close();
+      files[k] = SD.open(paths[k], FILE_WRITE);
+      CHECK_EQ(files[k].size(), size[k]);
+    }
+  }
+  for (int k = 0; k < 3; k++)
+    files[k].close();
+  CHECK(fatMirrored());
+
+  CHECK(SD.begin(IMAGE));
+  for (int k = 0; k < 3; k++)
+  {
+    File f = SD.open(paths[k]);
+    uint32_t pos = 0;
+    int n;
+
+    CHECK_EQ(f.size(), size[k]);
+    while ((n = f.read(buf, sizeof(buf))) > 0)
+    {
+      for (int j = 0; j < n; j++)
+      {
+        if (buf[j] != (pattern(pos + j) ^ k))
+        {
+          CHECK_EQ(buf[j], pattern(pos + j) ^ k);
+          break;
+        }
+      }
+      pos += n;
+    }
+    CHECK_EQ(pos, size[k]);
+  }
+}
+
+/**
+ * Write and read a 100 byte file of pattern bytes
+ */
+static void writePattern(const char *path)
+{
+  uint8_t buf[100];
+  File f;
+
+  for (uint32_t i = 0; i < sizeof(buf); i++)
+    buf[i] = pattern(i);
+  f = SD.open(path, FILE_WRITE);
+  CHECK_EQ(f.write(buf, sizeof(buf)), sizeof(buf));
+  f.close();
+}
+
+/**
+ * read(), peek() and available() are served from the window read ahead.
+ * Bytes changed through another File after it was read are only seen
+ * from the next window on
+ */
+static void testFileBufferRead(void)
+{
+  uint8_t zero[2 * SD_FILE_BUFFER_SIZE];
+  File f, g;
+
+  mount();
+  writePattern("/READ.BIN");
+  f = SD.open("/READ.BIN");
+  CHECK_EQ(f.available(), 100);
+  CHECK_EQ(f.peek(), pattern(0));
+  CHECK_EQ(f.read(), pattern(0));
+  CHECK_EQ(f.position(), 1);
+  CHECK_EQ(f.available(), 99);
+
+  memset(zero, 0, sizeof(zero));
+  g = SD.open("/READ.BIN", FILE_WRITE);
+  CHECK(g.seek(0));
+  CHECK_EQ(g.write(zero, sizeof(zero)), sizeof(zero));
+  g.close();
+
+  for (uint32_t i = 1; i < SD_FILE_BUFFER_SIZE; i++)
+  {
+    CHECK_EQ(f.peek(), pattern(i));
+    CHECK_EQ(f.read(), pattern(i));
+  }
+  CHECK_EQ(f.position(), SD_FILE_BUFFER_SIZE);
+  CHECK_EQ(f.peek(), 0);
+  CHECK_EQ(f.read(), 0);
+  CHECK_EQ(f.available(), 100 - SD_FILE_BUFFER_SIZE - 1);
+
+  // A long read takes what is left in the window first
+  CHECK_EQ(f.read(zero, 2), 2);
+  CHECK(f.seek(98));
+  CHECK_EQ(f.read(), pattern(98));
+  CHECK_EQ(f.read(zero, sizeof(zero)), 1);
+  CHECK_EQ(zero[0], pattern(99));
+  CHECK_EQ(f.available(), 0);
+  CHECK_EQ(f.peek(), -1);
+  CHECK_EQ(f.read(), -1);
+}
+
+/**
+ * Single byte writes and reads mixed across window boundaries, in the
+ * middle of the file and past its end. position() and size() count the
+ * bytes not yet written to SdFile
+ */
+static void testFileBufferMixed(void)
+{
+  uint32_t edge = SD_FILE_BUFFER_SIZE;
+  File f;
+
+  mount();
+  writePattern("/MIXED.BIN");
+  f = SD.open("/MIXED.BIN", FILE_WRITE);
+  CHECK_EQ(f.position(), 100);
+
+  CHECK(f.seek(edge - 2));
+  CHECK_EQ(f.print("WXYZ"), 4);
+  CHECK_EQ(f.position(), edge + 2);
+  CHECK_EQ(f.size(), 100);
+  CHECK_EQ(f.read(), pattern(edge + 2));
+  CHECK_EQ(f.write('V'), 1);
+  CHECK_EQ(f.position(), edge + 4);
+  CHECK_EQ(f.peek(), pattern(edge + 4));
+  CHECK(f.seek(edge - 1));
+  CHECK_EQ(f.read(), 'X');
+  CHECK_EQ(f.read(), 'Y');
+
+  CHECK(f.seek(98));
+  CHECK_EQ(f.print("abcde"), 5);
+  CHECK_EQ(f.position(), 103);
+  CHECK_EQ(f.size(), 103);
+  CHECK_EQ(f.available(), 0);
+  CHECK_EQ(f.read(), -1);
+  CHECK(!f.getWriteError());
+  f.close();
+
+  f = SD.open("/MIXED.BIN");
+  CHECK_EQ(f.size(), 103);
+  for (uint32_t i = 0; i < 103; i++)
+  {
+    int c = f.read();
+
+    if (i >= edge - 2 && i < edge + 2)
+      CHECK_EQ(c, "WXYZ"[i - edge + 2]);
+    else if (i == edge + 3)
+      CHECK_EQ(c, 'V');
+    else if (i >= 98)
+      CHECK_EQ(c, "abcde"[i - 98]);
+    else
+      CHECK_EQ(c, pattern(i));
+  }
+}
+
+/**
+ * On a full volume single bytes are still taken into the window. The
+ * write that fills it can't be flushed and sets the write error
+ */
+static void testFileBufferWriteError(void)
+{
+  uint8_t buf[512];
+  uint32_t n = 0;
+  File f;
+
+  CHECK(sdImageCreate(IMAGE, 4200, 1));
+  CHECK(SD.begin(IMAGE));
+  memset(buf, 0x33, sizeof(buf));
+  f = SD.open("/FULL.BIN", FILE_WRITE);
+  while (f.write(buf, sizeof(buf)) == sizeof(buf))
+    ;
+  f.close();
+
+  f = SD.open("/LOG.TXT", FILE_WRITE);
+  CHECK(f);
+  while (n < SD_FILE_BUFFER_SIZE && f.write('.') == 1)
+    n++;
+  CHECK_EQ(n, SD_FILE_BUFFER_SIZE - 1);
+  CHECK(f.getWriteError());
+
+  // Bytes written short of the window end fail on flush()
+  f.clearWriteError();
+  f.seek(0);
+  CHECK_EQ(f.write('.'), 1);
+  CHECK(!f.getWriteError());
+  f.flush();
+  CHECK(f.getWriteError());
+  f.close();
+}
+
+/**
+ * Contents of a file as a string
+ */
+static void readText(const char *path, char *text, uint16_t size)
+{
+  File f = SD.open(path);
+  int n = f ? f.read(text, size - 1) : -1;
+
+  text[n > 0 ? n : 0] = 0;
+}
+
+static void writeText(const char *path, const char *text, uint8_t mode)
+{
+  File f = SD.open(path, mode);
+
+  CHECK(f);
+  CHECK_EQ(f.print(text), strlen(text));
+}
+
+/**
+ * Opening a path again goes to the directory entries remembered for it
+ * and its directories instead of scanning each directory of the path
+ */
+static void testPathCacheRepeat(void)
+{
+  const char *dirs[3] = {"/P1", "/P1/P2", "/P1/P2/P3"};
+  const char *path = "/P1/P2/P3/LOG.TXT";
+  char name[20];
+  uint32_t walk, cached;
+
+  // Each directory of the path comes after six blocks of other files
+  mount();
+  for (int k = 0; k < 3; k++)
+  {
+    for (int i = 0; i < 96; i++)
+    {
+      sprintf(name, "%s/F%02d.TXT", k ? dirs[k - 1] : "", i);
+      writeText(name, "", FILE_WRITE);
+    }
+    CHECK(SD.mkdir((char *)dirs[k]));
+  }
+  writeText(path, "log", FILE_WRITE);
+
+  CHECK(SD.begin(IMAGE));
+  SdVolume::sdCard()->clearStats();
+  {
+    File f = SD.open(path);
+    CHECK(f);
+  }
+  walk = SdVolume::sdCard()->blocksRead();
+
+  SdVolume::sdCard()->clearStats();
+  {
+    File f = SD.open(path);
+    CHECK(f);
+    CHECK_EQ(f.read(), 'l');
+  }
+  cached = SdVolume::sdCard()->blocksRead();
+  printf("  %u blocks read walking the path, %u cached\n",
+         (unsigned)walk, (unsigned)cached);
+#if SD_PATH_CACHE_SIZE
+  // The walk scans six blocks a directory. From the cache each level
+  // reads its entry block and, for a directory, the FAT for its size, and
+  // the entry again if the FAT took its cache block
+  CHECK(walk >= 3 * 6);
+  CHECK(cached <= 3 * 3 + 1);
+#else
+  CHECK(cached > walk);
+#endif
+}
+
+/**
+ * A file removed and created again under the same name is found again,
+ * with another file having taken its old directory entry
+ */
+static void testPathCacheRecreate(void)
+{
+  char text[20];
+
+  mount();
+  CHECK(SD.mkdir((char *)"/D"));
+  writeText("/D/LOG.TXT", "old", FILE_WRITE);
+  readText("/D/LOG.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "old"));
+
+  CHECK(SD.remove((char *)"/D/LOG.TXT"));
+  writeText("/D/OTHER.TXT", "other", FILE_WRITE);
+  CHECK(!SD.exists((char *)"/D/LOG.TXT"));
+  writeText("/D/LOG.TXT", "new", FILE_WRITE);
+
+  readText("/D/LOG.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "new"));
+  readText("/D/OTHER.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "other"));
+}
+
+/**
+ * Paths with the same hash share a cache slot. Opening the other one with
+ * O_TRUNC doesn't truncate the file remembered in the slot, whether the
+ * names differ or only their parent directories
+ */
+static void testPathCacheCollision(void)
+{
+  uint8_t trunc = O_WRITE | O_CREAT | O_TRUNC;
+  char text[20];
+
+  mount();
+  // 'A' * 33 + 'Z' == 'B' * 33 + '9'
+  writeText("/AZ.TXT", "keep", FILE_WRITE);
+  readText("/AZ.TXT", text, sizeof(text));
+  writeText("/B9.TXT", "b9", trunc);
+  readText("/AZ.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "keep"));
+  readText("/B9.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "b9"));
+
+  CHECK(SD.mkdir((char *)"/AZ"));
+  CHECK(SD.mkdir((char *)"/B9"));
+  writeText("/AZ/LOG.TXT", "keep", FILE_WRITE);
+  writeText("/B9/LOG.TXT", "b9 log", FILE_WRITE);
+  readText("/AZ/LOG.TXT", text, sizeof(text));
+  writeText("/B9/LOG.TXT", "b9", trunc);
+  readText("/AZ/LOG.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "keep"));
+  readText("/B9/LOG.TXT", text, sizeof(text));
+  CHECK(!strcmp(text, "b9"));
+}
+
+/**
+ * The free cluster count taken from FSINFO at mount matches the FAT
+ */
+static void testFreeCount32(void)
+{
+  CHECK(create32());
+  CHECK_EQ(vol32.fatType(), 32);
+  CHECK_EQ(vol32.freeClusterCount(), vol32.clusterCount() - 1);
+  CHECK_EQ(vol32.freeClusterCount(), fatFree32());
+
+  CHECK(append32("A.BIN", 5000));
+  CHECK(mount32());
+  CHECK_EQ(vol32.freeClusterCount(), vol32.clusterCount() - 11);
+  CHECK_EQ(vol32.freeClusterCount(), fatFree32());
+}
+
+/**
+ * FSINFO on the card follows an append and a remove, and the next
+ * mount starts from it
+ */
+static void testFsInfoSync32(void)
+{
+  uint32_t freeCount, nextFree;
+
+  CHECK(create32());
+  CHECK(append32("A.BIN", 5000));
+  CHECK(fsInfoGet(&freeCount, &nextFree));
+  CHECK_EQ(freeCount, fatFree32());
+  CHECK_EQ(freeCount, vol32.freeClusterCount());
+  CHECK_EQ(firstCluster32("A.BIN"), 3);
+  CHECK_EQ(nextFree, 13);
+
+  // B is allocated at the hint without searching past A
+  CHECK(mount32());
+  CHECK_EQ(vol32.freeClusterCount(), freeCount);
+  CHECK(append32("B.BIN", 1));
+  CHECK_EQ(firstCluster32("B.BIN"), 13);
+  CHECK(fsInfoGet(&freeCount, &nextFree));
+  CHECK_EQ(freeCount, fatFree32());
+  CHECK_EQ(nextFree, 14);
+
+  // Removing A gives its clusters back and moves the hint down to them
+  CHECK(SdFile::remove(&root32, "A.BIN"));
+  CHECK(fsInfoGet(&freeCount, &nextFree));
+  CHECK_EQ(freeCount, fatFree32());
+  CHECK_EQ(freeCount, vol32.clusterCount() - 2);
+  CHECK_EQ(nextFree, 3);
+  CHECK(mount32());
+  CHECK_EQ(vol32.freeClusterCount(), freeCount);
+  CHECK(append32("C.BIN", 1));
+  CHECK_EQ(firstCluster32("C.BIN"), 3);
+}
+
+/**
+ * A search that has found a region of the FAT full doesn't read it
+ * again until a cluster in it is freed
+ */
+static void testFreeMap32(void)
+{
+  uint32_t fatEnd, reads, freeCount, nextFree;
+
+  // FILL takes clusters 3 to 2047, the root directory 2. The last clusters
+  // of the FAT are taken behind the volume's back and the hint points
+  // just before them
+  CHECK(create32());
+  CHECK(append32("FILL.BIN", 2045L * 512));
+  CHECK_EQ(firstCluster32("FILL.BIN"), 3);
+  fatEnd = vol32.clusterCount() + 1;
+  for (uint32_t cluster = fatEnd - 10; cluster <= fatEnd; cluster++)
+    CHECK(fatPut32(cluster, 0x0FFFFFFF));
+  CHECK(fsInfoGet(&freeCount, &nextFree));
+  CHECK(fsInfoPut(freeCount - 11, fatEnd - 11));
+  CHECK(mount32());
+
+  // G gets the hint. H finds the end taken, wraps round and searches
+  // the regions holding FILL
+  CHECK(append32("G.BIN", 1));
+  CHECK_EQ(firstCluster32("G.BIN"), fatEnd - 11);
+  card32.clearStats();
+  CHECK(append32("H.BIN", 1));
+  reads = card32.blocksRead();
+  CHECK_EQ(firstCluster32("H.BIN"), 2048);
+  CHECK(reads >= 2048 / 128);
+
+  // Growing G wraps round again, now past the regions found full
+  card32.clearStats();
+  CHECK(append32("G.BIN", 512));
+  reads = card32.blocksRead();
+  CHECK_EQ(fatGet32(fatEnd - 11), 2049);
+  CHECK(reads < 8);
+
+  // Freeing FILL clears its regions
+  CHECK(SdFile::remove(&root32, "FILL.BIN"));
+  CHECK(append32("I.BIN", 1));
+  CHECK_EQ(firstCluster32("I.BIN"), 3);
+  CHECK_EQ(vol32.freeClusterCount(), fatFree32());
+}
+
+int main(int argc, char **argv)
+{
+  snprintf(image, sizeof(image), "%s.img", argv[0]);
+  snprintf(image32, sizeof(image32), "%s32.img", argv[0]);
+  printf("SD_CACHE_BLOCKS %u, SD_PATH_CACHE_SIZE %u\n", SD_CACHE_BLOCKS,
+         SD_PATH_CACHE_SIZE);
+
+  RUN(testReadBack);
+  RUN(testPreErase);
+  RUN(testLogFileWrap);
+  RUN(testInterleavedAppend);
+  RUN(testFileBufferRead);
+  RUN(testFileBufferMixed);
+  RUN(testFileBufferWriteError);
+  RUN(testPathCacheRepeat);
+  RUN(testPathCacheRecreate);
+  RUN(testPathCacheCollision);
+  RUN(testFreeCount32);
+  RUN(testFsInfoSync32);
+  RUN(testFreeMap32);
+
+  return UNIT_RESULT();
+}
@@ -0,0 +1,207 @@
+/**
+ * sdimage.cpp
+ *
+ * Blank FAT16 and FAT32 image files for the SD library host tests and
+ * benchmarks
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sdimage.h"
+
+/**
+ * Root directory entries
+ */
+#define SDIMAGE_ROOT_ENTRIES  512
+
+/**
+ * FAT32 reserved blocks: boot block, FSINFO and the backup boot block
+ */
+#define SDIMAGE_RESERVED32    32
+#define SDIMAGE_FSINFO32      1
+#define SDIMAGE_BACKUP32      6
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+/**
+ * sdImageCreate
+ *
+ * Create or overwrite a FAT16 image without an MBR. The data area is
+ * left sparse
+ *
+ * 'path'               Image file
+ * 'blocks'             Size in 512 byte blocks
+ * 'blocksPerCluster'   Power of two
+ *
+ * Return:
+ *  False if the file can't be written or the size doesn't give FAT16
+ */
+bool sdImageCreate(const char *path, uint32_t blocks, uint8_t blocksPerCluster)
+{
+  uint8_t block[512];
+  uint32_t rootBlocks = SDIMAGE_ROOT_ENTRIES * 32 / 512;
+  uint32_t fatBlocks = 1, clusters, dataStart, i;
+  FILE *f;
+  bool ok = true;
+
+  // The FAT size depends on the clusters it maps and the other way round
+  while (true)
+  {
+    clusters = (blocks - 1 - 2 * fatBlocks - rootBlocks) / blocksPerCluster;
+    if (2 * (clusters + 2) <= 512 * fatBlocks)
+      break;
+    fatBlocks++;
+  }
+  if (clusters < 4085 || clusters >= 65525)
+    return false;
+  dataStart = 1 + 2 * fatBlocks + rootBlocks;
+
+  if ((f = fopen(path, "w+b")) == NULL)
+    return false;
+
+  // Boot block
+  memset(block, 0, sizeof(block));
+  block[0] = 0xEB;
+  block[1] = 0x3C;
+  block[2] = 0x90;
+  memcpy(block + 3, "HOSTTEST", 8);
+  put16(block + 11, 512);
+  block[13] = blocksPerCluster;
+  put16(block + 14, 1);
+  block[16] = 2;
+  put16(block + 17, SDIMAGE_ROOT_ENTRIES);
+  if (blocks < 0x10000)
+    put16(block + 19, blocks);
+  else
+    put32(block + 32, blocks);
+  block[21] = 0xF8;
+  put16(block + 22, fatBlocks);
+  put16(block + 24, 32);
+  put16(block + 26, 64);
+  block[36] = 0x80;
+  block[38] = 0x29;
+  put32(block + 39, 0x20260101);
+  memcpy(block + 43, "NO NAME    FAT16   ", 19);
+  block[510] = 0x55;
+  block[511] = 0xAA;
+  ok &= fwrite(block, 1, 512, f) == 512;
+
+  // Both FATs, the root directory and the last block
+  for (i = 1; i < dataStart; i++)
+  {
+    memset(block, 0, sizeof(block));
+    if (i == 1 || i == 1 + fatBlocks)
+    {
+      put16(block, 0xFFF8);
+      put16(block + 2, 0xFFFF);
+    }
+    ok &= fwrite(block, 1, 512, f) == 512;
+  }
+  memset(block, 0, sizeof(block));
+  ok &= fseek(f, 512L * (blocks - 1), SEEK_SET) == 0;
+  ok &= fwrite(block, 1, 512, f) == 512;
+
+  ok &= fclose(f) == 0;
+  return ok;
+}
+
+/**
+ * sdImageCreate32
+ *
+ * Create or overwrite a FAT32 image without an MBR. The root directory
+ * takes the first cluster and FSINFO holds valid hints. The data area is
+ * left sparse
+ *
+ * 'path'               Image file
+ * 'blocks'             Size in 512 byte blocks
+ * 'blocksPerCluster'   Power of two
+ *
+ * Return:
+ *  False if the file can't be written or the size doesn't give FAT32
+ */
+bool sdImageCreate32(const char *path, uint32_t blocks, uint8_t blocksPerCluster)
+{
+  uint8_t boot[512], block[512];
+  uint32_t fatBlocks = 1, clusters, dataStart, i;
+  FILE *f;
+  bool ok = true;
+
+  while (true)
+  {
+    clusters = (blocks - SDIMAGE_RESERVED32 - 2 * fatBlocks) / blocksPerCluster;
+    if (4 * (clusters + 2) <= 512 * fatBlocks)
+      break;
+    fatBlocks++;
+  }
+  if (clusters < 65525)
+    return false;
+  dataStart = SDIMAGE_RESERVED32 + 2 * fatBlocks;
+
+  if ((f = fopen(path, "w+b")) == NULL)
+    return false;
+
+  // Boot block, written again as the backup
+  memset(boot, 0, sizeof(boot));
+  boot[0] = 0xEB;
+  boot[1] = 0x58;
+  boot[2] = 0x90;
+  memcpy(boot + 3, "HOSTTEST", 8);
+  put16(boot + 11, 512);
+  boot[13] = blocksPerCluster;
+  put16(boot + 14, SDIMAGE_RESERVED32);
+  boot[16] = 2;
+  boot[21] = 0xF8;
+  put16(boot + 24, 32);
+  put16(boot + 26, 64);
+  put32(boot + 32, blocks);
+  put32(boot + 36, fatBlocks);
+  put32(boot + 44, 2);
+  put16(boot + 48, SDIMAGE_FSINFO32);
+  put16(boot + 50, SDIMAGE_BACKUP32);
+  boot[64] = 0x80;
+  boot[66] = 0x29;
+  put32(boot + 67, 0x20260101);
+  memcpy(boot + 71, "NO NAME    FAT32   ", 19);
+  boot[510] = 0x55;
+  boot[511] = 0xAA;
+
+  // Reserved blocks, both FATs and the root directory cluster
+  for (i = 0; i < dataStart + blocksPerCluster; i++)
+  {
+    memset(block, 0, sizeof(block));
+    if (i == 0 || i == SDIMAGE_BACKUP32)
+      memcpy(block, boot, sizeof(block));
+    else if (i == SDIMAGE_FSINFO32)
+    {
+      put32(block, 0x41615252);
+      put32(block + 484, 0x61417272);
+      put32(block + 488, clusters - 1);
+      put32(block + 492, 3);
+      block[510] = 0x55;
+      block[511] = 0xAA;
+    }
+    else if (i == SDIMAGE_RESERVED32 || i == SDIMAGE_RESERVED32 + fatBlocks)
+    {
+      put32(block, 0x0FFFFFF8);
+      put32(block + 4, 0x0FFFFFFF);
+      put32(block + 8, 0x0FFFFFFF);
+    }
+    ok &= fwrite(block, 1, 512, f) == 512;
+  }
+  memset(block, 0, sizeof(block));
+  ok &= fseek(f, 512L * (blocks - 1), SEEK_SET) == 0;
+  ok &= fwrite(block, 1, 512, f) == 512;
+
+  ok &= fclose(f) == 0;
+  return ok;
+}
@@ -0,0 +1,44 @@
+/**
+ * sdimage.h
+ *
+ * Blank FAT16 and FAT32 image files for the SD library host tests and
+ * benchmarks
+ */
+
+#ifndef _SDIMAGE_H
+#define _SDIMAGE_H
+
+#include <stdint.h>
+
+/**
+ * sdImageCreate
+ *
+ * Create or overwrite a FAT16 image without an MBR. The data area is
+ * left sparse
+ *
+ * 'path'               Image file
+ * 'blocks'             Size in 512 byte blocks
+ * 'blocksPerCluster'   Power of two
+ *
+ * Return:
+ *  False if the file can't be written or the size doesn't give FAT16
+ */
+bool sdImageCreate(const char *path, uint32_t blocks, uint8_t blocksPerCluster);
+
+/**
+ * sdImageCreate32
+ *
+ * Create or overwrite a FAT32 image without an MBR. The root directory
+ * takes the first cluster and FSINFO holds valid hints. The data area is
+ * left sparse
+ *
+ * 'path'               Image file
+ * 'blocks'             Size in 512 byte blocks
+ * 'blocksPerCluster'   Power of two
+ *
+ * Return:
+ *  False if the file can't be written or the size doesn't give FAT32
+ */
+bool sdImageCreate32(const char *path, uint32_t blocks, uint8_t blocksPerCluster);
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * unit.h
+ *
+ * Minimal checks for the host tests
+ */
+
+#ifndef _UNIT_H
+#define _UNIT_H
+
+#include <stdio.h>
+
+static int unitFailures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond))                                                      \
+    {                                                                 \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      unitFailures++;                                                 \
+    }                                                                 \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                \
+  do {                                                                \
+    long long _a = (a), _b = (b);                                     \
+    if (_a != _b)                                                     \
+    {                                                                 \
+      printf("%s:%d: %s == %lld, expected %lld\n",                    \
+             __FILE__, __LINE__, #a, _a, _b);                         \
+      unitFailures++;                                                 \
+    }                                                                 \
+  } while (0)
+
+#define RUN(test)             \
+  do {                        \
+    printf("  %s\n", #test);  \
+    test();                   \
+  } while (0)
+
+#define UNIT_RESULT() (unitFailures ? (printf("%d failed\n", unitFailures), 1) \
+                                    : (printf("ok\n"), 0))
+
+#endif